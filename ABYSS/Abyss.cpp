@@ -12,6 +12,9 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#if _OPENMP
+# include <omp.h>
+#endif
 
 using namespace std;
 
@@ -50,12 +53,21 @@ static void write_graph(const string& path,
 static void assemble(const string& pathIn, const string& pathOut)
 {
 	Timer timer(__func__);
-	SequenceCollectionHash g;
+	// Use a fixed number of shards when the number of threads is
+	// specified, so that the assembly, including the numbering of
+	// the contigs, does not depend on the number of threads.
+	SequenceCollectionHash g(opt::threads > 0 ? 1024 : 1);
 
 	if (!pathIn.empty())
 		AssemblyAlgorithms::loadSequences(&g, pathIn.c_str());
-	for_each(opt::inFiles.begin(), opt::inFiles.end(),
-			bind1st(ptr_fun(AssemblyAlgorithms::loadSequences), &g));
+	if (opt::partitionMemory > 0)
+		AssemblyAlgorithms::loadPartitionedSequences(&g, opt::inFiles);
+	else if (opt::bloomSize > 0)
+		AssemblyAlgorithms::loadSolidSequences(&g, opt::inFiles);
+	else
+		for (vector<string>::const_iterator it = opt::inFiles.begin();
+				it != opt::inFiles.end(); ++it)
+			AssemblyAlgorithms::loadSequences(&g, *it);
 	size_t numLoaded = g.size();
 	cout << "Loaded " << numLoaded << " k-mer\n";
 	g.setDeletedKey();
@@ -120,6 +132,10 @@ int main(int argc, char* const* argv)
 
 	opt::parse(argc, argv);
 
+#if _OPENMP
+	omp_set_num_threads(opt::threads > 0 ? opt::threads : 1);
+#endif
+
 	bool krange = opt::kMin != opt::kMax;
 	if (krange)
 		cout << "Assembling k=" << opt::kMin << "-" << opt::kMax
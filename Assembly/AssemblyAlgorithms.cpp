@@ -1,5 +1,9 @@
 #include "AssemblyAlgorithms.h"
 #include "Assembly/Options.h"
+#include "Bloom/CascadingBloomFilter.h"
+#if _OPENMP
+# include "Bloom/ConcurrentBloomFilter.h"
+#endif
 #include "Common/Options.h"
 #include "FastaReader.h"
 #include "FastaWriter.h"
@@ -11,10 +15,19 @@
 #include "Timer.h"
 #include <algorithm>
 #include <cctype>
-#include <climits> // for UINT_MAX
+#include <cerrno>
+#include <climits> // for UCHAR_MAX, UINT_MAX
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
@@ -67,114 +80,378 @@ static size_t loadKmer(ISequenceCollection& g, FastaReader& in)
 	return count;
 }
 
-/** Load sequence data into the collection. */
-void loadSequences(ISequenceCollection* seqCollection, string inFile)
+/** The k-mer of a single read. */
+struct ReadKmer
 {
-	Timer timer("LoadSequences " + inFile);
+	FastaRecord rec;
 
-	logger(0) << "Reading `" << inFile << "'...\n";
+	/** Whether this read was reverse complemented. */
+	bool reversed;
 
-	if (inFile.find(".kmer") != string::npos) {
-		if (opt::rank <= 0)
-			seqCollection->setColourSpace(false);
-		seqCollection->load(inFile.c_str());
+	/** The k-mer of this read and whether each k-mer contains a
+	 * masked base. */
+	vector<pair<Kmer, bool> > kmer;
+
+	/** The shard of each k-mer of this read. */
+	vector<unsigned> shard;
+
+	/** The number of k-mer of this read that were discarded because
+	 * they were seen only once. */
+	unsigned filtered;
+};
+
+/** The number of reads of each kind loaded from a file. */
+struct LoadCounts
+{
+	size_t count, good, small, nonACGT, reversed;
+
+	/** The number of k-mer discarded because they were seen only
+	 * once. */
+	size_t filtered;
+
+	/** The number of bases read. */
+	size_t bases;
+
+	LoadCounts() : count(0), good(0), small(0), nonACGT(0),
+		reversed(0), filtered(0), bases(0) { }
+};
+
+/** Return the code of the specified nucleotide or colour, which may
+ * be masked (lower case).
+ * @return UCHAR_MAX if the character is not one of ACGT0123
+ */
+static inline uint8_t maskedBaseToCode(char c)
+{
+	switch (c) {
+	  case 'A': case 'a': case '0': return 0;
+	  case 'C': case 'c': case '1': return 1;
+	  case 'G': case 'g': case '2': return 2;
+	  case 'T': case 't': case '3': return 3;
+	  default: return UCHAR_MAX;
+	}
+}
+
+/** Reverse complement the first read of a strand-specific pair.
+ * @return whether the read was reverse complemented
+ */
+static bool orientRead(FastaRecord& rec)
+{
+	if (opt::ss && rec.id.size() > 2
+			&& rec.id.substr(rec.id.size()-2) == "/1") {
+		rec.seq = reverseComplement(rec.seq);
+		return true;
+	}
+	return false;
+}
+
+/** Compute the hash values of a k-mer in the Bloom filter of solid
+ * k-mer. A strand-specific assembly hashes the k-mer as it is, so
+ * that a k-mer seen once on each strand is not counted twice, and
+ * otherwise the canonical k-mer is hashed.
+ */
+static void solidHashes(const Kmer& kmer, unsigned n, size_t hashes[])
+{
+	if (!opt::ss) {
+		Bloom::hashes(kmer, Bloom::HASH_CITY, n, hashes);
 		return;
 	}
+	hashes[0] = hashmem(&kmer, Kmer::serialSize());
+	for (unsigned i = 1; i < n; i++)
+		hashes[i] = hashmem(&kmer, Kmer::serialSize(), i);
+}
 
-	size_t count = 0, count_good = 0,
-			 count_small = 0, count_nonACGT = 0,
-			 count_reversed = 0;
-	int fastaFlags = opt::maskCov ?  FastaReader::NO_FOLD_CASE :
-			FastaReader::FOLD_CASE;
-	FastaReader reader(inFile.c_str(), fastaFlags);
-	if (endsWith(inFile, ".jf") || endsWith(inFile, ".jfq")) {
-		// Load k-mer with coverage data.
-		count = loadKmer(*seqCollection, reader);
-		count_good = count;
-	} else
-	for (FastaRecord rec; reader >> rec;) {
-		Sequence seq = rec.seq;
-		size_t len = seq.length();
-		if (opt::kmerSize > len) {
-			count_small++;
+/** Extract the k-mer of the specified read. Each k-mer is built by
+ * shifting the next base into the previous k-mer rather than by
+ * converting a substring of the read.
+ * @param empty a k-mer whose bases are all zero
+ * @param solid if not NULL, discard the k-mer that are not in this
+ * set of k-mer seen at least twice
+ */
+static void extractKmer(ReadKmer& r, const Kmer& empty,
+		const CascadingBloomFilter* solid = NULL)
+{
+	r.kmer.clear();
+	r.reversed = false;
+	r.filtered = 0;
+	Sequence& seq = r.rec.seq;
+	size_t len = seq.length();
+	if (opt::kmerSize > len)
+		return;
+
+	if (isalnum(seq[0])) {
+		if (opt::colourSpace)
+			assert(isdigit(seq[0]));
+		else
+			assert(isalpha(seq[0]));
+	}
+
+	r.reversed = orientRead(r.rec);
+
+	Kmer kmer(empty);
+	// The number of consecutive usable bases
+	unsigned run = 0;
+	// One past the position of the last masked base
+	size_t masked = 0;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t code = maskedBaseToCode(seq[i]);
+		if (code == UCHAR_MAX) {
+			run = 0;
 			continue;
 		}
-
-		if (opt::rank <= 0
-				&& count == 0 && seqCollection->empty()) {
-			// Detect colour-space reads.
-			bool colourSpace
-				= seq.find_first_of("0123") != string::npos;
-			seqCollection->setColourSpace(colourSpace);
-			if (colourSpace)
-				cout << "Colour-space assembly\n";
+		if (islower(seq[i]))
+			masked = i + 1;
+		kmer.shift(SENSE, code);
+		if (++run < opt::kmerSize)
+			continue;
+		if (solid != NULL) {
+			size_t hashes[Bloom::MAX_HASHES];
+			solidHashes(kmer, solid->getHashNum(), hashes);
+			if (!solid->contains(hashes)) {
+				r.filtered++;
+				continue;
+			}
 		}
+		r.kmer.push_back(make_pair(kmer,
+					masked > i + 1 - opt::kmerSize));
+	}
+}
 
-		if (isalnum(seq[0])) {
-			if (opt::colourSpace)
-				assert(isdigit(seq[0]));
-			else
-				assert(isalpha(seq[0]));
-		}
+/** Record the shard of each k-mer of the specified read. */
+static void shardKmer(const SequenceCollectionHash& g, ReadKmer& r)
+{
+	r.shard.resize(r.kmer.size());
+	for (size_t i = 0; i < r.kmer.size(); i++)
+		r.shard[i] = g.shard(r.kmer[i].first);
+}
 
-		bool good = seq.find_first_not_of("ACGT0123") == string::npos;
-		bool discarded = true;
+/** Add the k-mer of the specified reads, which belong to the
+ * specified stripe of shards, to the collection. The k-mer of each
+ * shard are added in the same order as they were read.
+ */
+static void addStripe(SequenceCollectionHash& g,
+		const vector<ReadKmer>& batch, size_t n,
+		unsigned stripe, unsigned stripes)
+{
+	for (size_t i = 0; i < n; i++) {
+		const ReadKmer& r = batch[i];
+		for (size_t j = 0; j < r.kmer.size(); j++)
+			if (r.shard[j] % stripes == stripe)
+				g.add(r.kmer[j].first, r.kmer[j].second ? 0 : 1);
+	}
+}
 
-		if (opt::ss && rec.id.size() > 2
-				&& rec.id.substr(rec.id.size()-2) == "/1") {
-			seq = reverseComplement(seq);
-			count_reversed++;
-		}
+/** Count the specified read, whose k-mer have been added to the
+ * collection. */
+static void countRead(ISequenceCollection* seqCollection,
+		const ReadKmer& r, LoadCounts& n)
+{
+	n.bases += r.rec.seq.length();
+	if (opt::kmerSize > r.rec.seq.length()) {
+		n.small++;
+		return;
+	}
+	if (r.reversed)
+		n.reversed++;
+
+	if (r.kmer.empty() && r.filtered == 0)
+		n.nonACGT++;
+	else
+		n.good++;
+	n.filtered += r.filtered;
+
+	if (++n.count % 100000 == 0) {
+		logger(1) << "Read " << n.count << " reads. ";
+		seqCollection->printLoad();
+	}
+	seqCollection->pumpNetwork();
+}
 
-		for (unsigned i = 0; i < len - opt::kmerSize + 1; i++) {
-			Sequence kmer(seq, i, opt::kmerSize);
-			if (good || kmer.find_first_not_of("acgtACGT0123")
-					== string::npos) {
-				if (good || kmer.find_first_of("acgt") == string::npos)
-					seqCollection->add(Kmer(kmer));
-				else {
-					transform(kmer.begin(), kmer.end(), kmer.begin(),
-							::toupper);
-					seqCollection->add(Kmer(kmer), 0);
+/** Add the k-mer of the specified read to the collection. */
+static void addKmer(ISequenceCollection* seqCollection,
+		const ReadKmer& r, LoadCounts& n)
+{
+	for (vector<pair<Kmer, bool> >::const_iterator it
+			= r.kmer.begin(); it != r.kmer.end(); ++it)
+		seqCollection->add(it->first, it->second ? 0 : 1);
+	countRead(seqCollection, r, n);
+}
+
+/** Read a batch of reads.
+ * @param detectColourSpace whether to detect colour space from the
+ * first read that is not shorter than k
+ * @return the number of reads read
+ */
+static size_t readBatch(ISequenceCollection* seqCollection,
+		FastaReader& in, vector<ReadKmer>& batch,
+		bool& detectColourSpace)
+{
+	size_t n = 0;
+	for (; n < batch.size() && in >> batch[n].rec; n++) {
+		const Sequence& seq = batch[n].rec.seq;
+		if (!detectColourSpace || opt::kmerSize > seq.length())
+			continue;
+		detectColourSpace = false;
+		bool colourSpace = seq.find_first_of("0123") != string::npos;
+		seqCollection->setColourSpace(colourSpace);
+		if (colourSpace)
+			cout << "Colour-space assembly\n";
+	}
+	return n;
+}
+
+/** Load the reads of the specified file into the collection.
+ * Reads are parsed into k-mer in parallel by a team of threads,
+ * while the master thread adds the k-mer of the previous batch to the
+ * collection, in the same order as they were read, and reads the
+ * next batch. The resulting collection is identical to that
+ * loaded by a single thread. If the collection is sharded, the k-mer
+ * of the previous batch are instead added by every thread, each
+ * thread adding the k-mer of its own stripe of shards. In ABYSS-P,
+ * only the master thread sends and receives messages.
+ * @param g the collection if it is a SequenceCollectionHash
+ * @param solid if not NULL, load only the k-mer in this set
+ */
+static void loadReads(ISequenceCollection* seqCollection,
+		SequenceCollectionHash* g, FastaReader& in, LoadCounts& n,
+		const CascadingBloomFilter* solid)
+{
+	const Kmer empty(Sequence(opt::kmerSize, 'A'));
+	bool detectColourSpace = opt::rank <= 0 && seqCollection->empty();
+
+#if _OPENMP
+	if (opt::threads > 1) {
+		const bool sharded = g != NULL && g->shards() > 1;
+		const unsigned stripes = opt::threads;
+		const size_t BATCH_SIZE = 4096;
+		vector<ReadKmer> batch[3];
+		for (unsigned i = 0; i < 3; i++)
+			batch[i].resize(BATCH_SIZE);
+
+		unsigned cur = 0;
+		size_t nCur = readBatch(seqCollection, in, batch[cur],
+				detectColourSpace);
+		size_t nPrev = 0;
+		while (nCur > 0 || nPrev > 0) {
+			unsigned prev = (cur + 2) % 3, next = (cur + 1) % 3;
+			size_t nNext = 0;
+#pragma omp parallel
+			{
+#pragma omp master
+				{
+					if (!sharded)
+						for (size_t i = 0; i < nPrev; i++)
+							addKmer(seqCollection, batch[prev][i], n);
+					if (nCur > 0)
+						nNext = readBatch(seqCollection, in,
+								batch[next], detectColourSpace);
+				}
+#pragma omp for schedule(dynamic, 64) nowait
+				for (int i = 0; i < (int)nCur; i++) {
+					extractKmer(batch[cur][i], empty, solid);
+					if (sharded)
+						shardKmer(*g, batch[cur][i]);
+				}
+				if (sharded) {
+#pragma omp for schedule(dynamic, 1)
+					for (int i = 0; i < (int)stripes; i++)
+						addStripe(*g, batch[prev], nPrev,
+								i, stripes);
 				}
-				discarded = false;
 			}
+			if (sharded)
+				for (size_t i = 0; i < nPrev; i++)
+					countRead(seqCollection, batch[prev][i], n);
+			nPrev = nCur;
+			nCur = nNext;
+			cur = next;
 		}
-		if (discarded)
-			count_nonACGT++;
-		else
-			count_good++;
+		return;
+	}
+#endif
 
-		if (++count % 100000 == 0) {
-			logger(1) << "Read " << count << " reads. ";
-			seqCollection->printLoad();
-		}
-		seqCollection->pumpNetwork();
+	vector<ReadKmer> batch(1);
+	while (readBatch(seqCollection, in, batch, detectColourSpace) > 0) {
+		extractKmer(batch.front(), empty, solid);
+		addKmer(seqCollection, batch.front(), n);
+	}
+}
+
+/** Load sequence data into the collection.
+ * @param g the collection if it is a SequenceCollectionHash
+ * @param solid if not NULL, load only the k-mer of reads that are
+ * in this set
+ * @param section load only this section of the file, numbered from 1
+ * @param nsections the number of sections of the file
+ * @return the number of k-mer discarded because they are not in solid
+ */
+static size_t loadSequences(ISequenceCollection* seqCollection,
+		SequenceCollectionHash* g, const string& inFile,
+		const CascadingBloomFilter* solid = NULL,
+		unsigned section = 1, unsigned nsections = 1)
+{
+	Timer timer("LoadSequences " + inFile);
+
+	if (nsections > 1)
+		logger(0) << "Reading section " << section
+			<< " of " << nsections << " of `" << inFile << "'...\n";
+	else
+		logger(0) << "Reading `" << inFile << "'...\n";
+
+	if (inFile.find(".kmer") != string::npos) {
+		if (opt::rank <= 0)
+			seqCollection->setColourSpace(false);
+		seqCollection->load(inFile.c_str());
+		return 0;
 	}
+
+	double startTime = wallClock();
+	LoadCounts n;
+	int fastaFlags = opt::maskCov ?  FastaReader::NO_FOLD_CASE :
+			FastaReader::FOLD_CASE;
+	FastaReader reader(inFile.c_str(), fastaFlags);
+	if (nsections > 1)
+		reader.split(section, nsections);
+	if (endsWith(inFile, ".jf") || endsWith(inFile, ".jfq")) {
+		// Load k-mer with coverage data.
+		n.count = loadKmer(*seqCollection, reader);
+		n.good = n.count;
+	} else
+		loadReads(seqCollection, g, reader, n, solid);
 	assert(reader.eof());
 
-	logger(1) << "Read " << count << " reads. ";
+	logger(1) << "Read " << n.count << " reads. ";
 	seqCollection->printLoad();
-
-	if (count_reversed > 0)
+	double seconds = wallClock() - startTime;
+	if (seconds > 0)
+		logger(1) << "Read " << n.count << " reads ("
+			<< n.bases << " bases) in "
+			<< setprecision(3) << seconds << " s ("
+			<< (size_t)(n.count / seconds) << " reads/s, "
+			<< (size_t)(n.bases / seconds) << " bases/s)\n";
+
+	if (n.filtered > 0)
+		logger(1) << "Discarded " << n.filtered
+			<< " k-mer seen only once\n";
+
+	if (n.reversed > 0)
 		cerr << "`" << inFile << "': "
-			"reversed " << count_reversed << " reads\n";
-	if (count_small > 0)
+			"reversed " << n.reversed << " reads\n";
+	if (n.small > 0)
 		cerr << "`" << inFile << "': "
-			"discarded " << count_small << " reads "
+			"discarded " << n.small << " reads "
 			"shorter than " << opt::kmerSize << " bases\n";
 	if (reader.unchaste() > 0)
 		cerr << "`" << inFile << "': "
 			"discarded " << reader.unchaste() << " unchaste reads\n";
-	if (count_nonACGT > 0)
+	if (n.nonACGT > 0)
 		cerr << "`" << inFile << "': "
-			"discarded " << count_nonACGT << " reads "
+			"discarded " << n.nonACGT << " reads "
 			"containing non-ACGT characters\n";
-	if (count_good == 0)
+	if (n.good == 0)
 		cerr << "warning: `" << inFile << "': "
 			"contains no usable sequence\n";
 
-	if (opt::rank <= 0 && count == 0 && seqCollection->empty()) {
+	if (opt::rank <= 0 && n.count == 0 && seqCollection->empty()) {
 		/* The master process did not load any data, which means that
 		 * it hasn't told the slave processes whether this assembly is
 		 * in colour-space. Rather than fail right now, assume that
@@ -185,6 +462,531 @@ void loadSequences(ISequenceCollection* seqCollection, string inFile)
 		assert(!opt::colourSpace);
 		seqCollection->setColourSpace(false);
 	}
+	return n.filtered;
+}
+
+/** Load sequence data into the collection. */
+void loadSequences(ISequenceCollection* seqCollection, string inFile)
+{
+	loadSequences(seqCollection, NULL, inFile);
+}
+
+/** Load sequence data into the collection. */
+void loadSequences(SequenceCollectionHash* seqCollection, string inFile)
+{
+	loadSequences(seqCollection, seqCollection, inFile);
+}
+
+/** Load one section of the sequence data into the collection.
+ * @param section the section to load, numbered from 1
+ * @param nsections the number of sections of the file
+ */
+void loadSequences(ISequenceCollection* seqCollection, string inFile,
+		unsigned section, unsigned nsections)
+{
+	loadSequences(seqCollection, NULL, inFile, NULL,
+			section, nsections);
+}
+
+/** Return whether the specified file contains k-mer rather than
+ * reads. */
+static bool isKmerFile(const string& path)
+{
+	return path.find(".kmer") != string::npos
+		|| endsWith(path, ".jf") || endsWith(path, ".jfq");
+}
+
+/** Add the k-mer of the reads of the specified file to the Bloom
+ * filter.
+ * @return the number of reads
+ */
+template <typename BF>
+static size_t countKmer(ISequenceCollection* seqCollection,
+		BF& bloom, const string& inFile)
+{
+	const Kmer empty(Sequence(opt::kmerSize, 'A'));
+	const size_t BATCH_SIZE = 4096;
+	FastaReader in(inFile.c_str(), FastaReader::FOLD_CASE);
+	vector<ReadKmer> batch(BATCH_SIZE);
+	bool detectColourSpace = opt::rank <= 0 && seqCollection->empty();
+	size_t count = 0;
+	for (size_t n; (n = readBatch(seqCollection, in, batch,
+				detectColourSpace)) > 0;) {
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < (int)n; i++) {
+			extractKmer(batch[i], empty);
+			size_t hashes[Bloom::MAX_HASHES];
+			for (vector<pair<Kmer, bool> >::const_iterator it
+					= batch[i].kmer.begin();
+					it != batch[i].kmer.end(); ++it) {
+				solidHashes(it->first, bloom.getHashNum(), hashes);
+				bloom.insert(hashes);
+			}
+		}
+		count += n;
+	}
+	assert(in.eof());
+	return count;
+}
+
+/** Return the estimated number of distinct elements added to the
+ * specified Bloom filter, which uses a single hash function. */
+static double estimateCardinality(const BloomFilter& bloom)
+{
+	double m = bloom.size();
+	double set = bloom.popcount();
+	return set < m ? -m * log(1 - set / m) : set;
+}
+
+/** Load the k-mer of the specified files that are seen at least
+ * twice. A first pass over the reads counts their k-mer using a
+ * cascading Bloom filter of opt::bloomSize bytes. The second pass
+ * loads only the k-mer seen at least twice, with their exact
+ * coverage, so that the k-mer seen only once, which are mostly
+ * sequencing errors, are never added to the collection.
+ */
+void loadSolidSequences(SequenceCollectionHash* seqCollection,
+		const vector<string>& inFiles)
+{
+	assert(opt::bloomSize > 0);
+	CascadingBloomFilter bloom(
+			opt::bloomSize * 8 / CascadingBloomFilter::MAX_COUNT);
+	{
+		Timer timer("CountKmer");
+		cout << "Counting k-mer using a cascading Bloom filter of "
+			<< toSI(opt::bloomSize) << "B\n";
+#if _OPENMP
+		ConcurrentBloomFilter<CascadingBloomFilter> cbf(bloom);
+#endif
+		for (vector<string>::const_iterator it = inFiles.begin();
+				it != inFiles.end(); ++it) {
+			if (isKmerFile(*it))
+				continue;
+			logger(0) << "Reading `" << *it << "'...\n";
+#if _OPENMP
+			size_t n = countKmer(seqCollection, cbf, *it);
+#else
+			size_t n = countKmer(seqCollection, bloom, *it);
+#endif
+			logger(1) << "Counted the k-mer of " << n << " reads\n";
+		}
+	}
+
+	double distinct = estimateCardinality(bloom.getBloomFilter(0));
+	double solid = estimateCardinality(bloom.getBloomFilter(1));
+	cout << "Counted about " << (size_t)distinct << " distinct k-mer, "
+		"of which " << (size_t)solid << " were seen at least twice "
+		"(FPR " << setprecision(3) << 100 * bloom.FPR() << "%)\n";
+
+	size_t discarded = 0;
+	for (vector<string>::const_iterator it = inFiles.begin();
+			it != inFiles.end(); ++it)
+		discarded += loadSequences(seqCollection, seqCollection,
+				*it, &bloom);
+
+	// Each discarded k-mer was seen only once, so it would have
+	// used one entry of the collection.
+	size_t n = seqCollection->size();
+	if (n > 0)
+		cout << "Discarded " << discarded << " k-mer seen only once, "
+			"which saved about " << toSI((double)discarded
+					* seqCollection->memory() / n) << "B of memory\n";
+}
+
+/** The length of a minimizer. */
+static const unsigned MINIMIZER_LEN = 15;
+
+/** Return the hash of the specified m-mer, which is the finalizer of
+ * MurmurHash3. */
+static inline uint64_t hashMmer(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/** Return the hash of the minimizer of the specified k-mer, which is
+ * the same as that found by splitSuperKmer. A k-mer and its reverse
+ * complement have the same minimizer, and adjacent k-mer usually do.
+ */
+uint64_t minimizerHash(const Kmer& kmer)
+{
+	const unsigned k = Kmer::length();
+	const unsigned m = min(k, MINIMIZER_LEN);
+	const uint64_t mask = ((uint64_t)1 << 2 * m) - 1;
+	uint64_t fwd = 0, rev = 0, minHash = ~(uint64_t)0;
+	for (unsigned i = 0; i < k; i++) {
+		uint8_t code = kmer.at(i);
+		fwd = (fwd << 2 | code) & mask;
+		rev = rev >> 2 | (uint64_t)(opt::colourSpace ? code : 3 - code)
+			<< 2 * (m - 1);
+		if (i + 1 >= m)
+			minHash = min(minHash, hashMmer(min(fwd, rev)));
+	}
+	return minHash;
+}
+
+/** A run of consecutive k-mer of a read that have the same
+ * minimizer, and so belong to the same partition. */
+struct SuperKmer
+{
+	unsigned partition;
+	size_t pos;
+	size_t len;
+	SuperKmer(unsigned partition, size_t pos, size_t len)
+		: partition(partition), pos(pos), len(len) { }
+};
+
+/** Split the specified read into super-k-mer. The minimizer of a
+ * k-mer is its m-mer with the smallest hash, in which each m-mer is
+ * taken in its canonical orientation, so that a k-mer and its reverse
+ * complement have the same minimizer.
+ */
+static void splitSuperKmer(const Sequence& seq, unsigned partitions,
+		vector<SuperKmer>& out)
+{
+	out.clear();
+	const unsigned k = opt::kmerSize;
+	const unsigned m = min(k, MINIMIZER_LEN);
+	const uint64_t mask = ((uint64_t)1 << 2 * m) - 1;
+	const size_t len = seq.length();
+	if (len < k)
+		return;
+
+	// The hash of the canonical m-mer ending at each position.
+	vector<uint64_t> h(len);
+	uint64_t fwd = 0, rev = 0;
+	unsigned run = 0;
+	size_t minPos = 0;
+	bool open = false;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t code = maskedBaseToCode(seq[i]);
+		if (code == UCHAR_MAX) {
+			run = 0;
+			open = false;
+			continue;
+		}
+		fwd = (fwd << 2 | code) & mask;
+		rev = rev >> 2 | (uint64_t)(opt::colourSpace ? code : 3 - code)
+			<< 2 * (m - 1);
+		if (++run < m)
+			continue;
+		h[i] = hashMmer(min(fwd, rev));
+		if (run < k)
+			continue;
+
+		// The m-mer of the k-mer ending at i end at i-k+m to i.
+		size_t first = i + m - k;
+		if (run == k || minPos < first) {
+			minPos = first;
+			for (size_t j = first + 1; j <= i; j++)
+				if (h[j] < h[minPos])
+					minPos = j;
+		} else if (h[i] < h[minPos])
+			minPos = i;
+
+		unsigned partition = h[minPos] % partitions;
+		if (open && out.back().partition == partition)
+			out.back().len++;
+		else
+			out.push_back(SuperKmer(partition, i + 1 - k, k));
+		open = true;
+	}
+}
+
+/** Return the size of the specified file, or zero if it is not a
+ * regular file. */
+static size_t fileSize(const string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+		? st.st_size : 0;
+}
+
+/** Return the estimated number of bytes of memory used to count the
+ * k-mer of a partition of the specified size. Every base is assumed
+ * to start a distinct k-mer. */
+static double partitionMemory(size_t bytes)
+{
+	return (double)bytes * (sizeof (SequenceDataHash::value_type)
+			+ 2 * sizeof (void*));
+}
+
+/** Write the super-k-mer of the reads of the specified file to the
+ * partitions, in the same order as the reads.
+ * @return the number of reads
+ */
+static size_t partitionReads(ISequenceCollection* seqCollection,
+		const string& inFile, vector<FILE*>& parts)
+{
+	const size_t BATCH_SIZE = 4096;
+	int fastaFlags = opt::maskCov ?  FastaReader::NO_FOLD_CASE :
+			FastaReader::FOLD_CASE;
+	FastaReader in(inFile.c_str(), fastaFlags);
+	vector<ReadKmer> batch(BATCH_SIZE);
+	vector< vector<SuperKmer> > superKmers(BATCH_SIZE);
+	bool detectColourSpace = opt::rank <= 0 && seqCollection->empty();
+	size_t count = 0;
+	for (size_t n; (n = readBatch(seqCollection, in, batch,
+				detectColourSpace)) > 0;) {
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < (int)n; i++) {
+			if (batch[i].rec.seq.length() >= opt::kmerSize)
+				orientRead(batch[i].rec);
+			splitSuperKmer(batch[i].rec.seq, parts.size(),
+					superKmers[i]);
+		}
+		for (size_t i = 0; i < n; i++) {
+			const Sequence& seq = batch[i].rec.seq;
+			for (vector<SuperKmer>::const_iterator it
+					= superKmers[i].begin();
+					it != superKmers[i].end(); ++it) {
+				FILE* f = parts[it->partition];
+				fwrite(&seq[it->pos], 1, it->len, f);
+				putc('\n', f);
+			}
+		}
+		count += n;
+	}
+	assert(in.eof());
+	if (in.unchaste() > 0)
+		cerr << "`" << inFile << "': "
+			"discarded " << in.unchaste() << " unchaste reads\n";
+	return count;
+}
+
+/** Add the specified k-mer to the map, in the same way as
+ * SequenceCollectionHash::add. */
+static void addCoverage(SequenceDataHash& h, const Kmer& kmer,
+		unsigned coverage)
+{
+	bool rc = false;
+	SequenceDataHash::iterator it = h.find(kmer);
+	if (it == h.end() && !opt::ss) {
+		it = h.find(reverseComplement(kmer));
+		rc = it != h.end();
+	}
+	if (it == h.end()) {
+		h.insert(make_pair(kmer, KmerData(SENSE, coverage)));
+	} else if (coverage > 0) {
+		KmerData data = it->second;
+		data.addMultiplicity(rc ? ANTISENSE : SENSE, coverage);
+#if ENABLE_COMPACT_TABLE
+		h.setData(it, data);
+#else
+		it->second = data;
+#endif
+	}
+}
+
+/** Return the largest number of partition files that may be open at
+ * once, which leaves some file descriptors for the input files and
+ * the standard streams. */
+static unsigned maxPartitions()
+{
+	const unsigned MAX_PARTITIONS = 1000;
+	const unsigned RESERVED_FILES = 32;
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0
+			|| rl.rlim_cur == RLIM_INFINITY
+			|| rl.rlim_cur >= MAX_PARTITIONS + RESERVED_FILES)
+		return MAX_PARTITIONS;
+	return rl.rlim_cur > RESERVED_FILES + 1
+		? rl.rlim_cur - RESERVED_FILES : 1;
+}
+
+/** The directory of the partition files and the partition files
+ * that have not yet been removed. */
+static string s_partitionDir;
+static vector<string> s_partitionPaths;
+
+/** Remove the partition files and their directory. This function is
+ * registered with atexit so that the partitions are removed even when
+ * the program exits early because of an error. */
+static void removePartitions()
+{
+	for (vector<string>::const_iterator it
+			= s_partitionPaths.begin();
+			it != s_partitionPaths.end(); ++it)
+		unlink(it->c_str());
+	s_partitionPaths.clear();
+	if (!s_partitionDir.empty())
+		rmdir(s_partitionDir.c_str());
+	s_partitionDir.clear();
+}
+
+/** Close the specified partition file, and exit if any write to it
+ * failed, such as when the disk is full. */
+static void closePartition(FILE* f, const string& path)
+{
+	bool failed = ferror(f);
+	if (fclose(f) != 0 || failed) {
+		cerr << "error: `" << path << "': "
+			<< (errno != 0 ? strerror(errno) : "write error")
+			<< '\n';
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Count the k-mer of the specified partition file.
+ * @return the number of super-k-mer
+ */
+static size_t countPartition(SequenceDataHash& h, const string& path)
+{
+	const Kmer empty(Sequence(opt::kmerSize, 'A'));
+	ifstream in(path.c_str());
+	assert_good(in, path);
+	size_t count = 0;
+	ReadKmer r;
+	while (getline(in, r.rec.seq)) {
+		extractKmer(r, empty);
+		for (vector<pair<Kmer, bool> >::const_iterator it
+				= r.kmer.begin(); it != r.kmer.end(); ++it)
+			addCoverage(h, it->first, it->second ? 0 : 1);
+		count++;
+	}
+	assert(in.eof());
+	return count;
+}
+
+/** Load the k-mer of the specified files out of core. The reads are
+ * split into super-k-mer, which are written to partition files by
+ * their minimizer, so that every occurrence of a k-mer is in the
+ * same partition. The partitions are then counted a group at a time,
+ * each group using at most opt::partitionMemory bytes, and only the
+ * k-mer whose coverage is at least two are added to the collection.
+ * The partition files are written to the directory $TMPDIR or /tmp,
+ * and are removed when they have been counted or when the program
+ * exits.
+ */
+void loadPartitionedSequences(SequenceCollectionHash* seqCollection,
+		const vector<string>& inFiles)
+{
+	assert(opt::partitionMemory > 0);
+
+	// Files of k-mer are not partitioned.
+	size_t inputBytes = 0;
+	vector<string> readFiles;
+	for (vector<string>::const_iterator it = inFiles.begin();
+			it != inFiles.end(); ++it) {
+		if (isKmerFile(*it)) {
+			loadSequences(seqCollection, *it);
+			continue;
+		}
+		readFiles.push_back(*it);
+		inputBytes += fileSize(*it);
+	}
+	if (readFiles.empty())
+		return;
+
+	unsigned partitions = (unsigned)min((double)maxPartitions(),
+			ceil(partitionMemory(inputBytes) / opt::partitionMemory));
+	partitions = max(partitions, 1U);
+
+	const char* tmpdir = getenv("TMPDIR");
+	string dir = string(tmpdir != NULL && *tmpdir != '\0'
+			? tmpdir : "/tmp") + "/ABYSS.XXXXXX";
+	if (mkdtemp(&dir[0]) == NULL) {
+		perror(dir.c_str());
+		exit(EXIT_FAILURE);
+	}
+	static bool registered = false;
+	if (!registered) {
+		atexit(removePartitions);
+		registered = true;
+	}
+	s_partitionDir = dir;
+	vector<string>& paths = s_partitionPaths;
+	paths.resize(partitions);
+	vector<FILE*> parts(partitions);
+	for (unsigned i = 0; i < partitions; i++) {
+		ostringstream ss;
+		ss << dir << '/' << setfill('0') << setw(3) << i << ".txt";
+		paths[i] = ss.str();
+		parts[i] = fopen(paths[i].c_str(), "w");
+		if (parts[i] == NULL) {
+			perror(paths[i].c_str());
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	{
+		Timer timer("PartitionReads");
+		cout << "Partitioning reads into " << partitions
+			<< " partitions in `" << dir << "'\n";
+		for (vector<string>::const_iterator it = readFiles.begin();
+				it != readFiles.end(); ++it) {
+			logger(0) << "Reading `" << *it << "'...\n";
+			size_t n = partitionReads(seqCollection, *it, parts);
+			logger(1) << "Partitioned " << n << " reads\n";
+		}
+		for (unsigned i = 0; i < partitions; i++)
+			closePartition(parts[i], paths[i]);
+	}
+
+	// Count the partitions, a group at a time.
+	Timer timer("CountPartitions");
+	vector<size_t> sizes(partitions);
+	size_t diskBytes = 0;
+	for (unsigned i = 0; i < partitions; i++) {
+		sizes[i] = fileSize(paths[i]);
+		diskBytes += sizes[i];
+	}
+	size_t distinct = 0, solid = 0;
+	unsigned groups = 0;
+	for (unsigned first = 0; first < partitions; groups++) {
+		unsigned last = first + 1;
+		double bytes = partitionMemory(sizes[first]);
+		for (; last < partitions && bytes + partitionMemory(sizes[last])
+				<= opt::partitionMemory; last++)
+			bytes += partitionMemory(sizes[last]);
+
+		SequenceDataHash h;
+		for (unsigned i = first; i < last; i++) {
+			countPartition(h, paths[i]);
+			unlink(paths[i].c_str());
+		}
+		distinct += h.size();
+		for (SequenceDataHash::const_iterator it = h.begin();
+				it != h.end(); ++it) {
+			if (it->second.getMultiplicity() >= 2) {
+				seqCollection->insert(*it);
+				solid++;
+			}
+		}
+		logger(1) << "Counted " << h.size() << " distinct k-mer "
+			"of partitions " << first << " to " << last - 1 << '\n';
+		first = last;
+	}
+	removePartitions();
+
+	cout << "Counted " << distinct << " distinct k-mer in "
+		<< partitions << " partitions of " << toSI(diskBytes)
+		<< "B on disk in " << groups << " groups\n"
+		"Loaded " << solid << " k-mer whose coverage is at least 2\n";
+}
+
+/** Add the edges of the specified k-mer to its neighbours.
+ * @return the number of edges added
+ */
+size_t addAdjacency(ISequenceCollection* seqCollection,
+		const Kmer& kmer)
+{
+	size_t numBasesSet = 0;
+	for (extDirection dir = SENSE; dir <= ANTISENSE; ++dir) {
+		Kmer testSeq(kmer);
+		uint8_t adjBase = testSeq.shift(dir);
+		for (unsigned i = 0; i < NUM_BASES; i++) {
+			testSeq.setLastBase(dir, i);
+			if (seqCollection->setBaseExtension(
+						testSeq, !dir, adjBase))
+				numBasesSet++;
+		}
+	}
+	return numBasesSet;
 }
 
 /** Generate the adjacency information for each sequence in the
@@ -203,16 +1005,7 @@ void generateAdjacency(ISequenceCollection* seqCollection)
 		if (++count % 1000000 == 0)
 			logger(1) << "Finding adjacent k-mer: " << count << '\n';
 
-		for (extDirection dir = SENSE; dir <= ANTISENSE; ++dir) {
-			Kmer testSeq(iter->first);
-			uint8_t adjBase = testSeq.shift(dir);
-			for (unsigned i = 0; i < NUM_BASES; i++) {
-				testSeq.setLastBase(dir, i);
-				if (seqCollection->setBaseExtension(
-							testSeq, !dir, adjBase))
-					numBasesSet++;
-			}
-		}
+		numBasesSet += addAdjacency(seqCollection, iter->first);
 		seqCollection->pumpNetwork();
 	}
 
@@ -220,6 +1013,30 @@ void generateAdjacency(ISequenceCollection* seqCollection)
 		logger(0) << "Added " << numBasesSet << " edges.\n";
 }
 
+/** Generate the adjacency information for each sequence in the
+ * collection, processing each shard in parallel. */
+void generateAdjacency(SequenceCollectionHash* g)
+{
+	if (g->shards() == 1) {
+		generateAdjacency(static_cast<ISequenceCollection*>(g));
+		return;
+	}
+	Timer timer("GenerateAdjacency");
+
+	size_t numBasesSet = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+: numBasesSet)
+	for (int shard = 0; shard < (int)g->shards(); shard++) {
+		for (ISequenceCollection::iterator it = g->begin(shard);
+				it != g->end(shard); ++it) {
+			if (!g->get(shard, it).second.deleted())
+				numBasesSet += addAdjacency(g, it->first);
+		}
+	}
+
+	if (numBasesSet > 0)
+		logger(0) << "Added " << numBasesSet << " edges.\n";
+}
+
 /** Mark the specified vertex and its neighbours.
  * @return the number of marked edges
  */
@@ -234,6 +1051,33 @@ static size_t markNeighbours(ISequenceCollection* g,
 	return adj.size();
 }
 
+/** Mark the specified vertex and its neighbours if it is ambiguous
+ * or a palindrome.
+ * @param[out] counte the number of marked edges
+ * @return the number of marked vertices
+ */
+static size_t markAmbiguous(ISequenceCollection* g,
+		const ISequenceCollection::value_type& u, size_t& counte)
+{
+	size_t countv = 0;
+	if (!opt::ss && u.first.isPalindrome()) {
+		countv += 2;
+		g->mark(u.first);
+		counte += markNeighbours(g, u, SENSE);
+	} else {
+		for (extDirection sense = SENSE;
+				sense <= ANTISENSE; ++sense) {
+			if (u.second.getExtension(sense).isAmbiguous()
+					|| (!opt::ss && u.first.isPalindrome(sense))) {
+				countv++;
+				g->mark(u.first, sense);
+				counte += markNeighbours(g, u, sense);
+			}
+		}
+	}
+	return countv;
+}
+
 /** Mark ambiguous branches and branches from palindromes for removal.
  * @return the number of branches marked
  */
@@ -250,22 +1094,7 @@ size_t markAmbiguous(ISequenceCollection* g)
 		if (++progress % 1000000 == 0)
 			logger(1) << "Splitting: " << progress << '\n';
 
-		if (!opt::ss && it->first.isPalindrome()) {
-			countv += 2;
-			g->mark(it->first);
-			counte += markNeighbours(g, *it, SENSE);
-		} else {
-			for (extDirection sense = SENSE;
-					sense <= ANTISENSE; ++sense) {
-				if (it->second.getExtension(sense).isAmbiguous()
-						|| (!opt::ss && it->first.isPalindrome(sense))) {
-					countv++;
-					g->mark(it->first, sense);
-					counte += markNeighbours(g, *it, sense);
-				}
-			}
-		}
-
+		countv += markAmbiguous(g, *it, counte);
 		g->pumpNetwork();
 	}
 	logger(0) << "Marked " << counte << " edges of " << countv
@@ -273,6 +1102,49 @@ size_t markAmbiguous(ISequenceCollection* g)
 	return countv;
 }
 
+/** Mark ambiguous branches and branches from palindromes for removal,
+ * processing each shard in parallel.
+ * @return the number of branches marked
+ */
+size_t markAmbiguous(SequenceCollectionHash* g)
+{
+	if (g->shards() == 1)
+		return markAmbiguous(static_cast<ISequenceCollection*>(g));
+	Timer timer(__func__);
+	size_t countv = 0, counte = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+: countv, counte)
+	for (int shard = 0; shard < (int)g->shards(); shard++) {
+		for (ISequenceCollection::iterator it = g->begin(shard);
+				it != g->end(shard); ++it) {
+			ISequenceCollection::value_type u = g->get(shard, it);
+			if (!u.second.deleted())
+				countv += markAmbiguous(g, u, counte);
+		}
+	}
+	logger(0) << "Marked " << counte << " edges of " << countv
+		<< " ambiguous vertices." << endl;
+	return countv;
+}
+
+/** Remove the edges to the specified vertex if it is marked and
+ * deleted.
+ * @return the number of branches removed
+ */
+static size_t splitAmbiguous(ISequenceCollection* pSC,
+		const ISequenceCollection::value_type& seq)
+{
+	if (!seq.second.deleted())
+		return 0;
+	size_t count = 0;
+	for (extDirection sense = SENSE; sense <= ANTISENSE; ++sense) {
+		if (seq.second.marked(sense)) {
+			removeExtensionsToSequence(pSC, seq, sense);
+			count++;
+		}
+	}
+	return count;
+}
+
 /** Remove the edges of marked and deleted vertices.
  * @return the number of branches removed
  */
@@ -282,21 +1154,33 @@ size_t splitAmbiguous(ISequenceCollection* pSC)
 	size_t count = 0;
 	for (ISequenceCollection::iterator it = pSC->begin();
 			it != pSC->end(); ++it) {
-		if (!it->second.deleted())
-			continue;
-		for (extDirection sense = SENSE;
-				sense <= ANTISENSE; ++sense) {
-			if (it->second.marked(sense)) {
-				removeExtensionsToSequence(pSC, *it, sense);
-				count++;
-			}
-		}
+		count += splitAmbiguous(pSC, *it);
 		pSC->pumpNetwork();
 	}
 	logger(0) << "Split " << count << " ambigiuous branches.\n";
 	return count;
 }
 
+/** Remove the edges of marked and deleted vertices, processing each
+ * shard in parallel.
+ * @return the number of branches removed
+ */
+size_t splitAmbiguous(SequenceCollectionHash* g)
+{
+	if (g->shards() == 1)
+		return splitAmbiguous(static_cast<ISequenceCollection*>(g));
+	Timer timer(__func__);
+	size_t count = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+: count)
+	for (int shard = 0; shard < (int)g->shards(); shard++) {
+		for (ISequenceCollection::iterator it = g->begin(shard);
+				it != g->end(shard); ++it)
+			count += splitAmbiguous(g, g->get(shard, it));
+	}
+	logger(0) << "Split " << count << " ambigiuous branches.\n";
+	return count;
+}
+
 /** Open the bubble file. */
 void openBubbleFile(ofstream& out)
 {
@@ -555,23 +1439,29 @@ size_t getNumEroded()
 	return numEroded;
 }
 
-/** Consider the specified k-mer for erosion.
- * @return the number of k-mer eroded, zero or one
- */
-size_t erode(ISequenceCollection* c,
-		const ISequenceCollection::value_type& seq)
+/** Return whether the specified k-mer should be eroded. */
+static bool isErodable(const ISequenceCollection::value_type& seq)
 {
 	if (seq.second.deleted())
-		return 0;
+		return false;
 	extDirection dir;
 	SeqContiguity contiguity = checkSeqContiguity(seq, dir);
 	if (contiguity == SC_CONTIGUOUS)
-		return 0;
+		return false;
 
 	const KmerData& data = seq.second;
-	if (data.getMultiplicity() < opt::erode
-			|| data.getMultiplicity(SENSE) < opt::erodeStrand
-			|| data.getMultiplicity(ANTISENSE) < opt::erodeStrand) {
+	return data.getMultiplicity() < opt::erode
+		|| data.getMultiplicity(SENSE) < opt::erodeStrand
+		|| data.getMultiplicity(ANTISENSE) < opt::erodeStrand;
+}
+
+/** Consider the specified k-mer for erosion.
+ * @return the number of k-mer eroded, zero or one
+ */
+size_t erode(ISequenceCollection* c,
+		const ISequenceCollection::value_type& seq)
+{
+	if (isErodable(seq)) {
 		removeSequenceAndExtensions(c, seq);
 		g_numEroded++;
 		return 1;
@@ -605,22 +1495,102 @@ size_t erodeEnds(ISequenceCollection* seqCollection)
 	return getNumEroded();
 }
 
+/** Erode data off the ends of the graph in rounds, processing each
+ * round in parallel. The first round considers every k-mer, and each
+ * following round considers the neighbours of the k-mer eroded by
+ * the previous round. The eroded k-mer are the same as those eroded
+ * one by one.
+ */
+size_t erodeEnds(SequenceCollectionHash* g)
+{
+	if (g->shards() == 1)
+		return erodeEnds(static_cast<ISequenceCollection*>(g));
+	Timer erodeEndsTimer("Erode");
+	assert(g_numEroded == 0);
+
+	typedef pair<Kmer, KmerData> V;
+	vector<V> doomed;
+#pragma omp parallel
+	{
+		vector<V> found;
+#pragma omp for schedule(dynamic) nowait
+		for (int shard = 0; shard < (int)g->shards(); shard++) {
+			for (ISequenceCollection::iterator it = g->begin(shard);
+					it != g->end(shard); ++it)
+				if (isErodable(*it))
+					found.push_back(*it);
+		}
+#pragma omp critical(erodeEnds)
+		doomed.insert(doomed.end(), found.begin(), found.end());
+	}
+
+	while (!doomed.empty()) {
+		g_numEroded += doomed.size();
+
+		// Erode these k-mer and find their neighbours.
+		vector<Kmer> frontier;
+#pragma omp parallel
+		{
+			vector<Kmer> adj;
+#pragma omp for schedule(dynamic, 64) nowait
+			for (int i = 0; i < (int)doomed.size(); i++) {
+				removeSequenceAndExtensions(g, doomed[i]);
+				for (extDirection dir = SENSE;
+						dir <= ANTISENSE; ++dir)
+					generateSequencesFromExtension(doomed[i].first,
+							dir, doomed[i].second.getExtension(dir),
+							adj);
+			}
+#pragma omp critical(erodeEnds)
+			frontier.insert(frontier.end(), adj.begin(), adj.end());
+		}
+		if (!opt::ss)
+			for (vector<Kmer>::iterator it = frontier.begin();
+					it != frontier.end(); ++it)
+				it->canonicalize();
+		sort(frontier.begin(), frontier.end());
+		frontier.erase(unique(frontier.begin(), frontier.end()),
+				frontier.end());
+
+		// Find the neighbours that are now erodable.
+		doomed.clear();
+#pragma omp parallel
+		{
+			vector<V> found;
+#pragma omp for schedule(dynamic, 64) nowait
+			for (int i = 0; i < (int)frontier.size(); i++) {
+				const V& seq = g->getSeqAndData(frontier[i]);
+				if (isErodable(seq))
+					found.push_back(seq);
+			}
+#pragma omp critical(erodeEnds)
+			doomed.insert(doomed.end(), found.begin(), found.end());
+		}
+	}
+
+	return getNumEroded();
+}
+
+static void findEnds(SequenceCollectionHash* g, vector<Kmer>& ends);
 static size_t trimSequences(SequenceCollectionHash* seqCollection,
-		unsigned maxBranchCull);
+		unsigned maxBranchCull, vector<Kmer>& ends);
 
 /** Trimming driver function */
 void performTrim(SequenceCollectionHash* seqCollection)
 {
 	if (opt::trimLen == 0)
 		return;
+	vector<Kmer> ends;
+	findEnds(seqCollection, ends);
 	unsigned rounds = 0;
 	size_t total = 0;
 	for (unsigned trim = 1; trim < opt::trimLen; trim *= 2) {
 		rounds++;
-		total += trimSequences(seqCollection, trim);
+		total += trimSequences(seqCollection, trim, ends);
 	}
 	size_t count;
-	while ((count = trimSequences(seqCollection, opt::trimLen)) > 0) {
+	while ((count = trimSequences(seqCollection, opt::trimLen,
+					ends)) > 0) {
 		rounds++;
 		total += count;
 	}
@@ -663,59 +1633,176 @@ SeqContiguity checkSeqContiguity(
 	}
 }
 
-/** Prune tips shorter than maxBranchCull. */
-static size_t trimSequences(SequenceCollectionHash* seqCollection,
-		unsigned maxBranchCull)
+/** Mark the tip starting at the specified k-mer for removal if it
+ * is shorter than maxBranchCull. Marking a tip does not affect
+ * whether any other tip is removed.
+ * @param[out] marked the k-mer of the tip, if it is marked
+ * @return the number of tips marked, zero or one
+ */
+static size_t trimSequence(SequenceCollectionHash* seqCollection,
+		const ISequenceCollection::value_type& seq,
+		unsigned maxBranchCull, vector<Kmer>& marked)
 {
-	Timer timer("TrimSequences");
-	cout << "Pruning tips shorter than "
-		<< maxBranchCull << " bp...\n";
-	size_t numBranchesRemoved = 0;
+	if (seq.second.deleted())
+		return 0;
 
-	for (ISequenceCollection::iterator iter = seqCollection->begin();
-			iter != seqCollection->end(); ++iter) {
-		if (iter->second.deleted())
-			continue;
+	extDirection dir;
+	// dir will be set to the trimming direction if the sequence
+	// can be trimmed.
+	SeqContiguity status = checkSeqContiguity(seq, dir);
 
-		extDirection dir;
-		// dir will be set to the trimming direction if the sequence
-		// can be trimmed.
-		SeqContiguity status = checkSeqContiguity(*iter, dir);
+	if (status == SC_CONTIGUOUS)
+		return 0;
+	else if(status == SC_ISLAND)
+	{
+		// remove this sequence, it has no extensions
+		seqCollection->mark(seq.first);
+		marked.push_back(seq.first);
+		return 1;
+	}
 
-		if (status == SC_CONTIGUOUS)
-			continue;
-		else if(status == SC_ISLAND)
-		{
-			// remove this sequence, it has no extensions
-			seqCollection->mark(iter->first);
-			numBranchesRemoved++;
-			continue;
-		}
+	BranchRecord currBranch(dir);
+	Kmer currSeq = seq.first;
+	while(currBranch.isActive())
+	{
+		ExtensionRecord extRec;
+		int multiplicity = -1;
+		bool success = seqCollection->getSeqData(
+				currSeq, extRec, multiplicity);
+		assert(success);
+		(void)success;
+		processLinearExtensionForBranch(currBranch,
+				currSeq, extRec, multiplicity, maxBranchCull);
+	}
 
-		BranchRecord currBranch(dir);
-		Kmer currSeq = iter->first;
-		while(currBranch.isActive())
-		{
-			ExtensionRecord extRec;
-			int multiplicity = -1;
-			bool success = seqCollection->getSeqData(
-					currSeq, extRec, multiplicity);
-			assert(success);
-			(void)success;
-			processLinearExtensionForBranch(currBranch,
-					currSeq, extRec, multiplicity, maxBranchCull);
+	// The branch has ended check it for removal, returns true if
+	// it was removed.
+	if (!processTerminatedBranchTrim(seqCollection, currBranch))
+		return 0;
+	for (BranchRecord::iterator it = currBranch.begin();
+			it != currBranch.end(); ++it)
+		marked.push_back(it->first);
+	return 1;
+}
+
+/** Sort the specified k-mer by their key in the collection and
+ * remove duplicates. */
+static void uniqueKmers(vector<Kmer>& kmers)
+{
+	if (!opt::ss)
+		for (vector<Kmer>::iterator it = kmers.begin();
+				it != kmers.end(); ++it)
+			it->canonicalize();
+	sort(kmers.begin(), kmers.end());
+	kmers.erase(unique(kmers.begin(), kmers.end()), kmers.end());
+}
+
+/** Find the endpoints and islands of the graph. */
+static void findEnds(SequenceCollectionHash* g, vector<Kmer>& ends)
+{
+	Timer timer(__func__);
+	ends.clear();
+#pragma omp parallel if (g->shards() > 1)
+	{
+		vector<Kmer> found;
+		extDirection dir;
+#pragma omp for schedule(dynamic) nowait
+		for (int shard = 0; shard < (int)g->shards(); shard++) {
+			for (ISequenceCollection::iterator it = g->begin(shard);
+					it != g->end(shard); ++it) {
+				const ISequenceCollection::value_type& seq = *it;
+				if (!seq.second.deleted() && checkSeqContiguity(
+							seq, dir) != SC_CONTIGUOUS)
+					found.push_back(seq.first);
+			}
 		}
+#pragma omp critical(findEnds)
+		ends.insert(ends.end(), found.begin(), found.end());
+	}
+	sort(ends.begin(), ends.end());
+}
 
-		// The branch has ended check it for removal, returns true if
-		// it was removed.
-		if(processTerminatedBranchTrim(seqCollection, currBranch))
-		{
-			numBranchesRemoved++;
+/** Remove the specified marked k-mer and add their neighbours to
+ * the specified endpoints.
+ * @return the number of removed k-mer
+ */
+static size_t removeMarked(SequenceCollectionHash* g,
+		const vector<Kmer>& marked, vector<Kmer>& ends)
+{
+	Timer timer(__func__);
+	size_t count = 0;
+#pragma omp parallel reduction(+: count) if (g->shards() > 1)
+	{
+		vector<Kmer> adj;
+#pragma omp for schedule(dynamic, 64) nowait
+		for (int i = 0; i < (int)marked.size(); i++) {
+			const ISequenceCollection::value_type seq
+				= g->getSeqAndData(marked[i]);
+			if (seq.second.deleted() || !seq.second.marked())
+				continue;
+			removeSequenceAndExtensions(g, seq);
+			count++;
+			for (extDirection dir = SENSE; dir <= ANTISENSE; ++dir)
+				generateSequencesFromExtension(seq.first, dir,
+						seq.second.getExtension(dir), adj);
 		}
-		seqCollection->pumpNetwork();
+#pragma omp critical(removeMarked)
+		ends.insert(ends.end(), adj.begin(), adj.end());
+	}
+	if (count > 0)
+		logger(1) << "Removed " << count << " marked k-mer.\n";
+	return count;
+}
+
+/** Keep the specified k-mer that are endpoints or islands. */
+static void filterEnds(SequenceCollectionHash* g, vector<Kmer>& ends)
+{
+	uniqueKmers(ends);
+	vector<bool> keep(ends.size());
+#pragma omp parallel for schedule(dynamic, 64) if (g->shards() > 1)
+	for (int i = 0; i < (int)ends.size(); i++) {
+		const ISequenceCollection::value_type seq
+			= g->getSeqAndData(ends[i]);
+		extDirection dir;
+		keep[i] = !seq.second.deleted()
+			&& checkSeqContiguity(seq, dir) != SC_CONTIGUOUS;
+	}
+	vector<Kmer>::iterator out = ends.begin();
+	for (size_t i = 0; i < ends.size(); i++)
+		if (keep[i])
+			*out++ = ends[i];
+	ends.erase(out, ends.end());
+}
+
+/** Prune tips shorter than maxBranchCull. Only the specified
+ * endpoints and islands are considered, which are all those of the
+ * graph. They are updated to those of the pruned graph.
+ */
+static size_t trimSequences(SequenceCollectionHash* seqCollection,
+		unsigned maxBranchCull, vector<Kmer>& ends)
+{
+	Timer timer("TrimSequences");
+	cout << "Pruning tips shorter than "
+		<< maxBranchCull << " bp...\n";
+	size_t numBranchesRemoved = 0;
+
+	SequenceCollectionHash* g = seqCollection;
+	vector<Kmer> marked;
+#pragma omp parallel reduction(+: numBranchesRemoved) \
+	if (g->shards() > 1)
+	{
+		vector<Kmer> found;
+#pragma omp for schedule(dynamic, 64) nowait
+		for (int i = 0; i < (int)ends.size(); i++)
+			numBranchesRemoved += trimSequence(g,
+					g->getSeqAndData(ends[i]), maxBranchCull, found);
+#pragma omp critical(trimSequences)
+		marked.insert(marked.end(), found.begin(), found.end());
 	}
+	uniqueKmers(marked);
 
-	size_t numSweeped = removeMarked(seqCollection);
+	size_t numSweeped = removeMarked(g, marked, ends);
+	filterEnds(g, ends);
 
 	if (numBranchesRemoved > 0)
 		logger(0) << "Pruned " << numSweeped << " k-mer in "
@@ -811,6 +1898,18 @@ bool processTerminatedBranchTrim(ISequenceCollection* seqCollection,
 		return false;
 }
 
+/** Remove the specified k-mer if it is marked.
+ * @return the number of removed k-mer, zero or one
+ */
+static size_t removeMarked(ISequenceCollection* pSC,
+		const ISequenceCollection::value_type& seq)
+{
+	if (seq.second.deleted() || !seq.second.marked())
+		return 0;
+	removeSequenceAndExtensions(pSC, seq);
+	return 1;
+}
+
 /** Remove all marked k-mer.
  * @return the number of removed k-mer
  */
@@ -820,12 +1919,7 @@ size_t removeMarked(ISequenceCollection* pSC)
 	size_t count = 0;
 	for (ISequenceCollection::iterator it = pSC->begin();
 			it != pSC->end(); ++it) {
-		if (it->second.deleted())
-			continue;
-		if (it->second.marked()) {
-			removeSequenceAndExtensions(pSC, *it);
-			count++;
-		}
+		count += removeMarked(pSC, *it);
 		pSC->pumpNetwork();
 	}
 	if (count > 0)
@@ -833,6 +1927,20 @@ size_t removeMarked(ISequenceCollection* pSC)
 	return count;
 }
 
+/** Orient a contig so that its sequence is not greater than its
+ * reverse complement. The orientation in which a k-mer is stored
+ * depends on which of its two strands was loaded first, which
+ * depends on the number of threads and processes.
+ */
+static void canonicalizeContig(Sequence& contig)
+{
+	if (opt::ss)
+		return;
+	Sequence rc = reverseComplement(contig);
+	if (rc < contig)
+		contig.swap(rc);
+}
+
 /** Assemble a contig.
  * @return the number of k-mer below the coverage threshold
  */
@@ -847,6 +1955,7 @@ size_t assembleContig(
 
 	// Assemble the contig.
 	Sequence contig(branch);
+	canonicalizeContig(contig);
 
 	size_t kmerCount = branch.calculateBranchMultiplicity();
 	if (writer != NULL)
@@ -863,14 +1972,44 @@ size_t assembleContig(
 	return 0;
 }
 
+/** Extend a contig from the specified endpoint until it ends. */
+static void extendContig(SequenceCollectionHash* seqCollection,
+		const ISequenceCollection::value_type& seq,
+		BranchRecord& branch)
+{
+	branch.push_back(seq);
+	Kmer currSeq = seq.first;
+	extendBranch(branch, currSeq,
+			seq.second.getExtension(branch.getDirection()));
+	assert(branch.isActive());
+	while (branch.isActive()) {
+		ExtensionRecord extRec;
+		int multiplicity = -1;
+		bool success = seqCollection->getSeqData(
+				currSeq, extRec, multiplicity);
+		assert(success);
+		(void)success;
+		processLinearExtensionForBranch(branch,
+				currSeq, extRec, multiplicity, UINT_MAX);
+	}
+}
+
+/** Return whether a contig is output when it is extended from the
+ * first k-mer of the specified branch. A contig is extended from
+ * both of its ends, and it is output from only one of them.
+ */
+static bool isOutputEnd(const BranchRecord& branch)
+{
+	return opt::ss ? branch.getDirection() == SENSE
+		: branch.isCanonical();
+}
+
 /** Assemble contigs.
  * @return the number of contigs assembled
  */
-size_t assemble(SequenceCollectionHash* seqCollection,
+static size_t assembleSerial(SequenceCollectionHash* seqCollection,
 		FastaWriter* fileWriter)
 {
-	Timer timer("Assemble");
-
 	size_t kmerCount = 0;
 	unsigned contigID = 0;
 	size_t assembledKmer = 0;
@@ -904,25 +2043,9 @@ size_t assemble(SequenceCollectionHash* seqCollection,
 		assert(status == SC_ENDPOINT);
 
 		BranchRecord currBranch(dir);
-		currBranch.push_back(*iter);
-		Kmer currSeq = iter->first;
-		extendBranch(currBranch, currSeq,
-				iter->second.getExtension(dir));
-		assert(currBranch.isActive());
-		while(currBranch.isActive())
-		{
-			ExtensionRecord extRec;
-			int multiplicity = -1;
-			bool success = seqCollection->getSeqData(
-					currSeq, extRec, multiplicity);
-			assert(success);
-			(void)success;
-			processLinearExtensionForBranch(currBranch,
-					currSeq, extRec, multiplicity, UINT_MAX);
-		}
+		extendContig(seqCollection, *iter, currBranch);
 
-		if ((opt::ss && currBranch.getDirection() == SENSE)
-				|| (!opt::ss && currBranch.isCanonical())) {
+		if (isOutputEnd(currBranch)) {
 			size_t removed = assembleContig(seqCollection,
 					fileWriter, currBranch, contigID++);
 			assembledKmer += currBranch.size();
@@ -952,6 +2075,174 @@ size_t assemble(SequenceCollectionHash* seqCollection,
 	return contigID;
 }
 
+/** A contig and its k-mer coverage. */
+struct AssembledContig
+{
+	Sequence seq;
+	unsigned kmerCount;
+
+	AssembledContig(const Sequence& seq, unsigned kmerCount)
+		: seq(seq), kmerCount(kmerCount) { }
+
+	bool operator<(const AssembledContig& o) const
+	{
+		return seq < o.seq;
+	}
+};
+
+/** Return the contig of the specified branch as it is output when it
+ * is extended from its last k-mer.
+ * @param[out] contig the contig
+ * @return whether the contig is output from its last k-mer
+ */
+static bool contigFromOtherEnd(SequenceCollectionHash* g,
+		const BranchRecord& branch, Sequence& contig)
+{
+	const Kmer& last = branch.back().first;
+	if (opt::ss) {
+		// The branch extended from the last k-mer is the same
+		// contig extended in the opposite direction.
+		contig = branch;
+		return true;
+	}
+	if (!opt::colourSpace && last != reverseComplement(last)) {
+		// The contig extended from the last k-mer is the same
+		// contig, which is oriented when it is output.
+		contig = branch;
+		return true;
+	}
+
+	// Extend the contig from the last k-mer.
+	ISequenceCollection::value_type seq = g->getSeqAndData(last);
+	extDirection dir;
+	SeqContiguity status = checkSeqContiguity(seq, dir, true);
+	assert(status == SC_ENDPOINT);
+	(void)status;
+	BranchRecord other(dir);
+	extendContig(g, seq, other);
+	if (!isOutputEnd(other))
+		return false;
+	contig = other;
+	return true;
+}
+
+/** Assemble contigs, processing the shards in parallel. A thread
+ * claims the endpoint from which it extends a contig, and the
+ * endpoint at which the contig ends, so that each contig is usually
+ * extended only once. The contigs are numbered in the order of their
+ * sequence, which does not depend on the number of threads.
+ * @return the number of contigs assembled
+ */
+static size_t assembleParallel(SequenceCollectionHash* g,
+		FastaWriter* fileWriter)
+{
+	size_t kmerCount = 0;
+	size_t assembledKmer = 0;
+	size_t lowCoverageKmer = 0;
+	size_t lowCoverageContigs = 0;
+	size_t numContigs = 0;
+	vector<AssembledContig> contigs;
+
+#pragma omp parallel reduction(+: kmerCount, assembledKmer, \
+		lowCoverageKmer, lowCoverageContigs, numContigs)
+	{
+		vector<AssembledContig> found;
+#pragma omp for schedule(dynamic) nowait
+		for (int shard = 0; shard < (int)g->shards(); shard++) {
+			for (ISequenceCollection::iterator it = g->begin(shard);
+					it != g->end(shard); ++it) {
+				const ISequenceCollection::value_type seq
+					= g->get(shard, it);
+				if (seq.second.deleted())
+					continue;
+				kmerCount++;
+
+				extDirection dir;
+				SeqContiguity status
+					= checkSeqContiguity(seq, dir, true);
+				if (status == SC_CONTIGUOUS)
+					continue;
+
+				BranchRecord branch(SENSE);
+				Sequence contig;
+				if (status == SC_ISLAND) {
+					branch.push_back(seq);
+					branch.terminate(BS_NOEXT);
+					contig = branch;
+				} else {
+					assert(status == SC_ENDPOINT);
+					if (g->testAndSetFlag(seq.first, SF_CLAIMED))
+						continue;
+					branch = BranchRecord(dir);
+					extendContig(g, seq, branch);
+					if (isOutputEnd(branch))
+						contig = branch;
+					else if (g->testAndSetFlag(branch.back().first,
+								SF_CLAIMED)
+							|| !contigFromOtherEnd(g, branch, contig))
+						continue;
+				}
+
+				numContigs++;
+				assembledKmer += branch.size();
+				size_t coverage = branch.calculateBranchMultiplicity();
+				if (fileWriter != NULL) {
+					canonicalizeContig(contig);
+					found.push_back(AssembledContig(contig, coverage));
+				}
+
+				// Remove low-coverage contigs.
+				if (opt::coverage > 0 && (float)coverage
+						/ branch.size() < opt::coverage) {
+					for (BranchRecord::iterator it = branch.begin();
+							it != branch.end(); ++it)
+						g->remove(it->first);
+					lowCoverageContigs++;
+					lowCoverageKmer += branch.size();
+				}
+			}
+		}
+#pragma omp critical(assemble)
+		contigs.insert(contigs.end(), found.begin(), found.end());
+	}
+	g->wipeFlag(SF_CLAIMED);
+
+	if (fileWriter != NULL) {
+		sort(contigs.begin(), contigs.end());
+		for (size_t i = 0; i < contigs.size(); i++)
+			fileWriter->WriteSequence(contigs[i].seq, i,
+					contigs[i].kmerCount);
+	}
+
+	if (opt::coverage > 0) {
+		cout << "Found " << assembledKmer << " k-mer in " << numContigs
+			<< " contigs before removing low-coverage contigs.\n"
+			"Removed " << lowCoverageKmer << " k-mer in "
+				<< lowCoverageContigs << " low-coverage contigs.\n";
+	} else {
+		assert(assembledKmer <= kmerCount);
+		size_t circularKmer = kmerCount - assembledKmer;
+		if (circularKmer > 0)
+			cout << "Left " << circularKmer
+				<< " unassembled k-mer in circular contigs.\n";
+		cout << "Assembled " << assembledKmer << " k-mer in "
+			<< numContigs << " contigs.\n";
+	}
+	return numContigs;
+}
+
+/** Assemble contigs.
+ * @return the number of contigs assembled
+ */
+size_t assemble(SequenceCollectionHash* seqCollection,
+		FastaWriter* fileWriter)
+{
+	Timer timer("Assemble");
+	return seqCollection->shards() > 1
+		? assembleParallel(seqCollection, fileWriter)
+		: assembleSerial(seqCollection, fileWriter);
+}
+
 /** Return the k-mer coverage histogram. */
 Histogram coverageHistogram(const ISequenceCollection& c)
 {
@@ -25,17 +25,32 @@ namespace AssemblyAlgorithms
 // Read a sequence file and load them into the collection
 void loadSequences(ISequenceCollection* seqCollection,
 		std::string inFile);
+void loadSequences(SequenceCollectionHash* seqCollection,
+		std::string inFile);
+void loadSequences(ISequenceCollection* seqCollection,
+		std::string inFile, unsigned section, unsigned nsections);
+void loadSolidSequences(SequenceCollectionHash* seqCollection,
+		const std::vector<std::string>& inFiles);
+void loadPartitionedSequences(SequenceCollectionHash* seqCollection,
+		const std::vector<std::string>& inFiles);
+
+size_t addAdjacency(ISequenceCollection* seqCollection,
+		const Kmer& kmer);
+
+uint64_t minimizerHash(const Kmer& kmer);
 
 /** Generate the adjacency information for all the sequences in the
  * collection. This is required before any other algorithm can run.
  */
 void generateAdjacency(ISequenceCollection* seqCollection);
+void generateAdjacency(SequenceCollectionHash* seqCollection);
 
 Histogram coverageHistogram(const ISequenceCollection& c);
 void setCoverageParameters(const Histogram& h);
 
 /* Erosion. Remove k-mer from the ends of blunt contigs. */
 size_t erodeEnds(ISequenceCollection* seqCollection);
+size_t erodeEnds(SequenceCollectionHash* seqCollection);
 size_t erode(ISequenceCollection* c,
 		const ISequenceCollection::value_type& seq);
 size_t getNumEroded();
@@ -80,7 +95,9 @@ void collapseJoinedBranches(
  * generating redundant/wrong contigs.
  */
 size_t markAmbiguous(ISequenceCollection* seqCollection);
+size_t markAmbiguous(SequenceCollectionHash* seqCollection);
 size_t splitAmbiguous(ISequenceCollection* seqCollection);
+size_t splitAmbiguous(SequenceCollectionHash* seqCollection);
 
 size_t assembleContig(ISequenceCollection* seqCollection,
 		FastaWriter* writer, BranchRecord& branch, unsigned id);
@@ -81,6 +81,6 @@ bool BranchGroup::isAmbiguous(const SequenceCollectionHash& g) const
 {
 	// Get fresh data from the collection to check that this bubble
 	// does in fact still exist.
-	const KmerData& data = g.getSeqAndData(m_origin).second;
+	const KmerData data = g.getSeqAndData(m_origin).second;
 	return data.deleted() ? false : data.isAmbiguous(m_dir);
 }
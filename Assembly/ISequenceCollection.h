@@ -5,7 +5,10 @@
 #include "Kmer.h"
 #include "KmerData.h"
 
-#if HAVE_GOOGLE_SPARSE_HASH_MAP
+#if ENABLE_COMPACT_TABLE
+# include "KmerTable.h"
+typedef KmerTable SequenceDataHash;
+#elif HAVE_GOOGLE_SPARSE_HASH_MAP
 # include <google/sparse_hash_map>
 typedef google::sparse_hash_map<Kmer, KmerData, hash<Kmer> >
 	SequenceDataHash;
@@ -14,14 +17,90 @@ typedef google::sparse_hash_map<Kmer, KmerData, hash<Kmer> >
 typedef unordered_map<Kmer, KmerData, hash<Kmer> >
 	SequenceDataHash;
 #endif
+#include <iterator>
+
+/** An iterator over the elements of a contiguous array of maps, such
+ * as the shards of a SequenceCollectionHash.
+ * @param Map the type of the maps
+ * @param It the type of the iterator of a map
+ */
+template <typename Map, typename It>
+class ShardIterator
+{
+	template <typename, typename> friend class ShardIterator;
+
+  public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef typename std::iterator_traits<It>::value_type value_type;
+	typedef typename std::iterator_traits<It>::difference_type
+		difference_type;
+	typedef typename std::iterator_traits<It>::pointer pointer;
+	typedef typename std::iterator_traits<It>::reference reference;
+
+	ShardIterator() : m_map(NULL), m_last(NULL) { }
+
+	/** Construct an iterator pointing at it in the map *map, which
+	 * is followed by the maps up to and including *last. */
+	ShardIterator(Map* map, Map* last, const It& it)
+		: m_map(map), m_last(last), m_it(it)
+	{
+		skipEmpty();
+	}
+
+	/** Convert an iterator to a const_iterator. */
+	template <typename Map2, typename It2>
+	ShardIterator(const ShardIterator<Map2, It2>& o)
+		: m_map(o.m_map), m_last(o.m_last), m_it(o.m_it) { }
+
+	reference operator*() const { return *m_it; }
+	pointer operator->() const { return &*m_it; }
+
+	bool operator==(const ShardIterator& o) const
+	{
+		return m_map == o.m_map && m_it == o.m_it;
+	}
+
+	bool operator!=(const ShardIterator& o) const
+	{
+		return !(*this == o);
+	}
+
+	ShardIterator& operator++()
+	{
+		++m_it;
+		skipEmpty();
+		return *this;
+	}
+
+	ShardIterator operator++(int)
+	{
+		ShardIterator it = *this;
+		++*this;
+		return it;
+	}
+
+  private:
+	/** Skip past the end of any map except the last. */
+	void skipEmpty()
+	{
+		while (m_map != m_last && m_it == m_map->end())
+			m_it = (++m_map)->begin();
+	}
+
+	Map* m_map;
+	Map* m_last;
+	It m_it;
+};
 
 /** The interface of a map of Kmer to KmerData. */
 class ISequenceCollection
 {
 	public:
 		typedef SequenceDataHash::value_type value_type;
-		typedef SequenceDataHash::iterator iterator;
-		typedef SequenceDataHash::const_iterator const_iterator;
+		typedef ShardIterator<SequenceDataHash,
+				SequenceDataHash::iterator> iterator;
+		typedef ShardIterator<const SequenceDataHash,
+				SequenceDataHash::const_iterator> const_iterator;
 
 		virtual ~ISequenceCollection() { }
 
@@ -12,6 +12,7 @@ enum SeqFlag
 	SF_MARK_SENSE = 0x1,
 	SF_MARK_ANTISENSE = 0x2,
 	SF_DELETE = 0x4,
+	SF_CLAIMED = 0x8,
 };
 
 static inline SeqFlag complement(SeqFlag flag)
@@ -23,6 +24,8 @@ static inline SeqFlag complement(SeqFlag flag)
 		out |= SF_MARK_SENSE;
 	if (flag & SF_DELETE)
 		out |= SF_DELETE;
+	if (flag & SF_CLAIMED)
+		out |= SF_CLAIMED;
 	return SeqFlag(out);
 }
 
@@ -161,6 +164,8 @@ class KmerData
 	}
 
   protected:
+	friend class KmerTable;
+
 	uint8_t m_flags;
 	uint16_t m_multiplicity[2];
 	ExtensionRecord m_ext;
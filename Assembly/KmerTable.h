@@ -0,0 +1,482 @@
+#ifndef KMERTABLE_H
+#define KMERTABLE_H 1
+
+#include "Kmer.h"
+#include "KmerData.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring> // for memcmp, memcpy, memset
+#include <iterator>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** A compact map of Kmer to KmerData using open addressing with
+ * linear probing. The k-mer are packed densely using Kmer::bytes()
+ * bytes each, and the coverage, edges and flags of each k-mer are
+ * stored in parallel arrays, which uses k/4 + 6 bytes per bucket.
+ *
+ * An iterator returns a copy of the k-mer and its data. The data of
+ * a k-mer is modified by calling setData. An erased k-mer leaves a
+ * tombstone, which is removed when the table is rehashed.
+ *
+ * The arrays are held in a single block of memory, which is either
+ * owned by the table or attached to it, for example a file mapped
+ * into memory. An attached table is used in place until it grows.
+ */
+class KmerTable
+{
+  public:
+	typedef Kmer key_type;
+	typedef KmerData mapped_type;
+	typedef std::pair<Kmer, KmerData> value_type;
+	typedef size_t size_type;
+
+  private:
+	template <typename> friend class Iterator;
+
+	/** The state of a bucket, stored in the high bits of its flags.
+	 */
+	enum {
+		FULL = 0x40,
+		ERASED = 0x80,
+		STATE = FULL | ERASED,
+	};
+
+	/** An iterator over the k-mer of a table. */
+	template <typename Table>
+	class Iterator
+	{
+		template <typename> friend class Iterator;
+		friend class KmerTable;
+
+	  public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef KmerTable::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const value_type* pointer;
+		typedef const value_type& reference;
+
+		Iterator() : m_table(NULL), m_i(0) { }
+
+		Iterator(Table* table, size_t i) : m_table(table), m_i(i)
+		{
+			skip();
+		}
+
+		/** Convert an iterator to a const_iterator. */
+		template <typename Table2>
+		Iterator(const Iterator<Table2>& o)
+			: m_table(o.m_table), m_i(o.m_i) { }
+
+		const value_type& operator*() const
+		{
+			m_table->get(m_i, m_value);
+			return m_value;
+		}
+
+		const value_type* operator->() const { return &**this; }
+
+		bool operator==(const Iterator& o) const
+		{
+			return m_i == o.m_i;
+		}
+
+		bool operator!=(const Iterator& o) const
+		{
+			return m_i != o.m_i;
+		}
+
+		Iterator& operator++()
+		{
+			++m_i;
+			skip();
+			return *this;
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator it = *this;
+			++*this;
+			return it;
+		}
+
+	  private:
+		/** Skip to the next full bucket. */
+		void skip()
+		{
+			size_t n = m_table->bucket_count();
+			while (m_i < n && !m_table->full(m_i))
+				++m_i;
+		}
+
+		Table* m_table;
+		size_t m_i;
+		mutable value_type m_value;
+	};
+
+  public:
+	typedef Iterator<KmerTable> iterator;
+	typedef Iterator<const KmerTable> const_iterator;
+
+	KmerTable()
+		: m_bytes(Kmer::bytes()), m_buckets(0), m_size(0), m_erased(0),
+		m_maxLoad(0.9), m_data(NULL)
+	{
+		setArrays();
+	}
+
+	KmerTable(const KmerTable& o)
+		: m_bytes(o.m_bytes), m_buckets(o.m_buckets), m_size(o.m_size),
+		m_erased(o.m_erased), m_maxLoad(o.m_maxLoad),
+		m_buffer(o.m_buffer),
+		m_data(o.attached() ? o.m_data : bufferData())
+	{
+		setArrays();
+	}
+
+	KmerTable& operator=(const KmerTable& o)
+	{
+		KmerTable t(o);
+		swap(t);
+		return *this;
+	}
+
+	/** Return the number of k-mer in this table. */
+	size_t size() const { return m_size; }
+
+	/** Return whether this table is empty. */
+	bool empty() const { return m_size == 0; }
+
+	/** Return the number of buckets. */
+	size_t bucket_count() const { return m_buckets; }
+
+	/** Return the number of bytes used by this table. */
+	size_t memory() const
+	{
+		return arrayBytes(m_buckets, m_bytes);
+	}
+
+	/** Return the number of bytes of the arrays of a table of n
+	 * buckets of k-mer of the specified number of bytes. */
+	static size_t arrayBytes(size_t n, unsigned bytes)
+	{
+		return n * (2 * sizeof (uint16_t) + bytes + 2);
+	}
+
+	/** Return the block of memory that holds the arrays of this
+	 * table, which is memory() bytes. */
+	const char* data() const { return m_data; }
+
+	/** Return whether the arrays of this table are attached rather
+	 * than owned. */
+	bool attached() const { return m_data != bufferData(); }
+
+	/** Use the arrays of a table of n buckets and size k-mer held in
+	 * the specified block of memory, which is memory() bytes, rather
+	 * than a copy of them. The memory must be writable, be aligned
+	 * to two bytes, and outlive its use by this table.
+	 */
+	void attach(char* p, size_t n, size_t size)
+	{
+		assert(size < n);
+		std::vector<uint64_t>().swap(m_buffer);
+		m_bytes = Kmer::bytes();
+		m_buckets = n;
+		m_size = size;
+		m_erased = 0;
+		m_data = p;
+		setArrays();
+	}
+
+	/** Set the maximum load factor. */
+	void max_load_factor(float x)
+	{
+		assert(x > 0 && x < 1);
+		m_maxLoad = x;
+	}
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_buckets); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const
+	{
+		return const_iterator(this, m_buckets);
+	}
+
+	/** Return an iterator pointing to the specified k-mer. */
+	iterator find(const Kmer& key)
+	{
+		return iterator(this, findBucket(key));
+	}
+
+	/** Return an iterator pointing to the specified k-mer. */
+	const_iterator find(const Kmer& key) const
+	{
+		return const_iterator(this, findBucket(key));
+	}
+
+	/** Insert the specified k-mer if it is not present.
+	 * @return an iterator to the k-mer and whether it was inserted
+	 */
+	std::pair<iterator, bool> insert(const value_type& x)
+	{
+		if (m_size + m_erased + 1 > m_maxLoad * m_buckets)
+			resize((size_t)((m_size + 1) / growLoad()) + 1);
+		size_t i = bucket(x.first);
+		size_t tombstone = m_buckets;
+		for (; m_flags[i] & STATE; i = next(i)) {
+			if (m_flags[i] & ERASED) {
+				if (tombstone == m_buckets)
+					tombstone = i;
+			} else if (equal(i, x.first))
+				return std::make_pair(iterator(this, i), false);
+		}
+		if (tombstone < m_buckets) {
+			i = tombstone;
+			m_erased--;
+		}
+		set(i, x.first);
+		setData(i, x.second);
+		m_size++;
+		return std::make_pair(iterator(this, i), true);
+	}
+
+	/** Erase the k-mer at the specified position. */
+	void erase(const iterator& it)
+	{
+		assert(full(it.m_i));
+		m_flags[it.m_i] = ERASED;
+		m_size--;
+		m_erased++;
+	}
+
+	/** Set the data of the k-mer at the specified position. */
+	void setData(const iterator& it, const KmerData& data)
+	{
+		assert(full(it.m_i));
+		setData(it.m_i, data);
+	}
+
+	/** Resize this table to at least n buckets and at least as many
+	 * buckets as needed to hold its k-mer at a load factor of
+	 * shrinkLoad(), and remove any tombstones.
+	 */
+	void rehash(size_t n)
+	{
+		size_t min = (size_t)(m_size / shrinkLoad()) + 1;
+		n = std::max(n, min);
+		if (n != m_buckets || m_erased > 0)
+			resize(n);
+	}
+
+  private:
+	/** Return the load factor of a table after it grows. */
+	static float growLoad() { return 0.7; }
+
+	/** Return the load factor of a table after it is shrunk. */
+	static float shrinkLoad() { return 0.85; }
+
+	/** Return the first bucket of the specified k-mer. */
+	size_t bucket(const Kmer& key) const
+	{
+		return hash<Kmer>()(key) % m_buckets;
+	}
+
+	/** Return the bucket following the specified bucket. */
+	size_t next(size_t i) const
+	{
+		return ++i == m_buckets ? 0 : i;
+	}
+
+	/** Return whether the specified bucket contains a k-mer. */
+	bool full(size_t i) const
+	{
+		return (m_flags[i] & STATE) == FULL;
+	}
+
+	/** Return the packed bases of the specified k-mer. The bases of
+	 * a Kmer are its only member. */
+	static const char* bases(const Kmer& kmer)
+	{
+		return reinterpret_cast<const char*>(&kmer);
+	}
+
+	/** Return the packed bases of the specified k-mer. */
+	static char* bases(Kmer& kmer)
+	{
+		return reinterpret_cast<char*>(&kmer);
+	}
+
+	/** Return whether the specified bucket holds the specified k-mer.
+	 */
+	bool equal(size_t i, const Kmer& key) const
+	{
+		return memcmp(m_keys + i * m_bytes, bases(key), m_bytes) == 0;
+	}
+
+	/** Return the bucket of the specified k-mer or bucket_count()
+	 * if it is not present. */
+	size_t findBucket(const Kmer& key) const
+	{
+		if (m_size == 0)
+			return m_buckets;
+		for (size_t i = bucket(key); m_flags[i] & STATE; i = next(i))
+			if (full(i) && equal(i, key))
+				return i;
+		return m_buckets;
+	}
+
+	/** Store the specified k-mer in the specified empty bucket. */
+	void set(size_t i, const Kmer& key)
+	{
+		memcpy(m_keys + i * m_bytes, bases(key), m_bytes);
+		m_flags[i] = FULL;
+	}
+
+	/** Store the data of the k-mer in the specified bucket. */
+	void setData(size_t i, const KmerData& data)
+	{
+		assert((data.m_flags & STATE) == 0);
+		m_flags[i] = FULL | data.m_flags;
+		m_ext[i] = data.m_ext.dir[SENSE].bits()
+			| data.m_ext.dir[ANTISENSE].bits() << 4;
+		m_multiplicity[2*i] = data.m_multiplicity[SENSE];
+		m_multiplicity[2*i + 1] = data.m_multiplicity[ANTISENSE];
+	}
+
+	/** Retrieve the k-mer of the specified bucket into kmer. */
+	void getKey(size_t i, Kmer& kmer) const
+	{
+		char* p = bases(kmer);
+		memcpy(p, m_keys + i * m_bytes, m_bytes);
+		memset(p + m_bytes, 0, sizeof kmer - m_bytes);
+	}
+
+	/** Return the k-mer of the specified bucket. */
+	Kmer key(size_t i) const
+	{
+		Kmer kmer;
+		getKey(i, kmer);
+		return kmer;
+	}
+
+	/** Retrieve the k-mer and data of the specified bucket. */
+	void get(size_t i, value_type& x) const
+	{
+		assert(full(i));
+		getKey(i, x.first);
+		KmerData& data = x.second;
+		data.m_flags = m_flags[i] & ~STATE;
+		data.m_ext.dir[SENSE] = SeqExt::mask(m_ext[i] & 0xf);
+		data.m_ext.dir[ANTISENSE] = SeqExt::mask(m_ext[i] >> 4);
+		data.m_multiplicity[SENSE] = m_multiplicity[2*i];
+		data.m_multiplicity[ANTISENSE] = m_multiplicity[2*i + 1];
+	}
+
+	/** Move the k-mer of this table to a table of n buckets. */
+	void resize(size_t n)
+	{
+		assert(n > m_size);
+		KmerTable t;
+		t.m_bytes = m_bytes;
+		t.m_maxLoad = m_maxLoad;
+		t.m_buckets = n;
+		t.m_buffer.resize((arrayBytes(n, m_bytes) + 7) / 8);
+		t.m_data = t.bufferData();
+		t.setArrays();
+		for (size_t i = 0; i < m_buckets; i++) {
+			if (!full(i))
+				continue;
+			size_t j = t.bucket(key(i));
+			while (t.m_flags[j] & STATE)
+				j = t.next(j);
+			memcpy(t.m_keys + j * m_bytes, m_keys + i * m_bytes,
+					m_bytes);
+			t.m_flags[j] = m_flags[i];
+			t.m_ext[j] = m_ext[i];
+			t.m_multiplicity[2*j] = m_multiplicity[2*i];
+			t.m_multiplicity[2*j + 1] = m_multiplicity[2*i + 1];
+		}
+		t.m_size = m_size;
+		swap(t);
+	}
+
+	/** Swap the contents of two tables. */
+	void swap(KmerTable& o)
+	{
+		std::swap(m_bytes, o.m_bytes);
+		std::swap(m_buckets, o.m_buckets);
+		std::swap(m_size, o.m_size);
+		std::swap(m_erased, o.m_erased);
+		std::swap(m_maxLoad, o.m_maxLoad);
+		std::swap(m_data, o.m_data);
+		m_buffer.swap(o.m_buffer);
+		setArrays();
+		o.setArrays();
+	}
+
+	/** Return the memory of the buffer owned by this table. */
+	char* bufferData()
+	{
+		return m_buffer.empty() ? NULL
+			: reinterpret_cast<char*>(&m_buffer[0]);
+	}
+
+	/** Return the memory of the buffer owned by this table. */
+	const char* bufferData() const
+	{
+		return m_buffer.empty() ? NULL
+			: reinterpret_cast<const char*>(&m_buffer[0]);
+	}
+
+	/** Point the arrays at the block of memory of this table. The
+	 * multiplicity array is first, so that it is aligned. */
+	void setArrays()
+	{
+		m_multiplicity = reinterpret_cast<uint16_t*>(m_data);
+		m_keys = m_data + 2 * sizeof (uint16_t) * m_buckets;
+		m_flags = reinterpret_cast<uint8_t*>(
+				m_keys + m_bytes * m_buckets);
+		m_ext = m_flags + m_buckets;
+	}
+
+	/** The number of bytes of a packed k-mer. */
+	unsigned m_bytes;
+
+	/** The number of buckets. */
+	size_t m_buckets;
+
+	/** The number of k-mer. */
+	size_t m_size;
+
+	/** The number of tombstones. */
+	size_t m_erased;
+
+	/** The load factor, including tombstones, at which the table
+	 * grows. */
+	float m_maxLoad;
+
+	/** The memory owned by this table, or empty if its arrays are
+	 * attached. */
+	std::vector<uint64_t> m_buffer;
+
+	/** The block of memory that holds the arrays. */
+	char* m_data;
+
+	/** The packed k-mer. */
+	char* m_keys;
+
+	/** The flags and the state of each bucket. */
+	uint8_t* m_flags;
+
+	/** The out edges in the low nibble and the in edges in the high
+	 * nibble. */
+	uint8_t* m_ext;
+
+	/** The multiplicity of each sense of each k-mer. */
+	uint16_t* m_multiplicity;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "Common/Options.h"
 #include "DataLayer/Options.h"
 #include "Kmer.h"
+#include "StringUtil.h" // for SIToBytes
 #include <algorithm>
 #include <climits> // for INT_MAX
 #include <getopt.h>
@@ -62,6 +63,10 @@ static const char USAGE_MESSAGE[] =
 "  -m, --mask-cov        do not include kmers containing masked bases in\n"
 "                        coverage calculations [experimental]\n"
 "  -s, --snp=FILE        record popped bubbles in FILE\n"
+"  -j, --threads=N       use N parallel threads [serial]. ABYSS numbers\n"
+"                        the contigs in the order of their sequence\n"
+"                        for every N. Each process of ABYSS-P uses one\n"
+"                        thread to communicate\n"
 "  -v, --verbose         display verbose output\n"
 "      --help            display this help and exit\n"
 "      --version         output version information and exit\n"
@@ -69,6 +74,46 @@ static const char USAGE_MESSAGE[] =
 " ABYSS Options: (won't work with ABYSS-P)\n"
 "\n"
 "  -g, --graph=FILE      generate a graph in dot format\n"
+"      --bloom-size=N    load only the k-mer seen at least twice,\n"
+"                        which are counted in a first pass using a\n"
+"                        cascading Bloom filter of N bytes. The size\n"
+"                        may have a suffix k, M or G [0, disabled]\n"
+"      --partition-memory=N\n"
+"                        count the k-mer out of core. The reads are\n"
+"                        partitioned by minimizer into files in\n"
+"                        $TMPDIR, and the partitions are counted using\n"
+"                        at most N bytes of memory at a time. Only the\n"
+"                        k-mer seen at least twice are loaded\n"
+"                        [0, disabled]\n"
+"\n"
+" ABYSS-P Options:\n"
+"\n"
+"      --packet-size=N   send the messages to each process in packets\n"
+"                        of at most N bytes, which may have a suffix\n"
+"                        k. With 0, the size adapts to the local cost\n"
+"                        of the sends [0, adaptive]\n"
+"      --minimizer       assign each k-mer to a process by its\n"
+"                        minimizer, so that adjacent k-mer usually\n"
+"                        belong to the same process\n"
+"      --no-minimizer    assign each k-mer to a process by its hash\n"
+"                        [default]\n"
+"      --shared-memory   send the messages to the processes of the\n"
+"                        same node through shared memory\n"
+"      --no-shared-memory  send every message using MPI [default]\n"
+"      --checkpoint-dir=DIR  store the k-mer of each process in DIR\n"
+"                        after the chosen stages, so that the\n"
+"                        assembly may be resumed. DIR is created\n"
+"                        if it does not exist\n"
+"      --checkpoint=LIST store a checkpoint after each stage of the\n"
+"                        comma-separated LIST of adjacency, trim\n"
+"                        and bubbles [adjacency,trim,bubbles]\n"
+"      --resume          resume the assembly from the checkpoint in\n"
+"                        the directory of --checkpoint-dir\n"
+"      --traffic=PREFIX  write the messages, bytes and packets of\n"
+"                        each type sent to and received from each\n"
+"                        process, and the latency of the messages,\n"
+"                        in each state to PREFIX-RANK-traffic.tsv\n"
+"                        and PREFIX-RANK-latency.tsv\n"
 "\n"
 "Report bugs to <" PACKAGE_BUGREPORT ">.\n";
 
@@ -125,9 +170,46 @@ string snpPath;
 /** input FASTA files */
 vector<string> inFiles;
 
-static const char shortopts[] = "b:c:e:E:g:k:mo:Q:q:s:t:v";
+/** The number of parallel threads, or zero to run serially without
+ * sharding the k-mer collection. */
+unsigned threads = 0;
+
+/** The size in bytes of the Bloom filter used to discard the k-mer
+ * seen only once, or zero to load every k-mer. */
+size_t bloomSize = 0;
+
+/** The memory in bytes used to count each group of partitions when
+ * counting the k-mer out of core, or zero to count them in memory. */
+size_t partitionMemory = 0;
+
+/** The size in bytes of the packets of messages sent between
+ * processes, or zero to adapt it to the network. */
+size_t packetSize = 0;
+
+/** Whether to assign each k-mer to a process by its minimizer. */
+int minimizer = 0;
+
+/** Whether to send the messages to the processes of the same node
+ * through shared memory. */
+int sharedMemory = 0;
+
+/** The directory of the checkpoints, or empty to store none. */
+string checkpointDir;
+
+/** The stages after which a checkpoint is stored. */
+string checkpointStages = "adjacency,trim,bubbles";
+
+/** Whether to resume the assembly from the last checkpoint. */
+int resume = 0;
+
+/** The prefix of the files of message traffic of each process. */
+string trafficPath;
 
-enum { OPT_HELP = 1, OPT_VERSION, COVERAGE_HIST };
+static const char shortopts[] = "b:c:e:E:g:j:k:mo:Q:q:s:t:v";
+
+enum { OPT_HELP = 1, OPT_VERSION, COVERAGE_HIST, BLOOM_SIZE,
+	PARTITION_MEMORY, PACKET_SIZE, TRAFFIC, CHECKPOINT_DIR,
+	CHECKPOINT };
 
 static const struct option longopts[] = {
 	{ "out",         required_argument, NULL, 'o' },
@@ -151,6 +233,18 @@ static const struct option longopts[] = {
 	{ "no-erode",    no_argument,       (int*)&erode, 0 },
 	{ "mask-cov",    no_argument, NULL, 'm' },
 	{ "graph",       required_argument, NULL, 'g' },
+	{ "threads",     required_argument, NULL, 'j' },
+	{ "bloom-size",  required_argument, NULL, BLOOM_SIZE },
+	{ "partition-memory", required_argument, NULL, PARTITION_MEMORY },
+	{ "packet-size", required_argument, NULL, PACKET_SIZE },
+	{ "minimizer",   no_argument,       &opt::minimizer, 1 },
+	{ "no-minimizer", no_argument,      &opt::minimizer, 0 },
+	{ "shared-memory", no_argument,     &opt::sharedMemory, 1 },
+	{ "no-shared-memory", no_argument,  &opt::sharedMemory, 0 },
+	{ "checkpoint-dir", required_argument, NULL, CHECKPOINT_DIR },
+	{ "checkpoint",  required_argument, NULL, CHECKPOINT },
+	{ "resume",      no_argument,       &opt::resume, 1 },
+	{ "traffic",     required_argument, NULL, TRAFFIC },
 	{ "snp",         required_argument, NULL, 's' },
 	{ "verbose",     no_argument,       NULL, 'v' },
 	{ "help",        no_argument,       NULL, OPT_HELP },
@@ -222,6 +316,27 @@ void parse(int argc, char* const* argv)
 			case 'g':
 				getline(arg, graphPath);
 				break;
+			case 'j':
+				arg >> threads;
+				break;
+			case BLOOM_SIZE:
+				bloomSize = SIToBytes(arg);
+				break;
+			case PARTITION_MEMORY:
+				partitionMemory = SIToBytes(arg);
+				break;
+			case PACKET_SIZE:
+				packetSize = SIToBytes(arg);
+				break;
+			case TRAFFIC:
+				getline(arg, trafficPath);
+				break;
+			case CHECKPOINT_DIR:
+				getline(arg, checkpointDir);
+				break;
+			case CHECKPOINT:
+				getline(arg, checkpointStages);
+				break;
 			case 'q':
 				arg >> opt::qualityThreshold;
 				break;
@@ -260,6 +375,15 @@ void parse(int argc, char* const* argv)
 		cerr << PROGRAM ": missing input sequence file argument\n";
 		die = true;
 	}
+	if (bloomSize > 0 && partitionMemory > 0) {
+		cerr << PROGRAM ": --bloom-size and --partition-memory "
+			"may not be used together\n";
+		die = true;
+	}
+	if (resume && checkpointDir.empty()) {
+		cerr << PROGRAM ": --resume requires --checkpoint-dir\n";
+		die = true;
+	}
 	if (die) {
 		cerr << "Try `" PROGRAM " --help' for more information.\n";
 		exit(EXIT_FAILURE);
@@ -1,6 +1,7 @@
 #ifndef ASSEMBLY_OPTIONS_H
 #define ASSEMBLY_OPTIONS_H 1
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -22,6 +23,16 @@ namespace opt {
 	extern std::string graphPath;
 	extern std::string snpPath;
 	extern std::vector<std::string> inFiles;
+	extern unsigned threads;
+	extern size_t bloomSize;
+	extern size_t partitionMemory;
+	extern size_t packetSize;
+	extern int minimizer;
+	extern int sharedMemory;
+	extern std::string checkpointDir;
+	extern std::string checkpointStages;
+	extern int resume;
+	extern std::string trafficPath;
 
 	void parse(int argc, char* const* argv);
 }
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "SequenceCollection.h"
+#include "KmerTable.h"
 #include "Log.h"
 #include "Common/Options.h"
 #include "Assembly/Options.h"
@@ -8,34 +9,94 @@
 #include "Timer.h"
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <iomanip>
+#include <iostream>
 #include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
-SequenceCollectionHash::SequenceCollectionHash()
-	: m_seqObserver(NULL), m_adjacencyLoaded(false)
+/** Set the data of the k-mer at the specified position. */
+static inline void setData(SequenceDataHash& map,
+		const SequenceDataHash::iterator& it, const KmerData& data)
 {
-#if HAVE_GOOGLE_SPARSE_HASH_MAP
+#if ENABLE_COMPACT_TABLE
+	map.setData(it, data);
+#else
+	(void)map;
+	it->second = data;
+#endif
+}
+
+SequenceCollectionHash::SequenceCollectionHash(unsigned shards)
+	: m_data(shards), m_seqObserver(NULL), m_adjacencyLoaded(false),
+	m_map(NULL), m_mapBytes(0)
+{
+	assert(shards > 0);
+	if (shards > 1)
+		m_locks.resize(shards);
+#if ENABLE_COMPACT_TABLE
+	// The compact table grows as needed.
+#elif HAVE_GOOGLE_SPARSE_HASH_MAP
 	// sparse_hash_set uses 2.67 bits per element on a 64-bit
 	// architecture and 2 bits per element on a 32-bit architecture.
 	// The number of elements is rounded up to a power of two.
-	if (opt::rank >= 0) {
-		// Make room for 200 million k-mers. Approximately 58 million
-		// 96-mers fit into 2 GB of ram, which results in a hash load
-		// of 0.216, and approximately 116 million 32-mers, which
-		// results in a hash load of 0.432.
-		m_data.rehash(200000000);
-		m_data.min_load_factor(0.2);
-	} else {
-		// Allocate a big hash for a single processor.
-		m_data.rehash(1<<29);
-		m_data.max_load_factor(0.4);
+	for (unsigned i = 0; i < shards; i++) {
+		if (opt::rank >= 0) {
+			// Make room for 200 million k-mers. Approximately 58
+			// million 96-mers fit into 2 GB of ram, which results in
+			// a hash load of 0.216, and approximately 116 million
+			// 32-mers, which results in a hash load of 0.432.
+			m_data[i].rehash(200000000 / shards);
+			m_data[i].min_load_factor(0.2);
+		} else {
+			// Allocate a big hash for a single processor.
+			m_data[i].rehash((1<<29) / shards);
+			m_data[i].max_load_factor(0.4);
+		}
 	}
 #endif
 }
 
+SequenceCollectionHash::~SequenceCollectionHash()
+{
+	if (m_map != NULL) {
+		// Release the tables that use the mapped file.
+		vector<SequenceDataHash>().swap(m_data);
+		munmap(m_map, m_mapBytes);
+	}
+}
+
+/** Return the shard of the specified k-mer, which is the same shard
+ * as that of its reverse complement. The shard is taken from the
+ * high bits of the hash, which are independent of the low bits used
+ * to select a bucket within a shard.
+ */
+unsigned SequenceCollectionHash::hashShard(const Kmer& key) const
+{
+	Kmer canonical(key);
+	if (!opt::ss)
+		canonical.canonicalize();
+	uint64_t h = canonical.getHashCode() * 0x9e3779b97f4a7c15ULL;
+	return (h >> 32) % m_data.size();
+}
+
+/** Return the number of sequences in this collection. */
+size_t SequenceCollectionHash::size() const
+{
+	size_t n = 0;
+	for (vector<SequenceDataHash>::const_iterator it = m_data.begin();
+			it != m_data.end(); ++it)
+		n += it->size();
+	return n;
+}
+
 /** sparse_hash_set requires that set_deleted_key()
  * is called before calling erase(). This key cannot
  * be an existing kmer in m_data. This function sets
@@ -44,36 +105,60 @@ SequenceCollectionHash::SequenceCollectionHash()
  */
 void SequenceCollectionHash::setDeletedKey()
 {
-#if HAVE_GOOGLE_SPARSE_HASH_MAP
-	for (SequenceDataHash::iterator it = m_data.begin();
-			it != m_data.end(); it++) {
-		Kmer rc(reverseComplement(it->first));
-		bool isrc;
-		SequenceDataHash::iterator search = find(rc, isrc);
-		// If this is false, we should have a palindrome or we're
-		// doing a SS assembly.
-		if (isrc || search == m_data.end()) {
-			m_data.set_deleted_key(rc);
-			return;
+#if HAVE_GOOGLE_SPARSE_HASH_MAP && !ENABLE_COMPACT_TABLE
+	for (vector<SequenceDataHash>::iterator shard = m_data.begin();
+			shard != m_data.end(); ++shard) {
+		bool found = shard->empty();
+		for (SequenceDataHash::iterator it = shard->begin();
+				!found && it != shard->end(); it++) {
+			Kmer rc(reverseComplement(it->first));
+			// If the reverse complement is present, we should have
+			// a palindrome or we're doing a SS assembly.
+			if (shard->find(rc) == shard->end()) {
+				shard->set_deleted_key(rc);
+				found = true;
+			}
+		}
+		if (!found) {
+			logger(1) << "error: unable to set deleted key.\n";
+			exit(EXIT_FAILURE);
 		}
 	}
-	logger(1) << "error: unable to set deleted key.\n";
-	exit(EXIT_FAILURE);
 #else
 	return;
 #endif
 }
 
+/** Copy the k-mer of the specified shard that are not deleted,
+ * holding the lock of the shard, so that the k-mer and their flags are
+ * not read while another thread modifies them.
+ */
+void SequenceCollectionHash::getKmer(unsigned shard,
+		vector<Kmer>& kmer) const
+{
+	kmer.clear();
+	ShardLock lock(*this, shard);
+	const SequenceDataHash& h = m_data[shard];
+	for (SequenceDataHash::const_iterator it = h.begin();
+			it != h.end(); ++it)
+		if (!it->second.deleted())
+			kmer.push_back(it->first);
+}
+
 /** Add the specified k-mer to this collection. */
 void SequenceCollectionHash::add(const Kmer& seq, unsigned coverage)
 {
+	unsigned shard = this->shard(seq);
+	ShardLock lock(*this, shard);
 	bool rc;
-	SequenceCollectionHash::iterator it = find(seq, rc);
-	if (it == m_data.end()) {
-		m_data.insert(make_pair(seq, KmerData(SENSE, coverage)));
+	SequenceDataHash::iterator it = find(shard, seq, rc);
+	if (it == m_data[shard].end()) {
+		m_data[shard].insert(make_pair(seq, KmerData(SENSE, coverage)));
 	} else if (coverage > 0) {
 		assert(!rc || !opt::ss);
-		it->second.addMultiplicity(rc ? ANTISENSE : SENSE, coverage);
+		KmerData data = it->second;
+		data.addMultiplicity(rc ? ANTISENSE : SENSE, coverage);
+		setData(m_data[shard], it, data);
 	}
 }
 
@@ -84,17 +169,32 @@ size_t SequenceCollectionHash::cleanup()
 {
 	Timer(__func__);
 	size_t count = 0;
-	for (iterator it = m_data.begin(); it != m_data.end();) {
-		if (it->second.deleted()) {
-			m_data.erase(it++);
-			count++;
-		} else
-			++it;
+#pragma omp parallel for schedule(dynamic) reduction(+: count) \
+	if (m_data.size() > 1)
+	for (int i = 0; i < (int)m_data.size(); i++) {
+		SequenceDataHash& shard = m_data[i];
+		for (SequenceDataHash::iterator it = shard.begin();
+				it != shard.end();) {
+			if (it->second.deleted()) {
+				shard.erase(it++);
+				count++;
+			} else
+				++it;
+		}
 	}
 	shrink();
 	return count;
 }
 
+/** Shrink the hash table. */
+void SequenceCollectionHash::shrink()
+{
+#pragma omp parallel for schedule(dynamic) if (m_data.size() > 1)
+	for (int i = 0; i < (int)m_data.size(); i++)
+		m_data[i].rehash(0);
+	printLoad();
+}
+
 /** Return the complement of the specified base.
  * If the assembly is in colour space, this is a no-op.
  */
@@ -107,97 +207,188 @@ static inline uint8_t complementBaseCode(uint8_t base)
 bool SequenceCollectionHash::setBaseExtension(
 		const Kmer& kmer, extDirection dir, uint8_t base)
 {
+	unsigned shard = this->shard(kmer);
+	ShardLock lock(*this, shard);
 	bool rc;
-	SequenceCollectionHash::iterator it = find(kmer, rc);
-	if (it == m_data.end())
+	SequenceDataHash::iterator it = find(shard, kmer, rc);
+	if (it == m_data[shard].end())
 		return false;
+	KmerData data = it->second;
 	if (opt::ss) {
 		assert(!rc);
-		it->second.setBaseExtension(dir, base);
+		data.setBaseExtension(dir, base);
 	} else {
 		bool palindrome = kmer.isPalindrome();
 		if (!rc || palindrome)
-			it->second.setBaseExtension(dir, base);
+			data.setBaseExtension(dir, base);
 		if (rc || palindrome)
-			it->second.setBaseExtension(!dir, complementBaseCode(base));
+			data.setBaseExtension(!dir, complementBaseCode(base));
 	}
+	setData(m_data[shard], it, data);
 	return true;
 }
 
-/** Remove the specified extensions from this k-mer. */
+/** Remove the specified extensions from this k-mer.
+ * The observer is called with a copy of the k-mer and its data after
+ * the lock of its shard is released.
+ */
 void SequenceCollectionHash::removeExtension(const Kmer& kmer,
 		extDirection dir, SeqExt ext)
 {
+	unsigned shard = this->shard(kmer);
+	lock(shard);
 	bool rc;
-	SequenceCollectionHash::iterator it = find(kmer, rc);
-	assert(it != m_data.end());
+	SequenceDataHash::iterator it = find(shard, kmer, rc);
+	assert(it != m_data[shard].end());
+	KmerData data = it->second;
 	if (opt::ss) {
 		assert(!rc);
-		it->second.removeExtension(dir, ext);
+		data.removeExtension(dir, ext);
 	} else {
 		bool palindrome = kmer.isPalindrome();
 		if (!rc || palindrome)
-			it->second.removeExtension(dir, ext);
+			data.removeExtension(dir, ext);
 		if (rc || palindrome)
-			it->second.removeExtension(!dir, ~ext);
+			data.removeExtension(!dir, ~ext);
+	}
+	setData(m_data[shard], it, data);
+	if (m_seqObserver == NULL) {
+		unlock(shard);
+		return;
 	}
-	notify(*it);
+	value_type seq(it->first, data);
+	unlock(shard);
+	notify(seq);
 }
 
 void SequenceCollectionHash::setFlag(const Kmer& key, SeqFlag flag)
 {
+	unsigned shard = this->shard(key);
+	ShardLock lock(*this, shard);
+	bool rc;
+	SequenceDataHash::iterator it = find(shard, key, rc);
+	assert(it != m_data[shard].end());
+	KmerData data = it->second;
+	data.setFlag(rc ? complement(flag) : flag);
+	setData(m_data[shard], it, data);
+}
+
+bool SequenceCollectionHash::testAndSetFlag(const Kmer& key,
+		SeqFlag flag)
+{
+	unsigned shard = this->shard(key);
+	ShardLock lock(*this, shard);
 	bool rc;
-	SequenceCollectionHash::iterator it = find(key, rc);
-	assert(it != m_data.end());
-	it->second.setFlag(rc ? complement(flag) : flag);
+	SequenceDataHash::iterator it = find(shard, key, rc);
+	assert(it != m_data[shard].end());
+	if (rc)
+		flag = complement(flag);
+	KmerData data = it->second;
+	if (data.isFlagSet(flag))
+		return true;
+	data.setFlag(flag);
+	setData(m_data[shard], it, data);
+	return false;
 }
 
 void SequenceCollectionHash::wipeFlag(SeqFlag flag)
 {
-	for (SequenceCollectionHash::iterator it = m_data.begin();
+#pragma omp parallel for schedule(dynamic) if (m_data.size() > 1)
+	for (int i = 0; i < (int)m_data.size(); i++) {
+		for (SequenceDataHash::iterator it = m_data[i].begin();
+				it != m_data[i].end(); ++it) {
+			KmerData data = it->second;
+			data.clearFlag(flag);
+			setData(m_data[i], it, data);
+		}
+	}
+}
+
+/** Return the number of bytes used by the specified hash table.
+ * The memory used by sparsehash and unordered_map is estimated from
+ * the size of their elements and buckets.
+ */
+static size_t memory(const SequenceDataHash& h)
+{
+#if ENABLE_COMPACT_TABLE
+	return h.memory();
+#elif HAVE_GOOGLE_SPARSE_HASH_MAP
+	// A group of 48 buckets uses a 6-byte bitmap, a pointer and a
+	// count, which is 2.67 bits per bucket on a 64-bit architecture.
+	return h.size() * sizeof (SequenceDataHash::value_type)
+		+ h.bucket_count() * 16 / 48;
+#else
+	// Each node holds a next pointer and the hash value.
+	return h.size() * (sizeof (SequenceDataHash::value_type)
+			+ sizeof (void*) + sizeof (size_t))
+		+ h.bucket_count() * sizeof (void*);
+#endif
+}
+
+/** Return the estimated memory used by the k-mer of this collection
+ * in bytes. */
+size_t SequenceCollectionHash::memory() const
+{
+	size_t bytes = 0;
+	for (vector<SequenceDataHash>::const_iterator it = m_data.begin();
 			it != m_data.end(); ++it)
-		it->second.clearFlag(flag);
+		bytes += ::memory(*it);
+	return bytes;
 }
 
 /** Print the load of the hash table. */
 void SequenceCollectionHash::printLoad() const
 {
-	size_t size = m_data.size();
-	size_t buckets = m_data.bucket_count();
-	logger(1) << "Hash load: " << size << " / " << buckets << " = "
+	size_t size = 0, buckets = 0, bytes = 0;
+	for (vector<SequenceDataHash>::const_iterator it = m_data.begin();
+			it != m_data.end(); ++it) {
+		size += it->size();
+		buckets += it->bucket_count();
+		bytes += ::memory(*it);
+	}
+	ostringstream s;
+	s << "Hash load: " << size << " / " << buckets << " = "
 		<< setprecision(3) << (float)size / buckets
-		<< " using " << toSI(getMemoryUsage()) << "B" << endl;
+		<< " using " << toSI(getMemoryUsage()) << "B";
+	if (size > 0)
+		s << " (" << setprecision(3) << (float)bytes / size
+			<< " bytes/k-mer)";
+	logger(1) << s.str() << endl;
 }
 
 /** Return an iterator pointing to the specified k-mer or its
- * reverse complement. Return in rc whether the sequence is reversed.
+ * reverse complement in the specified shard.
+ * Return in rc whether the sequence is reversed.
  */
-SequenceCollectionHash::iterator SequenceCollectionHash::find(
-		const Kmer& key, bool& rc)
+SequenceDataHash::iterator SequenceCollectionHash::find(
+		unsigned shard, const Kmer& key, bool& rc)
 {
-	SequenceCollectionHash::iterator it = find(key);
-	if (opt::ss || it != m_data.end()) {
+	SequenceDataHash& data = m_data[shard];
+	SequenceDataHash::iterator it = data.find(key);
+	if (opt::ss || it != data.end()) {
 		rc = false;
 		return it;
 	} else {
 		rc = true;
-		return find(reverseComplement(key));
+		return data.find(reverseComplement(key));
 	}
 }
 
 /** Return an iterator pointing to the specified k-mer or its
- * reverse complement. Return in rc whether the sequence is reversed.
+ * reverse complement in the specified shard.
+ * Return in rc whether the sequence is reversed.
  */
-SequenceCollectionHash::const_iterator SequenceCollectionHash::find(
-		const Kmer& key, bool& rc) const
+SequenceDataHash::const_iterator SequenceCollectionHash::find(
+		unsigned shard, const Kmer& key, bool& rc) const
 {
-	SequenceCollectionHash::const_iterator it = find(key);
-	if (opt::ss || it != m_data.end()) {
+	const SequenceDataHash& data = m_data[shard];
+	SequenceDataHash::const_iterator it = data.find(key);
+	if (opt::ss || it != data.end()) {
 		rc = false;
 		return it;
 	} else {
 		rc = true;
-		return find(reverseComplement(key));
+		return data.find(reverseComplement(key));
 	}
 }
 
@@ -205,14 +396,16 @@ SequenceCollectionHash::const_iterator SequenceCollectionHash::find(
  * The key sequence may not contain data. The returned sequence will
  * contain data.
  */
-const SequenceCollectionHash::value_type& SequenceCollectionHash::
+SequenceCollectionHash::value_type SequenceCollectionHash::
 getSeqAndData(const Kmer& key) const
 {
+	unsigned shard = this->shard(key);
+	ShardLock lock(*this, shard);
 	bool rc;
-	SequenceCollectionHash::const_iterator it = find(key, rc);
+	SequenceDataHash::const_iterator it = find(shard, key, rc);
 	// rc should not be ignored. This seems quite dubious.
 	// The edges of this k-mer should be complemented.
-	assert(it != m_data.end());
+	assert(it != m_data[shard].end());
 	return *it;
 }
 
@@ -220,10 +413,12 @@ getSeqAndData(const Kmer& key) const
 bool SequenceCollectionHash::getSeqData(const Kmer& key,
 		ExtensionRecord& extRecord, int& multiplicity) const
 {
+	unsigned shard = this->shard(key);
+	ShardLock lock(*this, shard);
 	bool rc;
-	SequenceCollectionHash::const_iterator it = find(key, rc);
+	SequenceDataHash::const_iterator it = find(shard, key, rc);
 	assert(!rc || !opt::ss);
-	if (it == m_data.end())
+	if (it == m_data[shard].end())
 		return false;
 	const KmerData data = it->second;
 	extRecord = rc ? ~data.extension() : data.extension();
@@ -231,61 +426,268 @@ bool SequenceCollectionHash::getSeqData(const Kmer& key,
 	return true;
 }
 
-#include <cstdio>
+/** The header of a file of k-mer. The header is followed by a
+ * KmerFileShard record for each shard. The arrays of each shard are
+ * those of a KmerTable, so that a file written by any backend may be
+ * used by the compact table in place, directly from memory mapped
+ * from the file.
+ */
+struct KmerFileHeader
+{
+	/** The file signature, "ABYSSKMR". */
+	char magic[8];
+
+	/** The version of the file format. */
+	uint32_t version;
+
+	/** The length of a k-mer. */
+	uint32_t k;
+
+	/** The number of bytes of a packed k-mer. */
+	uint32_t kmerBytes;
 
-/** Write this collection to disk.
+	/** The number of shards. */
+	uint32_t shards;
+
+	/** The rank of the process that wrote this file, or -1. */
+	int32_t rank;
+
+	/** The number of processes. */
+	uint32_t numProc;
+
+	/** Whether the assembly is strand specific and colour space. */
+	uint32_t flags;
+
+	/** Unused. Zero. */
+	uint32_t reserved;
+
+	/** The hash of the k-mer whose bases are all A. It identifies
+	 * the hash function that placed the k-mer in their buckets. */
+	uint64_t hashSeed;
+};
+
+/** The position of the arrays of a shard in a file of k-mer. */
+struct KmerFileShard
+{
+	/** The number of buckets. */
+	uint64_t buckets;
+
+	/** The number of k-mer. */
+	uint64_t size;
+
+	/** The offset from the start of the file of the arrays. */
+	uint64_t offset;
+};
+
+static const char KMER_FILE_MAGIC[8] = {
+	'A', 'B', 'Y', 'S', 'S', 'K', 'M', 'R' };
+static const uint32_t KMER_FILE_VERSION = 1;
+enum { KMER_FILE_SS = 0x1, KMER_FILE_COLOUR_SPACE = 0x2 };
+
+/** The arrays of a shard are aligned to a page. */
+static const size_t KMER_FILE_ALIGN = 4096;
+
+/** Return the hash that identifies the k-mer hash function. */
+static uint64_t kmerHashSeed()
+{
+	return hash<Kmer>()(Kmer(Sequence(Kmer::length(), 'A')));
+}
+
+/** Write the specified bytes to the specified file. */
+static void write(FILE* f, const void* p, size_t n, const string& path)
+{
+	if (n > 0 && fwrite(p, n, 1, f) != 1) {
+		perror(path.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Return the file offset following the arrays of the specified
+ * shard, aligned to KMER_FILE_ALIGN. */
+static uint64_t alignShard(uint64_t offset)
+{
+	return (offset + KMER_FILE_ALIGN - 1)
+		/ KMER_FILE_ALIGN * KMER_FILE_ALIGN;
+}
+
+/** Write this collection to disk. The file has the same format
+ * regardless of the backend of the collection.
  * @param path does not include the extension
  */
 void SequenceCollectionHash::store(const char* path)
 {
 	assert(path != NULL);
-#if HAVE_GOOGLE_SPARSE_HASH_MAP
 	ostringstream s;
 	s << path;
 	if (opt::rank >= 0)
 		s << '-' << setfill('0') << setw(3) << opt::rank;
 	s << ".kmer";
-	FILE* f = fopen(s.str().c_str(), "w");
+	string name = s.str();
+	FILE* f = fopen(name.c_str(), "w");
 	if (f == NULL) {
-		perror(s.str().c_str());
+		perror(name.c_str());
 		exit(EXIT_FAILURE);
 	}
 	shrink();
-	m_data.write_metadata(f);
-	m_data.write_nopointer_data(f);
-	fclose(f);
+
+	KmerFileHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, KMER_FILE_MAGIC, sizeof header.magic);
+	header.version = KMER_FILE_VERSION;
+	header.k = Kmer::length();
+	header.kmerBytes = Kmer::bytes();
+	header.shards = m_data.size();
+	header.rank = opt::rank;
+	header.numProc = opt::numProc;
+	header.flags = (opt::ss ? KMER_FILE_SS : 0)
+		| (opt::colourSpace ? KMER_FILE_COLOUR_SPACE : 0);
+	header.hashSeed = kmerHashSeed();
+	write(f, &header, sizeof header, name);
+
+	// Write the arrays of each shard in the layout of the compact
+	// table, followed by the position of each shard.
+	vector<KmerFileShard> shards(m_data.size());
+	uint64_t offset = alignShard(sizeof header
+			+ shards.size() * sizeof (KmerFileShard));
+	for (unsigned i = 0; i < m_data.size(); i++) {
+#if ENABLE_COMPACT_TABLE
+		const KmerTable& t = m_data[i];
 #else
-	// Not supported.
-	assert(false);
-	exit(EXIT_FAILURE);
+		KmerTable t;
+		for (SequenceDataHash::const_iterator it = m_data[i].begin();
+				it != m_data[i].end(); ++it)
+			t.insert(*it);
+		t.rehash(0);
 #endif
+		shards[i].buckets = t.bucket_count();
+		shards[i].size = t.size();
+		shards[i].offset = offset;
+		if (fseeko(f, offset, SEEK_SET) != 0) {
+			perror(name.c_str());
+			exit(EXIT_FAILURE);
+		}
+		write(f, t.data(), t.memory(), name);
+		offset = alignShard(offset + t.memory());
+	}
+	if (fseeko(f, sizeof header, SEEK_SET) != 0) {
+		perror(name.c_str());
+		exit(EXIT_FAILURE);
+	}
+	write(f, &shards[0], shards.size() * sizeof shards[0], name);
+	if (fclose(f) != 0) {
+		perror(name.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Exit with an error message about the specified file of k-mer. */
+static void kmerFileError(const char* path, const string& msg)
+{
+	cerr << "error: `" << path << "': " << msg << '\n';
+	exit(EXIT_FAILURE);
 }
 
-/** Load this collection from disk. */
+/** Load this collection from disk. The file is mapped into memory.
+ * When built with the compact table and the file has the same
+ * shards and hash function as this collection, each shard uses the
+ * mapped file in place, which is private to this process, and no
+ * k-mer are copied. Otherwise the k-mer are inserted into the
+ * collection.
+ */
 void SequenceCollectionHash::load(const char* path)
 {
-#if HAVE_GOOGLE_SPARSE_HASH_MAP
-	FILE* f = fopen(path, "r");
-	if (f == NULL) {
+	assert(m_map == NULL);
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
 		perror(path);
 		exit(EXIT_FAILURE);
 	}
-	m_data.read_metadata(f);
-	m_data.read_nopointer_data(f);
-	fclose(f);
-	m_adjacencyLoaded = true;
+	size_t bytes = st.st_size;
+	if (bytes < sizeof (KmerFileHeader))
+		kmerFileError(path, "not a k-mer file");
+	void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	char* p = static_cast<char*>(map);
+
+	const KmerFileHeader& header
+		= *reinterpret_cast<const KmerFileHeader*>(p);
+	if (memcmp(header.magic, KMER_FILE_MAGIC, sizeof header.magic) != 0)
+		kmerFileError(path, "not a k-mer file");
+	if (header.version != KMER_FILE_VERSION) {
+		ostringstream ss;
+		ss << "the file version " << header.version
+			<< " is not the version " << KMER_FILE_VERSION
+			<< " required by this program";
+		kmerFileError(path, ss.str());
+	}
+	if (header.k != Kmer::length() || header.kmerBytes != Kmer::bytes()) {
+		ostringstream ss;
+		ss << "the file has k=" << header.k
+			<< " rather than k=" << Kmer::length();
+		kmerFileError(path, ss.str());
+	}
+	if (header.rank != opt::rank
+			|| (int)header.numProc != opt::numProc) {
+		ostringstream ss;
+		ss << "the file was written by rank " << header.rank
+			<< " of " << header.numProc << " processes";
+		kmerFileError(path, ss.str());
+	}
+	if (!(header.flags & KMER_FILE_SS) != !opt::ss)
+		kmerFileError(path, opt::ss
+				? "the file is not a strand-specific assembly"
+				: "the file is a strand-specific assembly");
+	setColourSpace(header.flags & KMER_FILE_COLOUR_SPACE);
+
+	const KmerFileShard* shards = reinterpret_cast<const KmerFileShard*>(
+			p + sizeof header);
+	if (sizeof header + header.shards * sizeof *shards > bytes)
+		kmerFileError(path, "the file is truncated");
+	for (unsigned i = 0; i < header.shards; i++)
+		if (shards[i].offset + KmerTable::arrayBytes(
+					shards[i].buckets, header.kmerBytes) > bytes)
+			kmerFileError(path, "the file is truncated");
+
+#if ENABLE_COMPACT_TABLE
+	bool inPlace = header.shards == m_data.size()
+		&& header.hashSeed == kmerHashSeed();
 #else
-	(void)path;
-	// Not supported.
-	assert(false);
-	exit(EXIT_FAILURE);
+	bool inPlace = false;
+#endif
+	for (unsigned i = 0; i < header.shards; i++) {
+#if ENABLE_COMPACT_TABLE
+		if (inPlace) {
+			m_data[i].attach(p + shards[i].offset,
+					shards[i].buckets, shards[i].size);
+			continue;
+		}
 #endif
+		KmerTable t;
+		t.attach(p + shards[i].offset,
+				shards[i].buckets, shards[i].size);
+		for (KmerTable::const_iterator it = t.begin();
+				it != t.end(); ++it)
+			m_data[shard(it->first)].insert(*it);
+	}
+
+	if (inPlace) {
+		m_map = map;
+		m_mapBytes = bytes;
+	} else
+		munmap(map, bytes);
+	m_adjacencyLoaded = true;
 }
 
 /** Indicate that this is a colour-space collection. */
 void SequenceCollectionHash::setColourSpace(bool flag)
 {
-	if (!m_data.empty())
+	if (!empty())
 		assert(opt::colourSpace == flag);
 	opt::colourSpace = flag;
 }
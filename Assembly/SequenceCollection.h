@@ -6,10 +6,17 @@
 #include <boost/graph/graph_traits.hpp>
 #include <cassert>
 #include <utility>
+#include <vector>
 
 using boost::graph_traits;
 
-/** A map of Kmer to KmerData. */
+/** A map of Kmer to KmerData.
+ * The map may be split into shards by the hash of the canonical
+ * k-mer, so that it may be accessed by multiple threads concurrently.
+ * A k-mer and its reverse complement are stored in the same shard,
+ * and each shard is protected by its own lock. The k-mer of a single
+ * shard are visited by iterating from begin(shard) to end(shard).
+ */
 class SequenceCollectionHash : public ISequenceCollection
 {
 	public:
@@ -19,10 +26,20 @@ class SequenceCollectionHash : public ISequenceCollection
 		typedef mapped_type vertex_property_type;
 		typedef no_property edge_property_type;
 
-		SequenceCollectionHash();
+		SequenceCollectionHash(unsigned shards = 1);
+		~SequenceCollectionHash();
 
 		void add(const Kmer& seq, unsigned coverage = 1);
 
+		/** Add the specified k-mer and its data. The k-mer and its
+		 * reverse complement must not be present. */
+		void insert(const value_type& seq)
+		{
+			unsigned shard = this->shard(seq.first);
+			ShardLock lock(*this, shard);
+			m_data[shard].insert(seq);
+		}
+
 		/** Remove the specified sequence if it exists. */
 		void remove(const Kmer& seq)
 		{
@@ -32,18 +49,24 @@ class SequenceCollectionHash : public ISequenceCollection
 		// Clean up by erasing sequences flagged as deleted.
 		size_t cleanup();
 
-		/** Shrink the hash table. */
-		void shrink() {
-			m_data.rehash(0);
-			printLoad();
-		}
+		// Shrink the hash table.
+		void shrink();
 
 		// Print the load of the hash table.
 		void printLoad() const;
 
+		/** Return the estimated memory used by the k-mer of this
+		 * collection in bytes. */
+		size_t memory() const;
+
 		// Set flag for sequence seq
 		void setFlag(const Kmer& seq, SeqFlag flag);
 
+		/** Set the specified flag of the specified k-mer atomically.
+		 * @return whether the flag was already set
+		 */
+		bool testAndSetFlag(const Kmer& seq, SeqFlag flag);
+
 		// Clear the specified flag from every sequence in the
 		// collection.
 		void wipeFlag(SeqFlag flag);
@@ -57,27 +80,82 @@ class SequenceCollectionHash : public ISequenceCollection
 		bool getSeqData(const Kmer& seq,
 				ExtensionRecord& extRecord, int& multiplicity) const;
 
-		const value_type& getSeqAndData(const Kmer& key) const;
+		value_type getSeqAndData(const Kmer& key) const;
 
 		/** Return the data associated with the specified key. */
 		const mapped_type operator[](const key_type& key) const
 		{
+			unsigned shard = this->shard(key);
+			ShardLock lock(*this, shard);
 			bool rc;
-			SequenceCollectionHash::const_iterator it = find(key, rc);
-			assert(it != m_data.end());
+			SequenceDataHash::const_iterator it = find(shard, key, rc);
+			assert(it != m_data[shard].end());
 			return rc ? ~it->second : it->second;
 		}
 
-		iterator begin() { return m_data.begin(); }
-		const_iterator begin() const { return m_data.begin(); }
-		iterator end() { return m_data.end(); }
-		const_iterator end() const { return m_data.end(); }
+		iterator begin()
+		{
+			return iterator(&m_data.front(), &m_data.back(),
+					m_data.front().begin());
+		}
+
+		const_iterator begin() const
+		{
+			return const_iterator(&m_data.front(), &m_data.back(),
+					m_data.front().begin());
+		}
+
+		iterator end()
+		{
+			return iterator(&m_data.back(), &m_data.back(),
+					m_data.back().end());
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(&m_data.back(), &m_data.back(),
+					m_data.back().end());
+		}
+
+		/** Return the number of shards. */
+		unsigned shards() const { return m_data.size(); }
+
+		/** Return the shard of the specified k-mer. */
+		unsigned shard(const Kmer& key) const
+		{
+			return m_data.size() == 1 ? 0 : hashShard(key);
+		}
+
+		/** Return an iterator to the first k-mer of a shard. */
+		iterator begin(unsigned shard)
+		{
+			return iterator(&m_data[shard], &m_data[shard],
+					m_data[shard].begin());
+		}
+
+		/** Return an iterator past the last k-mer of a shard. */
+		iterator end(unsigned shard)
+		{
+			return iterator(&m_data[shard], &m_data[shard],
+					m_data[shard].end());
+		}
+
+		/** Return a copy of the k-mer and data at the specified
+		 * position of the specified shard.
+		 */
+		value_type get(unsigned shard, const const_iterator& it) const
+		{
+			ShardLock lock(*this, shard);
+			return *it;
+		}
+
+		void getKmer(unsigned shard, std::vector<Kmer>& kmer) const;
 
 		/** Return true if this collection is empty. */
-		bool empty() const { return m_data.empty(); }
+		bool empty() const { return size() == 0; }
 
-		/** Return the number of sequences in this collection. */
-		size_t size() const { return m_data.size(); }
+		// Return the number of sequences in this collection.
+		size_t size() const;
 
 		// Not a network sequence collection. Nothing to do.
 		size_t pumpNetwork() { return 0; }
@@ -104,14 +182,16 @@ class SequenceCollectionHash : public ISequenceCollection
 		void setDeletedKey();
 
 	private:
-		iterator find(const Kmer& key) { return m_data.find(key); }
-		const_iterator find(const Kmer& key) const
-		{
-			return m_data.find(key);
-		}
+		SequenceCollectionHash(const SequenceCollectionHash&);
+		SequenceCollectionHash& operator=(
+				const SequenceCollectionHash&);
+
+		unsigned hashShard(const Kmer& key) const;
 
-		iterator find(const Kmer& key, bool& rc);
-		const_iterator find(const Kmer& key, bool& rc) const;
+		SequenceDataHash::iterator find(unsigned shard,
+				const Kmer& key, bool& rc);
+		SequenceDataHash::const_iterator find(unsigned shard,
+				const Kmer& key, bool& rc) const;
 
 		/** Call the observers of the specified sequence. */
 		void notify(const value_type& seq)
@@ -120,14 +200,70 @@ class SequenceCollectionHash : public ISequenceCollection
 				m_seqObserver(this, seq);
 		}
 
-		/** The underlying collection. */
-		SequenceDataHash m_data;
+		/** Acquire the lock of the specified shard. */
+		void lock(unsigned shard) const
+		{
+			if (m_locks.empty())
+				return;
+			volatile int* p = &m_locks[shard].locked;
+			while (__sync_lock_test_and_set(p, 1))
+				while (*p)
+					;
+		}
+
+		/** Release the lock of the specified shard. */
+		void unlock(unsigned shard) const
+		{
+			if (!m_locks.empty())
+				__sync_lock_release(&m_locks[shard].locked);
+		}
+
+		/** Hold the lock of a shard for the lifetime of this
+		 * object. */
+		class ShardLock;
+		friend class ShardLock;
+		class ShardLock
+		{
+		  public:
+			ShardLock(const SequenceCollectionHash& c, unsigned shard)
+				: m_c(c), m_shard(shard)
+			{
+				m_c.lock(shard);
+			}
+			~ShardLock() { m_c.unlock(m_shard); }
+		  private:
+			const SequenceCollectionHash& m_c;
+			unsigned m_shard;
+		};
+
+		/** A spin lock, padded to a cache line to avoid false
+		 * sharing. */
+		struct Lock
+		{
+			volatile int locked;
+			char padding[64 - sizeof (int)];
+			Lock() : locked(0) { }
+		};
+
+		/** The underlying collection, one map per shard. */
+		std::vector<SequenceDataHash> m_data;
+
+		/** The locks of the shards, or empty if there is only one
+		 * shard. */
+		mutable std::vector<Lock> m_locks;
 
 		/** The observers. Only a single observer is implemented.*/
 		SeqObserver m_seqObserver;
 
 		/** Whether adjacency information has been loaded. */
 		bool m_adjacencyLoaded;
+
+		/** The file of k-mer mapped into memory and used in place
+		 * by the shards, or NULL. */
+		void* m_map;
+
+		/** The size of the mapped file. */
+		size_t m_mapBytes;
 };
 
 // Graph
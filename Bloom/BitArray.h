@@ -0,0 +1,219 @@
+#ifndef BLOOM_BITARRAY_H
+#define BLOOM_BITARRAY_H 1
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** An array of bits, which is stored in 64-bit words aligned to
+ * cache lines, so that a 64-byte block of bits is one cache line.
+ * The words are either allocated, or mapped read-only from a file. */
+class BitArray
+{
+  public:
+
+	/** The size in bytes of a cache line. */
+	static const size_t CACHE_LINE = 64;
+
+	BitArray() : m_size(0), m_words(NULL), m_map(NULL), m_mapBytes(0) { }
+
+	/** Construct an array of n bits, which are all cleared. */
+	explicit BitArray(size_t n)
+		: m_size(0), m_words(NULL), m_map(NULL), m_mapBytes(0)
+	{
+		resize(n);
+	}
+
+	BitArray(const BitArray& o)
+		: m_size(0), m_words(NULL), m_map(NULL), m_mapBytes(0)
+	{
+		*this = o;
+	}
+
+	~BitArray()
+	{
+		release();
+	}
+
+	BitArray& operator=(const BitArray& o)
+	{
+		if (this != &o) {
+			resize(0);
+			resize(o.m_size);
+			std::copy(o.m_words, o.m_words + o.numWords(), m_words);
+		}
+		return *this;
+	}
+
+	/** Return the number of bits. */
+	size_t size() const { return m_size; }
+
+	/** Return the number of words. */
+	size_t numWords() const { return (m_size + 63) / 64; }
+
+	/** Return the words of this array. */
+	const uint64_t* words() const { return m_words; }
+
+	/** Return the words of this array, which must not be mapped. */
+	uint64_t* words()
+	{
+		assert(m_map == NULL);
+		return m_words;
+	}
+
+	/** Return whether this array is mapped from a file. */
+	bool isMapped() const { return m_map != NULL; }
+
+	/**
+	 * Map n bits stored as 64-bit words at the specified offset of a
+	 * file read-only into memory, in place of this array. The pages
+	 * of the file are shared with every other process that maps it,
+	 * and are read from disk when first used. The bits may be read
+	 * but not changed.
+	 * @param offset a multiple of the size of a page
+	 */
+	void map(const char* path, off_t offset, size_t n)
+	{
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+		if (fd == -1 || fstat(fd, &st) == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		size_t bytes = offset + (n + 63) / 64 * sizeof *m_words;
+		if ((size_t)st.st_size < bytes) {
+			std::cerr << "error: `" << path << "' is truncated\n";
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) {
+			// There is nothing to map.
+			close(fd);
+			release();
+			m_size = 0;
+			return;
+		}
+		void* p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		release();
+		m_map = p;
+		m_mapBytes = bytes;
+		m_words = (uint64_t*)((char*)p + offset);
+		m_size = n;
+	}
+
+	/** Change the number of bits, keeping the bits that remain. A
+	 * mapped array is copied into memory. */
+	void resize(size_t n)
+	{
+		if (n == m_size && m_map == NULL)
+			return;
+		uint64_t* words = NULL;
+		size_t bytes = ((n + 63) / 64 * sizeof *words
+				+ CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+		if (n > 0) {
+			if (posix_memalign((void**)&words, CACHE_LINE, bytes) != 0) {
+				std::cerr << "error: allocating a bit array of "
+					<< bytes << " bytes: " << strerror(errno) << '\n';
+				exit(EXIT_FAILURE);
+			}
+			memset(words, 0, bytes);
+			size_t keep = std::min(n, m_size);
+			std::copy(m_words, m_words + (keep + 63) / 64, words);
+			if (keep % 64 != 0)
+				words[keep / 64] &= ((uint64_t)1 << keep % 64) - 1;
+		}
+		release();
+		m_words = words;
+		m_size = n;
+	}
+
+	/** Clear every bit. */
+	void reset()
+	{
+		assert(m_map == NULL);
+		std::fill(m_words, m_words + numWords(), 0);
+	}
+
+	/** Return the number of set bits. */
+	size_t count() const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < numWords(); i++)
+			n += __builtin_popcountll(m_words[i]);
+		return n;
+	}
+
+	/** Return whether the specified bit is set. */
+	bool operator[](size_t i) const
+	{
+		assert(i < m_size);
+		return m_words[i / 64] >> (i % 64) & 1;
+	}
+
+	/** Set the specified bit. */
+	void set(size_t i)
+	{
+		assert(i < m_size);
+		m_words[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+
+	/** Set the specified bit atomically with respect to other
+	 * threads, without a lock.
+	 * @return whether the bit was already set
+	 */
+	bool testAndSet(size_t i)
+	{
+		assert(i < m_size);
+		uint64_t mask = (uint64_t)1 << (i % 64);
+		uint64_t* p = &m_words[i / 64];
+		// Most bits are already set, and reading them does not
+		// take the cache line from the other threads.
+		if (*(volatile uint64_t*)p & mask)
+			return true;
+		return __sync_fetch_and_or(p, mask) & mask;
+	}
+
+	/** Clear the specified bit. */
+	void reset(size_t i)
+	{
+		assert(i < m_size);
+		m_words[i / 64] &= ~((uint64_t)1 << (i % 64));
+	}
+
+  private:
+	/** Free or unmap the words. */
+	void release()
+	{
+		if (m_map != NULL)
+			munmap(m_map, m_mapBytes);
+		else
+			free(m_words);
+		m_map = NULL;
+		m_mapBytes = 0;
+		m_words = NULL;
+	}
+
+	size_t m_size;
+	uint64_t* m_words;
+
+	/** The mapped file, or NULL if the words are allocated. */
+	void* m_map;
+
+	/** The size of the mapped file. */
+	size_t m_mapBytes;
+};
+
+#endif
@@ -17,14 +17,22 @@
 #ifndef BLOOM_H_
 #define BLOOM_H_
 
+#include "Bloom/BitArray.h"
+#include "Bloom/RollingHash.h"
 #include "Common/Kmer.h"
 #include "Common/HashFunction.h"
 #include "Common/Uncompress.h"
 #include "Common/IOUtil.h"
+#include "Common/Timer.h"
 #include "DataLayer/FastaReader.h"
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
 
 #if _OPENMP
+# include "Common/Pipe.h"
 # include <omp.h>
 #endif
 
@@ -32,26 +40,52 @@ namespace Bloom {
 
 	typedef Kmer key_type;
 
+	/** The hash function of a bloom filter. */
+	enum HashType {
+		/** CityHash of the canonical k-mer */
+		HASH_CITY,
+		/** rolling hash of the k-mer and its reverse complement */
+		HASH_ROLLING
+	};
+
 	/** Header section of serialized bloom filters. */
 	struct FileHeader {
 		unsigned bloomVersion;
 		unsigned k;
+		unsigned hashNum;
+		HashType hashType;
+		bool blocked;
 		size_t fullBloomSize;
 		size_t startBitPos;
 		size_t endBitPos;
 	};
 
 	/**
-	 * Number of seqs to read in during each iteration of an
-	 * OpenMP bloom filter loading task
+	 * Number of seqs in each batch passed from the threads that
+	 * read files to the threads that load a bloom filter
 	 */
 	static const unsigned LOAD_CHUNK_SIZE = 1000;
+	/** Number of batches of seqs in flight per loading thread */
+	static const unsigned LOAD_BATCHES_PER_THREAD = 4;
 	/** Print a progress message after loading this many seqs */
 	static const unsigned LOAD_PROGRESS_STEP = 100000;
 	/** file format version number */
-	static const unsigned BLOOM_VERSION = 2;
+	static const unsigned BLOOM_VERSION = 4;
+	/** The maximum number of hash functions of a bloom filter */
+	static const unsigned MAX_HASHES = 32;
+	/**
+	 * The number of bits of a block of a blocked bloom filter,
+	 * which is one cache line
+	 */
+	static const unsigned BLOCK_BITS = 512;
 	/** I/O buffer size when reading/writing bloom filter files */
 	static const unsigned long IO_BUFFER_SIZE = 32*1024;
+	/**
+	 * The bit array of a version 4 file starts at a multiple of this
+	 * many bytes from the start of the file, which is the size of a
+	 * page, so that it may be mapped into memory
+	 */
+	static const unsigned DATA_ALIGNMENT = 4096;
 
 	/**
 	 * How to treat existing bits in the bloom filter when
@@ -67,64 +101,284 @@ namespace Bloom {
 	inline static size_t hash(const key_type& key)
 	{
 		if (key.isCanonical())
-			return hashmem(&key, sizeof key);
+			return hashmem(&key, key_type::serialSize());
 
 		key_type copy(key);
 		copy.reverseComplement();
-		return hashmem(&copy, sizeof copy);
+		return hashmem(&copy, key_type::serialSize());
 	}
 
 	/** Return the hash value of this object given seed. */
 	inline static size_t hash(const key_type& key, size_t seed)
 	{
 		if (key.isCanonical())
-			return hashmem(&key, sizeof key, seed);
+			return hashmem(&key, key_type::serialSize(), seed);
 
 		key_type copy(key);
 		copy.reverseComplement();
-		return hashmem(&copy, sizeof copy, seed);
+		return hashmem(&copy, key_type::serialSize(), seed);
+	}
+
+	/** Return the name of the specified hash function. */
+	inline static const char* hashTypeName(HashType type)
+	{
+		return type == HASH_ROLLING ? "rolling" : "city";
+	}
+
+	/** Parse the name of a hash function.
+	 * @return false if the name is not recognized
+	 */
+	inline static bool parseHashType(const std::string& name,
+			HashType& type)
+	{
+		if (name == "city")
+			type = HASH_CITY;
+		else if (name == "rolling")
+			type = HASH_ROLLING;
+		else
+			return false;
+		return true;
+	}
+
+	/** Compute the specified number of hash values of this object.
+	 * The first hash value of HASH_CITY is that of hash(key).
+	 */
+	inline static void hashes(const key_type& key, HashType type,
+			unsigned n, size_t* hashes)
+	{
+		assert(n > 0 && n <= MAX_HASHES);
+		if (type == HASH_ROLLING) {
+			RollingHash(key).getHashes(n, hashes);
+			return;
+		}
+		hashes[0] = hash(key);
+		for (unsigned i = 1; i < n; i++)
+			hashes[i] = hash(key, i);
+	}
+
+	/**
+	 * Return the index of the bit of the i-th hash value of an object
+	 * in a bloom filter of the specified size. The bits of an object
+	 * in a blocked bloom filter are all in the one block selected by
+	 * its first hash value, so that a lookup reads one cache line.
+	 */
+	inline static size_t index(const size_t hashes[], unsigned i,
+			size_t size, bool blocked)
+	{
+		if (!blocked)
+			return hashes[i] % size;
+		assert(size % BLOCK_BITS == 0);
+		size_t block = hashes[0] % (size / BLOCK_BITS);
+		// the offset in the block is the high bits of the hash value
+		// after multiplication by the golden ratio
+		uint64_t x = hashes[i] * 0x9e3779b97f4a7c15ULL;
+		return block * BLOCK_BITS + (x >> (64 - 9));
 	}
 
 	template <typename BF>
 	inline static void loadSeq(BF& bloomFilter, unsigned k, const std::string& seq);
 
-	/** Load a sequence file into a bloom filter */
+	/** A batch of seqs read from a file. The strings are reused
+	 * from one batch to the next. */
+	struct LoadBatch {
+		std::vector<std::string> seqs;
+		size_t size;
+		LoadBatch() : seqs(LOAD_CHUNK_SIZE), size(0) { }
+	};
+
+	/** The number of reads and bases loaded into a bloom filter */
+	struct LoadCount {
+		size_t reads;
+		size_t bases;
+	};
+
+	/** Load a batch of seqs into a bloom filter, and add it to the
+	 * count, which may be shared by several threads. */
 	template <typename BF>
-	inline static void loadFile(BF& bloomFilter, unsigned k, const std::string& path,
-			bool verbose = false)
+	inline static void loadBatch(BF& bloomFilter, unsigned k,
+			const LoadBatch& batch, LoadCount& count, bool verbose)
+	{
+		size_t bases = 0;
+		for (size_t i = 0; i < batch.size; i++) {
+			loadSeq(bloomFilter, k, batch.seqs[i]);
+			bases += batch.seqs[i].size();
+		}
+		__sync_fetch_and_add(&count.bases, bases);
+		size_t reads = __sync_fetch_and_add(&count.reads, batch.size);
+		if (verbose && reads / LOAD_PROGRESS_STEP
+				!= (reads + batch.size) / LOAD_PROGRESS_STEP)
+#pragma omp critical(cerr)
+			std::cerr << "Loaded " << (reads + batch.size)
+				/ LOAD_PROGRESS_STEP * LOAD_PROGRESS_STEP
+				<< " reads into bloom filter\n";
+	}
+
+	/** Read a batch of seqs from a file.
+	 * @return whether any seqs were read
+	 */
+	inline static bool readBatch(FastaReader& in, LoadBatch& batch)
+	{
+		for (batch.size = 0; batch.size < LOAD_CHUNK_SIZE
+				&& in >> batch.seqs[batch.size]; batch.size++)
+			;
+		return batch.size > 0;
+	}
+
+	/** Open a sequence file to load into a bloom filter. */
+	inline static FastaReader* openLoadFile(const std::string& path,
+			bool verbose)
 	{
 		assert(!path.empty());
 		if (verbose)
+#pragma omp critical(cerr)
 			std::cerr << "Reading `" << path << "'...\n";
-		FastaReader in(path.c_str(), FastaReader::FOLD_CASE);
-		uint64_t count = 0;
-		const size_t CHUNK_SIZE = 1000;
+		return new FastaReader(path.c_str(), FastaReader::FOLD_CASE);
+	}
+
+	/** Load sequence files into a bloom filter in this thread. */
+	template <typename BF>
+	inline static void loadFilesSerial(BF& bloomFilter, unsigned k,
+			const std::vector<std::string>& paths, LoadBatch& batch,
+			LoadCount& count, bool verbose)
+	{
+		for (size_t i = 0; i < paths.size(); i++) {
+			FastaReader* in = openLoadFile(paths[i], verbose);
+			while (readBatch(*in, batch))
+				loadBatch(bloomFilter, k, batch, count, verbose);
+			assert(in->eof());
+			delete in;
+		}
+	}
+
+#if _OPENMP
+	/** Read the files paths[next++] into batches, which are taken
+	 * from empty and pushed onto full, until every file has been
+	 * taken by a thread. */
+	inline static void readBatches(const std::vector<std::string>& paths,
+			size_t& next, Pipe<LoadBatch*>& empty,
+			Pipe<LoadBatch*>& full, bool verbose)
+	{
+		for (size_t i; (i = __sync_fetch_and_add(&next, 1))
+				< paths.size();) {
+			FastaReader* in = openLoadFile(paths[i], verbose);
+			for (;;) {
+				LoadBatch* batch = empty.pop().first;
+				if (!readBatch(*in, *batch)) {
+					empty.push(batch);
+					break;
+				}
+				full.push(batch);
+			}
+			assert(in->eof());
+			delete in;
+		}
+	}
+#endif
+
+	/**
+	 * Load sequence files into a bloom filter, which must be safe to
+	 * insert into from several threads when OpenMP is enabled.
+	 * Parsing is pipelined with hashing: up to half of the threads
+	 * read the files, at most one thread per file, and pass batches
+	 * of seqs through a bounded queue to the other threads, which
+	 * load them into the bloom filter. A thread that has no file
+	 * left to read helps to load the bloom filter.
+	 */
+	template <typename BF>
+	inline static void loadFiles(BF& bloomFilter, unsigned k,
+			const std::vector<std::string>& paths,
+			bool verbose = false)
+	{
+		if (paths.empty())
+			return;
+		double start = wallClock();
+		LoadCount count = { 0, 0 };
+
+#if _OPENMP
+		// batches are recycled, which bounds the memory of seqs
+		// that are read but not yet loaded
+		size_t numBatches
+			= LOAD_BATCHES_PER_THREAD * omp_get_max_threads();
+		std::vector<LoadBatch> batches(numBatches);
+		Pipe<LoadBatch*> empty(numBatches), full(numBatches);
+		for (size_t i = 0; i < numBatches; i++)
+			empty.push(&batches[i]);
+		size_t next = 0;
+		unsigned doneReaders = 0;
 #pragma omp parallel
-		for (std::string seq[CHUNK_SIZE];;) {
-			bool good = true;
-			size_t i = 0;
-#pragma omp critical(in)
-			for (; good && i < CHUNK_SIZE; i++)
-				good = in >> seq[i];
-			if (!good)
-				i--;
-			if (i == 0)
-				break;
-			for (size_t j = 0; j < i; j++) {
-				loadSeq(bloomFilter, k, seq[j]);
-				if (verbose)
-#pragma omp critical(cerr)
-				{
-					count++;
-					if (count % LOAD_PROGRESS_STEP == 0)
-						std::cerr << "Loaded " << count << " reads into bloom filter\n";
+		{
+			unsigned threads = omp_get_num_threads();
+			unsigned readers = std::min((size_t)std::max(threads / 2, 1U),
+					paths.size());
+			if (threads == 1) {
+				// no other thread to load the batches
+				loadFilesSerial(bloomFilter, k, paths, batches[0],
+						count, verbose);
+			} else {
+				if (omp_get_thread_num() < (int)readers) {
+					readBatches(paths, next, empty, full, verbose);
+					if (__sync_add_and_fetch(&doneReaders, 1)
+							== readers)
+						full.close();
+				}
+				for (std::pair<LoadBatch*, size_t> batch = full.pop();
+						batch.second > 0; batch = full.pop()) {
+					loadBatch(bloomFilter, k, *batch.first, count,
+							verbose);
+					empty.push(batch.first);
 				}
 			}
 		}
-		assert(in.eof());
+#else
+		LoadBatch batch;
+		loadFilesSerial(bloomFilter, k, paths, batch, count, verbose);
+#endif
+
 		if (verbose) {
-			std::cerr << "Loaded " << count << " reads from `"
-				<< path << "` into bloom filter\n";
+			double seconds = wallClock() - start;
+			std::cerr << "Loaded " << count.reads << " reads ("
+				<< count.bases << " bases) from " << paths.size()
+				<< (paths.size() == 1 ? " file" : " files")
+				<< " into bloom filter in " << seconds << " s ("
+				<< (size_t)(seconds > 0 ? count.bases / seconds : 0)
+				<< " bases/s)\n";
+		}
+	}
+
+	/** Load a sequence file into a bloom filter */
+	template <typename BF>
+	inline static void loadFile(BF& bloomFilter, unsigned k,
+			const std::string& path, bool verbose = false)
+	{
+		loadFiles(bloomFilter, k, std::vector<std::string>(1, path),
+				verbose);
+	}
+
+	/** Load a sequence (string) into a bloom filter using a rolling
+	 * hash, which is updated in constant time for each k-mer. */
+	template <typename BF>
+	inline static void loadSeqRolling(BF& bloomFilter, unsigned k,
+			const std::string& seq)
+	{
+		unsigned n = bloomFilter.getHashNum();
+		size_t hashValues[MAX_HASHES];
+		RollingHash hash;
+		// the number of consecutive ACGT ending at i
+		size_t run = 0;
+		for (size_t i = 0; i < seq.size(); ++i) {
+			int c = RollingHash::code(seq[i]);
+			if (c < 0) {
+				run = 0;
+				continue;
+			}
+			if (++run < k)
+				continue;
+			if (run == k)
+				hash = RollingHash(seq, i + 1 - k, k);
+			else
+				hash.rollRight(RollingHash::code(seq[i - k]), c);
+			hash.getHashes(n, hashValues);
+			bloomFilter.insert(hashValues);
 		}
 	}
 
@@ -134,6 +388,10 @@ namespace Bloom {
 	{
 		if (seq.size() < k)
 			return;
+		if (bloomFilter.getHashType() == HASH_ROLLING) {
+			loadSeqRolling(bloomFilter, k, seq);
+			return;
+		}
 		for (size_t i = 0; i < seq.size() - k + 1; ++i) {
 			std::string kmer = seq.substr(i, k);
 			size_t pos = kmer.find_last_not_of("ACGTacgt");
@@ -144,55 +402,71 @@ namespace Bloom {
 		}
 	}
 
-	/** Write a bloom filter to a stream */
-	template <typename BF>
-	static void write(const BF& bloomFilter, size_t fullBloomSize,
-		size_t startBitPos, size_t endBitPos, std::ostream& out)
+	/**
+	 * Write a bloom filter to a stream. The header is padded by a
+	 * line of spaces so that the bit array starts at a multiple of
+	 * DATA_ALIGNMENT bytes from the start of the header, and the bit
+	 * array is stored as the 64-bit words of a BitArray in the byte
+	 * order of the host, so that it may be mapped into memory.
+	 */
+	static void write(const BitArray& array, size_t fullBloomSize,
+		size_t startBitPos, size_t endBitPos, unsigned hashNum,
+		HashType hashType, bool blocked, std::ostream& out)
 	{
 
 		// file header
 
-		out << BLOOM_VERSION << '\n';
-		assert(out);
-		out << Kmer::length() << '\n';
-		assert(out);
-		out << fullBloomSize
+		std::ostringstream header;
+		header << BLOOM_VERSION << '\n'
+			<< Kmer::length() << '\n'
+			<< hashNum << '\t' << hashTypeName(hashType)
+			<< '\t' << (blocked ? "blocked" : "flat") << '\n'
+			<< fullBloomSize
 			<< '\t' << startBitPos
 			<< '\t' << endBitPos
 			<< '\n';
+		size_t pad = (DATA_ALIGNMENT
+				- (header.str().size() + 1) % DATA_ALIGNMENT)
+			% DATA_ALIGNMENT;
+		out << header.str() << std::string(pad, ' ') << '\n';
 		assert(out);
 
 		// bloom filter bits
 
 		size_t bits = endBitPos - startBitPos + 1;
-		size_t bytes = (bits + 7) / 8;
-		char buf[IO_BUFFER_SIZE];
-		for (size_t i = 0, j = 0; i < bytes;) {
-			size_t writeSize = std::min(IO_BUFFER_SIZE, bytes - i);
+		size_t words = (bits + 63) / 64;
+		if (bits == array.size()) {
+			out.write((const char*)array.words(),
+					words * sizeof *array.words());
+			assert(out);
+			return;
+		}
+
+		const size_t BUF_WORDS = IO_BUFFER_SIZE / sizeof (uint64_t);
+		uint64_t buf[BUF_WORDS];
+		for (size_t i = 0, j = 0; i < words;) {
+			size_t writeSize = std::min(BUF_WORDS, words - i);
 			for (size_t k = 0; k < writeSize; k++) {
 				buf[k] = 0;
-				for (unsigned l = 0; l < 8; l++, j++) {
-					buf[k] <<= 1;
-					if (j < bits && bloomFilter[j]) {
-						buf[k] |= 1;
-					}
-				}
+				for (unsigned l = 0; l < 64; l++, j++)
+					if (j < bits && j < array.size() && array[j])
+						buf[k] |= (uint64_t)1 << l;
 			}
-			out.write(buf, writeSize);
+			out.write((const char*)buf, writeSize * sizeof *buf);
 			assert(out);
 			i += writeSize;
 		}
 	}
 
 	/** Write a bloom filter to a stream */
-	template <typename BF>
-	static void write(const BF& bloomFilter, std::ostream& out)
+	static inline void write(const BitArray& array, unsigned hashNum,
+		HashType hashType, bool blocked, std::ostream& out)
 	{
-		Bloom::write(bloomFilter, bloomFilter.size(), 0,
-			bloomFilter.size() - 1, out);
+		Bloom::write(array, array.size(), 0,
+			array.size() - 1, hashNum, hashType, blocked, out);
 	}
 
-	FileHeader readHeader(std::istream& in)
+	inline static FileHeader readHeader(std::istream& in)
 	{
 		FileHeader header;
 
@@ -200,7 +474,8 @@ namespace Bloom {
 
 		in >> header.bloomVersion >> expect("\n");
 		assert(in);
-		if (header.bloomVersion != BLOOM_VERSION) {
+		if (header.bloomVersion < 2
+				|| header.bloomVersion > BLOOM_VERSION) {
 			std::cerr << "error: bloom filter version (`"
 				<< header.bloomVersion << "'), does not match version required "
 				"by this program (`" << BLOOM_VERSION << "').\n";
@@ -218,6 +493,29 @@ namespace Bloom {
 			exit(EXIT_FAILURE);
 		}
 
+		// read the hash functions, which version 2 does not record
+
+		header.hashNum = 1;
+		header.hashType = HASH_CITY;
+		header.blocked = false;
+		if (header.bloomVersion >= 3) {
+			std::string name, layout("flat");
+			in >> header.hashNum >> expect("\t") >> name;
+			if (in.peek() == '\t')
+				in >> expect("\t") >> layout;
+			in >> expect("\n");
+			assert(in);
+			header.blocked = layout == "blocked";
+			if (header.hashNum == 0 || header.hashNum > MAX_HASHES
+					|| !parseHashType(name, header.hashType)
+					|| (layout != "flat" && layout != "blocked")) {
+				std::cerr << "error: unsupported bloom filter hash "
+					"functions (`" << header.hashNum << ' ' << name
+					<< ' ' << layout << "').\n";
+				exit(EXIT_FAILURE);
+			}
+		}
+
 		// read bloom filter dimensions
 
 		in >> header.fullBloomSize
@@ -225,6 +523,11 @@ namespace Bloom {
 		   >> expect("\t") >> header.endBitPos
 		   >> expect("\n");
 
+		// skip the padding before the bit array
+
+		if (header.bloomVersion >= 4)
+			in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
 		assert(in);
 		assert(header.startBitPos < header.fullBloomSize);
 		assert(header.endBitPos < header.fullBloomSize);
@@ -233,9 +536,47 @@ namespace Bloom {
 		return header;
 	}
 
+	/** Read the 64-bit words of a bit array of a version 4 file. */
+	static inline void readWords(BitArray& array, std::istream& in,
+			LoadType loadType, size_t size, size_t offset, size_t bits)
+	{
+		// the words of the file are those of the array when the file
+		// is neither a window nor shrunk
+		uint64_t* dst = offset == 0 && bits == size
+			? array.words() : NULL;
+
+		const size_t BUF_WORDS = IO_BUFFER_SIZE / sizeof (uint64_t);
+		uint64_t buf[BUF_WORDS];
+		size_t words = (bits + 63) / 64;
+		for (size_t i = 0, j = 0; i < words; ) {
+			size_t readSize = std::min(BUF_WORDS, words - i);
+			in.read((char*)buf, readSize * sizeof *buf);
+			assert(in);
+			for (size_t k = 0; k < readSize; k++) {
+				if (dst != NULL) {
+					if (loadType == LOAD_INTERSECT)
+						dst[i + k] &= buf[k];
+					else
+						dst[i + k] |= buf[k];
+					continue;
+				}
+				for (unsigned l = 0; l < 64 && j < bits; l++, j++) {
+					bool bit = buf[k] >> l & 1;
+					size_t index = (offset + j) % size;
+					if (loadType == LOAD_INTERSECT) {
+						if (!bit)
+							array.reset(index);
+					} else if (bit)
+						array.set(index);
+				}
+			}
+			i += readSize;
+		}
+	}
+
 	/** Read the bloom filter bit array from a stream */
-	template <typename BF>
-	static void readData(BF& bloomFilter, const Bloom::FileHeader& header,
+	static inline void readData(BitArray& bloomFilter,
+			const Bloom::FileHeader& header,
 			std::istream& in, LoadType loadType = LOAD_OVERWRITE,
 			unsigned shrinkFactor = 1)
 	{
@@ -254,6 +595,12 @@ namespace Bloom {
 
 		size /= shrinkFactor;
 
+		if (header.blocked && size % BLOCK_BITS != 0) {
+			std::cerr << "error: the number of bits of a blocked bloom "
+				"filter must be a multiple of " << BLOCK_BITS << "\n";
+			exit(EXIT_FAILURE);
+		}
+
 		if((loadType == LOAD_UNION || loadType == LOAD_INTERSECT)
 			&& size != bloomFilter.size()) {
 			std::cerr << "error: can't union/intersect two bloom filters "
@@ -270,6 +617,12 @@ namespace Bloom {
 
 		size_t offset = header.startBitPos;
 		size_t bits = header.endBitPos - header.startBitPos + 1;
+
+		if (header.bloomVersion >= 4) {
+			readWords(bloomFilter, in, loadType, size, offset, bits);
+			return;
+		}
+
 		size_t bytes = (bits + 7) / 8;
 
 		char buf[IO_BUFFER_SIZE];
@@ -285,10 +638,12 @@ namespace Bloom {
 					{
 					case LOAD_OVERWRITE:
 					case LOAD_UNION:
-						bloomFilter[index] |= bit;
+						if (bit)
+							bloomFilter.set(index);
 						break;
 					case LOAD_INTERSECT:
-						bloomFilter[index] &= bit;
+						if (!bit)
+							bloomFilter.reset(index);
 						break;
 					}
 				}
@@ -298,14 +653,23 @@ namespace Bloom {
 
 	}
 
-	/** Read a bloom filter from a stream */
-	template <typename BF>
-	static void read(BF& bloomFilter, std::istream& in,
-			LoadType loadType = LOAD_OVERWRITE,
-			unsigned shrinkFactor = 1)
+	/** Check that a bloom filter read with the specified header may
+	 * be combined with one using these hash functions and layout, and
+	 * return the hash functions and layout to use. */
+	inline static void checkHashes(const FileHeader& header,
+			LoadType loadType, unsigned& hashNum, HashType& hashType,
+			bool& blocked)
 	{
-		FileHeader header = readHeader(in);
-		readData(bloomFilter, header, in, loadType, shrinkFactor);
+		if (loadType != LOAD_OVERWRITE && (header.hashNum != hashNum
+					|| header.hashType != hashType
+					|| header.blocked != blocked)) {
+			std::cerr << "error: can't union/intersect two bloom filters "
+				"with different hash functions or layouts.\n";
+			exit(EXIT_FAILURE);
+		}
+		hashNum = header.hashNum;
+		hashType = header.hashType;
+		blocked = header.blocked;
 	}
 
 	//TODO: Bloom filter calculation methods
@@ -6,12 +6,14 @@
 #define BLOOMFILTER_H 1
 
 #include "Bloom/Bloom.h"
+#include "Bloom/BitArray.h"
 #include "Common/Kmer.h"
 #include "Common/IOUtil.h"
 #include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <vector>
 #include <iostream>
-#include <boost/dynamic_bitset.hpp>
 
 /** A Bloom filter. */
 class BloomFilter
@@ -19,10 +21,27 @@ class BloomFilter
   public:
 
 	/** Constructor. */
-	BloomFilter() { }
-
-	/** Constructor. */
-	BloomFilter(size_t n) : m_array(n) { }
+	BloomFilter()
+		: m_hashNum(1), m_hashType(Bloom::HASH_CITY), m_blocked(false)
+	{ }
+
+	/** Constructor.
+	 * @param n the number of bits
+	 * @param hashNum the number of hash functions
+	 * @param hashType the hash function
+	 * @param blocked whether the bits of each element are in one
+	 * block of Bloom::BLOCK_BITS bits, in which case n must be a
+	 * multiple of Bloom::BLOCK_BITS
+	 */
+	BloomFilter(size_t n, unsigned hashNum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY,
+			bool blocked = false)
+		: m_array(n), m_hashNum(hashNum), m_hashType(hashType),
+		m_blocked(blocked)
+	{
+		assert(hashNum > 0 && hashNum <= Bloom::MAX_HASHES);
+		assert(!blocked || n % Bloom::BLOCK_BITS == 0);
+	}
 
 	/** Return the size of the bit array. */
 	size_t size() const { return m_array.size(); }
@@ -33,10 +52,25 @@ class BloomFilter
 		return m_array.count();
 	}
 
+	/** Return the number of hash functions. */
+	unsigned getHashNum() const { return m_hashNum; }
+
+	/** Return the hash function. */
+	Bloom::HashType getHashType() const { return m_hashType; }
+
+	/** Return whether the bits of each element are in one block. */
+	bool isBlocked() const { return m_blocked; }
+
+	/** Return the index of the bit of the i-th hash value. */
+	size_t index(const size_t hashes[], unsigned i) const
+	{
+		return Bloom::index(hashes, i, m_array.size(), m_blocked);
+	}
+
 	/** Return the estimated false positive rate */
 	double FPR() const
 	{
-		return (double)popcount() / size();
+		return pow((double)popcount() / size(), (double)m_hashNum);
 	}
 
 	/** Return whether the specified bit is set. */
@@ -46,23 +80,66 @@ class BloomFilter
 		return m_array[i];
 	}
 
+	/** Return whether the object with these hash values is present
+	 * in this set. */
+	bool contains(const size_t hashes[]) const
+	{
+		for (unsigned i = 0; i < m_hashNum; i++)
+			if (!m_array[index(hashes, i)])
+				return false;
+		return true;
+	}
+
 	/** Return whether the object is present in this set. */
 	bool operator[](const Bloom::key_type& key) const
 	{
-		return m_array[Bloom::hash(key) % m_array.size()];
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, m_hashNum, hashes);
+		return contains(hashes);
 	}
 
 	/** Add the object with the specified index to this set. */
 	void insert(size_t index)
 	{
 		assert(index < m_array.size());
-		m_array[index] = true;
+		m_array.set(index);
+	}
+
+	/** Add the object with the specified index to this set,
+	 * atomically with respect to other threads.
+	 * @return whether the bit was already set
+	 */
+	bool insertAtomic(size_t index)
+	{
+		return m_array.testAndSet(index);
+	}
+
+	/** Add the object with these hash values to this set,
+	 * atomically with respect to other threads.
+	 * @return whether every bit was already set
+	 */
+	bool insertAtomic(const size_t hashes[])
+	{
+		bool found = true;
+		for (unsigned i = 0; i < m_hashNum; i++)
+			if (!m_array.testAndSet(index(hashes, i)))
+				found = false;
+		return found;
+	}
+
+	/** Add the object with these hash values to this set. */
+	void insert(const size_t hashes[])
+	{
+		for (unsigned i = 0; i < m_hashNum; i++)
+			m_array.set(index(hashes, i));
 	}
 
 	/** Add the object to this set. */
 	void insert(const Bloom::key_type& key)
 	{
-		m_array[Bloom::hash(key) % m_array.size()] = true;
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, m_hashNum, hashes);
+		insert(hashes);
 	}
 
 	/** Operator for reading a bloom filter from a stream. */
@@ -83,18 +160,65 @@ class BloomFilter
 	void read(std::istream& in, Bloom::LoadType loadType = Bloom::LOAD_OVERWRITE,
 		unsigned shrinkFactor = 1)
 	{
-		Bloom::read(m_array, in, loadType, shrinkFactor);
+		Bloom::FileHeader header = Bloom::readHeader(in);
+		Bloom::checkHashes(header, loadType,
+				m_hashNum, m_hashType, m_blocked);
+		Bloom::readData(m_array, header, in, loadType, shrinkFactor);
+	}
+
+	/**
+	 * Map a bloom filter file read-only into memory, so that every
+	 * process that maps the same file shares one copy of its bits in
+	 * the page cache. A file that is not version 4, or that is a
+	 * window of a larger bloom filter, is read instead. Bits may not
+	 * be inserted into a mapped bloom filter.
+	 */
+	void map(const std::string& path)
+	{
+		std::ifstream in(path.c_str(),
+				std::ios_base::in | std::ios_base::binary);
+		assert_good(in, path);
+		Bloom::FileHeader header = Bloom::readHeader(in);
+		assert_good(in, path);
+		Bloom::checkHashes(header, Bloom::LOAD_OVERWRITE,
+				m_hashNum, m_hashType, m_blocked);
+		off_t offset = in.tellg();
+		if (header.bloomVersion < 4 || header.startBitPos != 0
+				|| header.endBitPos + 1 != header.fullBloomSize
+				|| offset % Bloom::DATA_ALIGNMENT != 0) {
+			std::cerr << "warning: `" << path << "' cannot be mapped "
+				"into memory and is read instead\n";
+			Bloom::readData(m_array, header, in);
+			assert_good(in, path);
+			return;
+		}
+		if (m_blocked && header.fullBloomSize % Bloom::BLOCK_BITS != 0) {
+			std::cerr << "error: the number of bits of a blocked bloom "
+				"filter must be a multiple of " << Bloom::BLOCK_BITS
+				<< "\n";
+			exit(EXIT_FAILURE);
+		}
+		m_array.map(path.c_str(), offset, header.fullBloomSize);
 	}
 
 	/** Write a bloom filter to a stream. */
 	void write(std::ostream& out) const
 	{
-		Bloom::write(m_array, out);
+		Bloom::write(m_array, m_hashNum, m_hashType, m_blocked, out);
 	}
 
   protected:
 
-	boost::dynamic_bitset<> m_array;
+	BitArray m_array;
+
+	/** The number of hash functions */
+	unsigned m_hashNum;
+
+	/** The hash function */
+	Bloom::HashType m_hashType;
+
+	/** Whether the bits of each element are in one block */
+	bool m_blocked;
 };
 
 #endif
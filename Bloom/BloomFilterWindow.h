@@ -26,9 +26,15 @@ public:
 	 * @param fullBloomSize size in bits of the containing bloom filter
 	 * @param startBitPos index of first bit in the window
 	 * @param endBitPos index of last bit in the window
+	 * @param hashNum the number of hash functions
+	 * @param hashType the hash function
+	 * @param blocked whether the containing bloom filter is blocked
 	 */
-	BloomFilterWindow(size_t fullBloomSize, size_t startBitPos, size_t endBitPos) :
-		BloomFilter(endBitPos - startBitPos + 1),
+	BloomFilterWindow(size_t fullBloomSize, size_t startBitPos, size_t endBitPos,
+			unsigned hashNum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY,
+			bool blocked = false) :
+		BloomFilter(endBitPos - startBitPos + 1, hashNum, hashType),
 		m_fullBloomSize(fullBloomSize),
 		m_startBitPos(startBitPos),
 		m_endBitPos(endBitPos)
@@ -36,6 +42,8 @@ public:
 		assert(startBitPos < fullBloomSize);
 		assert(endBitPos < fullBloomSize);
 		assert(startBitPos <= endBitPos);
+		assert(!blocked || fullBloomSize % Bloom::BLOCK_BITS == 0);
+		m_blocked = blocked;
 	}
 
 	/**
@@ -85,10 +93,42 @@ public:
 		return false;
 	}
 
+	/** Return the index in the containing bloom filter of the bit
+	 * of the i-th hash value. */
+	size_t index(const size_t hashes[], unsigned i) const
+	{
+		return Bloom::index(hashes, i, m_fullBloomSize, m_blocked);
+	}
+
+	/** Return whether the object with these hash values is present
+	 * in this set. */
+	bool contains(const size_t hashes[]) const
+	{
+		for (unsigned i = 0; i < m_hashNum; i++)
+			if (!(*this)[index(hashes, i)])
+				return false;
+		return true;
+	}
+
 	/** Return whether the object is present in this set. */
 	bool operator[](const Bloom::key_type& key) const
 	{
-		return (*this)[Bloom::hash(key) % m_fullBloomSize];
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, m_hashNum, hashes);
+		return contains(hashes);
+	}
+
+	/** Return whether the bits of the object with these hash values
+	 * that are within this window are all set. */
+	bool containsWithin(const size_t hashes[]) const
+	{
+		for (unsigned i = 0; i < m_hashNum; i++) {
+			size_t j = index(hashes, i);
+			if (j >= m_startBitPos && j <= m_endBitPos
+					&& !BloomFilter::operator[](j - m_startBitPos))
+				return false;
+		}
+		return true;
 	}
 
 	/** Add the object with the specified index to this set. */
@@ -98,10 +138,19 @@ public:
 			BloomFilter::insert(i - m_startBitPos);
 	}
 
+	/** Add the object with these hash values to this set. */
+	void insert(const size_t hashes[])
+	{
+		for (unsigned i = 0; i < m_hashNum; i++)
+			insert(index(hashes, i));
+	}
+
 	/** Add the object to this set. */
 	void insert(const Bloom::key_type& key)
 	{
-		insert(Bloom::hash(key) % m_fullBloomSize);
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, m_hashNum, hashes);
+		insert(hashes);
 	}
 
 	/** Operator for reading a bloom filter from a stream. */
@@ -124,6 +173,8 @@ public:
 			unsigned shrinkFactor = 1)
 	{
 		Bloom::FileHeader header = Bloom::readHeader(in);
+		Bloom::checkHashes(header, loadType,
+				m_hashNum, m_hashType, m_blocked);
 
 		m_fullBloomSize = header.fullBloomSize;
 		m_startBitPos = header.startBitPos;
@@ -137,6 +188,7 @@ public:
 		header.fullBloomSize = header.endBitPos - header.startBitPos + 1;
 		header.startBitPos = 0;
 		header.endBitPos = header.fullBloomSize - 1;
+		header.blocked = false;
 
 		Bloom::readData(m_array, header, in, loadType, shrinkFactor);
 	}
@@ -145,7 +197,7 @@ public:
 	void write(std::ostream& out) const
 	{
 		Bloom::write(m_array, m_fullBloomSize, m_startBitPos,
-			m_endBitPos, out);
+			m_endBitPos, m_hashNum, m_hashType, m_blocked, out);
 	}
 
 private:
@@ -20,11 +20,21 @@ class CascadingBloomFilter
 	/** Constructor */
 	CascadingBloomFilter() {}
 
-	/** Constructor */
-	CascadingBloomFilter(size_t n)
+	/** Constructor
+	 * @param n the number of bits of each level
+	 * @param hashNum the number of hash functions
+	 * @param hashType the hash function
+	 * @param blocked whether the bits of each element are in one block
+	 */
+	CascadingBloomFilter(size_t n, unsigned hashNum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY,
+			bool blocked = false)
 	{
 		for (unsigned i = 0; i < MAX_COUNT; i++)
-			m_data.push_back(new BloomFilter(n));
+			m_data.push_back(new BloomFilter(n,
+						hashNum, hashType, blocked));
+		if (hashNum > 1)
+			m_locks.resize(NUM_LOCKS);
 	}
 
 	/** Destructor */
@@ -51,10 +61,39 @@ class CascadingBloomFilter
 		return m_data.back()->popcount();
 	}
 
+	/** Return the number of hash functions. */
+	unsigned getHashNum() const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->getHashNum();
+	}
+
+	/** Return the hash function. */
+	Bloom::HashType getHashType() const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->getHashType();
+	}
+
+	/** Return whether the bits of each element are in one block. */
+	bool isBlocked() const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->isBlocked();
+	}
+
+	/** Return the index of the bit of the i-th hash value. */
+	size_t index(const size_t hashes[], unsigned i) const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->index(hashes, i);
+	}
+
 	/** Return the estimated false positive rate */
 	double FPR() const
 	{
-		return (double)popcount() / size();
+		assert(m_data.back() != NULL);
+		return m_data.back()->FPR();
 	}
 
 	/** Return whether the element with this index has count >=
@@ -66,11 +105,19 @@ class CascadingBloomFilter
 		return (*m_data.back())[i];
 	}
 
+	/** Return whether the element with these hash values has
+	 * count >= MAX_COUNT. */
+	bool contains(const size_t hashes[]) const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->contains(hashes);
+	}
+
 	/** Return whether this element has count >= MAX_COUNT. */
 	bool operator[](const Bloom::key_type& key) const
 	{
 		assert(m_data.back() != NULL);
-		return (*m_data.back())[Bloom::hash(key) % m_data.back()->size()];
+		return (*m_data.back())[key];
 	}
 
 	/** Add the object with the specified index to this multiset. */
@@ -85,11 +132,62 @@ class CascadingBloomFilter
 		}
 	}
 
+	/** Add the object with the specified index to this multiset,
+	 * atomically with respect to other threads. The bit is set in
+	 * the first level in which it was not already set. */
+	void insertAtomic(size_t index)
+	{
+		for (unsigned i = 0; i < MAX_COUNT; ++i) {
+			assert(m_data.at(i) != NULL);
+			if (!m_data[i]->insertAtomic(index))
+				break;
+		}
+	}
+
+	/** Add the object with these hash values to this Cascading
+	 * multiset. Its bits are set in the first level in which they
+	 * were not all already set. */
+	void insert(const size_t hashes[])
+	{
+		for (unsigned i = 0; i < MAX_COUNT; ++i) {
+			assert(m_data.at(i) != NULL);
+			if (!m_data[i]->contains(hashes)) {
+				m_data[i]->insert(hashes);
+				break;
+			}
+		}
+	}
+
+	/** Add the object with these hash values to this multiset,
+	 * atomically with respect to other threads. Its bits are set in
+	 * the first level in which they were not all already set.
+	 * Two threads that insert the same new object could each set
+	 * some of its bits and find them not all already set, so an
+	 * object with more than one bit holds a lock, which is chosen by
+	 * its first hash value. */
+	void insertAtomic(const size_t hashes[])
+	{
+		volatile int* lock = m_locks.empty() ? NULL
+			: &m_locks[hashes[0] % NUM_LOCKS].locked;
+		if (lock != NULL)
+			while (__sync_lock_test_and_set(lock, 1))
+				while (*lock)
+					;
+		for (unsigned i = 0; i < MAX_COUNT; ++i) {
+			assert(m_data.at(i) != NULL);
+			if (!m_data[i]->insertAtomic(hashes))
+				break;
+		}
+		if (lock != NULL)
+			__sync_lock_release(lock);
+	}
+
 	/** Add the object to this Cascading multiset. */
 	void insert(const Bloom::key_type& key)
 	{
-		assert(m_data.back() != NULL);
-		insert(Bloom::hash(key) % m_data.back()->size());
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, getHashType(), getHashNum(), hashes);
+		insert(hashes);
 	}
 
 	/** Get the Bloom filter for a given level */
@@ -113,8 +211,24 @@ class CascadingBloomFilter
 	}
 
   private:
+	/** The number of locks of an object with more than one bit. */
+	static const unsigned NUM_LOCKS = 1024;
+
+	/** A spin lock, padded to a cache line to avoid false
+	 * sharing. */
+	struct Lock
+	{
+		volatile int locked;
+		char padding[64 - sizeof (int)];
+		Lock() : locked(0) { }
+	};
+
 	std::vector<BloomFilter*> m_data;
 
+	/** The locks of insertAtomic, or empty if there is only one hash
+	 * function. */
+	std::vector<Lock> m_locks;
+
 };
 
 #endif
@@ -15,12 +15,20 @@ class CascadingBloomFilterWindow : private CascadingBloomFilter
 	 * @param fullBloomSize size in bits of the containing counting bloom filter
 	 * @param startBitPos index of first bit in the window
 	 * @param endBitPos index of last bit in the window
+	 * @param hashNum the number of hash functions
+	 * @param hashType the hash function
+	 * @param blocked whether the containing bloom filter is blocked
 	 */
-	CascadingBloomFilterWindow(size_t fullBloomSize, size_t startBitPos, size_t endBitPos)
+	CascadingBloomFilterWindow(size_t fullBloomSize, size_t startBitPos, size_t endBitPos,
+			unsigned hashNum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY,
+			bool blocked = false)
 		: m_fullBloomSize(fullBloomSize)
 	{
 		for (unsigned i = 0; i < MAX_COUNT; i++)
-			m_data.push_back(new BloomFilterWindow(fullBloomSize, startBitPos, endBitPos));
+			m_data.push_back(new BloomFilterWindow(fullBloomSize,
+						startBitPos, endBitPos, hashNum, hashType,
+						blocked));
 	}
 
 	/** Return the size of the bit array. */
@@ -37,10 +45,25 @@ class CascadingBloomFilterWindow : private CascadingBloomFilter
 		return m_data.back()->popcount();
 	}
 
+	/** Return the number of hash functions. */
+	unsigned getHashNum() const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->getHashNum();
+	}
+
+	/** Return the hash function. */
+	Bloom::HashType getHashType() const
+	{
+		assert(m_data.back() != NULL);
+		return m_data.back()->getHashType();
+	}
+
 	/** Return the estimated false positive rate */
 	double FPR() const
 	{
-		return (double)popcount() / size();
+		assert(m_data.back() != NULL);
+		return m_data.back()->FPR();
 	}
 
 	/** Add the object with the specified index to this multiset. */
@@ -55,11 +78,26 @@ class CascadingBloomFilterWindow : private CascadingBloomFilter
 		}
 	}
 
+	/** Add the object with these hash values to this counting
+	 * multiset. Its bits within this window are set in the first
+	 * level in which they were not all already set. */
+	void insert(const size_t hashes[])
+	{
+		for (unsigned i = 0; i < MAX_COUNT; ++i) {
+			assert(m_data.at(i) != NULL);
+			if (!m_data[i]->containsWithin(hashes)) {
+				m_data[i]->insert(hashes);
+				break;
+			}
+		}
+	}
+
 	/** Add the object to this counting multiset. */
 	void insert(const Bloom::key_type& key)
 	{
-		assert(m_data.back() != NULL);
-		insert(Bloom::hash(key) % m_fullBloomSize);
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, getHashType(), getHashNum(), hashes);
+		insert(hashes);
 	}
 
 	void write(std::ostream& out) const
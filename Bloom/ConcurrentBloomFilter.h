@@ -1,17 +1,21 @@
 #ifndef CONCURRENTBLOOMFILTER_H
-#define CONCURRENTBLOOMFILTER
-
-#ifndef _OPENMP
-# error ConcurrentBloomFilter class requires a compiler that supports OpenMP
-#endif
+#define CONCURRENTBLOOMFILTER_H 1
 
 #include "config.h"
-#include <vector>
-#include <omp.h>
+#include "Bloom/Bloom.h"
 
 /**
  * A wrapper class that makes a Bloom filter
- * thread-safe.
+ * thread-safe without locks. A bit is set by an
+ * atomic or of its 64-bit word, and is read
+ * without synchronization, because a bit that is
+ * set is never cleared. The wrapped Bloom filter
+ * must implement insertAtomic, which for a
+ * cascading Bloom filter sets the bits of an
+ * element in the first level in which they were
+ * not all already set. With more than one hash
+ * function, a cascading Bloom filter holds one of
+ * its locks while it inserts an element.
  */
 template <class BloomFilterType>
 class ConcurrentBloomFilter
@@ -20,77 +24,66 @@ class ConcurrentBloomFilter
 public:
 
 	/** Constructor */
-	ConcurrentBloomFilter(BloomFilterType& bloom, size_t numLocks) :
-		m_bloom(bloom), m_locks(numLocks)
-	{
-		m_windowSize = bloom.size() / numLocks;
-		// round down to the nearest byte boundary,
-		// because bytes that span locks will
-		// cause concurrency issues
-		m_windowSize -= m_windowSize % 8;
-		assert(numLocks < bloom.size());
-		for (size_t i = 0; i < m_locks.size(); i++)
-			omp_init_lock(&(m_locks.at(i)));
-	}
+	ConcurrentBloomFilter(BloomFilterType& bloom) : m_bloom(bloom) { }
 
-	/** Destructor */
-	~ConcurrentBloomFilter()
-	{
-		for (size_t i = 0; i < m_locks.size(); i++)
-			omp_destroy_lock(&(m_locks.at(i)));
-	}
+	/** Return the size of the bit array. */
+	size_t size() const { return m_bloom.size(); }
 
 	/** Return whether the specified bit is set. */
 	bool operator[](size_t i) const
 	{
 		assert(i < m_bloom.size());
-		bool bit;
-		getLock(i);
-			bit = m_bloom[i];
-		releaseLock(i);
-		return bit;
+		return m_bloom[i];
+	}
+
+	/** Return the number of hash functions. */
+	unsigned getHashNum() const { return m_bloom.getHashNum(); }
+
+	/** Return the hash function. */
+	Bloom::HashType getHashType() const { return m_bloom.getHashType(); }
+
+	/** Return whether the object with these hash values is present
+	 * in this set. */
+	bool contains(const size_t hashes[]) const
+	{
+		for (unsigned i = 0; i < getHashNum(); i++)
+			if (!(*this)[m_bloom.index(hashes, i)])
+				return false;
+		return true;
 	}
 
 	/** Return whether the object is present in this set. */
 	bool operator[](const Bloom::key_type& key) const
 	{
-		return *this[Bloom::hash(key) % m_bloom.size()];
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, getHashType(), getHashNum(), hashes);
+		return contains(hashes);
 	}
 
 	/** Add the object with the specified index to this set. */
 	void insert(size_t index)
 	{
 		assert(index < m_bloom.size());
-		getLock(index);
-			m_bloom.insert(index);
-		releaseLock(index);
+		m_bloom.insertAtomic(index);
 	}
 
-	/** Add the object to this set. */
-	void insert(const Bloom::key_type& key)
+	/** Add the object with these hash values to this set. */
+	void insert(const size_t hashes[])
 	{
-		insert(Bloom::hash(key) % m_bloom.size());
+		m_bloom.insertAtomic(hashes);
 	}
 
-private:
-
-	void getLock(size_t bitIndex)
+	/** Add the object to this set. */
+	void insert(const Bloom::key_type& key)
 	{
-		assert(bitIndex < m_bloom.size());
-		size_t lockIndex = std::min(bitIndex / m_windowSize, m_locks.size() - 1);
-		omp_set_lock(&(m_locks.at(lockIndex)));
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, getHashType(), getHashNum(), hashes);
+		insert(hashes);
 	}
 
-	void releaseLock(size_t bitIndex)
-	{
-		assert(bitIndex < m_bloom.size());
-		size_t lockIndex = std::min(bitIndex / m_windowSize, m_locks.size() - 1);
-		omp_unset_lock(&(m_locks.at(lockIndex)));
-	}
+private:
 
 	BloomFilterType& m_bloom;
-	std::vector<omp_lock_t> m_locks;
-	size_t m_windowSize;
 };
 
 #endif
@@ -0,0 +1,149 @@
+#ifndef ROLLINGHASH_H
+#define ROLLINGHASH_H 1
+
+#include "Common/Kmer.h"
+#include "Common/Options.h"
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+/**
+ * A rolling hash of a k-mer and its reverse complement, in the
+ * manner of ntHash. Each base is assigned a random 64-bit seed. The
+ * hash of a k-mer is the exclusive or of the seeds of its bases,
+ * each rotated by its distance from the end of the k-mer, so that
+ * shifting a base in or out of the k-mer updates the hash in
+ * constant time. The canonical hash is the lesser of the hashes of
+ * the two strands.
+ */
+class RollingHash
+{
+  public:
+
+	/** Construct an empty hash. */
+	RollingHash() : m_k(0), m_forward(0), m_reverse(0) { }
+
+	/** Construct the hash of the k bases of seq at pos, which must
+	 * all be ACGT. */
+	RollingHash(const std::string& seq, size_t pos, unsigned k)
+		: m_k(k), m_forward(0), m_reverse(0)
+	{
+		assert(pos + k <= seq.size());
+		for (unsigned i = 0; i < k; i++) {
+			int c = code(seq[pos + i]);
+			assert(c >= 0);
+			m_forward = rol(m_forward, 1) ^ seed(c);
+			m_reverse ^= rol(seed(complement(c)), i);
+		}
+	}
+
+	/** Construct the hash of the specified k-mer. */
+	explicit RollingHash(const Kmer& kmer)
+		: m_k(Kmer::length()), m_forward(0), m_reverse(0)
+	{
+		for (unsigned i = 0; i < m_k; i++) {
+			uint8_t c = kmer.at(i);
+			m_forward = rol(m_forward, 1) ^ seed(c);
+			m_reverse ^= rol(seed(complement(c)), i);
+		}
+	}
+
+	/** Shift the base in onto the end of the k-mer, and the base
+	 * out off its start. */
+	void rollRight(uint8_t out, uint8_t in)
+	{
+		assert(out < 4 && in < 4);
+		m_forward = rol(m_forward, 1) ^ rol(seed(out), m_k)
+			^ seed(in);
+		m_reverse = ror(m_reverse ^ seed(complement(out)), 1)
+			^ rol(seed(complement(in)), m_k - 1);
+	}
+
+	/** Shift the base in onto the start of the k-mer, and the base
+	 * out off its end. */
+	void rollLeft(uint8_t out, uint8_t in)
+	{
+		assert(out < 4 && in < 4);
+		m_forward = ror(m_forward ^ seed(out), 1)
+			^ rol(seed(in), m_k - 1);
+		m_reverse = rol(m_reverse, 1)
+			^ rol(seed(complement(out)), m_k)
+			^ seed(complement(in));
+	}
+
+	/** Return the canonical hash, which is the same for both
+	 * strands. */
+	uint64_t hash() const
+	{
+		return m_forward < m_reverse ? m_forward : m_reverse;
+	}
+
+	/** Derive n hash values from the canonical hash. */
+	void getHashes(unsigned n, size_t* hashes) const
+	{
+		uint64_t h = hash();
+		hashes[0] = h;
+		for (unsigned i = 1; i < n; i++) {
+			uint64_t x = h * (i ^ m_k * MULTI_SEED);
+			hashes[i] = x ^ x >> MULTI_SHIFT;
+		}
+	}
+
+	/** Return the code of the specified base, or -1 if it is not
+	 * ACGT. */
+	static int code(char c)
+	{
+		switch (c) {
+		  case 'A': case 'a': return 0;
+		  case 'C': case 'c': return 1;
+		  case 'G': case 'g': return 2;
+		  case 'T': case 't': return 3;
+		  default: return -1;
+		}
+	}
+
+  private:
+
+	static uint64_t rol(uint64_t x, unsigned n)
+	{
+		n &= 63;
+		return n == 0 ? x : x << n | x >> (64 - n);
+	}
+
+	static uint64_t ror(uint64_t x, unsigned n)
+	{
+		n &= 63;
+		return n == 0 ? x : x >> n | x << (64 - n);
+	}
+
+	/** Return the code of the complement of a base, which is the
+	 * base itself in colour space. */
+	static uint8_t complement(uint8_t c)
+	{
+		return opt::colourSpace ? c : 3 - c;
+	}
+
+	/** Multiplier used to derive further hash values. */
+	static const uint64_t MULTI_SEED = 0x90b45d39fb6da1faULL;
+
+	/** Shift used to derive further hash values. */
+	static const unsigned MULTI_SHIFT = 27;
+
+	/** Return the random seed of a base, which are those of
+	 * ntHash. */
+	static uint64_t seed(uint8_t c)
+	{
+		static const uint64_t seeds[4] = {
+			0x3c8bfbb395c60474ULL, 0x3193c18562a02b4cULL,
+			0x20323ed082572324ULL, 0x295549f54be24456ULL
+		};
+		return seeds[c];
+	}
+
+	unsigned m_k;
+	uint64_t m_forward;
+	uint64_t m_reverse;
+};
+
+#endif
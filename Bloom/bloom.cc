@@ -52,6 +52,16 @@ static const char USAGE_MESSAGE[] =
 " Options for `" PROGRAM " build':\n"
 "\n"
 "  -b, --bloom-size=N         size of bloom filter [500M]\n"
+"  -H, --hash-functions=N     use N hash functions [1]\n"
+"      --hash=TYPE            hash function: `rolling' to update the\n"
+"                             hash of each k-mer from the previous k-mer\n"
+"                             in constant time, or `city' to hash each\n"
+"                             canonical k-mer with CityHash [city]\n"
+"      --blocked              set the bits of each k-mer in one block of\n"
+"                             64 bytes, so that a lookup reads one cache\n"
+"                             line\n"
+"      --no-blocked           spread the bits of each k-mer over the\n"
+"                             whole bloom filter [default]\n"
 "  -j, --threads=N            use N parallel threads [1]\n"
 "  -l, --levels=N             build a cascading bloom filter with N levels\n"
 "                             and output the last level\n"
@@ -62,7 +72,8 @@ static const char USAGE_MESSAGE[] =
 "      --trim-masked          trim masked bases from the ends of reads\n"
 "      --no-trim-masked       do not trim masked bases from the ends\n"
 "                             of reads [default]\n"
-"  -n, --num-locks=N          number of write locks on bloom filter\n"
+"  -n, --num-locks=N          ignored, because the number of locks\n"
+"                             is fixed\n"
 "  -q, --trim-quality=N       trim bases from the ends of reads whose\n"
 "                             quality is less than the threshold\n"
 "      --standard-quality     zero quality is `!' (33)\n"
@@ -84,6 +95,15 @@ namespace opt {
 	/** The number of parallel threads. */
 	unsigned threads = 1;
 
+	/** The number of hash functions. */
+	unsigned hashNum = 1;
+
+	/** The hash function. */
+	Bloom::HashType hashType = Bloom::HASH_CITY;
+
+	/** Set the bits of each k-mer in one block. */
+	int blocked = 0;
+
 	/** The size of a k-mer. */
 	unsigned k;
 
@@ -96,12 +116,6 @@ namespace opt {
 	 */
 	vector< vector<string> > levelInitPaths;
 
-	/**
-	 * Num of locked windows to use, when invoking with
-	 * the -j option.
-	 */
-	size_t numLocks = 1000;
-
 	/** Index of bloom filter window.
 	  ("M" for -w option) */
 	unsigned windowIndex = 0;
@@ -111,12 +125,16 @@ namespace opt {
 	unsigned windows = 0;
 }
 
-static const char shortopts[] = "b:j:k:l:L:n:q:vw:";
+static const char shortopts[] = "b:H:j:k:l:L:n:q:vw:";
 
-enum { OPT_HELP = 1, OPT_VERSION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_HASH };
 
 static const struct option longopts[] = {
 	{ "bloom-size",       required_argument, NULL, 'b' },
+	{ "hash-functions",   required_argument, NULL, 'H' },
+	{ "hash",             required_argument, NULL, OPT_HASH },
+	{ "blocked",          no_argument, &opt::blocked, 1 },
+	{ "no-blocked",       no_argument, &opt::blocked, 0 },
 	{ "threads",          required_argument, NULL, 'j' },
 	{ "kmer",             required_argument, NULL, 'k' },
 	{ "levels",           required_argument, NULL, 'l' },
@@ -243,6 +261,16 @@ void initBloomFilterLevels(CBF& bf)
 			bf.getBloomFilter(i).read(*in, loadType);
 			assert(*in);
 			closeInputStream(in, path);
+			if (bf.getBloomFilter(i).getHashNum() != opt::hashNum
+					|| bf.getBloomFilter(i).getHashType()
+						!= opt::hashType
+					|| bf.getBloomFilter(i).isBlocked()
+						!= (bool)opt::blocked) {
+				cerr << PROGRAM ": `" << path << "' uses different "
+					"hash functions than the options -H, --hash and "
+					"--blocked\n";
+				exit(EXIT_FAILURE);
+			}
 		}
 	}
 }
@@ -250,8 +278,8 @@ void initBloomFilterLevels(CBF& bf)
 template <typename BF>
 void loadFilters(BF& bf, int argc, char** argv)
 {
-	for (int i = optind; i < argc; i++)
-		Bloom::loadFile(bf, opt::k, argv[i], opt::verbose);
+	Bloom::loadFiles(bf, opt::k,
+			vector<string>(argv + optind, argv + argc), opt::verbose);
 
 	if (opt::verbose)
 		cerr << "Successfully loaded bloom filter.\n";
@@ -279,6 +307,9 @@ template <typename BF>
 void printBloomStats(ostream& os, const BF& bloom)
 {
 	os << "Bloom size (bits): " << bloom.size() << "\n"
+		<< "Bloom hash functions: " << bloom.getHashNum()
+			<< " (" << Bloom::hashTypeName(bloom.getHashType())
+			<< (bloom.isBlocked() ? ", blocked" : "") << ")\n"
 		<< "Bloom popcount (bits): " << bloom.popcount() << "\n"
 		<< "Bloom filter FPR: " << setprecision(3)
 			<< 100 * bloom.FPR() << "%\n";
@@ -310,6 +341,19 @@ int build(int argc, char** argv)
 			dieWithUsageError();
 		  case 'b':
 			opt::bloomSize = SIToBytes(arg); break;
+		  case 'H':
+			arg >> opt::hashNum; break;
+		  case OPT_HASH:
+			{
+				string name;
+				arg >> name;
+				if (!Bloom::parseHashType(name, opt::hashType)) {
+					cerr << PROGRAM ": unknown hash function `"
+						<< name << "'\n";
+					dieWithUsageError();
+				}
+				break;
+			}
 		  case 'j':
 			arg >> opt::threads; break;
 		  case 'l':
@@ -330,7 +374,12 @@ int build(int argc, char** argv)
 				break;
 			}
 		  case 'n':
-			arg >> opt::numLocks; break;
+			{
+				// for compatibility
+				size_t numLocks;
+				arg >> numLocks;
+				break;
+			}
 		  case 'q':
 			arg >> opt::qualityThreshold; break;
 		  case 'w':
@@ -346,6 +395,12 @@ int build(int argc, char** argv)
 		}
 	}
 
+	if (opt::hashNum == 0 || opt::hashNum > Bloom::MAX_HASHES) {
+		cerr << PROGRAM ": the number of hash functions (-H) must be "
+			"between 1 and " << Bloom::MAX_HASHES << "\n";
+		dieWithUsageError();
+	}
+
 	if (opt::levels > 2)
 	{
 		cerr << PROGRAM ": -l > 2 is not currently supported\n";
@@ -387,6 +442,13 @@ int build(int argc, char** argv)
 		dieWithUsageError();
 	}
 
+	if (opt::blocked && bits / opt::levels % Bloom::BLOCK_BITS != 0) {
+		cerr << PROGRAM ": the size of each level of a blocked bloom "
+			"filter must be a multiple of " << Bloom::BLOCK_BITS / 8
+			<< " bytes\n";
+		dieWithUsageError();
+	}
+
 	if (argc - optind < 2) {
 		cerr << PROGRAM ": missing arguments\n";
 		dieWithUsageError();
@@ -402,10 +464,10 @@ int build(int argc, char** argv)
 	if (opt::windows == 0) {
 
 		if (opt::levels == 1) {
-			BloomFilter bloom(bits);
+			BloomFilter bloom(bits, opt::hashNum, opt::hashType,
+					opt::blocked);
 #ifdef _OPENMP
-			ConcurrentBloomFilter<BloomFilter>
-				cbf(bloom, opt::numLocks);
+			ConcurrentBloomFilter<BloomFilter> cbf(bloom);
 			loadFilters(cbf, argc, argv);
 #else
 			loadFilters(bloom, argc, argv);
@@ -414,11 +476,11 @@ int build(int argc, char** argv)
 			writeBloom(bloom, outputPath);
 		}
 		else {
-			CascadingBloomFilter cascadingBloom(bits);
+			CascadingBloomFilter cascadingBloom(bits,
+					opt::hashNum, opt::hashType, opt::blocked);
 			initBloomFilterLevels(cascadingBloom);
 #ifdef _OPENMP
-			ConcurrentBloomFilter<CascadingBloomFilter>
-				cbf(cascadingBloom, opt::numLocks);
+			ConcurrentBloomFilter<CascadingBloomFilter> cbf(cascadingBloom);
 			loadFilters(cbf, argc, argv);
 #else
 			loadFilters(cascadingBloom, argc, argv);
@@ -439,13 +501,16 @@ int build(int argc, char** argv)
 			endBitPos = bits - 1;
 
 		if (opt::levels == 1) {
-			BloomFilterWindow bloom(bits, startBitPos, endBitPos);
+			BloomFilterWindow bloom(bits, startBitPos, endBitPos,
+					opt::hashNum, opt::hashType, opt::blocked);
 			loadFilters(bloom, argc, argv);
 			printBloomStats(cerr, bloom);
 			writeBloom(bloom, outputPath);
 		}
 		else {
-			CascadingBloomFilterWindow cascadingBloom(bits, startBitPos, endBitPos);
+			CascadingBloomFilterWindow cascadingBloom(bits,
+					startBitPos, endBitPos,
+					opt::hashNum, opt::hashType, opt::blocked);
 			initBloomFilterLevels(cascadingBloom);
 			loadFilters(cascadingBloom, argc, argv);
 			printCascadingBloomStats(cerr, cascadingBloom);
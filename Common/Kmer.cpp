@@ -14,6 +14,9 @@ unsigned Kmer::s_length;
 /** The size of a k-mer in bytes. */
 unsigned Kmer::s_bytes;
 
+/** The size of a k-mer in 64-bit words. */
+unsigned Kmer::s_words;
+
 static unsigned seqIndexToByteNumber(unsigned seqIndex);
 static unsigned seqIndexToBaseIndex(unsigned seqIndex);
 static uint8_t getBaseCode(const char* pSeq,
@@ -25,7 +28,7 @@ static void setBaseCode(char* pSeq,
 Kmer::Kmer(const Sequence& seq)
 {
 	assert(seq.length() == s_length);
-	memset(m_seq, 0, NUM_BYTES);
+	memset(m_seq, 0, sizeof m_seq);
 	const char* p = seq.data();
 	for (unsigned i = 0; i < s_length; i++)
 		set(i, baseToCode(*p++));
@@ -76,234 +79,389 @@ Sequence Kmer::str() const
 	return s;
 }
 
-/** Swap the positions of four bases. */
-static const uint8_t swapBases[256] = {
-	0x00, 0x40, 0x80, 0xc0, 0x10, 0x50, 0x90, 0xd0,
-	0x20, 0x60, 0xa0, 0xe0, 0x30, 0x70, 0xb0, 0xf0,
-	0x04, 0x44, 0x84, 0xc4, 0x14, 0x54, 0x94, 0xd4,
-	0x24, 0x64, 0xa4, 0xe4, 0x34, 0x74, 0xb4, 0xf4,
-	0x08, 0x48, 0x88, 0xc8, 0x18, 0x58, 0x98, 0xd8,
-	0x28, 0x68, 0xa8, 0xe8, 0x38, 0x78, 0xb8, 0xf8,
-	0x0c, 0x4c, 0x8c, 0xcc, 0x1c, 0x5c, 0x9c, 0xdc,
-	0x2c, 0x6c, 0xac, 0xec, 0x3c, 0x7c, 0xbc, 0xfc,
-	0x01, 0x41, 0x81, 0xc1, 0x11, 0x51, 0x91, 0xd1,
-	0x21, 0x61, 0xa1, 0xe1, 0x31, 0x71, 0xb1, 0xf1,
-	0x05, 0x45, 0x85, 0xc5, 0x15, 0x55, 0x95, 0xd5,
-	0x25, 0x65, 0xa5, 0xe5, 0x35, 0x75, 0xb5, 0xf5,
-	0x09, 0x49, 0x89, 0xc9, 0x19, 0x59, 0x99, 0xd9,
-	0x29, 0x69, 0xa9, 0xe9, 0x39, 0x79, 0xb9, 0xf9,
-	0x0d, 0x4d, 0x8d, 0xcd, 0x1d, 0x5d, 0x9d, 0xdd,
-	0x2d, 0x6d, 0xad, 0xed, 0x3d, 0x7d, 0xbd, 0xfd,
-	0x02, 0x42, 0x82, 0xc2, 0x12, 0x52, 0x92, 0xd2,
-	0x22, 0x62, 0xa2, 0xe2, 0x32, 0x72, 0xb2, 0xf2,
-	0x06, 0x46, 0x86, 0xc6, 0x16, 0x56, 0x96, 0xd6,
-	0x26, 0x66, 0xa6, 0xe6, 0x36, 0x76, 0xb6, 0xf6,
-	0x0a, 0x4a, 0x8a, 0xca, 0x1a, 0x5a, 0x9a, 0xda,
-	0x2a, 0x6a, 0xaa, 0xea, 0x3a, 0x7a, 0xba, 0xfa,
-	0x0e, 0x4e, 0x8e, 0xce, 0x1e, 0x5e, 0x9e, 0xde,
-	0x2e, 0x6e, 0xae, 0xee, 0x3e, 0x7e, 0xbe, 0xfe,
-	0x03, 0x43, 0x83, 0xc3, 0x13, 0x53, 0x93, 0xd3,
-	0x23, 0x63, 0xa3, 0xe3, 0x33, 0x73, 0xb3, 0xf3,
-	0x07, 0x47, 0x87, 0xc7, 0x17, 0x57, 0x97, 0xd7,
-	0x27, 0x67, 0xa7, 0xe7, 0x37, 0x77, 0xb7, 0xf7,
-	0x0b, 0x4b, 0x8b, 0xcb, 0x1b, 0x5b, 0x9b, 0xdb,
-	0x2b, 0x6b, 0xab, 0xeb, 0x3b, 0x7b, 0xbb, 0xfb,
-	0x0f, 0x4f, 0x8f, 0xcf, 0x1f, 0x5f, 0x9f, 0xdf,
-	0x2f, 0x6f, 0xaf, 0xef, 0x3f, 0x7f, 0xbf, 0xff
-};
+/** The maximum number of 64-bit words of a k-mer. */
+static const unsigned MAX_WORDS = Kmer::NUM_WORDS;
 
-#if MAX_KMER > 96
-# include <bitset>
-typedef bitset<2 * MAX_KMER> Seq;
+/** Load a word of eight packed bytes. The first base is stored in
+ * the most significant bits.
+ */
+static inline uint64_t loadWord(const char* p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof x);
+#if WORDS_BIGENDIAN
+	return x;
+#elif __GNUC__
+	return __builtin_bswap64(x);
 #else
-# define SEQ_WORDS ((Kmer::NUM_BYTES + 7)/8)
-# define SEQ_BITS (64 * SEQ_WORDS)
-# define SEQ_FULL_WORDS ((int)Kmer::NUM_BYTES/8)
-# define SEQ_ODD_BYTES (Kmer::NUM_BYTES - 8*SEQ_FULL_WORDS)
-
-/** A sequence of bits of length SEQ_BITS. */
-struct Seq {
-	uint64_t x[SEQ_WORDS];
-
-	/** Return the number of bits in this sequence. */
-	static unsigned size() { return SEQ_BITS; }
-
-	/** Flip all the bits. */
-	void flip()
-	{
-		for (unsigned i = 0; i < SEQ_WORDS; i++)
-			x[i] = ~x[i];
-	}
+	const uint8_t* q = reinterpret_cast<const uint8_t*>(p);
+	x = 0;
+	for (unsigned i = 0; i < 8; i++)
+		x = x << 8 | q[i];
+	return x;
+#endif
+}
 
-	/** Shift right by the specified number of bits. */
-	void operator>>=(uint8_t n)
-	{
-		if (n == 0)
-			return;
-#if MAX_KMER <= 32
-		x[0] >>= n;
-#elif MAX_KMER <= 64
-		uint64_t x0 = x[0], x1 = x[1];
-		if (n < 64) {
-			x[0] = x0 >> n;
-			x[1] = x1 >> n | x0 << (64 - n);
+/** Store a word of eight packed bytes. */
+static inline void storeWord(char* p, uint64_t x)
+{
+#if WORDS_BIGENDIAN
+#elif __GNUC__
+	x = __builtin_bswap64(x);
+#else
+	uint64_t y = 0;
+	for (unsigned i = 0; i < 8; i++, x >>= 8)
+		y = y << 8 | (x & 0xff);
+	x = y;
+#endif
+	memcpy(p, &x, sizeof x);
+}
+
+/** Load the first n words of a k-mer. The storage of a k-mer ends
+ * before the end of its last word when MAX_KMER is not a multiple of
+ * 32, and the missing bytes are zero.
+ */
+static inline void load(unsigned n, const char* p, uint64_t* x)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (8*i + 8 <= Kmer::NUM_BYTES) {
+			x[i] = loadWord(p + 8*i);
 		} else {
-			x[0] = 0;
-			x[1] = x0 >> (n - 64);
+			char buf[8] = { 0 };
+			memcpy(buf, p + 8*i, Kmer::NUM_BYTES - 8*i);
+			x[i] = loadWord(buf);
 		}
-#elif MAX_KMER <= 96
-		uint64_t x0 = x[0], x1 = x[1], x2 = x[2];
-		if (n < 64) {
-			x[0] = x0 >> n;
-			x[1] = x1 >> n | x0 << (64 - n);
-			x[2] = x2 >> n | x1 << (64 - n);
-		} else if (n == 64) {
-			x[0] = 0;
-			x[1] = x0;
-			x[2] = x1;
-		} else if (n < 128) {
-			n -= 64;
-			x[0] = 0;
-			x[1] = x0 >> n;
-			x[2] = x1 >> n | x0 << (64 - n);
+	}
+}
+
+/** Store the first n words of a k-mer. The bytes of the last word
+ * that follow the storage of a k-mer are zero, and are dropped.
+ */
+static inline void store(unsigned n, char* p, const uint64_t* x)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (8*i + 8 <= Kmer::NUM_BYTES) {
+			storeWord(p + 8*i, x[i]);
 		} else {
-			n -= 128;
-			x[0] = 0;
-			x[1] = 0;
-			x[2] = x0 >> n;
+			char buf[8];
+			storeWord(buf, x[i]);
+			memcpy(p + 8*i, buf, Kmer::NUM_BYTES - 8*i);
 		}
+	}
+}
+
+/** Return the number of bits of the last of n words used by a k-mer.
+ */
+static inline unsigned lastBits(unsigned n)
+{
+	return 2 * Kmer::length() - 64 * (n - 1);
+}
+
+/** Return the mask of the bits of the last of n words used by a
+ * k-mer. */
+static inline uint64_t lastMask(unsigned n)
+{
+	unsigned bits = lastBits(n);
+	return bits == 64 ? ~(uint64_t)0 : ~(~(uint64_t)0 >> bits);
+}
+
+/** Reverse the order of the 32 bases of a word. */
+static inline uint64_t reverseBases(uint64_t x)
+{
+	x = (x & 0x3333333333333333ULL) << 2
+		| (x >> 2 & 0x3333333333333333ULL);
+	x = (x & 0x0f0f0f0f0f0f0f0fULL) << 4
+		| (x >> 4 & 0x0f0f0f0f0f0f0f0fULL);
+#if __GNUC__
+	return __builtin_bswap64(x);
 #else
-# error
+	x = (x & 0x00ff00ff00ff00ffULL) << 8
+		| (x >> 8 & 0x00ff00ff00ff00ffULL);
+	x = (x & 0x0000ffff0000ffffULL) << 16
+		| (x >> 16 & 0x0000ffff0000ffffULL);
+	return x << 32 | x >> 32;
 #endif
+}
+
+/** Store the reverse (complement) of the n words x in y. */
+static inline void reverseComplement(unsigned n,
+		const uint64_t* x, uint64_t* y, bool complement)
+{
+	const uint64_t flip = complement ? ~(uint64_t)0 : 0;
+	for (unsigned i = 0; i < n; i++)
+		y[i] = reverseBases(x[n - 1 - i] ^ flip);
+
+	// Shift the bits flush to the left of the first word.
+	unsigned shift = 64 - lastBits(n);
+	if (shift > 0) {
+		for (unsigned i = 0; i < n - 1; i++)
+			y[i] = y[i] << shift | y[i + 1] >> (64 - shift);
+		y[n - 1] <<= shift;
 	}
-};
+}
+
+/** Reverse-complement the n words of a k-mer. */
+static inline void reverseComplement(unsigned n, char* p)
+{
+	uint64_t x[MAX_WORDS], y[MAX_WORDS];
+	load(n, p, x);
+	reverseComplement(n, x, y, !opt::colourSpace);
+	store(n, p, y);
+}
+
+/** Return whether the n words of a k-mer are less than or equal to
+ * its reverse complement. The words of the reverse complement are
+ * computed one at a time, and only until they differ.
+ */
+static inline bool isCanonical(unsigned n, const char* p)
+{
+	uint64_t x[MAX_WORDS];
+	load(n, p, x);
+	unsigned shift = 64 - lastBits(n);
+	uint64_t next = reverseBases(~x[n - 1]);
+	for (unsigned i = 0; i < n; i++) {
+		uint64_t y = next;
+		next = i + 1 < n ? reverseBases(~x[n - 2 - i]) : 0;
+		if (shift > 0)
+			y = y << shift | next >> (64 - shift);
+		if (x[i] != y)
+			return x[i] < y;
+	}
+	return true;
+}
+
+/** Shift the n words of a k-mer left and append a base.
+ * @return the base shifted out
+ */
+static inline uint8_t shiftAppend(unsigned n, char* p, uint8_t base)
+{
+	uint64_t x[MAX_WORDS];
+	load(n, p, x);
+	uint8_t out = x[0] >> 62;
+	for (unsigned i = 0; i < n - 1; i++)
+		x[i] = x[i] << 2 | x[i + 1] >> 62;
+	x[n - 1] = (x[n - 1] << 2 & lastMask(n))
+		| (uint64_t)base << (64 - lastBits(n));
+	store(n, p, x);
+	return out;
+}
+
+/** Shift the n words of a k-mer right and prepend a base.
+ * @return the base shifted out
+ */
+static inline uint8_t shiftPrepend(unsigned n, char* p, uint8_t base)
+{
+	uint64_t x[MAX_WORDS];
+	load(n, p, x);
+	uint8_t out = x[n - 1] >> (64 - lastBits(n)) & 0x3;
+	for (unsigned i = n - 1; i > 0; i--)
+		x[i] = x[i] >> 2 | x[i - 1] << 62;
+	x[0] = x[0] >> 2 | (uint64_t)base << 62;
+	x[n - 1] &= lastMask(n);
+	store(n, p, x);
+	return out;
+}
+
+#if __GNUC__ && __x86_64__ && MAX_KMER >= 64
+# define KMER_SIMD 1
+# include <immintrin.h>
 #endif
 
-/** Load with appropriate endianness for shifting. */
-static Seq load(const uint8_t *src)
+#if KMER_SIMD
+/** The implementation of the reverse complement. */
+enum RCMethod { RC_WORDS, RC_SSSE3, RC_AVX2 };
+
+/** The implementation of the reverse complement at this k. */
+static RCMethod s_rcMethod = RC_WORDS;
+
+/** The byte shuffle that reverses the packed bytes of a k-mer. The
+ * first table selects bytes from the same 128-bit lane, and the second
+ * selects bytes from the other lane.
+ */
+static uint8_t s_shuffle[2][32] __attribute__((aligned(32)));
+
+/** The number of bits to shift the reversed bytes left. */
+static unsigned s_bitShift;
+
+/** Reverse the two bases in each nibble, and shift the result to the
+ * opposite nibble of the byte. */
+static const uint8_t reverseNibbleLo[16] __attribute__((aligned(16))) = {
+	0x00, 0x40, 0x80, 0xc0, 0x10, 0x50, 0x90, 0xd0,
+	0x20, 0x60, 0xa0, 0xe0, 0x30, 0x70, 0xb0, 0xf0
+};
+static const uint8_t reverseNibbleHi[16] __attribute__((aligned(16))) = {
+	0x00, 0x04, 0x08, 0x0c, 0x01, 0x05, 0x09, 0x0d,
+	0x02, 0x06, 0x0a, 0x0e, 0x03, 0x07, 0x0b, 0x0f
+};
+
+/** Reverse-complement the packed bytes of a k-mer of at most 16
+ * bytes using SSSE3: shuffle the bytes into reverse order, reverse
+ * the four bases of each byte using a nibble lookup, and shift the
+ * bits flush to the left.
+ */
+__attribute__((target("ssse3")))
+static void reverseComplementSSSE3(char* p, bool complement)
 {
-	Seq seq;
-#if MAX_KMER > 96
-# if WORDS_BIGENDIAN
-	const uint64_t *s = reinterpret_cast<const uint64_t*>(src);
-	uint64_t *d = reinterpret_cast<uint64_t*>(&seq + 1);
-	copy(s, s + SEQ_WORDS, reverse_iterator<uint64_t*>(d));
-# else
-	uint8_t *d = reinterpret_cast<uint8_t*>(&seq);
-	memcpy(d, src, sizeof seq);
-	reverse(d, d + sizeof seq);
-# endif
-#else
-	uint64_t *px = seq.x;
-	const uint8_t *p = src;
-	for (int i = 0; i < SEQ_FULL_WORDS; i++) {
-		*px++ = (uint64_t)p[0] << 56
-			| (uint64_t)p[1] << 48
-			| (uint64_t)p[2] << 40
-			| (uint64_t)p[3] << 32
-			| (uint64_t)p[4] << 24
-			| (uint64_t)p[5] << 16
-			| (uint64_t)p[6] << 8
-			| (uint64_t)p[7] << 0;
-		p += 8;
+	__m128i* q = reinterpret_cast<__m128i*>(p);
+	__m128i x = _mm_loadu_si128(q);
+	if (complement)
+		x = _mm_xor_si128(x, _mm_set1_epi8(-1));
+	x = _mm_shuffle_epi8(x, _mm_load_si128(
+				reinterpret_cast<const __m128i*>(s_shuffle[0])));
+
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	__m128i lo = _mm_and_si128(x, nibble);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+	x = _mm_or_si128(
+		_mm_shuffle_epi8(_mm_load_si128(
+			reinterpret_cast<const __m128i*>(reverseNibbleLo)), lo),
+		_mm_shuffle_epi8(_mm_load_si128(
+			reinterpret_cast<const __m128i*>(reverseNibbleHi)), hi));
+
+	if (s_bitShift > 0) {
+		unsigned r = s_bitShift;
+		__m128i next = _mm_srli_si128(x, 1);
+		x = _mm_or_si128(
+			_mm_and_si128(_mm_sll_epi16(x, _mm_cvtsi32_si128(r)),
+				_mm_set1_epi8((char)(0xff << r))),
+			_mm_and_si128(
+				_mm_srl_epi16(next, _mm_cvtsi32_si128(8 - r)),
+				_mm_set1_epi8((char)(0xff >> (8 - r)))));
 	}
-	if (SEQ_ODD_BYTES > 0) {
-		uint64_t x = 0;
-		if (SEQ_ODD_BYTES > 0) x |= (uint64_t)p[0] << 56;
-		if (SEQ_ODD_BYTES > 1) x |= (uint64_t)p[1] << 48;
-		if (SEQ_ODD_BYTES > 2) x |= (uint64_t)p[2] << 40;
-		if (SEQ_ODD_BYTES > 3) x |= (uint64_t)p[3] << 32;
-		if (SEQ_ODD_BYTES > 4) x |= (uint64_t)p[4] << 24;
-		if (SEQ_ODD_BYTES > 5) x |= (uint64_t)p[5] << 16;
-		if (SEQ_ODD_BYTES > 6) x |= (uint64_t)p[6] << 8;
-		if (SEQ_ODD_BYTES > 7) x |= (uint64_t)p[7] << 0;
-		*px = x;
+	_mm_storeu_si128(q, x);
+}
+
+/** Reverse-complement the packed bytes of a k-mer of at most 32
+ * bytes using AVX2. The bytes are reversed within each lane and
+ * merged with the bytes of the other lane.
+ */
+__attribute__((target("avx2")))
+static void reverseComplementAVX2(char* p, bool complement)
+{
+	__m256i* q = reinterpret_cast<__m256i*>(p);
+	__m256i x = _mm256_loadu_si256(q);
+	if (complement)
+		x = _mm256_xor_si256(x, _mm256_set1_epi8(-1));
+	__m256i swapped = _mm256_permute4x64_epi64(x, 0x4e);
+	x = _mm256_or_si256(
+		_mm256_shuffle_epi8(x, _mm256_load_si256(
+				reinterpret_cast<const __m256i*>(s_shuffle[0]))),
+		_mm256_shuffle_epi8(swapped, _mm256_load_si256(
+				reinterpret_cast<const __m256i*>(s_shuffle[1]))));
+
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(x, nibble);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+	x = _mm256_or_si256(
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_load_si128(reinterpret_cast<const __m128i*>(
+					reverseNibbleLo))), lo),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_load_si128(reinterpret_cast<const __m128i*>(
+					reverseNibbleHi))), hi));
+
+	if (s_bitShift > 0) {
+		unsigned r = s_bitShift;
+		__m256i next = _mm256_alignr_epi8(
+				_mm256_permute2x128_si256(x, x, 0x81), x, 1);
+		x = _mm256_or_si256(
+			_mm256_and_si256(_mm256_sll_epi16(x, _mm_cvtsi32_si128(r)),
+				_mm256_set1_epi8((char)(0xff << r))),
+			_mm256_and_si256(
+				_mm256_srl_epi16(next, _mm_cvtsi32_si128(8 - r)),
+				_mm256_set1_epi8((char)(0xff >> (8 - r)))));
 	}
-#endif
-	return seq;
+	_mm256_storeu_si256(q, x);
 }
+#endif
 
-/**
- * Reverse the bytes by storing them in the reverse order of
- * loading, and reverse the words in the same fashion.
+/** Set the length of a k-mer.
+ * This value is shared by all instances.
  */
-static void storeReverse(uint8_t *dest, const Seq seq)
+void Kmer::setLength(unsigned length)
 {
-#if MAX_KMER > 96
-# if WORDS_BIGENDIAN
-	const uint64_t *s = reinterpret_cast<const uint64_t*>(&seq);
-	uint64_t *d = reinterpret_cast<uint64_t*>(dest);
-	copy(s, s + SEQ_WORDS,
-			reverse_iterator<uint64_t*>(d + SEQ_WORDS));
-	reverse(dest, dest + Kmer::NUM_BYTES);
-# else
-	memcpy(dest, &seq, Kmer::NUM_BYTES);
-# endif
-#else
-	const uint64_t *px = &seq.x[SEQ_WORDS-1];
-# if WORDS_BIGENDIAN
-	for (int i = 0; i < SEQ_FULL_WORDS; i++) {
-		dest[0] = *px >> 0;
-		dest[1] = *px >> 8;
-		dest[2] = *px >> 16;
-		dest[3] = *px >> 24;
-		dest[4] = *px >> 32;
-		dest[5] = *px >> 40;
-		dest[6] = *px >> 48;
-		dest[7] = *px >> 56;
-		dest += 8;
-		px--;
+	assert(length <= MAX_KMER);
+	s_length = length;
+	s_bytes = (length + 3) / 4;
+	s_words = (length + 31) / 32;
+
+#if KMER_SIMD
+	s_rcMethod = RC_WORDS;
+	s_bitShift = 8 * s_bytes - 2 * length;
+	for (unsigned i = 0; i < 32; i++) {
+		unsigned j = s_bytes - 1 - i;
+		bool sameLane = i / 16 == j / 16;
+		s_shuffle[0][i] = i < s_bytes && sameLane ? j % 16 : 0x80;
+		s_shuffle[1][i] = i < s_bytes && !sameLane ? j % 16 : 0x80;
 	}
-# else
-	uint64_t *d = (uint64_t*)dest;
-	for (int i = 0; i < SEQ_FULL_WORDS; i++)
-		*d++ = *px--;
-	dest = (uint8_t*)d;
-# endif
-	if (SEQ_ODD_BYTES > 0) dest[0] = *px >> 0;
-	if (SEQ_ODD_BYTES > 1) dest[1] = *px >> 8;
-	if (SEQ_ODD_BYTES > 2) dest[2] = *px >> 16;
-	if (SEQ_ODD_BYTES > 3) dest[3] = *px >> 24;
-	if (SEQ_ODD_BYTES > 4) dest[4] = *px >> 32;
-	if (SEQ_ODD_BYTES > 5) dest[5] = *px >> 40;
-	if (SEQ_ODD_BYTES > 6) dest[6] = *px >> 48;
-	if (SEQ_ODD_BYTES > 7) dest[7] = *px >> 56;
+
+	__builtin_cpu_init();
+	if (s_bytes <= 16 && sizeof (Kmer) >= 16
+			&& __builtin_cpu_supports("ssse3"))
+		s_rcMethod = RC_SSSE3;
+	else if (s_bytes <= 32 && sizeof (Kmer) >= 32
+			&& __builtin_cpu_supports("avx2"))
+		s_rcMethod = RC_AVX2;
 #endif
 }
 
+/** Evaluate and return the expression f, which depends on the
+ * number of words n of a k-mer. The common sizes of one to four words
+ * are specialized so that the compiler unrolls the loops over words.
+ */
+#define KMER_CASE(N, f) case N: { const unsigned n = N; return f; }
+#if MAX_KMER > 32
+# define KMER_CASE_1(f) KMER_CASE(1, f)
+#else
+# define KMER_CASE_1(f)
+#endif
+#if MAX_KMER > 64
+# define KMER_CASE_2(f) KMER_CASE(2, f)
+#else
+# define KMER_CASE_2(f)
+#endif
+#if MAX_KMER > 96
+# define KMER_CASE_3(f) KMER_CASE(3, f)
+#else
+# define KMER_CASE_3(f)
+#endif
+#if MAX_KMER > 128
+# define KMER_CASE_4(f) KMER_CASE(4, f)
+# define KMER_DEFAULT_WORDS std::max(s_words, 5U)
+#else
+# define KMER_CASE_4(f)
+# define KMER_DEFAULT_WORDS MAX_WORDS
+#endif
+#define KMER_DISPATCH(f) \
+	switch (s_words) { \
+	  KMER_CASE_1(f) \
+	  KMER_CASE_2(f) \
+	  KMER_CASE_3(f) \
+	  KMER_CASE_4(f) \
+	  default: { const unsigned n = KMER_DEFAULT_WORDS; return f; } \
+	}
+
 /** Reverse-complement this sequence. */
 void Kmer::reverseComplement()
 {
-	Seq seq = load((uint8_t*)m_seq);
-
-	// Complement the bits.
-	if (!opt::colourSpace)
-		seq.flip();
-
-	// Shift the bits flush to the right of the double word.
-	seq >>= seq.size() - 2*s_length;
-
-	storeReverse((uint8_t*)m_seq, seq);
-
-	// Reverse the pairs of bits withing a byte.
-	unsigned numBytes = bytes();
-	for (unsigned i = 0; i < numBytes; i++)
-		m_seq[i] = swapBases[(uint8_t)m_seq[i]];
+#if KMER_SIMD
+	switch (s_rcMethod) {
+	  case RC_SSSE3:
+		return reverseComplementSSSE3(m_seq, !opt::colourSpace);
+	  case RC_AVX2:
+		return reverseComplementAVX2(m_seq, !opt::colourSpace);
+	  case RC_WORDS:
+		break;
+	}
+#endif
+	KMER_DISPATCH((::reverseComplement(n, m_seq)));
 }
 
+/** Return whether this k-mer is less than or equal to its reverse
+ * complement. */
 bool Kmer::isCanonical() const
 {
-	for (unsigned i = 0, j = s_length - 1;
-		i < s_length / 2 + s_length % 2; i++, j--) {
-		uint8_t base = getBaseCode(m_seq,
-			seqIndexToByteNumber(i), seqIndexToBaseIndex(i));
-		uint8_t rcBase = 0x3 & ~getBaseCode(m_seq,
-			seqIndexToByteNumber(j), seqIndexToBaseIndex(j));
-		if (base == rcBase)
-			continue;
-		return rcBase > base;
-	}
-	return true;
+	KMER_DISPATCH((::isCanonical(n, m_seq)));
 }
 
 void Kmer::canonicalize()
@@ -322,15 +480,7 @@ void Kmer::setLastBase(extDirection dir, uint8_t base)
  */
 uint8_t Kmer::shiftAppend(uint8_t base)
 {
-	unsigned numBytes = bytes();
-	uint8_t shiftIn = base;
-	for(int i = numBytes - 1; i >= 0; i--)
-	{
-		unsigned index = (unsigned)i == numBytes - 1
-			? seqIndexToBaseIndex(s_length - 1) : 3;
-		shiftIn = leftShiftByte(m_seq, i, index, shiftIn);
-	}
-	return shiftIn;
+	KMER_DISPATCH((::shiftAppend(n, m_seq, base)));
 }
 
 /** Shift the sequence right and prepend a new base at the front.
@@ -338,55 +488,7 @@ uint8_t Kmer::shiftAppend(uint8_t base)
  */
 uint8_t Kmer::shiftPrepend(uint8_t base)
 {
-	unsigned numBytes = bytes();
-
-	unsigned lastBaseByte = seqIndexToByteNumber(s_length - 1);
-	unsigned lastBaseIndex = seqIndexToBaseIndex(s_length - 1);
-
-	// save the last base (which gets shifted out)
-	uint8_t lastBase = getBaseCode(m_seq,
-			lastBaseByte, lastBaseIndex);
-	// Zero the last base, which is required by compare.
-	setBaseCode(m_seq, lastBaseByte, lastBaseIndex, 0);
-
-	uint8_t shiftIn = base;
-	for(unsigned i = 0; i <= numBytes - 1; i++)
-	{
-		// index is always zero
-		unsigned index = 0;
-		shiftIn = rightShiftByte(m_seq, i, index, shiftIn);
-	}
-	return lastBase;
-}
-
-uint8_t Kmer::leftShiftByte(char* pSeq,
-		unsigned byteNum, unsigned index, uint8_t base)
-{
-	// save the first base
-	uint8_t outBase = (pSeq[byteNum] >> 6) & 0x3;
-
-	// shift left one position
-	pSeq[byteNum] <<= 2;
-
-	// Set the new base
-	setBaseCode(pSeq, byteNum, index, base);
-
-	return outBase;
-}
-
-uint8_t Kmer::rightShiftByte(char* pSeq,
-		unsigned byteNum, unsigned index, uint8_t base)
-{
-	// save the last base
-	uint8_t outBase = pSeq[byteNum] & 0x3;
-
-	// shift right one position
-	pSeq[byteNum] >>= 2;
-
-	// add the new base
-	setBaseCode(pSeq, byteNum, index, base);
-
-	return outBase;
+	KMER_DISPATCH((::shiftPrepend(n, m_seq, base)));
 }
 
 //Set a base by byte number/ sub index
@@ -41,15 +41,7 @@ class Kmer
 
 	static unsigned length() { return s_length; }
 
-	/** Set the length of a k-mer.
-	 * This value is shared by all instances.
-	 */
-	static void setLength(unsigned length)
-	{
-		assert(length <= MAX_KMER);
-		s_length = length;
-		s_bytes = (length + 3) / 4;
-	}
+	static void setLength(unsigned length);
 
 	void reverseComplement();
 	bool isCanonical() const;
@@ -59,6 +51,7 @@ class Kmer
 	bool isPalindrome(extDirection dir) const;
 	void setLastBase(extDirection dir, uint8_t base);
 	uint8_t getLastBaseChar() const;
+	uint8_t at(unsigned i) const;
 
 	uint8_t shift(extDirection dir, uint8_t base = 0)
 	{
@@ -90,14 +83,8 @@ class Kmer
 	uint8_t shiftAppend(uint8_t base);
 	uint8_t shiftPrepend(uint8_t base);
 
-	uint8_t at(unsigned i) const;
 	void set(unsigned i, uint8_t base);
 
-	static uint8_t leftShiftByte(char* pSeq,
-			unsigned byteNum, unsigned index, uint8_t base);
-	static uint8_t rightShiftByte(char* pSeq,
-			unsigned byteNum, unsigned index, uint8_t base);
-
   public:
 #if MAX_KMER > 96
 # if MAX_KMER % 32 != 0
@@ -109,11 +96,17 @@ class Kmer
 # endif
 #endif
 	static const unsigned NUM_BYTES = MAX_KMER / 4;
+	static const unsigned NUM_WORDS = (NUM_BYTES + 7) / 8;
 
   protected:
 	static unsigned s_length;
 	static unsigned s_bytes;
+	static unsigned s_words;
 
+	/** The packed bases, two bits per base with the first base in
+	 * the most significant bits. The k-mer is manipulated a 64-bit
+	 * word at a time, and the last word may extend past the end of
+	 * the storage. The bits following the last base are zero. */
 	char m_seq[NUM_BYTES];
 };
 
@@ -2,6 +2,7 @@
 #define PIPE_H 1
 
 #include "Semaphore.h"
+#include <cassert>
 #include <queue>
 #include <pthread.h>
 
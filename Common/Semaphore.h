@@ -1,6 +1,10 @@
 #ifndef SEMAPHORE_H
 #define SEMAPHORE_H 1
 
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
 /** Semaphore class needed since some OS' do not support unnamed
  * semaphores. */
 #if __APPLE__
@@ -23,6 +23,9 @@ class SeqExt
 			return ext;
 		}
 
+		/** Return the bits of this SeqExt. */
+		uint8_t bits() const { return m_record; }
+
 		/** Return the out degree. */
 		unsigned outDegree()
 		{
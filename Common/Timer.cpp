@@ -1,6 +1,7 @@
 #include "Timer.h"
 #include "Log.h"
 #include <iomanip>
+#include <sys/time.h>
 
 using namespace std;
 
@@ -16,3 +17,11 @@ Timer::~Timer()
 	logger(2) << m_funcStr << ": " << setprecision(3)
 		<< (double)(clock() - m_start) / CLOCKS_PER_SEC << " s\n";
 }
+
+/** Return the wall-clock time in seconds. */
+double wallClock()
+{
+	timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
@@ -17,4 +17,7 @@ class Timer
 		clock_t m_start;
 };
 
+/** Return the wall-clock time in seconds. */
+double wallClock();
+
 #endif
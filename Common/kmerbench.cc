@@ -0,0 +1,192 @@
+/**
+ * Measure the throughput of the operations on a k-mer.
+ */
+
+#include "config.h"
+#include "Kmer.h"
+#include "Sequence.h"
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+#define PROGRAM "kmerbench"
+
+static const char VERSION_MESSAGE[] =
+PROGRAM " (" PACKAGE_NAME ") " VERSION "\n"
+"\n"
+"Copyright 2014 Canada's Michael Smith Genome Sciences Centre\n";
+
+static const char USAGE_MESSAGE[] =
+"Usage: " PROGRAM " [OPTION]...\n"
+"Measure the number of k-mer per second of the reverse complement,\n"
+"canonicalization and shift of a k-mer.\n"
+"\n"
+" Options:\n"
+"\n"
+"  -k, --kmer=N          length of a k-mer. May be specified more\n"
+"                        than once [25, 64 and 96]\n"
+"  -n, --count=N         number of k-mer [1000000]\n"
+"  -r, --repeat=N        number of passes over the k-mer [20]\n"
+"      --help            display this help and exit\n"
+"      --version         output version information and exit\n"
+"\n"
+"Report bugs to <" PACKAGE_BUGREPORT ">.\n";
+
+namespace opt {
+	static vector<unsigned> k;
+	static unsigned count = 1000000;
+	static unsigned repeat = 20;
+}
+
+static const char shortopts[] = "k:n:r:";
+
+enum { OPT_HELP = 1, OPT_VERSION };
+
+static const struct option longopts[] = {
+	{ "kmer", required_argument, NULL, 'k' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "repeat", required_argument, NULL, 'r' },
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ "version", no_argument, NULL, OPT_VERSION },
+	{ NULL, 0, NULL, 0 }
+};
+
+/** Return random k-mer. */
+static vector<Kmer> randomKmers(unsigned n)
+{
+	vector<Kmer> kmers;
+	kmers.reserve(n);
+	Sequence s(Kmer::length(), 'A');
+	for (unsigned i = 0; i < n; i++) {
+		for (Sequence::iterator it = s.begin(); it != s.end(); ++it)
+			*it = "ACGT"[rand() % 4];
+		kmers.push_back(Kmer(s));
+	}
+	return kmers;
+}
+
+/** Return the seconds elapsed since start. */
+static double elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/** Print the throughput of an operation. */
+static void report(const char* op, double seconds)
+{
+	double n = (double)opt::count * opt::repeat;
+	cout << Kmer::length() << '\t' << op << '\t'
+		<< (unsigned long)(n / seconds) << '\n';
+}
+
+/** Measure the operations at the current k. */
+static void bench()
+{
+	vector<Kmer> kmers = randomKmers(opt::count);
+	size_t sum = 0;
+
+	clock_t start = clock();
+	for (unsigned r = 0; r < opt::repeat; r++)
+		for (vector<Kmer>::iterator it = kmers.begin();
+				it != kmers.end(); ++it)
+			it->reverseComplement();
+	report("reverseComplement", elapsed(start));
+
+	start = clock();
+	for (unsigned r = 0; r < opt::repeat; r++)
+		for (vector<Kmer>::const_iterator it = kmers.begin();
+				it != kmers.end(); ++it)
+			sum += it->isCanonical();
+	report("isCanonical", elapsed(start));
+
+	start = clock();
+	for (unsigned r = 0; r < opt::repeat; r++) {
+		for (vector<Kmer>::const_iterator it = kmers.begin();
+				it != kmers.end(); ++it) {
+			Kmer u = *it;
+			u.canonicalize();
+			sum += u.getHashCode();
+		}
+	}
+	report("canonicalize", elapsed(start));
+
+	start = clock();
+	Kmer u = kmers.front();
+	for (unsigned r = 0; r < opt::repeat; r++)
+		for (unsigned i = 0; i < opt::count; i++)
+			sum += u.shift(SENSE, i & 3);
+	report("shift", elapsed(start));
+
+	// Use the result so that it is not optimized away.
+	if (sum == 0)
+		cerr << "";
+}
+
+int main(int argc, char** argv)
+{
+	bool die = false;
+	for (int c; (c = getopt_long(argc, argv,
+					shortopts, longopts, NULL)) != -1;) {
+		istringstream arg(optarg != NULL ? optarg : "");
+		switch (c) {
+		  case '?': die = true; break;
+		  case 'k': {
+			unsigned k;
+			arg >> k;
+			opt::k.push_back(k);
+			break;
+		  }
+		  case 'n': arg >> opt::count; break;
+		  case 'r': arg >> opt::repeat; break;
+		  case OPT_HELP:
+			cout << USAGE_MESSAGE;
+			exit(EXIT_SUCCESS);
+		  case OPT_VERSION:
+			cout << VERSION_MESSAGE;
+			exit(EXIT_SUCCESS);
+		}
+		if (optarg != NULL && !arg.eof()) {
+			cerr << PROGRAM ": invalid option: `-"
+				<< (char)c << optarg << "'\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (opt::k.empty()) {
+		const unsigned k[] = { 25, 64, 96 };
+		for (unsigned i = 0; i < sizeof k / sizeof *k; i++)
+			if (k[i] <= MAX_KMER)
+				opt::k.push_back(k[i]);
+	}
+
+	for (vector<unsigned>::const_iterator it = opt::k.begin();
+			it != opt::k.end(); ++it) {
+		if (*it == 0 || *it > MAX_KMER) {
+			cerr << PROGRAM ": k must be between 1 and "
+				<< MAX_KMER << '\n';
+			die = true;
+		}
+	}
+
+	if (opt::count == 0 || optind < argc)
+		die = true;
+
+	if (die) {
+		cerr << "Try `" << PROGRAM
+			<< " --help' for more information.\n";
+		exit(EXIT_FAILURE);
+	}
+
+	cout << "k\toperation\tkmers_per_second\n";
+	for (vector<unsigned>::const_iterator it = opt::k.begin();
+			it != opt::k.end(); ++it) {
+		Kmer::setLength(*it);
+		bench();
+	}
+	return 0;
+}
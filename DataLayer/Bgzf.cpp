@@ -0,0 +1,309 @@
+#include "config.h"
+#include "Bgzf.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring> // for strerror
+#include <iostream>
+#include <sys/stat.h>
+#if HAVE_ZLIB_H && HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+using namespace std;
+
+/** The size of the fixed part of the header of a block. */
+static const size_t HEADER_SIZE = 12;
+
+/** The size of the trailer of a block, the CRC32 and ISIZE. */
+static const size_t TRAILER_SIZE = 8;
+
+/** The maximum size of a block, compressed or uncompressed. */
+static const size_t MAX_BLOCK_SIZE = 1 << 16;
+
+static void die(const char* path)
+{
+	cerr << "error: reading `" << path << "': "
+		<< strerror(errno) << endl;
+	exit(EXIT_FAILURE);
+}
+
+/** Return a little-endian 16-bit integer. */
+static inline unsigned getU16(const unsigned char* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+/** Return a little-endian 32-bit integer. */
+static inline uint32_t getU32(const unsigned char* p)
+{
+	return (uint32_t)getU16(p) | (uint32_t)getU16(p + 2) << 16;
+}
+
+/** Return the length of the extra field of the block header at p, or
+ * 0 if p is not the header of a BGZF block.
+ */
+static unsigned headerExtraLength(const unsigned char* p)
+{
+	return p[0] == 31 && p[1] == 139 && p[2] == 8 && (p[3] & 4)
+		? getU16(p + 10) : 0;
+}
+
+/** Return the size of the block whose header is at p, or 0 if p is
+ * not the header of a BGZF block. The BC subfield of the extra field
+ * records the size of the block.
+ * @param xlen the length of the extra field
+ */
+static size_t blockSize(const unsigned char* p, unsigned xlen)
+{
+	const unsigned char* end = p + HEADER_SIZE + xlen;
+	for (const unsigned char* q = p + HEADER_SIZE;
+			q + 4 <= end; q += 4 + getU16(q + 2)) {
+		if (q[0] == 'B' && q[1] == 'C' && getU16(q + 2) == 2
+				&& q + 6 <= end) {
+			size_t size = getU16(q + 4) + 1;
+			return size >= HEADER_SIZE + xlen + TRAILER_SIZE
+				? size : 0;
+		}
+	}
+	return 0;
+}
+
+/** Return the size of the block whose header is at p, or 0 if p is
+ * not the header of a BGZF block.
+ * @param n the number of bytes available at p
+ */
+static size_t headerBlockSize(const unsigned char* p, size_t n)
+{
+	if (n < HEADER_SIZE)
+		return 0;
+	unsigned xlen = headerExtraLength(p);
+	return xlen > 0 && HEADER_SIZE + xlen <= n ? blockSize(p, xlen) : 0;
+}
+
+BgzfBuf::BgzfBuf(const char* path)
+	: m_file(fopen(path, "rb")), m_size(0), m_offset(0),
+	m_base(0), m_keep(false)
+{
+	// The mode "rb" bypasses the decompression of Uncompress.cpp.
+	if (m_file == NULL)
+		die(path);
+	if (fseeko(m_file, 0, SEEK_END) != 0)
+		die(path);
+	m_size = ftello(m_file);
+	m_block.reserve(MAX_BLOCK_SIZE);
+	m_data.reserve(MAX_BLOCK_SIZE);
+}
+
+BgzfBuf::~BgzfBuf()
+{
+	fclose(m_file);
+}
+
+/** Return whether the specified file is a regular file compressed
+ * using BGZF.
+ */
+bool BgzfBuf::isBgzf(const char* path)
+{
+#if HAVE_ZLIB_H && HAVE_LIBZ
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	vector<unsigned char> header(HEADER_SIZE);
+	bool bgzf = fread(&header[0], 1, HEADER_SIZE, f) == HEADER_SIZE;
+	unsigned xlen = bgzf ? headerExtraLength(&header[0]) : 0;
+	if (xlen > 0) {
+		header.resize(HEADER_SIZE + xlen);
+		bgzf = fread(&header[HEADER_SIZE], 1, xlen, f) == xlen
+			&& blockSize(&header[0], xlen) > 0;
+	} else
+		bgzf = false;
+	fclose(f);
+	return bgzf;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
+/** Read the header of the block at the specified offset, and leave
+ * the file positioned after the header.
+ * @return the size of the block, or 0 if it is not a block
+ */
+size_t BgzfBuf::readHeader(off_t offset)
+{
+	if (offset + (off_t)HEADER_SIZE > m_size)
+		return 0;
+	m_block.resize(HEADER_SIZE);
+	if ((ftello(m_file) != offset
+				&& fseeko(m_file, offset, SEEK_SET) != 0)
+			|| fread(&m_block[0], 1, HEADER_SIZE, m_file)
+				!= HEADER_SIZE)
+		return 0;
+	unsigned xlen = headerExtraLength(&m_block[0]);
+	if (xlen == 0 || offset + (off_t)(HEADER_SIZE + xlen) > m_size)
+		return 0;
+	m_block.resize(HEADER_SIZE + xlen);
+	if (fread(&m_block[HEADER_SIZE], 1, xlen, m_file) != xlen)
+		return 0;
+	size_t size = blockSize(&m_block[0], xlen);
+	return offset + (off_t)size <= m_size ? size : 0;
+}
+
+/** Return the offset of the first block that starts at or after the
+ * specified offset, or the size of the file if there is none. A
+ * header found by chance in the compressed data is rejected by
+ * checking that it is followed by another header or the end of the
+ * file.
+ */
+off_t BgzfBuf::nextBlock(off_t offset)
+{
+	// A block starts within MAX_BLOCK_SIZE bytes of any offset. The
+	// window holds the header of a block that starts in its first
+	// MAX_BLOCK_SIZE bytes, and the header of the block after it.
+	vector<unsigned char> window(3 * MAX_BLOCK_SIZE);
+	for (; offset < m_size; offset += MAX_BLOCK_SIZE) {
+		size_t n = min(off_t(window.size()), m_size - offset);
+		if (fseeko(m_file, offset, SEEK_SET) != 0)
+			return m_size;
+		n = fread(&window[0], 1, n, m_file);
+		for (size_t i = 0; i < min(n, MAX_BLOCK_SIZE); ++i) {
+			size_t size = headerBlockSize(&window[i], n - i);
+			if (size == 0 || offset + off_t(i + size) > m_size)
+				continue;
+			size_t next = i + size;
+			if (offset + off_t(next) == m_size)
+				return offset + i;
+			size_t nextSize = next < n
+				? headerBlockSize(&window[next], n - next) : 0;
+			if (nextSize > 0 && offset + off_t(next + nextSize) <= m_size)
+				return offset + i;
+		}
+	}
+	return m_size;
+}
+
+/** Return the size of the data of the blocks between the specified
+ * offsets, which is recorded in the trailer of each block.
+ */
+uint64_t BgzfBuf::uncompressedSize(off_t begin, off_t end)
+{
+	uint64_t n = 0;
+	unsigned char isize[4];
+	for (off_t offset = begin; offset < end;) {
+		size_t size = readHeader(offset);
+		assert(size > 0);
+		if (fseeko(m_file, offset + size - 4, SEEK_SET) != 0
+				|| fread(isize, 1, sizeof isize, m_file)
+					!= sizeof isize)
+			return n;
+		n += getU32(isize);
+		offset += size;
+	}
+	return n;
+}
+
+/** Seek to the block at the specified offset, which becomes
+ * position 0 of the stream.
+ */
+void BgzfBuf::seekBlock(off_t offset)
+{
+	m_offset = offset;
+	m_base = 0;
+	m_data.clear();
+	setg(NULL, NULL, NULL);
+}
+
+/** Decompress the next block and append it to m_data. */
+void BgzfBuf::readBlock()
+{
+#if HAVE_ZLIB_H && HAVE_LIBZ
+	size_t size = readHeader(m_offset);
+	if (size == 0) {
+		cerr << "error: corrupt BGZF block at offset "
+			<< m_offset << endl;
+		exit(EXIT_FAILURE);
+	}
+	size_t headerSize = m_block.size();
+	m_block.resize(size);
+	if (fread(&m_block[headerSize], 1, size - headerSize, m_file)
+			!= size - headerSize) {
+		cerr << "error: truncated BGZF block at offset "
+			<< m_offset << endl;
+		exit(EXIT_FAILURE);
+	}
+	m_offset += size;
+
+	uint32_t isize = getU32(&m_block[size - 4]);
+	assert(isize <= MAX_BLOCK_SIZE);
+	if (isize == 0)
+		return;
+	size_t n = m_data.size();
+	m_data.resize(n + isize);
+
+	z_stream z;
+	memset(&z, 0, sizeof z);
+	int err = inflateInit2(&z, -MAX_WBITS);
+	assert(err == Z_OK);
+	z.next_in = &m_block[headerSize];
+	z.avail_in = size - headerSize - TRAILER_SIZE;
+	z.next_out = (Bytef*)&m_data[n];
+	z.avail_out = isize;
+	err = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+	if (err != Z_STREAM_END || z.avail_out != 0) {
+		cerr << "error: inflating the BGZF block at offset "
+			<< m_offset - size << endl;
+		exit(EXIT_FAILURE);
+	}
+#else
+	assert(false);
+	abort();
+#endif
+}
+
+BgzfBuf::int_type BgzfBuf::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	if (!m_keep) {
+		m_base += m_data.size();
+		m_data.clear();
+	}
+	size_t pos = m_data.size();
+	while (m_data.size() == pos) {
+		if (m_offset >= m_size)
+			return traits_type::eof();
+		readBlock();
+	}
+	setg(&m_data[0], &m_data[0] + pos, &m_data[0] + m_data.size());
+	return traits_type::to_int_type(*gptr());
+}
+
+BgzfBuf::pos_type BgzfBuf::seekoff(off_type off,
+		ios_base::seekdir way, ios_base::openmode which)
+{
+	if (way == ios_base::cur)
+		return seekpos(m_base + (gptr() - eback()) + off, which);
+	else if (way == ios_base::beg)
+		return seekpos(off, which);
+	else
+		return pos_type(off_type(-1));
+}
+
+/** Seek to a position of the data that is kept. */
+BgzfBuf::pos_type BgzfBuf::seekpos(pos_type pos,
+		ios_base::openmode which)
+{
+	off_type i = off_type(pos) - off_type(m_base);
+	if (!(which & ios_base::in)
+			|| i < 0 || i > off_type(m_data.size()))
+		return pos_type(off_type(-1));
+	if (!m_data.empty())
+		setg(&m_data[0], &m_data[0] + i, &m_data[0] + m_data.size());
+	return pos;
+}
@@ -0,0 +1,70 @@
+#ifndef BGZF_H
+#define BGZF_H 1
+
+#include <cstdio>
+#include <stdint.h>
+#include <streambuf>
+#include <sys/types.h> // for off_t
+#include <vector>
+
+/** Decompress a BGZF file, the blocked gzip format of bgzip and
+ * samtools, starting at any of its blocks. Each block is a gzip
+ * member of at most 64 kB, which is decompressed independently of the
+ * others. The position of the stream is the number of bytes
+ * decompressed since the first block. Only the data decompressed
+ * while keep is set may be sought.
+ */
+class BgzfBuf : public std::streambuf
+{
+	public:
+		BgzfBuf(const char* path);
+		~BgzfBuf();
+
+		static bool isBgzf(const char* path);
+
+		/** Return the size of the compressed file in bytes. */
+		off_t size() const { return m_size; }
+
+		off_t nextBlock(off_t offset);
+		uint64_t uncompressedSize(off_t begin, off_t end);
+		void seekBlock(off_t offset);
+
+		/** Keep the decompressed data so that it may be sought. */
+		void keep(bool keep) { m_keep = keep; }
+
+	protected:
+		int_type underflow();
+		pos_type seekoff(off_type off, std::ios_base::seekdir way,
+				std::ios_base::openmode which);
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+	private:
+		BgzfBuf(const BgzfBuf&);
+		BgzfBuf& operator=(const BgzfBuf&);
+
+		size_t readHeader(off_t offset);
+		void readBlock();
+
+		/** The compressed file. */
+		FILE* m_file;
+
+		/** The size of the compressed file. */
+		off_t m_size;
+
+		/** The offset of the next block to decompress. */
+		off_t m_offset;
+
+		/** The compressed block. */
+		std::vector<unsigned char> m_block;
+
+		/** The decompressed data. */
+		std::vector<char> m_data;
+
+		/** The position of the first byte of m_data. */
+		uint64_t m_base;
+
+		/** Whether to keep the data already read. */
+		bool m_keep;
+};
+
+#endif
@@ -1,12 +1,16 @@
 #include "FastaReader.h"
+#include "Bgzf.h"
 #include "DataLayer/Options.h"
 #include "IOUtil.h"
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <sstream>
+#include <sys/stat.h>
 #include <vector>
 
 using namespace std;
@@ -30,6 +34,16 @@ namespace opt {
 	int internalQThreshold;
 }
 
+/** Return whether the specified file is a gzip file compressed
+ * using BGZF, which may be decompressed starting at any of its
+ * blocks. A BAM file is compressed using BGZF as well.
+ */
+static bool isBgzf(const char* path)
+{
+	return endsWith(path, ".gz") && !endsWith(path, ".tar.gz")
+		&& BgzfBuf::isBgzf(path);
+}
+
 /** Output an error message. */
 ostream& FastaReader::die()
 {
@@ -37,21 +51,107 @@ ostream& FastaReader::die()
 }
 
 FastaReader::FastaReader(const char* path, int flags, int len)
-	: m_path(path), m_fin(path),
+	: m_path(path),
 	m_in(strcmp(path, "-") == 0 ? cin : m_fin),
 	m_flags(flags), m_line(0), m_unchaste(0),
 	m_end(numeric_limits<streamsize>::max()),
+	m_bgzf(NULL),
 	m_maxLength(len)
 {
-	if (strcmp(path, "-") != 0)
-		assert_good(m_fin, path);
+	if (strcmp(path, "-") != 0) {
+		// Decompress a BGZF file here rather than in a pipe, so that
+		// it may be split.
+		if (isBgzf(path)) {
+			m_bgzf = new BgzfBuf(path);
+			m_in.rdbuf(m_bgzf);
+		} else {
+			m_fin.open(path);
+			assert_good(m_fin, path);
+		}
+	}
 	if (m_in.peek() == EOF)
 		cerr << m_path << ':' << m_line << ": warning: "
 			"file is empty\n";
 }
 
-/** Split the fasta file into nsections and seek to the start
- * of section. */
+FastaReader::~FastaReader()
+{
+	if (!m_in.eof()) {
+		std::string line;
+		getline(line);
+		die() << "expected end-of-file near\n"
+			<< line << '\n';
+		exit(EXIT_FAILURE);
+	}
+	if (m_bgzf != NULL) {
+		m_in.rdbuf(m_fin.rdbuf());
+		delete m_bgzf;
+	}
+}
+
+/** Return whether the specified file may be split into sections,
+ * which is a FASTA or FASTQ file that is either uncompressed or
+ * compressed using BGZF.
+ */
+bool FastaReader::isSplittable(const char* path)
+{
+	char buf[4];
+	size_t n;
+	if (isBgzf(path)) {
+		BgzfBuf bgzf(path);
+		n = bgzf.sgetn(buf, sizeof buf);
+	} else {
+		struct stat st;
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			return false;
+		// The mode "rb" reads a compressed file without
+		// decompressing it.
+		FILE* f = fopen(path, "rb");
+		if (f == NULL)
+			return false;
+		n = fread(buf, 1, sizeof buf, f);
+		fclose(f);
+	}
+	if (n == 0)
+		return false;
+	// The header of a SAM file starts with '@' as well.
+	bool sam = n == sizeof buf && buf[0] == '@'
+		&& isalpha(buf[1]) && isalpha(buf[2]) && buf[3] == '\t';
+	return (buf[0] == '>' || buf[0] == '@') && !sam;
+}
+
+/** Skip to the start of the next record. In FASTA, it is the next
+ * line that starts with '>'. In FASTQ, it is the next line that
+ * starts with '@' and is not followed by a line that starts with '@',
+ * because a sequence never starts with '@', and a line of quality
+ * that starts with '@' is followed by a header.
+ */
+void FastaReader::skipToRecord(char recordType)
+{
+	for (;;) {
+		streampos pos = m_in.tellg();
+		int c = m_in.peek();
+		if (c == EOF)
+			return;
+		m_in.ignore(numeric_limits<streamsize>::max(), '\n');
+		if (c != recordType)
+			continue;
+		if (recordType == '@') {
+			c = m_in.peek();
+			if (c == EOF)
+				return;
+			if (c == '@')
+				continue;
+		}
+		m_in.seekg(pos);
+		return;
+	}
+}
+
+/** Split the file into nsections and seek to the start of section.
+ * The records that start in the byte range of the section belong to
+ * it. A BGZF file is split at the boundaries of its blocks.
+ */
 void FastaReader::split(unsigned section, unsigned nsections)
 {
 	assert(nsections >= section);
@@ -61,29 +161,45 @@ void FastaReader::split(unsigned section, unsigned nsections)
 		return;
 	// Move the get pointer to the first entry in this section and
 	// update the m_end if there is more than one section.
-	m_in.seekg(0, ios::end);
-	streampos length = m_in.tellg();
-	assert(length > 0);
-	streampos start = length * (section - 1) / nsections;
-	streampos end = length * section / nsections;
-	assert(end > 0);
-	if (end < length) {
-		m_in.seekg(end);
-		if (m_in.peek() == '>')
-			end += 1;
+	streamoff end;
+	bool partial;
+	char recordType;
+	recordType = m_in.peek();
+	if (m_bgzf != NULL) {
+		off_t length = m_bgzf->size();
+		off_t first = m_bgzf->nextBlock(
+				length * (section - 1) / nsections);
+		off_t last = m_bgzf->nextBlock(length * section / nsections);
+		end = m_bgzf->uncompressedSize(first, last);
+		m_bgzf->seekBlock(first);
+		m_in.clear();
+		partial = first > 0;
+	} else {
+		m_in.seekg(0, ios::end);
+		streamoff length = m_in.tellg();
+		assert(length > 0);
+		streamoff start = length * (section - 1) / nsections;
+		end = length * section / nsections;
+		m_in.seekg(start);
+		partial = start > 0;
 	}
-	m_end = end;
-	m_in.seekg(start);
-	if (start > 0) {
+	if (recordType != '@')
+		recordType = '>';
+
+	// A record that starts at the end of this section belongs to it.
+	m_end = end + 1;
+	if (partial) {
+		if (m_bgzf != NULL)
+			m_bgzf->keep(true);
 		m_in.ignore(numeric_limits<streamsize>::max(), '\n');
-		m_in.ignore(numeric_limits<streamsize>::max(), '>');
+		skipToRecord(recordType);
+		if (m_bgzf != NULL)
+			m_bgzf->keep(false);
 		if (m_in.peek() == EOF)
 			cerr << m_path << ':' << section << ": warning: "
-				"there are no contigs in this section\n";
-		m_in.putback('>');
+				"there are no sequences in this section\n";
 	}
 	assert(m_end > 0);
-	assert(m_in.good());
 }
 
 /** Return whether this read passed the chastity filter. */
@@ -10,6 +10,8 @@
 #include <limits> // for numeric_limits
 #include <ostream>
 
+class BgzfBuf;
+
 /** Read a FASTA, FASTQ, export, qseq or SAM file. */
 class FastaReader {
 	public:
@@ -24,24 +26,17 @@ class FastaReader {
 
 		FastaReader(const char* path, int flags, int len = 0);
 
-		~FastaReader()
-		{
-			if (!m_in.eof()) {
-				std::string line;
-				getline(line);
-				die() << "expected end-of-file near\n"
-					<< line << '\n';
-				exit(EXIT_FAILURE);
-			}
-		}
+		~FastaReader();
 
 		Sequence read(std::string& id, std::string& comment,
 				char& anchor, std::string& qual);
 
-		/** Split the fasta file into nsections and seek to the start
+		/** Split the file into nsections and seek to the start
 		 * of section. */
 		void split(unsigned section, unsigned nsections);
 
+		static bool isSplittable(const char* path);
+
 		/** Return whether this stream is at end-of-file. */
 		bool eof() const { return m_in.eof(); };
 
@@ -96,6 +91,7 @@ class FastaReader {
 		}
 
 		std::ostream& die();
+		void skipToRecord(char recordType);
 		bool isChaste(const std::string& s, const std::string& line);
 		void checkSeqQual(const std::string& s, const std::string& q);
 
@@ -115,6 +111,9 @@ class FastaReader {
 		/** Position of the end of the current section. */
 		std::streampos m_end;
 
+		/** The decompressed section of a BGZF file. */
+		BgzfBuf* m_bgzf;
+
 		/** Trim sequences to this length. 0 is unlimited. */
 		const int m_maxLength;
 };
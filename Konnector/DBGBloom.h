@@ -6,6 +6,7 @@
 #ifndef DBGBLOOM_H
 #define DBGBLOOM_H 1
 
+#include "Bloom/Bloom.h"
 #include "Common/IOUtil.h"
 #include "Common/Kmer.h"
 #include "Common/SeqExt.h" // for NUM_BASES
@@ -68,6 +69,15 @@ struct DBGBloomIndexMap
 	}
 };
 
+/** Compute the rolling hash of a vertex if the graph uses one. */
+template <typename Graph>
+static inline void initHash(const Graph& g, const Kmer& u,
+		RollingHash& hash)
+{
+	if (g.m_bloom.getHashType() == Bloom::HASH_ROLLING)
+		hash = RollingHash(u);
+}
+
 // Graph
 
 namespace boost {
@@ -111,7 +121,9 @@ struct adjacency_iterator
 	{
 		for (; m_i < NUM_BASES; ++m_i) {
 			m_v.setLastBase(SENSE, m_i);
-			if (vertex_exists(m_v, m_g))
+			RollingHash hash(m_hash);
+			hash.rollRight(m_out, m_i);
+			if (vertex_exists(m_v, hash, m_g))
 				break;
 		}
 	}
@@ -122,7 +134,8 @@ struct adjacency_iterator
 	adjacency_iterator(const DBGBloom<BF>& g, vertex_descriptor u)
 		: m_g(g), m_v(u), m_i(0)
 	{
-		m_v.shift(SENSE);
+		initHash(g, u, m_hash);
+		m_out = m_v.shift(SENSE);
 		next();
 	}
 
@@ -153,6 +166,10 @@ struct adjacency_iterator
   private:
 	const DBGBloom<BF>& m_g;
 	vertex_descriptor m_v;
+	/** The rolling hash of the source vertex */
+	RollingHash m_hash;
+	/** The base shifted off the source vertex */
+	uint8_t m_out;
 	short unsigned m_i;
 }; // adjacency_iterator
 
@@ -165,7 +182,9 @@ struct out_edge_iterator
 	{
 		for (; m_i < NUM_BASES; ++m_i) {
 			m_v.setLastBase(SENSE, m_i);
-			if (vertex_exists(m_v, *m_g))
+			RollingHash hash(m_hash);
+			hash.rollRight(m_out, m_i);
+			if (vertex_exists(m_v, hash, *m_g))
 				break;
 		}
 	}
@@ -178,7 +197,8 @@ struct out_edge_iterator
 	out_edge_iterator(const DBGBloom<BF>& g, vertex_descriptor u)
 		: m_g(&g), m_u(u), m_v(u), m_i(0)
 	{
-		m_v.shift(SENSE);
+		initHash(g, u, m_hash);
+		m_out = m_v.shift(SENSE);
 		next();
 	}
 
@@ -217,6 +237,8 @@ struct out_edge_iterator
 	const DBGBloom<BF>* m_g;
 	vertex_descriptor m_u;
 	vertex_descriptor m_v;
+	RollingHash m_hash;
+	uint8_t m_out;
 	unsigned m_i;
 }; // out_edge_iterator
 
@@ -229,7 +251,9 @@ struct in_edge_iterator
 	{
 		for (; m_i < NUM_BASES; ++m_i) {
 			m_v.setLastBase(ANTISENSE, m_i);
-			if (vertex_exists(m_v, *m_g))
+			RollingHash hash(m_hash);
+			hash.rollLeft(m_out, m_i);
+			if (vertex_exists(m_v, hash, *m_g))
 				break;
 		}
 	}
@@ -242,7 +266,8 @@ struct in_edge_iterator
 	in_edge_iterator(const DBGBloom<BF>& g, vertex_descriptor u)
 		: m_g(&g), m_u(u), m_v(u), m_i(0)
 	{
-		m_v.shift(ANTISENSE);
+		initHash(g, u, m_hash);
+		m_out = m_v.shift(ANTISENSE);
 		next();
 	}
 
@@ -281,6 +306,8 @@ struct in_edge_iterator
 	const DBGBloom<BF>* m_g;
 	vertex_descriptor m_u;
 	vertex_descriptor m_v;
+	RollingHash m_hash;
+	uint8_t m_out;
 	unsigned m_i;
 }; // in_edge_iterator
 
@@ -298,6 +325,21 @@ vertex_exists(typename graph_traits<Graph>::vertex_descriptor u, const Graph& g)
 	return g.m_bloom[u] > g.m_depthThresh;
 }
 
+/** Return whether this vertex, whose rolling hash is given, exists in
+ * the subgraph. The rolling hash of a neighbour of a vertex is
+ * computed in constant time from that of the vertex. */
+template <typename Graph>
+static inline bool
+vertex_exists(typename graph_traits<Graph>::vertex_descriptor u,
+		const RollingHash& hash, const Graph& g)
+{
+	if (g.m_bloom.getHashType() != Bloom::HASH_ROLLING)
+		return vertex_exists(u, g);
+	size_t hashes[Bloom::MAX_HASHES];
+	hash.getHashes(g.m_bloom.getHashNum(), hashes);
+	return g.m_bloom.contains(hashes) > g.m_depthThresh;
+}
+
 template <typename Graph>
 static inline
 std::pair<typename graph_traits<Graph>::adjacency_iterator,
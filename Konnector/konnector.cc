@@ -72,6 +72,11 @@ static const char USAGE_MESSAGE[] =
 "  -F, --max-frag=N           max fragment size in base pairs [1000]\n"
 "  -i, --input-bloom=FILE     load bloom filter from FILE\n"
 "  -I, --interleaved          input reads files are interleaved\n"
+"      --mmap                 map the bloom filter of -i read-only into\n"
+"                             memory, which is shared by every process\n"
+"                             that maps the same file\n"
+"      --no-mmap              read the bloom filter of -i into memory\n"
+"                             [default]\n"
 "      --mask                 mask new and changed bases as lower case\n"
 "      --no-mask              do not mask bases [default]\n"
 "      --chastity             discard unchaste reads [default]\n"
@@ -153,6 +158,9 @@ namespace opt {
 	/** Bloom filter input file */
 	static string inputBloomPath;
 
+	/** Map the bloom filter input file into memory */
+	static int mmap = 0;
+
 	/** Max paths between read 1 and read 2 */
 	unsigned maxPaths = 2;
 
@@ -215,6 +223,8 @@ static const struct option longopts[] = {
 	{ "kmer",             required_argument, NULL, 'k' },
 	{ "chastity",         no_argument, &opt::chastityFilter, 1 },
 	{ "no-chastity",      no_argument, &opt::chastityFilter, 0 },
+	{ "mmap",             no_argument, &opt::mmap, 1 },
+	{ "no-mmap",          no_argument, &opt::mmap, 0 },
 	{ "mask",             no_argument, &opt::mask, 1 },
 	{ "no-mask",          no_argument, &opt::mask, 0 },
 	{ "no-limits",        no_argument, NULL, 'n' },
@@ -535,6 +545,11 @@ int main(int argc, char** argv)
 		die = true;
 	}
 
+	if (opt::mmap && opt::inputBloomPath.empty()) {
+		cerr << PROGRAM ": option `--mmap' requires `-i'\n";
+		die = true;
+	}
+
 	if (die) {
 		cerr << "Try `" << PROGRAM
 			<< " --help' for more information.\n";
@@ -563,11 +578,16 @@ int main(int argc, char** argv)
 				<< opt::inputBloomPath << "'...\n";
 
 		const char* inputPath = opt::inputBloomPath.c_str();
-		ifstream inputBloom(inputPath, ios_base::in | ios_base::binary);
-		assert_good(inputBloom, inputPath);
-		inputBloom >> bloom;
-		assert_good(inputBloom, inputPath);
-		inputBloom.close();
+		if (opt::mmap) {
+			bloom.map(inputPath);
+		} else {
+			ifstream inputBloom(inputPath,
+					ios_base::in | ios_base::binary);
+			assert_good(inputBloom, inputPath);
+			inputBloom >> bloom;
+			assert_good(inputBloom, inputPath);
+			inputBloom.close();
+		}
 
 	} else {
 
@@ -575,14 +595,13 @@ int main(int argc, char** argv)
 		// because counting bloom filter requires twice as
 		// much space.
 		size_t bits = opt::bloomSize * 8 / 2;
-		CascadingBloomFilter tempBloom(bits);
+		CascadingBloomFilter tempBloom(bits, 1, Bloom::HASH_ROLLING);
+		vector<string> paths(argv + optind, argv + argc);
 #ifdef _OPENMP
-		ConcurrentBloomFilter<CascadingBloomFilter> cbf(tempBloom, 1000);
-		for (int i = optind; i < argc; i++)
-			Bloom::loadFile(cbf, opt::k, string(argv[i]), opt::verbose);
+		ConcurrentBloomFilter<CascadingBloomFilter> cbf(tempBloom);
+		Bloom::loadFiles(cbf, opt::k, paths, opt::verbose);
 #else
-		for (int i = optind; i < argc; i++)
-			Bloom::loadFile(tempBloom, opt::k, string(argv[i]), opt::verbose);
+		Bloom::loadFiles(tempBloom, opt::k, paths, opt::verbose);
 #endif
 		bloom = tempBloom.getBloomFilter(tempBloom.MAX_COUNT-1);
 	}
@@ -16,14 +16,18 @@ class CountingBloomFilter {
 public:
 
 	/** Constructor */
-	CountingBloomFilter(unsigned hashnum = 1) :
-			m_data(0), hashNum(hashnum), uniqueEntries(0), replicateEntries(0)
+	CountingBloomFilter(unsigned hashnum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY) :
+			m_data(0), hashNum(hashnum), m_hashType(hashType),
+			uniqueEntries(0), replicateEntries(0)
 	{
 	}
 
 	/** Constructor */
-	CountingBloomFilter(size_t n, unsigned hashnum = 1) :
-			m_data(n), hashNum(hashnum), uniqueEntries(0), replicateEntries(0)
+	CountingBloomFilter(size_t n, unsigned hashnum = 1,
+			Bloom::HashType hashType = Bloom::HASH_CITY) :
+			m_data(n), hashNum(hashnum), m_hashType(hashType),
+			uniqueEntries(0), replicateEntries(0)
 	{
 	}
 
@@ -49,6 +53,18 @@ public:
 				double(uniqueEntries) * hashNum), double(hashNum));
 	}
 
+	/** Return the number of hash functions. */
+	unsigned getHashNum() const
+	{
+		return hashNum;
+	}
+
+	/** Return the hash function. */
+	Bloom::HashType getHashType() const
+	{
+		return m_hashType;
+	}
+
 	/** Return the count of the single element (debugging purposes)
 	 */
 	NumericType operator[](size_t i) const
@@ -56,12 +72,12 @@ public:
 		return m_data[i];
 	}
 
-	/** Return the count of this element. */
-	NumericType operator[](const Bloom::key_type& key) const
+	/** Return the count of the element with these hash values. */
+	NumericType count(const size_t hashes[]) const
 	{
-		NumericType currentMin = m_data[Bloom::hash(key, 0) % m_data.size()];
+		NumericType currentMin = m_data[hashes[0] % m_data.size()];
 		for (unsigned int i = 1; i < hashNum; ++i) {
-			NumericType min = m_data[Bloom::hash(key, i) % m_data.size()];
+			NumericType min = m_data[hashes[i] % m_data.size()];
 			if (min < currentMin) {
 				currentMin = min;
 			}
@@ -72,27 +88,34 @@ public:
 		return currentMin;
 	}
 
+	/** Return the count of this element. */
+	NumericType operator[](const Bloom::key_type& key) const
+	{
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, hashNum, hashes);
+		return count(hashes);
+	}
+
 	/** Add the object with the specified index (debugging purposes). */
 	void insert(size_t index)
 	{
 		++m_data[index];
 	}
 
-	/** Add the object to this counting multiset.
+	/** Add the object with these hash values to this counting
+	 * multiset.
 	 *  If all values are the same update all
 	 *  If some values are larger only update smallest counts*/
-	void insert(const Bloom::key_type& key)
+	void insert(const size_t hashes[])
 	{
 		//check for which elements to update
-		NumericType minEle = (*this)[key];
+		NumericType minEle = count(hashes);
 
 		//update only those elements
-		for (unsigned int i = 1; i < hashNum; ++i) {
-			size_t hashVal = Bloom::hash(key, i) % m_data.size();
-			NumericType val = m_data[hashVal];
-			if (minEle == val) {
+		for (unsigned int i = 0; i < hashNum; ++i) {
+			size_t hashVal = hashes[i] % m_data.size();
+			if (minEle == m_data[hashVal])
 				insert(hashVal);
-			}
 		}
 		if (minEle)
 			++uniqueEntries;
@@ -100,6 +123,14 @@ public:
 			++replicateEntries;
 	}
 
+	/** Add the object to this counting multiset. */
+	void insert(const Bloom::key_type& key)
+	{
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(key, m_hashType, hashNum, hashes);
+		insert(hashes);
+	}
+
 	void write(std::ostream& out) const
 	{
 		assert(!m_data.empty());
@@ -124,6 +155,7 @@ public:
 protected:
 	std::vector<NumericType> m_data;
 	unsigned hashNum;
+	Bloom::HashType m_hashType;
 	size_t uniqueEntries;
 	size_t replicateEntries;
 
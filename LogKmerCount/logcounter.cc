@@ -157,8 +157,8 @@ int main(int argc, char** argv)
 
 	//size determined by
 	CountingBloomFilter<plc> bloom(opt::bloomSize, 1);
-	for (int i = optind; i < argc; i++)
-		Bloom::loadFile(bloom, opt::k, string(argv[i]), opt::verbose);
+	Bloom::loadFiles(bloom, opt::k,
+			vector<string>(argv + optind, argv + argc), opt::verbose);
 
 	return 0;
 }
@@ -1,20 +1,30 @@
 #include "config.h"
 #include "CommLayer.h"
+#include "Assembly/Options.h"
 #include "Common/Options.h"
 #include "Log.h"
 #include "MessageBuffer.h"
+#include "SharedRings.h"
 #include <mpi.h>
+#include <algorithm>
 #include <cstring>
+#include <limits>
 #include <vector>
 
 using namespace std;
 
-static const unsigned RX_BUFSIZE = 16*1024;
+static const unsigned RX_BUFSIZE = CommLayer::MAX_PACKET_SIZE;
 
 CommLayer::CommLayer()
 	: m_msgID(0),
 	  m_rxBuffer(new uint8_t[RX_BUFSIZE]),
+	  m_rxSpare(new uint8_t[RX_BUFSIZE]),
 	  m_request(MPI_REQUEST_NULL),
+	  m_waveRequest(MPI_REQUEST_NULL),
+	  m_waveTx(numeric_limits<uint64_t>::max()),
+	  m_waveRx(numeric_limits<uint64_t>::max()),
+	  m_numReductions(0), m_numBarriers(0),
+	  m_shared(NULL), m_sharedSource(-1), m_sharedHeld(-1),
 	  m_rxPackets(0), m_rxMessages(0), m_rxBytes(0),
 	  m_txPackets(0), m_txMessages(0), m_txBytes(0)
 {
@@ -22,12 +32,19 @@ CommLayer::CommLayer()
 	MPI_Irecv(m_rxBuffer, RX_BUFSIZE,
 			MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD,
 			&m_request);
+	if (opt::sharedMemory) {
+		m_shared = new SharedRings;
+		logger(1) << "Sending packets through shared memory to "
+			<< m_shared->size() << " processes of this node\n";
+	}
 }
 
 CommLayer::~CommLayer()
 {
 	MPI_Cancel(&m_request);
 	delete[] m_rxBuffer;
+	delete[] m_rxSpare;
+	delete m_shared;
 	logger(1) << "Sent " << m_msgID << " control, "
 		<< m_txPackets << " packets, "
 		<< m_txMessages << " messages, "
@@ -62,6 +79,23 @@ APMessage CommLayer::checkMessage(int& sendID)
 {
 	MPI_Status status;
 	bool flag = request_get_status(m_request, status);
+	if (m_shared != NULL) {
+		releaseShared();
+		// A control message must not overtake a packet sent
+		// through shared memory before it by the same process.
+		// The ring is checked after the control message is found,
+		// so that such a packet is seen.
+		size_t size;
+		int source = status.MPI_SOURCE;
+		if (flag ? (APMessage)status.MPI_TAG == APM_CONTROL
+					&& m_shared->isLocal(source)
+					&& m_shared->front(source, size) != NULL
+				: m_shared->poll(source)) {
+			m_sharedSource = sendID = source;
+			return APM_BUFFERED;
+		}
+		m_sharedSource = -1;
+	}
 	if (flag)
 		sendID = status.MPI_SOURCE;
 	return flag ? (APMessage)status.MPI_TAG : APM_NONE;
@@ -71,13 +105,47 @@ APMessage CommLayer::checkMessage(int& sendID)
 bool CommLayer::receiveEmpty()
 {
 	MPI_Status status;
+	if (m_shared != NULL) {
+		releaseShared();
+		int source;
+		if (m_shared->poll(source))
+			return false;
+	}
 	return !request_get_status(m_request, status);
 }
 
+/** Return whether the packets to the specified process are sent
+ * through shared memory. */
+bool CommLayer::isShared(int destID) const
+{
+	return m_shared != NULL && m_shared->isLocal(destID);
+}
+
+/** Copy a packet into the ring of shared memory to the specified
+ * process of this node.
+ * @return false if the ring is full, in which case the packet should
+ * be sent again later
+ */
+bool CommLayer::sendSharedMessage(int destID,
+		const char* msg, size_t size)
+{
+	return m_shared->push(destID, msg, size);
+}
+
+/** Release the packet received through shared memory. */
+void CommLayer::releaseShared()
+{
+	if (m_sharedHeld >= 0) {
+		m_shared->pop(m_sharedHeld);
+		m_sharedHeld = -1;
+	}
+}
+
 /** Block until all processes have reached this routine. */
 void CommLayer::barrier()
 {
 	logger(4) << "entering barrier\n";
+	m_numBarriers++;
 	MPI_Barrier(MPI_COMM_WORLD);
 	logger(4) << "left barrier\n";
 }
@@ -107,6 +175,7 @@ long long unsigned CommLayer::reduce(long long unsigned count)
 {
 	logger(4) << "entering reduce: " << count << '\n';
 	long long unsigned sum;
+	m_numReductions++;
 	MPI_Allreduce(&count, &sum, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM,
 			MPI_COMM_WORLD);
 	logger(4) << "left reduce: " << sum << '\n';
@@ -118,6 +187,7 @@ vector<unsigned> CommLayer::reduce(const vector<unsigned>& v)
 {
 	logger(4) << "entering reduce\n";
 	vector<unsigned> sum(v.size());
+	m_numReductions++;
 	MPI_Allreduce(const_cast<unsigned*>(&v[0]),
 			&sum[0], v.size(), MPI_UNSIGNED, MPI_SUM,
 			MPI_COMM_WORLD);
@@ -131,6 +201,7 @@ vector<long unsigned> CommLayer::reduce(
 {
 	logger(4) << "entering reduce\n";
 	vector<long unsigned> sum(v.size());
+	m_numReductions++;
 	MPI_Allreduce(const_cast<long unsigned*>(&v[0]),
 			&sum[0], v.size(), MPI_UNSIGNED_LONG, MPI_SUM,
 			MPI_COMM_WORLD);
@@ -138,6 +209,55 @@ vector<long unsigned> CommLayer::reduce(
 	return sum;
 }
 
+/** Test whether every packet sent by any process has been received,
+ * without blocking. Each call either starts a wave of termination
+ * detection, which is a nonblocking reduction of the number of packets
+ * in flight, or tests whether the current wave has completed, so that
+ * the caller continues to receive and send packets meanwhile. Because
+ * every process starts the next wave after every process has started
+ * the previous one, if no process sent or received a packet between
+ * the two waves and no packet is in flight, no packet remains.
+ * The caller must send its queued packets before each call.
+ * @return true when the communication has terminated
+ */
+bool CommLayer::testQuiescence()
+{
+	if (m_waveRequest == MPI_REQUEST_NULL) {
+		m_waveIn[0] = m_txPackets - m_rxPackets;
+		m_waveIn[1] = m_txPackets != m_waveTx
+			|| m_rxPackets != m_waveRx;
+		m_waveTx = m_txPackets;
+		m_waveRx = m_rxPackets;
+		m_numReductions++;
+		MPI_Iallreduce(m_waveIn, m_waveOut, 2,
+				MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD,
+				&m_waveRequest);
+		return false;
+	}
+
+	int flag;
+	MPI_Test(&m_waveRequest, &flag, MPI_STATUS_IGNORE);
+	if (!flag)
+		return false;
+	logger(4) << "wave: " << m_waveOut[0] << " in flight, "
+		<< m_waveOut[1] << " active\n";
+	if (m_waveOut[0] != 0 || m_waveOut[1] != 0)
+		return false;
+	m_waveTx = m_waveRx = numeric_limits<uint64_t>::max();
+	return true;
+}
+
+/** Log the number of reductions and barriers of the specified
+ * state, and then clear them. */
+void CommLayer::logReductions(int state)
+{
+	if (m_numReductions == 0 && m_numBarriers == 0)
+		return;
+	logger(1) << "Performed " << m_numReductions << " reductions and "
+		<< m_numBarriers << " barriers in state " << state << '\n';
+	m_numReductions = m_numBarriers = 0;
+}
+
 uint64_t CommLayer::sendCheckPointMessage(int argument)
 {
 	logger(4) << "checkpoint: " << argument << '\n';
@@ -196,77 +316,56 @@ ControlMessage CommLayer::receiveControlMessage()
 	return msg;
 }
 
-/** Send a buffered collection of messages. */
-void CommLayer::sendBufferedMessage(int destID,
+/** Start sending a buffered collection of messages. The send does
+ * not block, so that two processes sending a large packet to each
+ * other do not wait on each other to receive it. The buffer must not
+ * be modified until the returned request is complete.
+ */
+MPI_Request CommLayer::sendBufferedMessage(int destID,
 		char* msg, size_t size)
 {
-	MPI_Send(msg, size, MPI_BYTE, destID, APM_BUFFERED,
-			MPI_COMM_WORLD);
+	MPI_Request request;
+	MPI_Isend(msg, size, MPI_BYTE, destID, APM_BUFFERED,
+			MPI_COMM_WORLD, &request);
+	return request;
 }
 
-/** Receive a buffered message. */
-void CommLayer::receiveBufferedMessage(MessagePtrVector& outmessages)
+/** Receive a buffered message. The receive buffers are swapped so
+ * that the next receive is posted before the packet is decoded. A
+ * packet in shared memory is read in place.
+ * @param[out] size the size of the packet in bytes
+ * @return the packet, which is valid until the next call to
+ * checkMessage or this function
+ */
+const char* CommLayer::receiveBufferedMessage(size_t& size)
 {
-	assert(outmessages.empty());
+	if (m_sharedSource >= 0) {
+		const char* packet = m_shared->front(m_sharedSource, size);
+		assert(packet != NULL);
+		m_sharedHeld = m_sharedSource;
+		m_sharedSource = -1;
+		m_rxPackets++;
+		m_rxBytes += size;
+		return packet;
+	}
+
 	int flag;
 	MPI_Status status;
 	MPI_Test(&m_request, &flag, &status);
 	assert(flag);
 	assert((APMessage)status.MPI_TAG == APM_BUFFERED);
 
-	int size;
-	MPI_Get_count(&status, MPI_BYTE, &size);
-
-	int offset = 0;
-	while (offset < size) {
-		MessageType type = Message::readMessageType(
-				(char*)m_rxBuffer + offset);
-
-		Message* pNewMessage;
-		switch(type)
-		{
-			case MT_ADD:
-				pNewMessage = new SeqAddMessage();
-				break;
-			case MT_REMOVE:
-				pNewMessage = new SeqRemoveMessage();
-				break;
-			case MT_SET_FLAG:
-				pNewMessage = new SetFlagMessage();
-				break;
-			case MT_REMOVE_EXT:
-				pNewMessage = new RemoveExtensionMessage();
-				break;
-			case MT_SEQ_DATA_REQUEST:
-				pNewMessage = new SeqDataRequest();
-				break;
-			case MT_SEQ_DATA_RESPONSE:
-				pNewMessage = new SeqDataResponse();
-				break;
-			case MT_SET_BASE:
-				pNewMessage = new SetBaseMessage();
-				break;
-			default:
-				assert(false);
-				break;
-		}
-
-		// Unserialize the new message from the buffer
-		offset += pNewMessage->unserialize(
-				(char*)m_rxBuffer + offset);
-
-		// Constructed message will be deleted in the
-		// NetworkSequenceCollection calling function.
-		outmessages.push_back(pNewMessage);
-	}
-	assert(offset == size);
+	int count;
+	MPI_Get_count(&status, MPI_BYTE, &count);
+	size = count;
 
+	swap(m_rxBuffer, m_rxSpare);
 	assert(m_request == MPI_REQUEST_NULL);
 	MPI_Irecv(m_rxBuffer, RX_BUFSIZE,
 			MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD,
 			&m_request);
 
 	m_rxPackets++;
-	m_rxMessages += outmessages.size();
 	m_rxBytes += size;
+	return (const char*)m_rxSpare;
 }
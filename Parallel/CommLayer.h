@@ -5,6 +5,8 @@
 #include <mpi.h>
 #include <vector>
 
+class SharedRings;
+
 enum APMessage
 {
 	APM_NONE,
@@ -24,8 +26,6 @@ enum APControl
 	APC_BARRIER,
 };
 
-typedef std::vector<Message*> MessagePtrVector;
-
 struct ControlMessage
 {
 	int64_t id;
@@ -40,6 +40,10 @@ class CommLayer
 		CommLayer();
 		~CommLayer();
 
+		/** The size of the receive buffer, which is the largest
+		 * packet that may be sent. */
+		static const size_t MAX_PACKET_SIZE = 64*1024;
+
 		// Check if a message exists, if it does return the type
 		APMessage checkMessage(int &sendID);
 
@@ -71,22 +75,54 @@ class CommLayer
 		// Send a message that the checkpoint has been reached
 		uint64_t sendCheckPointMessage(int argument = 0);
 
-		// Send a buffered message
-		void sendBufferedMessage(int destID, char* msg, size_t size);
+		// Start sending a buffered message
+		MPI_Request sendBufferedMessage(int destID,
+				char* msg, size_t size);
+
+		/** Return whether the packets to the specified process are
+		 * sent through shared memory. */
+		bool isShared(int destID) const;
+		bool sendSharedMessage(int destID,
+				const char* msg, size_t size);
 
 		// Receive a buffered sequence of messages
-		void receiveBufferedMessage(MessagePtrVector& outmessages);
+		const char* receiveBufferedMessage(size_t& size);
 
-		uint64_t reduceInflight()
-		{
-			return reduce(m_txPackets - m_rxPackets);
-		}
+		bool testQuiescence();
+		void logReductions(int state);
 
 	private:
 		uint64_t m_msgID;
 		uint8_t* m_rxBuffer;
+		uint8_t* m_rxSpare;
 		MPI_Request m_request;
 
+		/** The nonblocking reduction of the current wave of
+		 * termination detection. */
+		MPI_Request m_waveRequest;
+		long long unsigned m_waveIn[2], m_waveOut[2];
+
+		/** The packets sent and received when the current wave
+		 * started. */
+		uint64_t m_waveTx, m_waveRx;
+
+		/** The number of reductions and barriers in this state. */
+		unsigned m_numReductions, m_numBarriers;
+
+		/** The rings of the processes of this node, or NULL if
+		 * every packet is sent using MPI. */
+		SharedRings* m_shared;
+
+		/** The process whose packet in shared memory was found by
+		 * checkMessage, or -1 if it found a message from MPI. */
+		int m_sharedSource;
+
+		/** The process whose packet in shared memory was received,
+		 * which is released by the next check, or -1. */
+		int m_sharedHeld;
+
+		void releaseShared();
+
 	protected:
 		// Counters
 		uint64_t m_rxPackets;
@@ -1,57 +1,128 @@
 #include "MessageBuffer.h"
+#include "Assembly/Options.h"
 #include "Common/Options.h"
+#include "IOUtil.h"
+#include "Log.h"
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
 
+const double MessageBuffer::FLUSH_INTERVAL = 0.001;
+
+/** The names of the message types. */
+static const char* const MESSAGE_TYPE_NAMES[NUM_MESSAGE_TYPES] = {
+	"void", "add", "remove", "set-flag", "remove-ext",
+	"seq-data-request", "seq-data-response", "set-base"
+};
+
+/** Open the file of the traffic of this process with the specified
+ * suffix, and write its header. */
+static void openTraffic(ofstream& out, const char* suffix,
+		const char* header)
+{
+	ostringstream s;
+	s << opt::trafficPath << '-' << opt::rank << suffix;
+	string path = s.str();
+	out.open(path.c_str());
+	assert_good(out, path);
+	out << header << '\n';
+}
+
 MessageBuffer::MessageBuffer()
-	: m_msgQueues(opt::numProc)
+	: m_msgQueues(opt::numProc), m_msgCounts(opt::numProc),
+	  m_queuedAt(opt::numProc), m_pending(0), m_oldest(0),
+	  m_backlog(opt::numProc), m_backlogged(0),
+	  m_sent(0), m_loggedMessages(0),
+	  // SeqDataResponse is the largest message.
+	  m_maxMessageSize(SeqDataResponse().getNetworkSize()),
+	  m_packetSize(DEFAULT_PACKET_SIZE),
+	  m_fitN(0), m_fitS(0), m_fitT(0), m_fitSS(0), m_fitST(0),
+	  m_latency(0), m_bandwidth(0),
+	  m_txTraffic(opt::numProc * NUM_MESSAGE_TYPES),
+	  m_rxTraffic(opt::numProc * NUM_MESSAGE_TYPES),
+	  m_packetTypes(opt::numProc),
+	  m_stamp(!opt::trafficPath.empty()), m_clockOffset(0),
+	  m_latencies(NUM_MESSAGE_TYPES)
 {
+	if (m_stamp) {
+		// Take the clock of process 0 as the reference. Every
+		// process reads its clock on leaving the barrier.
+		MPI_Barrier(MPI_COMM_WORLD);
+		double now = MPI_Wtime(), reference = now;
+		MPI_Bcast(&reference, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+		m_clockOffset = reference - now;
+		openTraffic(m_trafficOut, "-traffic.tsv",
+				"state\ttype\tpeer\t"
+				"tx_messages\ttx_bytes\ttx_packets\t"
+				"rx_messages\trx_bytes\trx_packets");
+		openTraffic(m_latencyOut, "-latency.tsv",
+				"state\ttype\tlatency_us\tmessages");
+	}
+	if (opt::packetSize > 0)
+		m_packetSize = opt::packetSize;
+	if (m_packetSize > MAX_PACKET_SIZE)
+		m_packetSize = MAX_PACKET_SIZE;
+	if (m_packetSize < m_maxMessageSize)
+		m_packetSize = m_maxMessageSize;
 	for (unsigned i = 0; i < m_msgQueues.size(); i++)
-		m_msgQueues[i].reserve(MAX_MESSAGES);
+		m_msgQueues[i].reserve(m_packetSize);
+}
+
+/** Wait for the packets that are being sent. */
+MessageBuffer::~MessageBuffer()
+{
+	assert(m_backlogged == 0);
+	for (list<Transmission>::iterator it = m_sending.begin();
+			it != m_sending.end(); ++it)
+		MPI_Wait(&it->request, MPI_STATUS_IGNORE);
 }
 
 void MessageBuffer::sendSeqAddMessage(int nodeID, const Kmer& seq)
 {
-	queueMessage(nodeID, new SeqAddMessage(seq), SM_BUFFERED);
+	queueMessage(nodeID, SeqAddMessage(seq), SM_BUFFERED);
 }
 
 void MessageBuffer::sendSeqRemoveMessage(int nodeID, const Kmer& seq)
 {
-	queueMessage(nodeID, new SeqRemoveMessage(seq), SM_BUFFERED);
+	queueMessage(nodeID, SeqRemoveMessage(seq), SM_BUFFERED);
 }
 
 // Send a set flag message
 void MessageBuffer::sendSetFlagMessage(int nodeID,
 		const Kmer& seq, SeqFlag flag)
 {
-	queueMessage(nodeID, new SetFlagMessage(seq, flag), SM_BUFFERED);
+	queueMessage(nodeID, SetFlagMessage(seq, flag), SM_BUFFERED);
 }
 
 // Send a remove extension message
 void MessageBuffer::sendRemoveExtension(int nodeID,
 		const Kmer& seq, extDirection dir, SeqExt ext)
 {
-	queueMessage(nodeID, new RemoveExtensionMessage(seq, dir, ext),
+	queueMessage(nodeID, RemoveExtensionMessage(seq, dir, ext),
 			SM_BUFFERED);
 }
 
 // Send a sequence data request
 void MessageBuffer::sendSeqDataRequest(int nodeID,
-		IDType group, IDType id, const Kmer& seq)
+		IDType group, IDType id, const Kmer& seq,
+		extDirection dir, unsigned lookahead)
 {
+	assert(lookahead < 256);
 	queueMessage(nodeID,
-			new SeqDataRequest(seq, group, id), SM_IMMEDIATE);
+			SeqDataRequest(seq, group, id, dir, lookahead),
+			SM_IMMEDIATE);
 }
 
 // Send a sequence data response
 void MessageBuffer::sendSeqDataResponse(int nodeID,
 		IDType group, IDType id, const Kmer& seq,
-		ExtensionRecord extRec, int multiplicity)
+		ExtensionRecord extRec, int multiplicity, SendMode mode)
 {
 	queueMessage(nodeID,
-			new SeqDataResponse(seq, group, id, extRec, multiplicity),
-			SM_IMMEDIATE);
+			SeqDataResponse(seq, group, id, extRec, multiplicity),
+			mode);
 }
 
 // Send a set base message
@@ -59,67 +130,365 @@ void MessageBuffer::sendSetBaseExtension(int nodeID,
 		const Kmer& seq, extDirection dir, uint8_t base)
 {
 	queueMessage(nodeID,
-			new SetBaseMessage(seq, dir, base), SM_BUFFERED);
+			SetBaseMessage(seq, dir, base), SM_BUFFERED);
 }
 
+/** Append space for a message to the packet for the specified
+ * process.
+ * @return a pointer to the space
+ */
+char* MessageBuffer::reserve(int nodeID, size_t size)
+{
+	MsgBuffer& packet = m_msgQueues[nodeID];
+	if (packet.empty()) {
+		m_queuedAt[nodeID] = MPI_Wtime();
+		if (m_pending++ == 0)
+			m_oldest = m_queuedAt[nodeID];
+		if (m_stamp) {
+			double t = m_queuedAt[nodeID] + m_clockOffset;
+			packet.resize(sizeof t);
+			memcpy(&packet[0], &t, sizeof t);
+		}
+	}
+	size_t offset = packet.size();
+	packet.resize(offset + size);
+	m_msgCounts[nodeID]++;
+	return &packet[offset];
+}
+
+/** Serialize the message into the packet for the specified process.
+ */
 void MessageBuffer::queueMessage(
-		int nodeID, Message* message, SendMode mode)
+		int nodeID, const Message& message, SendMode mode)
 {
 	if (opt::verbose >= 9)
-		cout << opt::rank << " to " << nodeID << ": " << *message;
-	m_msgQueues[nodeID].push_back(message);
+		cout << opt::rank << " to " << nodeID << ": " << message;
+	size_t size = message.getNetworkSize();
+	char* p = reserve(nodeID, size);
+	size_t n = message.serialize(p);
+	assert(n == size);
+	(void)n;
+	countSent(nodeID, p, size);
 	checkQueueForSend(nodeID, mode);
 }
 
+/** Queue the messages serialized by a worker thread. */
+void MessageBuffer::queueBatch(const MessageBatch& batch)
+{
+	const vector<char>& data = batch.m_data;
+	MessageBatch::Header header;
+	for (size_t offset = 0; offset < data.size();
+			offset += sizeof header + header.size) {
+		memcpy(&header, &data[offset], sizeof header);
+		char* p = reserve(header.nodeID, header.size);
+		memcpy(p, &data[offset + sizeof header], header.size);
+		countSent(header.nodeID, p, header.size);
+		checkQueueForSend(header.nodeID, SM_BUFFERED);
+	}
+}
+
 void MessageBuffer::checkQueueForSend(int nodeID, SendMode mode)
 {
-	size_t numMsgs = m_msgQueues[nodeID].size();
 	// check if the messages should be sent
-	if ((numMsgs == MAX_MESSAGES || mode == SM_IMMEDIATE)
-			&& numMsgs > 0) {
-		// Calculate the total size of the message
-		size_t totalSize = 0;
-		for(size_t i = 0; i < numMsgs; i++)
-		{
-			totalSize += m_msgQueues[nodeID][i]->getNetworkSize();
+	if ((m_msgQueues[nodeID].size() + m_maxMessageSize > m_packetSize
+				|| mode == SM_IMMEDIATE)
+			&& m_msgCounts[nodeID] > 0)
+		sendPacket(nodeID);
+}
+
+/** Start sending the packet of the specified process, and replace
+ * it with a spare empty packet. */
+void MessageBuffer::sendPacket(int nodeID)
+{
+	reapSent();
+	MsgBuffer& packet = m_msgQueues[nodeID];
+	size_t size = packet.size();
+	if (isShared(nodeID)) {
+		// Keep the order of the packets to each process.
+		if (m_backlog[nodeID].empty()
+				&& sendSharedMessage(nodeID, &packet[0], size))
+			packet.clear();
+		else {
+			m_backlog[nodeID].push_back(MsgBuffer());
+			m_backlog[nodeID].back().swap(packet);
+			m_backlogged++;
 		}
+	} else {
+		m_sending.push_back(Transmission());
+		Transmission& tx = m_sending.back();
+		tx.packet.swap(packet);
+		tx.start = MPI_Wtime();
+		tx.request = sendBufferedMessage(nodeID, &tx.packet[0], size);
+	}
+	if (packet.capacity() == 0 && !m_spare.empty()) {
+		packet.swap(m_spare.back());
+		m_spare.pop_back();
+	}
 
-		// Generate a buffer for all the messages
-		char* buffer = new char[totalSize];
+	m_txPackets++;
+	m_txMessages += m_msgCounts[nodeID];
+	m_txBytes += size;
+	m_packetSizes.insert(size);
+	if (m_stamp)
+		for (unsigned type = 0; type < NUM_MESSAGE_TYPES; ++type)
+			if (m_packetTypes[nodeID] & 1 << type)
+				m_txTraffic[nodeID * NUM_MESSAGE_TYPES + type]
+					.packets++;
+	clearQueue(nodeID);
+}
 
-		// Copy the messages into the buffer
-		size_t offset = 0;
-		for(size_t i = 0; i < numMsgs; i++)
-			offset += m_msgQueues[nodeID][i]->serialize(
-					buffer + offset);
+/** Count the messages of each type of a packet received from the
+ * specified process, and their latency from the time at which the
+ * oldest message of the packet was queued.
+ */
+void MessageBuffer::countReceived(int senderID,
+		const unsigned* messages, const size_t* bytes,
+		double queuedAt)
+{
+	// Round the latency up to a power of two microseconds.
+	int latency = 1;
+	double t = (MPI_Wtime() + m_clockOffset - queuedAt) * 1e6;
+	while (latency < t && latency < 1 << 30)
+		latency <<= 1;
+	for (unsigned type = 0; type < NUM_MESSAGE_TYPES; ++type) {
+		if (messages[type] == 0)
+			continue;
+		TrafficCounts& c
+			= m_rxTraffic[senderID * NUM_MESSAGE_TYPES + type];
+		c.messages += messages[type];
+		c.bytes += bytes[type];
+		c.packets++;
+		m_latencies[type].insert(latency, messages[type]);
+	}
+}
 
-		assert(offset == totalSize);
-		sendBufferedMessage(nodeID, buffer, totalSize);
+/** Copy the packets waiting for space into the rings of shared
+ * memory that have space. */
+void MessageBuffer::sendBacklog()
+{
+	for (size_t id = 0; id < m_backlog.size() && m_backlogged > 0;
+			++id) {
+		list<MsgBuffer>& backlog = m_backlog[id];
+		while (!backlog.empty() && sendSharedMessage(id,
+					&backlog.front()[0], backlog.front().size())) {
+			backlog.front().clear();
+			m_spare.push_back(MsgBuffer());
+			m_spare.back().swap(backlog.front());
+			backlog.pop_front();
+			m_backlogged--;
+		}
+	}
+}
 
-		delete [] buffer;
-		clearQueue(nodeID);
+/** Release the packets whose send has completed, and measure the
+ * time from starting each send to finding that it has completed. A
+ * small packet is usually sent eagerly, and its send completes once
+ * MPI has copied it, so this time estimates the local cost of a send
+ * and the delay until it is tested, rather than the latency of the
+ * network. */
+void MessageBuffer::reapSent()
+{
+	if (m_backlogged > 0)
+		sendBacklog();
+	for (list<Transmission>::iterator it = m_sending.begin();
+			it != m_sending.end();) {
+		int flag;
+		MPI_Test(&it->request, &flag, MPI_STATUS_IGNORE);
+		if (!flag) {
+			++it;
+			continue;
+		}
+		double t = MPI_Wtime() - it->start;
+		size_t size = it->packet.size();
+		m_fitN++;
+		m_fitS += size;
+		m_fitT += t;
+		m_fitSS += (double)size * size;
+		m_fitST += size * t;
+		if (++m_sent % ADAPT_INTERVAL == 0)
+			adaptPacketSize();
 
-		m_txPackets++;
-		m_txMessages += numMsgs;
-		m_txBytes += totalSize;
+		it->packet.clear();
+		m_spare.push_back(MsgBuffer());
+		m_spare.back().swap(it->packet);
+		it = m_sending.erase(it);
 	}
 }
 
-// Clear a queue of messages
+/** Fit the time to send a packet, as measured by reapSent, to its
+ * size by least squares, and unless opt::packetSize is specified,
+ * choose the size of a packet so that the fixed cost of a send is at
+ * most a tenth of the time to send it. The fixed cost is an estimate
+ * of the local overhead of a send, not of the latency of the network.
+ * The sums decay so that the fit follows the recent packets.
+ */
+void MessageBuffer::adaptPacketSize()
+{
+	double var = m_fitN * m_fitSS - m_fitS * m_fitS;
+	if (var > 0) {
+		double slope = (m_fitN * m_fitST - m_fitS * m_fitT) / var;
+		double intercept = (m_fitT - slope * m_fitS) / m_fitN;
+		if (slope > 0 && intercept > 0) {
+			m_latency = intercept;
+			m_bandwidth = 1 / slope;
+			if (opt::packetSize == 0) {
+				double size = 9 * m_latency * m_bandwidth;
+				if (size < MIN_PACKET_SIZE)
+					size = MIN_PACKET_SIZE;
+				else if (size > MAX_PACKET_SIZE)
+					size = MAX_PACKET_SIZE;
+				m_packetSize = (size_t)size;
+			}
+		}
+	}
+	m_fitN /= 2;
+	m_fitS /= 2;
+	m_fitT /= 2;
+	m_fitSS /= 2;
+	m_fitST /= 2;
+}
+
+// Clear a queue of messages, keeping its capacity
 void MessageBuffer::clearQueue(int nodeID)
 {
-	size_t numMsgs = m_msgQueues[nodeID].size();
-	for(size_t i = 0; i < numMsgs; i++)
-	{
-		// Delete the messages
-		delete m_msgQueues[nodeID][i];
-		m_msgQueues[nodeID][i] = 0;
+	if (m_msgCounts[nodeID] > 0) {
+		assert(m_pending > 0);
+		m_pending--;
 	}
 	m_msgQueues[nodeID].clear();
+	m_msgCounts[nodeID] = 0;
+	m_packetTypes[nodeID] = 0;
+}
+
+/** Send the packets whose oldest message has waited longer than
+ * FLUSH_INTERVAL, so that a partly full packet is not held back
+ * while this process is waiting for a response.
+ */
+void MessageBuffer::flushStale()
+{
+	reapSent();
+	if (m_pending == 0)
+		return;
+	double now = MPI_Wtime();
+	if (now - m_oldest < FLUSH_INTERVAL)
+		return;
+	m_oldest = now;
+	for (size_t id = 0; id < m_msgQueues.size(); ++id) {
+		if (m_msgCounts[id] == 0)
+			continue;
+		if (now - m_queuedAt[id] >= FLUSH_INTERVAL)
+			sendPacket(id);
+		else if (m_queuedAt[id] < m_oldest)
+			m_oldest = m_queuedAt[id];
+	}
 }
 
-// Flush the message buffer by sending all messages that are queued
-void MessageBuffer::flush()
+/** Log the sizes of the packets sent in the specified state, and
+ * then clear them. */
+void MessageBuffer::logPacketSizes(int state)
+{
+	if (m_packetSizes.empty())
+		return;
+	const Histogram& h = m_packetSizes;
+	logger(1) << "Sent " << m_txMessages - m_loggedMessages
+		<< " messages in " << h.size() << " packets in state " << state
+		<< " of mean size " << (unsigned)h.mean()
+		<< " median " << h.median()
+		<< " 90th percentile " << h.percentile(0.9)
+		<< " max " << h.maximum() << " bytes\n";
+	if (m_bandwidth > 0)
+		logger(1) << "Packet size " << m_packetSize << " bytes, "
+			"local send overhead "
+			<< setprecision(3) << m_latency * 1e6 << " us, "
+			"bandwidth " << setprecision(3) << m_bandwidth / 1e6
+			<< " MB/s\n";
+	logger(2) << h.barplot() << '\n';
+	m_packetSizes = Histogram();
+	m_loggedMessages = m_txMessages;
+}
+
+/** Log the messages of each type sent and received in the specified
+ * state, write them for each process to opt::trafficPath, and then
+ * clear them.
+ */
+void MessageBuffer::logTraffic(int state)
+{
+	if (!m_stamp)
+		return;
+	vector<TrafficCounts> tx(NUM_MESSAGE_TYPES), rx(NUM_MESSAGE_TYPES);
+	for (int id = 0; id < opt::numProc; ++id) {
+		for (unsigned type = 0; type < NUM_MESSAGE_TYPES; ++type) {
+			const TrafficCounts& t
+				= m_txTraffic[id * NUM_MESSAGE_TYPES + type];
+			const TrafficCounts& r
+				= m_rxTraffic[id * NUM_MESSAGE_TYPES + type];
+			if (t.messages == 0 && r.messages == 0)
+				continue;
+			tx[type].messages += t.messages;
+			tx[type].bytes += t.bytes;
+			tx[type].packets += t.packets;
+			rx[type].messages += r.messages;
+			rx[type].bytes += r.bytes;
+			rx[type].packets += r.packets;
+			if (m_trafficOut.is_open())
+				m_trafficOut << state
+					<< '\t' << MESSAGE_TYPE_NAMES[type]
+					<< '\t' << id
+					<< '\t' << t.messages
+					<< '\t' << t.bytes
+					<< '\t' << t.packets
+					<< '\t' << r.messages
+					<< '\t' << r.bytes
+					<< '\t' << r.packets << '\n';
+		}
+	}
+
+	for (unsigned type = 0; type < NUM_MESSAGE_TYPES; ++type) {
+		if (tx[type].messages == 0 && rx[type].messages == 0)
+			continue;
+		const Histogram& h = m_latencies[type];
+		ostringstream ss;
+		ss << "State " << state << ' '
+			<< MESSAGE_TYPE_NAMES[type] << ": sent "
+			<< tx[type].messages << " messages, "
+			<< tx[type].bytes << " bytes in "
+			<< tx[type].packets << " packets; received "
+			<< rx[type].messages << " messages, "
+			<< rx[type].bytes << " bytes in "
+			<< rx[type].packets << " packets";
+		if (!h.empty())
+			ss << "; latency median " << h.median()
+				<< " 90th percentile " << h.percentile(0.9)
+				<< " max " << h.maximum() << " us";
+		logger(2) << ss.str() << '\n';
+		if (m_latencyOut.is_open())
+			for (Histogram::const_iterator it = h.begin();
+					it != h.end(); ++it)
+				m_latencyOut << state
+					<< '\t' << MESSAGE_TYPE_NAMES[type]
+					<< '\t' << it->first
+					<< '\t' << it->second << '\n';
+	}
+	if (m_trafficOut.is_open()) {
+		m_trafficOut.flush();
+		m_latencyOut.flush();
+		assert_good(m_trafficOut, opt::trafficPath);
+		assert_good(m_latencyOut, opt::trafficPath);
+	}
+
+	fill(m_txTraffic.begin(), m_txTraffic.end(), TrafficCounts());
+	fill(m_rxTraffic.begin(), m_rxTraffic.end(), TrafficCounts());
+	m_latencies.assign(NUM_MESSAGE_TYPES, Histogram());
+}
+
+/** Send the messages of every queue. A packet to a process of this
+ * node may have to wait for space in its ring of shared memory, which
+ * the receiver frees only while it receives packets, so the caller
+ * must receive packets and call this function again until it returns
+ * true.
+ * @return whether no packet is waiting to be sent
+ */
+bool MessageBuffer::flush()
 {
 	// Send all messages in all queues
 	for(size_t id = 0; id < m_msgQueues.size(); ++id)
@@ -127,23 +496,29 @@ void MessageBuffer::flush()
 		// force the queue to send any pending messages
 		checkQueueForSend(id, SM_IMMEDIATE);
 	}
+	reapSent();
+	return m_backlogged == 0;
 }
 
-// Check if all the queues are empty
+/** Check that all the queues are empty and that no packet is waiting
+ * for space in a ring of shared memory. */
 bool MessageBuffer::transmitBufferEmpty() const
 {
 	bool isEmpty = true;
-	for (MessageQueues::const_iterator it = m_msgQueues.begin();
-			it != m_msgQueues.end(); ++it) {
-		if (!it->empty()) {
+	for (size_t id = 0; id < m_msgQueues.size(); ++id) {
+		if (m_msgCounts[id] > 0) {
 			cerr
 				<< opt::rank << ": error: tx buffer should be empty: "
-				<< it->size() << " messages from "
-				<< opt::rank << " to " << it - m_msgQueues.begin()
-				<< '\n';
-			for (MsgBuffer::const_iterator j = it->begin();
-					j != it->end(); ++j)
-				cerr << **j << '\n';
+				<< m_msgCounts[id] << " messages of "
+				<< m_msgQueues[id].size() << " bytes from "
+				<< opt::rank << " to " << id << '\n';
+			isEmpty = false;
+		}
+		if (!m_backlog[id].empty()) {
+			cerr
+				<< opt::rank << ": error: tx backlog should be empty: "
+				<< m_backlog[id].size() << " packets from "
+				<< opt::rank << " to " << id << '\n';
 			isEmpty = false;
 		}
 	}
@@ -4,23 +4,113 @@
 class MessageBuffer;
 
 #include "CommLayer.h"
+#include "Histogram.h"
 #include "Messages.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <list>
 #include <vector>
 
-typedef std::vector<Message*> MsgBuffer;
+/** A packet of serialized messages. */
+typedef std::vector<char> MsgBuffer;
 typedef std::vector<MsgBuffer> MessageQueues;
 
+/** Messages to any process, which are serialized by a worker thread
+ * and queued for sending by the communication thread. Each message
+ * is preceded by its destination and size. */
+class MessageBatch
+{
+	public:
+		void add(int nodeID, const Message& message)
+		{
+			Header header;
+			header.nodeID = nodeID;
+			header.size = message.getNetworkSize();
+			size_t offset = m_data.size();
+			m_data.resize(offset + sizeof header + header.size);
+			memcpy(&m_data[offset], &header, sizeof header);
+			message.serialize(&m_data[offset + sizeof header]);
+		}
+
+		/** Return the size of this batch in bytes. */
+		size_t bytes() const { return m_data.size(); }
+		bool empty() const { return m_data.empty(); }
+		void clear() { m_data.clear(); }
+		void swap(MessageBatch& o) { m_data.swap(o.m_data); }
+
+	private:
+		friend class MessageBuffer;
+
+		struct Header
+		{
+			int32_t nodeID;
+			uint32_t size;
+		};
+
+		std::vector<char> m_data;
+};
+
+/** The number of messages, bytes and packets of one type exchanged
+ * with one process. */
+struct TrafficCounts
+{
+	uint64_t messages;
+	uint64_t bytes;
+	uint64_t packets;
+
+	TrafficCounts() : messages(0), bytes(0), packets(0) { }
+};
+
+/** Count the messages of each type of a packet while passing them to
+ * a handler. */
+template <typename Handler>
+class CountingHandler
+{
+	public:
+		CountingHandler(Handler& handler) : m_handler(handler)
+		{
+			std::fill(messages, messages + NUM_MESSAGE_TYPES, 0);
+			std::fill(bytes, bytes + NUM_MESSAGE_TYPES, 0);
+		}
+
+		template <typename M>
+		void handle(int senderID, const M& message)
+		{
+			messages[M::TYPE]++;
+			bytes[M::TYPE] += message.getNetworkSize();
+			m_handler.handle(senderID, message);
+		}
+
+		/** The number of messages and bytes of each type. */
+		unsigned messages[NUM_MESSAGE_TYPES];
+		size_t bytes[NUM_MESSAGE_TYPES];
+
+	private:
+		Handler& m_handler;
+};
+
 enum SendMode
 {
 	SM_BUFFERED,
 	SM_IMMEDIATE
 };
 
-/** A buffer of Message. */
+/** A buffer of Message. The messages to each process are serialized
+ * directly into a reusable packet, so that queueing and sending a
+ * message does not allocate memory. A packet is sent when it is full,
+ * or when its oldest message has waited longer than FLUSH_INTERVAL.
+ * The size of a full packet is either opt::packetSize or adapts to
+ * the measured cost of sending a packet. A packet is sent without
+ * blocking, and its buffer is reused once the send completes. A
+ * packet to a process of the same node may be copied into a ring of
+ * shared memory instead, and waits while the ring is full.
+ */
 class MessageBuffer : public CommLayer
 {
 	public:
 		MessageBuffer();
+		~MessageBuffer();
 
 		void sendCheckPointMessage(int argument = 0)
 		{
@@ -49,16 +139,46 @@ class MessageBuffer : public CommLayer
 		void sendRemoveExtension(int nodeID,
 				const Kmer& seq, extDirection dir, SeqExt ext);
 		void sendSeqDataRequest(int nodeID,
-				IDType group, IDType id, const Kmer& seq);
+				IDType group, IDType id, const Kmer& seq,
+				extDirection dir = SENSE, unsigned lookahead = 0);
 		void sendSeqDataResponse(int nodeID,
 				IDType group, IDType id, const Kmer& seq,
-				ExtensionRecord extRec, int multiplicity);
+				ExtensionRecord extRec, int multiplicity,
+				SendMode mode = SM_IMMEDIATE);
 		void sendSetBaseExtension(int nodeID,
 				const Kmer& seq, extDirection dir, uint8_t base);
 
-		void flush();
+		bool flush();
 		void queueMessage
-			(int nodeID, Message* message, SendMode mode);
+			(int nodeID, const Message& message, SendMode mode);
+		void queueBatch(const MessageBatch& batch);
+
+		/** Receive a packet of messages and pass each message to
+		 * handler.handle. */
+		template <typename Handler>
+		void receiveBufferedMessage(int senderID, Handler& handler)
+		{
+			size_t size;
+			const char* packet
+				= CommLayer::receiveBufferedMessage(size);
+			double queuedAt = 0;
+			if (m_stamp) {
+				assert(size >= sizeof queuedAt);
+				memcpy(&queuedAt, packet, sizeof queuedAt);
+				packet += sizeof queuedAt;
+				size -= sizeof queuedAt;
+			}
+			if (!m_stamp) {
+				m_rxMessages += dispatchMessages(
+						senderID, packet, size, handler);
+				return;
+			}
+			CountingHandler<Handler> counter(handler);
+			m_rxMessages += dispatchMessages(
+					senderID, packet, size, counter);
+			countReceived(senderID,
+					counter.messages, counter.bytes, queuedAt);
+		}
 
 		// clear out a queue
 		void clearQueue(int nodeID);
@@ -69,9 +189,127 @@ class MessageBuffer : public CommLayer
 		// full.
 		void checkQueueForSend(int nodeID, SendMode mode);
 
+		void flushStale();
+		void logPacketSizes(int state);
+		void logTraffic(int state);
+
 	private:
-		static const size_t MAX_MESSAGES = 100;
+		char* reserve(int nodeID, size_t size);
+
+		/** Count a message queued for the specified process. */
+		void countSent(int nodeID, const char* message, size_t size)
+		{
+			if (!m_stamp)
+				return;
+			MessageType type = Message::readMessageType(message);
+			TrafficCounts& c
+				= m_txTraffic[nodeID * NUM_MESSAGE_TYPES + type];
+			c.messages++;
+			c.bytes += size;
+			m_packetTypes[nodeID] |= 1 << type;
+		}
+
+		void countReceived(int senderID, const unsigned* messages,
+				const size_t* bytes, double queuedAt);
+		void sendPacket(int nodeID);
+		void sendBacklog();
+		void reapSent();
+		void adaptPacketSize();
+
+		static const size_t MIN_PACKET_SIZE = 1024;
+		static const size_t DEFAULT_PACKET_SIZE = 4096;
+
+		/** The number of packets sent between adapting the size. */
+		static const unsigned ADAPT_INTERVAL = 1024;
+
+		/** The longest time in seconds that a message may wait. */
+		static const double FLUSH_INTERVAL;
+
 		MessageQueues m_msgQueues;
+
+		/** The number of messages queued for each process. */
+		std::vector<size_t> m_msgCounts;
+
+		/** The time at which each packet was started. */
+		std::vector<double> m_queuedAt;
+
+		/** The number of packets that are not empty. */
+		unsigned m_pending;
+
+		/** No packet was started before this time. */
+		double m_oldest;
+
+		/** A packet that is being sent. */
+		struct Transmission
+		{
+			MPI_Request request;
+			double start;
+			MsgBuffer packet;
+		};
+
+		/** The packets that are being sent. */
+		std::list<Transmission> m_sending;
+
+		/** The packets to each process of this node that are waiting
+		 * for space in its ring of shared memory. */
+		std::vector< std::list<MsgBuffer> > m_backlog;
+
+		/** The number of packets waiting for space in a ring. */
+		size_t m_backlogged;
+
+		/** Empty packets whose memory may be reused. */
+		MessageQueues m_spare;
+
+		/** The number of packets whose send has completed. */
+		uint64_t m_sent;
+
+		/** The number of messages sent before this state. */
+		uint64_t m_loggedMessages;
+
+		/** The size of the largest message. */
+		size_t m_maxMessageSize;
+
+		/** A packet is sent when its size reaches this size. */
+		size_t m_packetSize;
+
+		/** The sizes of the packets sent in this state. */
+		Histogram m_packetSizes;
+
+		/** The sums of a least-squares fit of the time from starting
+		 * to send a packet until its send is found to be complete, to
+		 * its size. */
+		double m_fitN, m_fitS, m_fitT, m_fitSS, m_fitST;
+
+		/** The fitted fixed cost in seconds and bandwidth in bytes
+		 * per second of sending a packet. The fixed cost estimates
+		 * the local overhead of a send, not the latency of the
+		 * network. */
+		double m_latency, m_bandwidth;
+
+		/** The messages of each type sent to and received from each
+		 * process in this state, indexed by process and then type. */
+		std::vector<TrafficCounts> m_txTraffic, m_rxTraffic;
+
+		/** The types of the messages of the packet for each
+		 * process, one bit for each type. */
+		std::vector<uint8_t> m_packetTypes;
+
+		/** Whether the messages of each type sent to and received
+		 * from each process are counted, which is set by --traffic.
+		 * Each packet then starts with the time at which its oldest
+		 * message was queued, to measure the latency. */
+		bool m_stamp;
+
+		/** The offset of the clock of process 0 from that of this
+		 * process. */
+		double m_clockOffset;
+
+		/** The histogram of the latency in microseconds from queueing
+		 * to handling the messages of each type in this state. */
+		std::vector<Histogram> m_latencies;
+
+		/** The files of the traffic and latency of each state. */
+		std::ofstream m_trafficOut, m_latencyOut;
 };
 
 #endif
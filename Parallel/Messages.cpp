@@ -1,5 +1,4 @@
 #include "Messages.h"
-#include "NetworkSequenceCollection.h"
 #include <cstring>
 
 static size_t serializeData(const void* ptr, char* buffer,
@@ -16,9 +15,9 @@ static size_t unserializeData(void* ptr, const char* buffer,
 	return size;
 }
 
-MessageType Message::readMessageType(char* buffer)
+MessageType Message::readMessageType(const char* buffer)
 {
-	return (MessageType)*(uint8_t*)buffer;
+	return (MessageType)*(const uint8_t*)buffer;
 }
 
 size_t Message::unserialize(const char* buffer)
@@ -29,7 +28,7 @@ size_t Message::unserialize(const char* buffer)
 	return offset;
 }
 
-size_t SeqAddMessage::serialize(char* buffer)
+size_t SeqAddMessage::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -37,13 +36,7 @@ size_t SeqAddMessage::serialize(char* buffer)
 	return offset;
 }
 
-void SeqAddMessage::handle(int senderID,
-		NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t SeqRemoveMessage::serialize(char* buffer)
+size_t SeqRemoveMessage::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -51,13 +44,7 @@ size_t SeqRemoveMessage::serialize(char* buffer)
 	return offset;
 }
 
-void SeqRemoveMessage::handle(int senderID,
-		NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t SetFlagMessage::serialize(char* buffer)
+size_t SetFlagMessage::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -75,13 +62,7 @@ size_t SetFlagMessage::unserialize(const char* buffer)
 	return offset;
 }
 
-void SetFlagMessage::handle(
-		int senderID, NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t RemoveExtensionMessage::serialize(char* buffer)
+size_t RemoveExtensionMessage::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -100,13 +81,7 @@ size_t RemoveExtensionMessage::unserialize(const char* buffer)
 	return offset;
 }
 
-void RemoveExtensionMessage::handle(
-		int senderID, NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t SetBaseMessage::serialize(char* buffer)
+size_t SetBaseMessage::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -126,13 +101,7 @@ size_t SetBaseMessage::unserialize(const char* buffer)
 	return offset;
 }
 
-void SetBaseMessage::handle(
-		int senderID, NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t SeqDataRequest::serialize(char* buffer)
+size_t SeqDataRequest::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -140,6 +109,9 @@ size_t SeqDataRequest::serialize(char* buffer)
 	offset += serializeData(
 			&m_group, buffer + offset, sizeof(m_group));
 	offset += serializeData(&m_id, buffer + offset, sizeof(m_id));
+	offset += serializeData(&m_dir, buffer + offset, sizeof(m_dir));
+	offset += serializeData(
+			&m_lookahead, buffer + offset, sizeof(m_lookahead));
 	return offset;
 }
 
@@ -150,16 +122,13 @@ size_t SeqDataRequest::unserialize(const char* buffer)
 	offset += unserializeData(
 			&m_group, buffer + offset, sizeof(m_group));
 	offset += unserializeData(&m_id, buffer + offset, sizeof(m_id));
+	offset += unserializeData(&m_dir, buffer + offset, sizeof(m_dir));
+	offset += unserializeData(
+			&m_lookahead, buffer + offset, sizeof(m_lookahead));
 	return offset;
 }
 
-void SeqDataRequest::handle(
-		int senderID, NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
-
-size_t SeqDataResponse::serialize(char* buffer)
+size_t SeqDataResponse::serialize(char* buffer) const
 {
 	size_t offset = 0;
 	buffer[offset++] = TYPE;
@@ -189,9 +158,3 @@ size_t SeqDataResponse::unserialize(const char* buffer)
 			&m_multiplicity, buffer + offset, sizeof(m_multiplicity));
 	return offset;
 }
-
-void SeqDataResponse::handle(
-		int senderID, NetworkSequenceCollection& handler)
-{
-	handler.handle(senderID, *this);
-}
@@ -3,10 +3,10 @@
 
 #include "Kmer.h"
 #include "KmerData.h"
+#include <cassert>
+#include <cstdlib>
 #include <ostream>
 
-class NetworkSequenceCollection;
-
 enum MessageType
 {
 	MT_VOID,
@@ -19,6 +19,9 @@ enum MessageType
 	MT_SET_BASE
 };
 
+/** The number of message types. */
+static const unsigned NUM_MESSAGE_TYPES = MT_SET_BASE + 1;
+
 enum MessageOp
 {
 	MO_VOID,
@@ -36,17 +39,14 @@ class Message
 		Message(const Kmer& seq) : m_seq(seq) { }
 		virtual ~Message() { }
 
-		virtual void handle(
-				int senderID, NetworkSequenceCollection& handler) = 0;
-
 		virtual size_t getNetworkSize() const
 		{
 			return sizeof (uint8_t) // MessageType
 				+ Kmer::serialSize();
 		}
 
-		static MessageType readMessageType(char* buffer);
-		virtual size_t serialize(char* buffer) = 0;
+		static MessageType readMessageType(const char* buffer);
+		virtual size_t serialize(char* buffer) const = 0;
 		virtual size_t unserialize(const char* buffer);
 
 		friend std::ostream& operator <<(std::ostream& out,
@@ -65,8 +65,7 @@ class SeqAddMessage : public Message
 		SeqAddMessage() { }
 		SeqAddMessage(const Kmer& seq) : Message(seq) { }
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 
 		static const MessageType TYPE = MT_ADD;
 };
@@ -78,8 +77,7 @@ class SeqRemoveMessage : public Message
 		SeqRemoveMessage() { }
 		SeqRemoveMessage(const Kmer& seq) : Message(seq) { }
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 
 		static const MessageType TYPE = MT_REMOVE;
 };
@@ -97,8 +95,7 @@ class SetFlagMessage : public Message
 			return Message::getNetworkSize() + sizeof m_flag;
 		}
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 		size_t unserialize(const char* buffer);
 
 		static const MessageType TYPE = MT_SET_FLAG;
@@ -120,8 +117,7 @@ class RemoveExtensionMessage : public Message
 				+ sizeof m_dir + sizeof m_ext;
 		}
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 		size_t unserialize(const char* buffer);
 
 		static const MessageType TYPE = MT_REMOVE_EXT;
@@ -134,22 +130,30 @@ class SeqDataRequest : public Message
 {
 	public:
 		SeqDataRequest() { }
-		SeqDataRequest(const Kmer& seq, IDType group, IDType id)
-			: Message(seq), m_group(group), m_id(id) { }
+		SeqDataRequest(const Kmer& seq, IDType group, IDType id,
+				extDirection dir = SENSE, uint8_t lookahead = 0)
+			: Message(seq), m_group(group), m_id(id),
+			m_dir(dir), m_lookahead(lookahead) { }
 
 		size_t getNetworkSize() const
 		{
 			return Message::getNetworkSize()
-				+ sizeof m_group + sizeof m_id;
+				+ sizeof m_group + sizeof m_id
+				+ sizeof m_dir + sizeof m_lookahead;
 		}
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 		size_t unserialize(const char* buffer);
 
 		static const MessageType TYPE = MT_SEQ_DATA_REQUEST;
 		IDType m_group;
 		IDType m_id;
+		uint8_t m_dir; // extDirection
+
+		/** The number of the following vertices in direction m_dir
+		 * whose properties are requested as well, if the path is
+		 * linear and they are local to the responder. */
+		uint8_t m_lookahead;
 };
 
 /** The response to a request for vertex properties. */
@@ -169,8 +173,7 @@ class SeqDataResponse : public Message
 				+ sizeof m_extRecord + sizeof m_multiplicity;
 		}
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 		size_t unserialize(const char* buffer);
 
 		static const MessageType TYPE = MT_SEQ_DATA_RESPONSE;
@@ -195,8 +198,7 @@ class SetBaseMessage : public Message
 				+ sizeof m_dir + sizeof m_base;
 		}
 
-		void handle(int senderID, NetworkSequenceCollection& handler);
-		size_t serialize(char* buffer);
+		size_t serialize(char* buffer) const;
 		size_t unserialize(const char* buffer);
 
 		static const MessageType TYPE = MT_SET_BASE;
@@ -204,4 +206,67 @@ class SetBaseMessage : public Message
 		uint8_t m_base;
 };
 
+/** Unserialize a message of type M from the specified buffer and
+ * pass it to the handler.
+ * @return the size of the message
+ */
+template <typename M, typename Handler>
+size_t dispatchMessage(int senderID,
+		const char* buffer, Handler& handler)
+{
+	M message;
+	size_t size = message.unserialize(buffer);
+	handler.handle(senderID, message);
+	return size;
+}
+
+/** Decode a packet of messages in place, and pass each message to
+ * the overload of handler.handle for its type, without allocating.
+ * @return the number of messages
+ */
+template <typename Handler>
+size_t dispatchMessages(int senderID,
+		const char* buffer, size_t size, Handler& handler)
+{
+	size_t count = 0;
+	for (size_t offset = 0; offset < size; count++) {
+		const char* p = buffer + offset;
+		switch (Message::readMessageType(p)) {
+		  case MT_ADD:
+			offset += dispatchMessage<SeqAddMessage>(
+					senderID, p, handler);
+			break;
+		  case MT_REMOVE:
+			offset += dispatchMessage<SeqRemoveMessage>(
+					senderID, p, handler);
+			break;
+		  case MT_SET_FLAG:
+			offset += dispatchMessage<SetFlagMessage>(
+					senderID, p, handler);
+			break;
+		  case MT_REMOVE_EXT:
+			offset += dispatchMessage<RemoveExtensionMessage>(
+					senderID, p, handler);
+			break;
+		  case MT_SEQ_DATA_REQUEST:
+			offset += dispatchMessage<SeqDataRequest>(
+					senderID, p, handler);
+			break;
+		  case MT_SEQ_DATA_RESPONSE:
+			offset += dispatchMessage<SeqDataResponse>(
+					senderID, p, handler);
+			break;
+		  case MT_SET_BASE:
+			offset += dispatchMessage<SetBaseMessage>(
+					senderID, p, handler);
+			break;
+		  default:
+			assert(false);
+			abort();
+		}
+		assert(offset <= size);
+	}
+	return count;
+}
+
 #endif
@@ -2,15 +2,31 @@
 #include "Assembly/Options.h"
 #include "AssemblyAlgorithms.h"
 #include "Common/Options.h"
+#include "FastaReader.h"
 #include "FastaWriter.h"
 #include "Histogram.h"
+#include "IOUtil.h"
 #include "Log.h"
 #include "StringUtil.h"
+#include "Timer.h"
+#include <algorithm>
+#include <cerrno>
 #include <climits> // for UINT_MAX
+#include <cstdio> // for rename
 #include <cstdlib>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <sched.h> // for sched_yield
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h> // for unlink
 #include <utility>
+#if _OPENMP
+# include <omp.h>
+#endif
 
 using namespace std;
 
@@ -19,38 +35,276 @@ using namespace std;
 // control node uses a lot of memory at large NP.
 const int DEDICATE_CONTROL_AT = 1000;
 
+/** The version of the manifest of a checkpoint. */
+static const unsigned CHECKPOINT_VERSION = 1;
+
+/** Return the path of the manifest of the checkpoints. */
+static string manifestPath()
+{
+	return opt::checkpointDir + "/manifest";
+}
+
+/** Return the prefix of the paths of the k-mer of the specified
+ * checkpoint, to which SequenceCollectionHash::store adds the rank.
+ */
+static string checkpointPrefix(unsigned generation)
+{
+	ostringstream s;
+	s << opt::checkpointDir << "/checkpoint-" << generation;
+	return s.str();
+}
+
+/** Return the path of the k-mer of this process of the specified
+ * checkpoint. */
+static string checkpointPath(unsigned generation)
+{
+	ostringstream s;
+	s << checkpointPrefix(generation)
+		<< '-' << setfill('0') << setw(3) << opt::rank << ".kmer";
+	return s.str();
+}
+
+/** Create the directory of the checkpoints and its parents, as does
+ * mkdir -p.
+ * @return whether the directory exists
+ */
+static bool makeCheckpointDir()
+{
+	const string& dir = opt::checkpointDir;
+	for (size_t i = dir.find('/', 1); ; i = dir.find('/', i + 1)) {
+		string path = dir.substr(0, i);
+		if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+			perror(path.c_str());
+			return false;
+		}
+		if (i == string::npos)
+			break;
+	}
+	struct stat st;
+	if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+		cerr << "error: `" << dir << "' is not a directory\n";
+		return false;
+	}
+	return true;
+}
+
+/** Return whether a checkpoint is stored after the specified stage.
+ */
+static bool isCheckpointStage(const char* stage)
+{
+	if (opt::checkpointDir.empty())
+		return false;
+	string stages = ',' + opt::checkpointStages + ',';
+	return stages.find(string(",") + stage + ',') != string::npos;
+}
+
+/** Load the reads. Every process reads its own section of each file
+ * that may be split, which is an uncompressed or BGZF-compressed FASTA
+ * or FASTQ file. Each of the other files is read by one process.
+ */
 void NetworkSequenceCollection::loadSequences()
 {
 	Timer timer("LoadSequences");
-	for (unsigned i = opt::rank; i < opt::inFiles.size();
-			i += opt::numProc)
-		AssemblyAlgorithms::loadSequences(this, opt::inFiles[i]);
+	if (m_resumeState != NAS_LOADING) {
+		string path = checkpointPath(m_checkpoint - 1);
+		logger(0) << "Reading `" << path << "'...\n";
+		m_data.load(path.c_str());
+		if (opt::rank == 0)
+			setColourSpace(opt::colourSpace);
+		return;
+	}
+	for (unsigned i = 0; i < opt::inFiles.size(); i++) {
+		const string& path = opt::inFiles[i];
+		if (opt::numProc > 1 && FastaReader::isSplittable(path.c_str()))
+			AssemblyAlgorithms::loadSequences(this, path,
+					opt::rank + 1, opt::numProc);
+		else if ((int)i % opt::numProc == opt::rank)
+			AssemblyAlgorithms::loadSequences(this, path);
+	}
 }
 
-/** Receive, process, send, and synchronize.
- * @return the number of inflight messages
+/** Generate the adjacency of the local k-mer. With more than one
+ * thread, the worker threads each take a shard at a time, and the
+ * edges to remote k-mer are queued in the outbox of the worker.
+ * Meanwhile the master thread, the only thread to call MPI, sends the
+ * posted outboxes and handles the received messages.
  */
-size_t NetworkSequenceCollection::pumpFlushReduce()
+void NetworkSequenceCollection::generateAdjacency()
 {
-	pumpNetwork();
-	m_comm.flush();
-	return m_comm.reduceInflight();
+#if _OPENMP
+	if (opt::threads > 1) {
+		Timer timer("GenerateAdjacency");
+		unsigned nextShard = 0;
+		m_outboxes.resize(opt::threads);
+		m_finishedWorkers = 0;
+		m_workersRunning = true;
+#pragma omp parallel num_threads(opt::threads)
+		{
+			// The runtime may provide fewer threads than requested.
+			unsigned workers = omp_get_num_threads() - 1;
+			if (workers == 0) {
+				AssemblyAlgorithms::generateAdjacency(this);
+			} else if (omp_get_thread_num() == 0) {
+				for (bool done = false; !done;) {
+#pragma omp critical(outbox)
+					done = m_finishedWorkers == workers;
+					drainOutboxes();
+					pumpNetwork();
+				}
+			} else {
+				// The master thread modifies the flags of the local
+				// k-mer while the workers run, so a worker copies the
+				// k-mer of its shard while holding the lock of the shard.
+				vector<Kmer> kmer;
+				for (unsigned shard;
+						(shard = __sync_fetch_and_add(&nextShard, 1))
+							< m_data.shards();) {
+					m_data.getKmer(shard, kmer);
+					for (vector<Kmer>::const_iterator it = kmer.begin();
+							it != kmer.end(); ++it)
+						AssemblyAlgorithms::addAdjacency(this, *it);
+				}
+				MessageBatch& outbox = *workerOutbox();
+#pragma omp critical(outbox)
+				{
+					if (!outbox.empty()) {
+						m_posted.push_back(MessageBatch());
+						m_posted.back().swap(outbox);
+					}
+					m_finishedWorkers++;
+				}
+			}
+		}
+		m_workersRunning = false;
+		return;
+	}
+#endif
+	AssemblyAlgorithms::generateAdjacency(this);
+}
+
+/** Return the outbox of the calling worker thread, or NULL if called
+ * by the communication thread. */
+MessageBatch* NetworkSequenceCollection::workerOutbox()
+{
+#if _OPENMP
+	if (m_workersRunning && omp_get_thread_num() > 0)
+		return &m_outboxes[omp_get_thread_num()];
+#endif
+	return NULL;
+}
+
+/** Post the outbox of a worker thread to the communication thread,
+ * and replace it with an empty outbox. Wait while too many outboxes
+ * are already posted.
+ */
+void NetworkSequenceCollection::postOutbox(MessageBatch& outbox)
+{
+	const size_t MAX_POSTED = 4 * opt::threads;
+	for (bool posted = false; !posted;) {
+#pragma omp critical(outbox)
+		if (m_posted.size() < MAX_POSTED) {
+			m_posted.push_back(MessageBatch());
+			m_posted.back().swap(outbox);
+			if (!m_spare.empty()) {
+				outbox.swap(m_spare.back());
+				m_spare.pop_back();
+			}
+			posted = true;
+		}
+		if (!posted)
+			sched_yield();
+	}
+}
+
+/** Queue the messages of the posted outboxes. Called by the
+ * communication thread. */
+void NetworkSequenceCollection::drainOutboxes()
+{
+	assert(m_draining.empty());
+#pragma omp critical(outbox)
+	m_draining.swap(m_posted);
+	if (m_draining.empty())
+		return;
+	for (vector<MessageBatch>::iterator it = m_draining.begin();
+			it != m_draining.end(); ++it) {
+		m_comm.queueBatch(*it);
+		it->clear();
+	}
+#pragma omp critical(outbox)
+	for (vector<MessageBatch>::iterator it = m_draining.begin();
+			it != m_draining.end(); ++it) {
+		m_spare.push_back(MessageBatch());
+		m_spare.back().swap(*it);
+	}
+	m_draining.clear();
+}
+
+/** Send a message to the specified process. A message sent by a
+ * worker thread is queued in its outbox. */
+void NetworkSequenceCollection::send(int nodeID, const Message& message)
+{
+	const size_t OUTBOX_SIZE = 64 * 1024;
+	MessageBatch* outbox = workerOutbox();
+	if (outbox == NULL) {
+		m_comm.queueMessage(nodeID, message, SM_BUFFERED);
+	} else {
+		outbox->add(nodeID, message);
+		if (outbox->bytes() >= OUTBOX_SIZE)
+			postOutbox(*outbox);
+	}
 }
 
 /** Receive packets and process them until no more work exists for any
- * slave processor.
+ * slave processor. Each process continues to receive packets while
+ * the termination of the communication is detected.
  */
 void NetworkSequenceCollection::completeOperation()
 {
 	Timer timer("completeOperation");
 
-	while (pumpFlushReduce() > 0)
-		;
+	do {
+		pumpNetwork();
+		m_comm.flush();
+	} while (!m_comm.testQuiescence());
 
 	assert(m_comm.transmitBufferEmpty()); // Nothing to send.
-	m_comm.barrier(); // Synchronize.
 	assert(m_comm.receiveEmpty()); // Nothing to receive.
-	assert(m_comm.reduceInflight() == 0);
+}
+
+/** Return the number of k-mer loaded by each process. Every process
+ * must call this function. */
+vector<long unsigned> NetworkSequenceCollection::reduceLoad()
+{
+	vector<long unsigned> loads(opt::numProc);
+	loads[opt::rank] = m_data.size();
+	return m_comm.reduce(loads);
+}
+
+/** Print the number of k-mer loaded by each process, and the ratio
+ * of the largest load to the mean load. */
+static void printLoadBalance(const vector<long unsigned>& loads)
+{
+	// The control process loads no k-mer at large NP.
+	vector<long unsigned>::const_iterator first = loads.begin();
+	if (opt::numProc >= DEDICATE_CONTROL_AT)
+		++first;
+	if (first == loads.end())
+		return;
+	long unsigned minLoad = *min_element(first, loads.end());
+	long unsigned maxLoad = *max_element(first, loads.end());
+	double mean = (double)accumulate(first, loads.end(), 0.0)
+		/ (loads.end() - first);
+	streamsize precision = cout.precision(3);
+	cout << "The k-mer per process range from " << minLoad
+		<< " to " << maxLoad << ". The largest is "
+		<< (mean > 0 ? maxLoad / mean : 1) << " times the mean.\n";
+	cout.precision(precision);
+	if (opt::verbose > 0) {
+		cout << "K-mer per process:";
+		for (unsigned i = 0; i < loads.size(); i++)
+			cout << ' ' << loads[i];
+		cout << '\n';
+	}
 }
 
 /** Run the assembly state machine. */
@@ -61,6 +315,11 @@ void NetworkSequenceCollection::run()
 
 	ofstream bubbleFile;
 
+	// Wait for the controller to create the checkpoint directory.
+	if (!opt::checkpointDir.empty() && !m_comm.receiveBroadcast())
+		exit(EXIT_FAILURE);
+	if (opt::resume)
+		readManifest();
 	SetState(NAS_LOADING);
 	while (m_state != NAS_DONE) {
 		switch (m_state) {
@@ -81,7 +340,7 @@ void NetworkSequenceCollection::run()
 				assert(!m_data.empty());
 				m_data.setDeletedKey();
 				m_data.shrink();
-				m_comm.reduce(m_data.size());
+				reduceLoad();
 
 				Histogram myh
 					= AssemblyAlgorithms::coverageHistogram(m_data);
@@ -94,7 +353,7 @@ void NetworkSequenceCollection::run()
 			case NAS_GEN_ADJ:
 				m_comm.barrier();
 				m_numBasesAdjSet = 0;
-				AssemblyAlgorithms::generateAdjacency(this);
+				generateAdjacency();
 				EndState();
 				SetState(NAS_WAITING);
 				m_comm.sendCheckPointMessage();
@@ -242,6 +501,14 @@ void NetworkSequenceCollection::run()
 				EndState();
 				SetState(NAS_DONE);
 				break;
+			case NAS_CHECKPOINT:
+				m_comm.barrier();
+				m_comm.reduce(storeCheckpoint());
+				m_comm.reduce(m_data.size());
+				m_comm.barrier();
+				removeCheckpoint();
+				SetState(NAS_WAITING);
+				break;
 			case NAS_WAITING:
 				pumpNetwork();
 				break;
@@ -418,6 +685,16 @@ void NetworkSequenceCollection::controlCoverage()
 /** Run the assembly state machine for the controller (rank = 0). */
 void NetworkSequenceCollection::runControl()
 {
+	// Create the checkpoint directory before loading the reads,
+	// rather than failing at the first checkpoint.
+	if (!opt::checkpointDir.empty()) {
+		bool ok = makeCheckpointDir();
+		m_comm.broadcast(ok);
+		if (!ok)
+			exit(EXIT_FAILURE);
+	}
+	if (opt::resume)
+		readManifest();
 	SetState(NAS_LOADING);
 	while (m_state != NAS_DONE) {
 		switch (m_state) {
@@ -440,11 +717,14 @@ void NetworkSequenceCollection::runControl()
 				assert(!m_data.empty() || opt::numProc >= DEDICATE_CONTROL_AT);
 				m_data.setDeletedKey();
 				m_data.shrink();
-				size_t numLoaded = m_comm.reduce(m_data.size());
+				vector<long unsigned> loads = reduceLoad();
+				size_t numLoaded = accumulate(
+						loads.begin(), loads.end(), (size_t)0);
 				cout << "Loaded " << numLoaded << " k-mer. "
 					"At least "
 					<< toSI(numLoaded * sizeof (value_type))
 					<< "B of RAM is required.\n";
+				printLoadBalance(loads);
 
 				Histogram myh
 					= AssemblyAlgorithms::coverageHistogram(m_data);
@@ -452,8 +732,9 @@ void NetworkSequenceCollection::runControl()
 				AssemblyAlgorithms::setCoverageParameters(h);
 				EndState();
 
-				SetState(m_data.isAdjacencyLoaded()
-						? NAS_ERODE : NAS_GEN_ADJ);
+				SetState(m_resumeState != NAS_LOADING ? m_resumeState
+						: m_data.isAdjacencyLoaded() ? NAS_ERODE
+						: NAS_GEN_ADJ);
 				break;
 			}
 			case NAS_GEN_ADJ:
@@ -461,7 +742,7 @@ void NetworkSequenceCollection::runControl()
 				m_comm.sendControlMessage(APC_SET_STATE, NAS_GEN_ADJ);
 				m_comm.barrier();
 				m_numBasesAdjSet = 0;
-				AssemblyAlgorithms::generateAdjacency(this);
+				generateAdjacency();
 				EndState();
 
 				m_numReachedCheckpoint++;
@@ -479,7 +760,8 @@ void NetworkSequenceCollection::runControl()
 					<< " edges.\n";
 				EndState();
 
-				SetState(opt::erode > 0 ? NAS_ERODE : NAS_TRIM);
+				controlCheckpoint("adjacency", "adjacency",
+						opt::erode > 0 ? NAS_ERODE : NAS_TRIM);
 				break;
 			case NAS_ERODE:
 				assert(opt::erode > 0);
@@ -498,17 +780,25 @@ void NetworkSequenceCollection::runControl()
 			case NAS_CLEAR_FLAGS:
 			case NAS_DISCOVER_BUBBLES:
 			case NAS_ASSEMBLE_COMPLETE:
+			case NAS_CHECKPOINT:
 			case NAS_WAITING:
 				// These states are used only by the slaves.
 				assert(false);
 				exit(EXIT_FAILURE);
 
 			case NAS_TRIM:
+			{
 				controlTrim();
-				SetState(opt::coverage > 0 ? NAS_COVERAGE
+				// Trimming is repeated after removing the
+				// low-coverage contigs.
+				ostringstream label;
+				label << "trim-" << ++m_trimRound;
+				controlCheckpoint("trim", label.str(),
+						opt::coverage > 0 ? NAS_COVERAGE
 						: opt::bubbleLen > 0 ? NAS_POPBUBBLE
 						: NAS_MARK_AMBIGUOUS);
 				break;
+			}
 
 			case NAS_COVERAGE:
 				controlCoverage();
@@ -528,7 +818,8 @@ void NetworkSequenceCollection::runControl()
 				out.close();
 				cout << "Removed " << numPopped << " bubbles.\n";
 
-				SetState(NAS_MARK_AMBIGUOUS);
+				controlCheckpoint("bubbles", "bubbles",
+						NAS_MARK_AMBIGUOUS);
 				break;
 			}
 			case NAS_MARK_AMBIGUOUS:
@@ -571,10 +862,166 @@ void NetworkSequenceCollection::runControl()
 	}
 }
 
+/** Read the manifest of the last checkpoint, and restore the
+ * parameters recorded in it. Every process reads the manifest.
+ */
+void NetworkSequenceCollection::readManifest()
+{
+	string path = manifestPath();
+	ifstream in(path.c_str());
+	if (!in) {
+		if (opt::rank == 0)
+			cout << "No checkpoint found in `" << opt::checkpointDir
+				<< "'. Starting from the beginning.\n";
+		return;
+	}
+
+	unsigned version = 0, generation = 0, k = 0;
+	int numProc = 0, state = NAS_LOADING;
+	string stage;
+	for (string key; in >> key;) {
+		if (key == "version")
+			in >> version;
+		else if (key == "stage")
+			in >> stage;
+		else if (key == "state")
+			in >> state;
+		else if (key == "generation")
+			in >> generation;
+		else if (key == "k")
+			in >> k;
+		else if (key == "numProc")
+			in >> numProc;
+		else if (key == "erode")
+			in >> opt::erode;
+		else if (key == "erodeStrand")
+			in >> opt::erodeStrand;
+		else if (key == "coverage")
+			in >> opt::coverage;
+		else if (key == "trimRound")
+			in >> m_trimRound;
+		else
+			in.ignore(numeric_limits<streamsize>::max(), '\n');
+	}
+
+	const char* error = NULL;
+	if (in.bad() || version != CHECKPOINT_VERSION)
+		error = "is not a manifest of this version";
+	else if (k != opt::kmerSize)
+		error = "has a different k";
+	else if (numProc != opt::numProc)
+		error = "has a different number of processes";
+	else if (state <= NAS_LOAD_COMPLETE || state >= NAS_ASSEMBLE)
+		error = "has an invalid state";
+	if (error != NULL) {
+		cerr << "error: the checkpoint `" << path << "' "
+			<< error << '\n';
+		exit(EXIT_FAILURE);
+	}
+
+	m_checkpoint = generation + 1;
+	m_resumeState = (NetworkAssemblyState)state;
+	if (opt::rank == 0)
+		cout << "Resuming from the checkpoint after " << stage << ".\n";
+}
+
+/** Record the checkpoint just stored, which completed the specified
+ * stage, in the manifest. The manifest is replaced atomically.
+ */
+void NetworkSequenceCollection::writeManifest(const string& stage,
+		NetworkAssemblyState next, size_t numKmer)
+{
+	string path = manifestPath();
+	string tmpPath = path + ".tmp";
+	ofstream out(tmpPath.c_str());
+	assert_good(out, tmpPath);
+	out << "version\t" << CHECKPOINT_VERSION << "\n"
+		"stage\t" << stage << "\n"
+		"state\t" << next << "\n"
+		"generation\t" << m_checkpoint << "\n"
+		"k\t" << opt::kmerSize << "\n"
+		"numProc\t" << opt::numProc << "\n"
+		"erode\t" << opt::erode << "\n"
+		"erodeStrand\t" << opt::erodeStrand << "\n"
+		"coverage\t" << opt::coverage << "\n"
+		"trimRound\t" << m_trimRound << "\n"
+		"kmer\t" << numKmer << '\n';
+	out.close();
+	assert_good(out, tmpPath);
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		perror(path.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Store the k-mer of this process in the next checkpoint.
+ * @return the size of the file in bytes
+ */
+uint64_t NetworkSequenceCollection::storeCheckpoint()
+{
+	double start = wallClock();
+	m_data.store(checkpointPrefix(m_checkpoint).c_str());
+	string path = checkpointPath(m_checkpoint);
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		perror(path.c_str());
+		exit(EXIT_FAILURE);
+	}
+	logger(1) << "Stored " << m_data.size() << " k-mer ("
+		<< toSI(st.st_size) << "B) in "
+		<< setprecision(3) << wallClock() - start << " s\n";
+	return st.st_size;
+}
+
+/** Remove the k-mer of this process of the previous checkpoint,
+ * once the manifest records the checkpoint just stored. */
+void NetworkSequenceCollection::removeCheckpoint()
+{
+	if (m_checkpoint > 0) {
+		string path = checkpointPath(m_checkpoint - 1);
+		if (unlink(path.c_str()) != 0 && errno != ENOENT)
+			perror(path.c_str());
+	}
+	m_checkpoint++;
+}
+
+/** Store a checkpoint if one is chosen after the specified stage,
+ * and then continue to the specified state.
+ * @param label the name of the checkpoint, which distinguishes the
+ * repeated rounds of a stage
+ */
+void NetworkSequenceCollection::controlCheckpoint(const char* stage,
+		const string& label, NetworkAssemblyState next)
+{
+	if (isCheckpointStage(stage)) {
+		cout << "Storing a checkpoint after " << label << "...\n";
+		double start = wallClock();
+		SetState(NAS_CHECKPOINT);
+		m_comm.sendControlMessage(APC_SET_STATE, NAS_CHECKPOINT);
+		m_comm.barrier();
+		uint64_t bytes = m_comm.reduce(storeCheckpoint());
+		size_t numKmer = m_comm.reduce(m_data.size());
+		writeManifest(label, next, numKmer);
+		m_comm.barrier();
+		removeCheckpoint();
+		double seconds = wallClock() - start;
+		ostringstream ss;
+		ss << "Stored " << numKmer << " k-mer (" << toSI(bytes)
+			<< "B) in " << setprecision(3) << seconds << " s ("
+			<< toSI(bytes / seconds) << "B/s).\n";
+		cout << ss.str();
+	}
+	SetState(next);
+}
+
+/** Send the queued messages, and receive packets until every packet
+ * has been sent, so that a following control message or barrier does
+ * not overtake a packet waiting for space in a ring of shared memory.
+ */
 void NetworkSequenceCollection::EndState()
 {
-	// Flush the message buffer
-	m_comm.flush();
+	while (!m_comm.flush())
+		pumpNetwork();
 }
 
 //
@@ -589,8 +1036,15 @@ void NetworkSequenceCollection::SetState(
 	// Ensure there are no pending messages
 	assert(m_comm.transmitBufferEmpty());
 
+	m_comm.logPacketSizes(m_state);
+	m_comm.logTraffic(m_state);
+	m_comm.logReductions(m_state);
 	m_state = newState;
 
+	// The edges of the remote k-mer may change in the next state.
+	m_extCache.clear();
+	assert(m_terminatedGroups.empty());
+
 	// Reset the checkpoint counter
 	m_numReachedCheckpoint = 0;
 	m_checkpointSum = 0;
@@ -601,6 +1055,7 @@ void NetworkSequenceCollection::SetState(
  */
 size_t NetworkSequenceCollection::pumpNetwork()
 {
+	m_comm.flushStale();
 	for (size_t count = 0; ; count++) {
 		int senderID;
 		APMessage msg = m_comm.checkMessage(senderID);
@@ -612,20 +1067,9 @@ size_t NetworkSequenceCollection::pumpNetwork()
 				// processing further packets.
 				return ++count;
 			case APM_BUFFERED:
-				{
-					MessagePtrVector msgs;
-					m_comm.receiveBufferedMessage(msgs);
-					for (MessagePtrVector::iterator
-							iter = msgs.begin();
-							iter != msgs.end(); iter++) {
-						// Handle each message based on its type
-						(*iter)->handle(senderID, *this);
-						// Delete the message
-						delete (*iter);
-						*iter = 0;
-					}
-					break;
-				}
+				// Handle each message based on its type
+				m_comm.receiveBufferedMessage(senderID, *this);
+				break;
 			case APM_NONE:
 				return count;
 		}
@@ -714,7 +1158,7 @@ void NetworkSequenceCollection::parseControlMessage(int source)
 			break;
 		case APC_ERODE_COMPLETE:
 			assert(m_state == NAS_ERODE_WAITING);
-			m_comm.flush();
+			EndState();
 			SetState(NAS_ERODE_COMPLETE);
 			break;
 		case APC_POPBUBBLE:
@@ -728,6 +1172,10 @@ void NetworkSequenceCollection::parseControlMessage(int source)
 	}
 }
 
+/** The branch ID of a SeqDataResponse that is sent in advance of a
+ * request, to be cached. */
+static const IDType LOOKAHEAD_ID = numeric_limits<IDType>::max();
+
 void NetworkSequenceCollection::handle(
 		int senderID, const SeqDataRequest& message)
 {
@@ -738,6 +1186,9 @@ void NetworkSequenceCollection::handle(
 	bool found = m_data.getSeqData(kmer, extRec, multiplicity);
 	assert(found);
 	(void)found;
+	if (message.m_lookahead > 0)
+		sendLookahead(senderID, kmer, extRec,
+				extDirection(message.m_dir), message.m_lookahead);
 	m_comm.sendSeqDataResponse(
 			senderID, message.m_group, message.m_id,
 			kmer, extRec, multiplicity);
@@ -746,9 +1197,159 @@ void NetworkSequenceCollection::handle(
 void NetworkSequenceCollection::handle(
 		int /*senderID*/, const SeqDataResponse& message)
 {
+	if (isCachedState())
+		cacheSeqData(message.m_seq,
+				message.m_extRecord, message.m_multiplicity);
+	if (message.m_id == LOOKAHEAD_ID)
+		return;
+
+	double start = MPI_Wtime();
+	if (m_probeStart > 0 && message.m_group == m_probeGroup
+			&& message.m_id == m_probeBranch) {
+		double t = start - m_probeStart;
+		m_roundTrip = m_roundTrip > 0 ? 0.875 * m_roundTrip + 0.125 * t
+			: t;
+		m_probeStart = 0;
+	}
 	processSequenceExtension(
 			message.m_group, message.m_id, message.m_seq,
 			message.m_extRecord, message.m_multiplicity);
+	double t = MPI_Wtime() - start;
+	m_responseTime = m_responseTime > 0
+		? 0.875 * m_responseTime + 0.125 * t : t;
+}
+
+/** Send the properties of the k-mer that follow the specified k-mer
+ * in direction dir, while the path is linear and the k-mer are local.
+ * The requester caches them, and so extends its branch without a round
+ * trip per k-mer. They are queued ahead of the response to the
+ * request, so that they arrive first.
+ */
+void NetworkSequenceCollection::sendLookahead(int nodeID, Kmer kmer,
+		ExtensionRecord extRec, extDirection dir, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		SeqExt ext = extRec.dir[dir];
+		if (!ext.hasExtension() || ext.isAmbiguous())
+			return;
+		vector<Kmer> adj;
+		AssemblyAlgorithms::generateSequencesFromExtension(
+				kmer, dir, ext, adj);
+		assert(adj.size() == 1);
+		kmer = adj.front();
+		int multiplicity = -1;
+		if (!isLocal(kmer)
+				|| !m_data.getSeqData(kmer, extRec, multiplicity))
+			return;
+		m_comm.sendSeqDataResponse(nodeID, 0, LOOKAHEAD_ID,
+				kmer, extRec, multiplicity, SM_BUFFERED);
+		if (extRec.dir[!dir].isAmbiguous())
+			return;
+	}
+}
+
+/** Return whether the edges of remote k-mer are looked ahead and
+ * cached in the current state. Only assembly does not change the
+ * edges and multiplicity of a k-mer. Trimming and removing
+ * low-coverage contigs remove k-mer and their edges while other
+ * branches are being extended.
+ */
+bool NetworkSequenceCollection::isCachedState() const
+{
+	return m_state == NAS_ASSEMBLE;
+}
+
+/** Return the index of the specified k-mer in the cache. */
+static inline size_t cacheIndex(const Kmer& kmer, size_t size)
+{
+	return kmer.getHashCode() & (size - 1);
+}
+
+/** Cache the properties of a remote k-mer. */
+void NetworkSequenceCollection::cacheSeqData(const Kmer& kmer,
+		const ExtensionRecord& extRec, int multiplicity)
+{
+	if (m_extCache.empty())
+		m_extCache.resize(EXT_CACHE_SIZE);
+	CachedSeqData& entry
+		= m_extCache[cacheIndex(kmer, m_extCache.size())];
+	entry.kmer = kmer;
+	entry.extRec = extRec;
+	entry.multiplicity = multiplicity;
+}
+
+/** Get the properties of the specified k-mer if it is local or
+ * cached.
+ * @return whether the properties were found
+ */
+bool NetworkSequenceCollection::lookupSeqData(const Kmer& kmer,
+		ExtensionRecord& extRec, int& multiplicity)
+{
+	if (isLocal(kmer)) {
+		bool found = m_data.getSeqData(kmer, extRec, multiplicity);
+		assert(found);
+		(void)found;
+		return true;
+	}
+	m_extRequests++;
+	if (m_extCache.empty())
+		return false;
+	const CachedSeqData& entry
+		= m_extCache[cacheIndex(kmer, m_extCache.size())];
+	if (entry.multiplicity < 0 || entry.kmer != kmer)
+		return false;
+	extRec = entry.extRec;
+	multiplicity = entry.multiplicity;
+	m_extCacheHits++;
+	return true;
+}
+
+/** Request the properties of a remote k-mer. In the states that
+ * cache them, the properties of the following k-mer are requested as
+ * well. One request at a time is timed to measure the round-trip
+ * time.
+ */
+void NetworkSequenceCollection::requestSeqData(uint64_t groupID,
+		uint64_t branchID, const Kmer& kmer, extDirection dir)
+{
+	unsigned lookahead = isCachedState() ? LOOKAHEAD : 0;
+	if (m_probeStart == 0) {
+		m_probeGroup = groupID;
+		m_probeBranch = branchID;
+		m_probeStart = MPI_Wtime();
+	}
+	m_comm.sendSeqDataRequest(computeNodeID(kmer),
+			groupID, branchID, kmer, dir, lookahead);
+}
+
+/** Adapt the maximum number of active branch groups to the round-trip
+ * time of an extension request. By Little's law, the number of
+ * requests in flight that keeps this process busy is the round-trip
+ * time divided by the time to process a response. A linear branch
+ * has at most one request in flight.
+ */
+void NetworkSequenceCollection::adaptWindow()
+{
+	if (m_roundTrip <= 0 || m_responseTime <= 0)
+		return;
+	double n = m_roundTrip / m_responseTime;
+	m_maxActive = n < MAX_ACTIVE ? MAX_ACTIVE
+		: n > MAX_WINDOW ? MAX_WINDOW
+		: (size_t)n;
+}
+
+/** Log the number of extension requests and the hit rate of the
+ * cache. */
+void NetworkSequenceCollection::logExtensionRequests()
+{
+	if (m_extRequests > 0)
+		logger(1) << "Requested the edges of " << m_extRequests
+			<< " remote k-mer, of which " << m_extCacheHits << " ("
+			<< 100 * m_extCacheHits / m_extRequests
+			<< "%) were cached. The round trip is "
+			<< (unsigned)(1e6 * m_roundTrip) << " us and "
+			"the window is " << m_maxActive << " branches.\n";
+	m_extRequests = m_extCacheHits = 0;
 }
 
 /** Distributed trimming function. */
@@ -788,15 +1389,16 @@ size_t NetworkSequenceCollection::performNetworkTrim(
 		assert(inserted);
 		(void)inserted;
 
-		generateExtensionRequest(branchGroupID, 0, iter->first);
+		generateExtensionRequest(branchGroupID, 0, iter->first, dir);
 		branchGroupID++;
 		numBranchesRemoved += processBranchesTrim();
 		seqCollection->pumpNetwork();
 
 		// Primitive load balancing
-		if(m_activeBranchGroups.size() > MAX_ACTIVE)
+		adaptWindow();
+		if(m_activeBranchGroups.size() > m_maxActive)
 		{
-			while(m_activeBranchGroups.size() > LOW_ACTIVE)
+			while(m_activeBranchGroups.size() > m_maxActive / 5)
 			{
 				seqCollection->pumpNetwork();
 				numBranchesRemoved += processBranchesTrim();
@@ -812,6 +1414,7 @@ size_t NetworkSequenceCollection::performNetworkTrim(
 	}
 
 	logger(0) << "Pruned " << numBranchesRemoved << " tips.\n";
+	logExtensionRequests();
 	return numBranchesRemoved;
 }
 
@@ -822,27 +1425,19 @@ size_t NetworkSequenceCollection::performNetworkTrim(
 size_t NetworkSequenceCollection::processBranchesTrim()
 {
 	size_t numBranchesRemoved = 0;
-	vector<BranchGroupMap::iterator> removeBranches;
-	// Check if any of the current branches have gone inactive
-	for (BranchGroupMap::iterator iter = m_activeBranchGroups.begin();
-			iter != m_activeBranchGroups.end(); iter++) {
-		if(!iter->second.isActive())
-		{
-			assert(iter->second.size() == 1);
-			if (AssemblyAlgorithms::processTerminatedBranchTrim(
-						this, iter->second[0]))
-				numBranchesRemoved++;
-
-			// Mark the group for removal
-			removeBranches.push_back(iter);
-		}
+	vector<uint64_t> terminated;
+	terminated.swap(m_terminatedGroups);
+	for (vector<uint64_t>::const_iterator it = terminated.begin();
+			it != terminated.end(); ++it) {
+		BranchGroupMap::iterator iter = m_activeBranchGroups.find(*it);
+		assert(iter != m_activeBranchGroups.end());
+		assert(!iter->second.isActive());
+		assert(iter->second.size() == 1);
+		if (AssemblyAlgorithms::processTerminatedBranchTrim(
+					this, iter->second[0]))
+			numBranchesRemoved++;
+		m_activeBranchGroups.erase(iter);
 	}
-
-	// Remove all the finished branches
-	for (vector<BranchGroupMap::iterator>::iterator rmIter
-				= removeBranches.begin();
-			rmIter != removeBranches.end(); rmIter++)
-		m_activeBranchGroups.erase(*rmIter);
 	return numBranchesRemoved;
 }
 
@@ -1144,15 +1739,16 @@ performNetworkAssembly(ISequenceCollection* seqCollection,
 		AssemblyAlgorithms::extendBranch(branch,
 				kmer, iter->second.getExtension(dir));
 		assert(branch.isActive());
-		generateExtensionRequest(branchGroupID++, 0, kmer);
+		generateExtensionRequest(branchGroupID++, 0, kmer, dir);
 
 		numAssembled += processBranchesAssembly(seqCollection,
 				fileWriter, numAssembled.first);
 		seqCollection->pumpNetwork();
 
-		if(m_activeBranchGroups.size() > MAX_ACTIVE)
+		adaptWindow();
+		if(m_activeBranchGroups.size() > m_maxActive)
 		{
-			while(m_activeBranchGroups.size() > LOW_ACTIVE)
+			while(m_activeBranchGroups.size() > m_maxActive / 5)
 			{
 				seqCollection->pumpNetwork();
 				numAssembled += processBranchesAssembly(seqCollection,
@@ -1178,6 +1774,7 @@ performNetworkAssembly(ISequenceCollection* seqCollection,
 	} else
 		logger(0) << "Assembled " << numAssembled.second
 			<< " k-mer in " << numAssembled.first << " contigs.\n";
+	logExtensionRequests();
 	return numAssembled;
 }
 
@@ -1190,43 +1787,45 @@ processBranchesAssembly(ISequenceCollection* seqCollection,
 		FastaWriter* fileWriter, unsigned currContigID)
 {
 	size_t assembledContigs = 0, assembledKmer = 0;
-	for (BranchGroupMap::iterator it = m_activeBranchGroups.begin();
-			it != m_activeBranchGroups.end();) {
-		if (!it->second.isActive()) {
-			assert(it->second.size() == 1);
-			BranchRecord& branch = it->second[0];
-			assert(branch.getState() == BS_NOEXT
-					|| branch.getState() == BS_AMBI_SAME
-					|| branch.getState() == BS_AMBI_OPP);
-			if ((opt::ss && branch.getDirection() == SENSE)
-					|| (!opt::ss && branch.isCanonical())) {
-				assembledContigs++;
-				assembledKmer += branch.size();
-				assembleContig(seqCollection, fileWriter, branch,
-						m_numAssembled + currContigID++);
-			}
-			m_activeBranchGroups.erase(it++);
-		} else
-			++it;
+	vector<uint64_t> terminated;
+	terminated.swap(m_terminatedGroups);
+	for (vector<uint64_t>::const_iterator id = terminated.begin();
+			id != terminated.end(); ++id) {
+		BranchGroupMap::iterator it = m_activeBranchGroups.find(*id);
+		assert(it != m_activeBranchGroups.end());
+		assert(!it->second.isActive());
+		assert(it->second.size() == 1);
+		BranchRecord& branch = it->second[0];
+		assert(branch.getState() == BS_NOEXT
+				|| branch.getState() == BS_AMBI_SAME
+				|| branch.getState() == BS_AMBI_OPP);
+		if ((opt::ss && branch.getDirection() == SENSE)
+				|| (!opt::ss && branch.isCanonical())) {
+			assembledContigs++;
+			assembledKmer += branch.size();
+			assembleContig(seqCollection, fileWriter, branch,
+					m_numAssembled + currContigID++);
+		}
+		m_activeBranchGroups.erase(it);
 	}
 	return make_pair(assembledContigs, assembledKmer);
 }
 
-/** Send a request for the edges of vertex kmer. */
+/** Send a request for the edges of vertex kmer, unless it is local
+ * or cached.
+ * @param dir the direction of the branch
+ */
 void NetworkSequenceCollection::generateExtensionRequest(
-		uint64_t groupID, uint64_t branchID, const Kmer& kmer)
+		uint64_t groupID, uint64_t branchID, const Kmer& kmer,
+		extDirection dir)
 {
-	if (isLocal(kmer)) {
-		ExtensionRecord extRec;
-		int multiplicity = -1;
-		bool success = m_data.getSeqData(kmer, extRec, multiplicity);
-		assert(success);
-		(void)success;
+	ExtensionRecord extRec;
+	int multiplicity = -1;
+	if (lookupSeqData(kmer, extRec, multiplicity))
 		processSequenceExtension(groupID, branchID,
 				kmer, extRec, multiplicity);
-	} else
-		m_comm.sendSeqDataRequest(computeNodeID(kmer),
-				groupID, branchID, kmer);
+	else
+		requestSeqData(groupID, branchID, kmer, dir);
 }
 
 /** Generate an extension request for each branch of this group. */
@@ -1243,7 +1842,7 @@ void NetworkSequenceCollection::generateExtensionRequests(
 	for (BranchGroup::const_iterator it = first; it != last; ++it) {
 		assert(it->size() == length);
 		generateExtensionRequest(groupID, branchID++,
-				it->back().first);
+				it->back().first, it->getDirection());
 	}
 }
 
@@ -1292,12 +1891,20 @@ void NetworkSequenceCollection::processLinearSequenceExtension(
 	BranchGroupMap::iterator iter
 		= m_activeBranchGroups.find(groupID);
 	assert(iter != m_activeBranchGroups.end());
+	BranchRecord& branch = iter->second[branchID];
 	Kmer currSeq = seq;
-	bool active = AssemblyAlgorithms::processLinearExtensionForBranch(
-			iter->second[branchID], currSeq, extRec, multiplicity,
-			maxLength);
-	if (active)
-		generateExtensionRequest(groupID, branchID, currSeq);
+	ExtensionRecord ext = extRec;
+	while (AssemblyAlgorithms::processLinearExtensionForBranch(
+				branch, currSeq, ext, multiplicity, maxLength)) {
+		// Extend the branch without a round trip while the next k-mer
+		// is local or cached.
+		if (!lookupSeqData(currSeq, ext, multiplicity)) {
+			requestSeqData(groupID, branchID, currSeq,
+					branch.getDirection());
+			return;
+		}
+	}
+	m_terminatedGroups.push_back(groupID);
 }
 
 /** Process a sequence extension for popping. */
@@ -1331,7 +1938,7 @@ void NetworkSequenceCollection::add(const Kmer& seq,
 		m_data.add(seq, coverage);
 	} else {
 		assert(coverage == 1);
-		m_comm.sendSeqAddMessage(computeNodeID(seq), seq);
+		send(computeNodeID(seq), SeqAddMessage(seq));
 	}
 }
 
@@ -1341,7 +1948,7 @@ void NetworkSequenceCollection::remove(const Kmer& seq)
 	if (isLocal(seq))
 		m_data.remove(seq);
 	else
-		m_comm.sendSeqRemoveMessage(computeNodeID(seq), seq);
+		send(computeNodeID(seq), SeqRemoveMessage(seq));
 }
 
 bool NetworkSequenceCollection::checkpointReached() const
@@ -1360,18 +1967,20 @@ void NetworkSequenceCollection::setFlag(const Kmer& seq, SeqFlag flag)
 	if (isLocal(seq))
 		m_data.setFlag(seq, flag);
 	else
-		m_comm.sendSetFlagMessage(computeNodeID(seq), seq, flag);
+		send(computeNodeID(seq), SetFlagMessage(seq, flag));
 }
 
 bool NetworkSequenceCollection::setBaseExtension(
 		const Kmer& seq, extDirection dir, uint8_t base)
 {
 	if (isLocal(seq)) {
-		if (m_data.setBaseExtension(seq, dir, base))
+		if (m_data.setBaseExtension(seq, dir, base)) {
+#pragma omp atomic
 			m_numBasesAdjSet++;
+		}
 	} else {
 		int nodeID = computeNodeID(seq);
-		m_comm.sendSetBaseExtension(nodeID, seq, dir, base);
+		send(nodeID, SetBaseMessage(seq, dir, base));
 	}
 
 	// As this call delegates, the return value is meaningless.
@@ -1387,7 +1996,7 @@ void NetworkSequenceCollection::removeExtension(
 		notify(seq);
 	} else {
 		int nodeID = computeNodeID(seq);
-		m_comm.sendRemoveExtension(nodeID, seq, dir, ext);
+		send(nodeID, RemoveExtensionMessage(seq, dir, ext));
 	}
 }
 
@@ -1400,9 +2009,11 @@ bool NetworkSequenceCollection::isLocal(const Kmer& seq) const
 /** Return the process ID to which the specified kmer belongs. */
 int NetworkSequenceCollection::computeNodeID(const Kmer& seq) const
 {
+	uint64_t code = opt::minimizer
+		? AssemblyAlgorithms::minimizerHash(seq) : seq.getCode();
 	if (opt::numProc < DEDICATE_CONTROL_AT) {
-		return seq.getCode() % (unsigned)opt::numProc;
+		return code % (unsigned)opt::numProc;
 	} else {
-		return seq.getCode() % (unsigned)(opt::numProc - 1) + 1;
+		return code % (unsigned)(opt::numProc - 1) + 1;
 	}
 }
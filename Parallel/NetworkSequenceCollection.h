@@ -7,6 +7,7 @@
 #include "CommLayer.h"
 #include "FastaWriter.h"
 #include "MessageBuffer.h"
+#include "Assembly/Options.h"
 #include "Timer.h"
 #include <ostream>
 #include <set>
@@ -32,6 +33,7 @@ enum NetworkAssemblyState
 	NAS_CLEAR_FLAGS, // clear the flags
 	NAS_ASSEMBLE, // assembling the data
 	NAS_ASSEMBLE_COMPLETE, // assembling is complete
+	NAS_CHECKPOINT, // store the k-mer of each process
 	NAS_WAITING, // non-control process is waiting
 	NAS_DONE // finished, clean up and exit
 };
@@ -43,8 +45,14 @@ class NetworkSequenceCollection : public ISequenceCollection
 {
 	public:
 		NetworkSequenceCollection()
-			: m_state(NAS_WAITING), m_trimStep(0),
-			m_numPopped(0), m_numAssembled(0) { }
+			: m_data(opt::threads > 1 ? 1024 : 1),
+			m_state(NAS_WAITING), m_trimStep(0),
+			m_numPopped(0), m_numAssembled(0),
+			m_maxActive(MAX_ACTIVE), m_roundTrip(0), m_responseTime(0),
+			m_probeStart(0), m_extRequests(0), m_extCacheHits(0),
+			m_workersRunning(false), m_finishedWorkers(0),
+			m_checkpoint(0), m_resumeState(NAS_LOADING),
+			m_trimRound(0) { }
 
 		size_t performNetworkTrim(ISequenceCollection* seqCollection);
 
@@ -61,6 +69,8 @@ class NetworkSequenceCollection : public ISequenceCollection
 		size_t controlMarkAmbiguous();
 		size_t controlSplitAmbiguous();
 		size_t controlSplit();
+		void controlCheckpoint(const char* stage,
+				const std::string& label, NetworkAssemblyState next);
 
 		// Perform a network assembly
 		std::pair<size_t, size_t> performNetworkAssembly(
@@ -83,7 +93,6 @@ class NetworkSequenceCollection : public ISequenceCollection
 
 		// Receive and dispatch packets.
 		size_t pumpNetwork();
-		size_t pumpFlushReduce();
 
 		void completeOperation();
 
@@ -132,6 +141,19 @@ class NetworkSequenceCollection : public ISequenceCollection
 		void notify(const Kmer& seq);
 
 		void loadSequences();
+		std::vector<long unsigned> reduceLoad();
+
+		void readManifest();
+		void writeManifest(const std::string& stage,
+				NetworkAssemblyState next, size_t numKmer);
+		uint64_t storeCheckpoint();
+		void removeCheckpoint();
+		void generateAdjacency();
+
+		MessageBatch* workerOutbox();
+		void postOutbox(MessageBatch& outbox);
+		void drainOutboxes();
+		void send(int nodeID, const Message& message);
 
 		std::pair<size_t, size_t> processBranchesAssembly(
 				ISequenceCollection* seqCollection,
@@ -140,7 +162,19 @@ class NetworkSequenceCollection : public ISequenceCollection
 		bool processBranchesDiscoverBubbles();
 
 		void generateExtensionRequest(
-				uint64_t groupID, uint64_t branchID, const Kmer& seq);
+				uint64_t groupID, uint64_t branchID, const Kmer& seq,
+				extDirection dir);
+		void requestSeqData(uint64_t groupID, uint64_t branchID,
+				const Kmer& seq, extDirection dir);
+		void sendLookahead(int nodeID, Kmer kmer,
+				ExtensionRecord extRec, extDirection dir, unsigned n);
+		bool lookupSeqData(const Kmer& kmer,
+				ExtensionRecord& extRec, int& multiplicity);
+		void cacheSeqData(const Kmer& kmer,
+				const ExtensionRecord& extRec, int multiplicity);
+		bool isCachedState() const;
+		void adaptWindow();
+		void logExtensionRequests();
 		void generateExtensionRequests(uint64_t groupID,
 				BranchGroup::const_iterator first,
 				BranchGroup::const_iterator last);
@@ -217,6 +251,43 @@ class NetworkSequenceCollection : public ISequenceCollection
 		// The current branches that are active
 		BranchGroupMap m_activeBranchGroups;
 
+		/** The linear branch groups that have terminated, and are
+		 * yet to be processed by processBranchesTrim or
+		 * processBranchesAssembly. */
+		std::vector<uint64_t> m_terminatedGroups;
+
+		/** The maximum number of active branch groups while
+		 * extending linear branches, which adapts to the round-trip
+		 * time of an extension request. */
+		size_t m_maxActive;
+
+		/** The mean round-trip time of an extension request and the
+		 * mean time to process its response in seconds. */
+		double m_roundTrip, m_responseTime;
+
+		/** The request whose round trip is being timed. */
+		IDType m_probeGroup, m_probeBranch;
+		double m_probeStart;
+
+		/** The properties of a remote k-mer. */
+		struct CachedSeqData
+		{
+			Kmer kmer;
+			ExtensionRecord extRec;
+			int multiplicity;
+			CachedSeqData() : multiplicity(-1) { }
+		};
+
+		/** A direct-mapped cache of the properties of the remote
+		 * k-mer received while assembling, in which the edges and
+		 * multiplicity of a k-mer do not change. The cache is
+		 * cleared when the state changes. */
+		std::vector<CachedSeqData> m_extCache;
+
+		/** The number of extension requests of remote k-mer, and the
+		 * number of those found in the cache. */
+		size_t m_extRequests, m_extCacheHits;
+
 		/** Bubbles, which are branch groups that have joined. */
 		BranchGroupMap m_bubbles;
 
@@ -224,8 +295,49 @@ class NetworkSequenceCollection : public ISequenceCollection
 		// during bubble popping.
 		std::set<uint64_t> m_finishedGroups;
 
+		/** Whether worker threads are running, which queue their
+		 * messages to be sent by the communication thread. */
+		bool m_workersRunning;
+
+		/** The messages queued by each worker thread. */
+		std::vector<MessageBatch> m_outboxes;
+
+		/** The outboxes posted by the worker threads, which are
+		 * guarded by the critical section outbox. */
+		std::vector<MessageBatch> m_posted;
+
+		/** Empty outboxes to be reused by the worker threads. */
+		std::vector<MessageBatch> m_spare;
+
+		/** The outboxes being sent by the communication thread. */
+		std::vector<MessageBatch> m_draining;
+
+		/** The number of worker threads that have finished. */
+		unsigned m_finishedWorkers;
+
+		/** The generation of the next checkpoint. */
+		unsigned m_checkpoint;
+
+		/** The state in which to resume the assembly after loading
+		 * the checkpoint, or NAS_LOADING if not resuming. */
+		NetworkAssemblyState m_resumeState;
+
+		/** The number of rounds of trimming completed, which
+		 * distinguishes the checkpoints after each round. */
+		unsigned m_trimRound;
+
 		static const size_t MAX_ACTIVE = 50;
 		static const size_t LOW_ACTIVE = 10;
+
+		/** The upper limit of m_maxActive. */
+		static const size_t MAX_WINDOW = 4096;
+
+		/** The number of following k-mer requested with each
+		 * extension request of a linear branch. */
+		static const unsigned LOOKAHEAD = 32;
+
+		/** The number of entries of m_extCache. */
+		static const size_t EXT_CACHE_SIZE = 1 << 16;
 };
 
 #endif
@@ -0,0 +1,183 @@
+#include "config.h"
+#include "SharedRings.h"
+#include "CommLayer.h"
+#include "Common/Options.h"
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+/** The size of the header preceding each packet of a ring. */
+static const size_t RECORD_HEADER = 8;
+
+/** The size recorded in place of a packet that wraps around to the
+ * start of the ring. */
+static const uint32_t WRAP = 0xffffffff;
+
+/** Round up to a multiple of eight. */
+static inline size_t align8(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
+/** Allocate a ring from each process of this node to each process
+ * of this node. Every process must call this constructor. If MPI-3 is
+ * not available, every other process is considered remote.
+ */
+SharedRings::SharedRings()
+	: m_comm(MPI_COMM_NULL), m_win(MPI_WIN_NULL),
+	  m_local(opt::numProc, -1), m_next(0)
+{
+	assert(RING_SIZE >= CommLayer::MAX_PACKET_SIZE + RECORD_HEADER);
+#if MPI_VERSION >= 3
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+			opt::rank, MPI_INFO_NULL, &m_comm);
+	int n, local;
+	MPI_Comm_size(m_comm, &n);
+	MPI_Comm_rank(m_comm, &local);
+	m_ranks.resize(n);
+	MPI_Allgather(&opt::rank, 1, MPI_INT,
+			&m_ranks[0], 1, MPI_INT, m_comm);
+	for (int i = 0; i < n; i++)
+		m_local[m_ranks[i]] = i;
+
+	// Allocate the rings to this process in its own segment, which
+	// may then be local to its NUMA node.
+	MPI_Info info;
+	MPI_Info_create(&info);
+	MPI_Info_set(info, const_cast<char*>("alloc_shared_noncontig"),
+			const_cast<char*>("true"));
+	Ring* base;
+	MPI_Win_allocate_shared(n * sizeof (Ring), 1, info, m_comm,
+			&base, &m_win);
+	MPI_Info_free(&info);
+	m_in.resize(n);
+	for (int i = 0; i < n; i++) {
+		m_in[i] = base + i;
+		m_in[i]->head = m_in[i]->tail = 0;
+	}
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, m_win);
+	MPI_Win_sync(m_win);
+	MPI_Barrier(m_comm);
+	MPI_Win_sync(m_win);
+
+	m_out.resize(n);
+	for (int i = 0; i < n; i++) {
+		MPI_Aint segmentSize;
+		int dispUnit;
+		Ring* p;
+		MPI_Win_shared_query(m_win, i, &segmentSize, &dispUnit, &p);
+		assert(segmentSize >= (MPI_Aint)(n * sizeof (Ring)));
+		m_out[i] = p + local;
+	}
+#endif
+}
+
+SharedRings::~SharedRings()
+{
+#if MPI_VERSION >= 3
+	if (m_win != MPI_WIN_NULL) {
+		MPI_Win_unlock_all(m_win);
+		MPI_Win_free(&m_win);
+	}
+	if (m_comm != MPI_COMM_NULL)
+		MPI_Comm_free(&m_comm);
+#endif
+}
+
+/** Copy a packet into the ring to the specified process of this
+ * node.
+ * @return false if the ring is full
+ */
+bool SharedRings::push(int dest, const char* packet, size_t size)
+{
+	assert(isLocal(dest));
+	Ring& r = *m_out[m_local[dest]];
+	uint64_t head = r.head;
+	uint64_t tail = r.tail;
+	__sync_synchronize();
+	size_t need = RECORD_HEADER + align8(size);
+	assert(need <= RING_SIZE);
+
+	size_t offset = tail % RING_SIZE;
+	if (offset + need > RING_SIZE) {
+		// Wrap around to the start of the ring.
+		size_t skip = RING_SIZE - offset;
+		if (tail + skip - head > RING_SIZE)
+			return false;
+		memcpy(&r.data[offset], &WRAP, sizeof WRAP);
+		tail += skip;
+		offset = 0;
+		__sync_synchronize();
+		r.tail = tail;
+	}
+	if (tail + need - head > RING_SIZE)
+		return false;
+
+	uint32_t n = size;
+	memcpy(&r.data[offset], &n, sizeof n);
+	memcpy(&r.data[offset + RECORD_HEADER], packet, size);
+	__sync_synchronize();
+	r.tail = tail + need;
+	return true;
+}
+
+/** Return the next packet from the specified process of this node,
+ * which is valid until it is popped, or NULL if its ring is empty.
+ * @param[out] size the size of the packet
+ */
+const char* SharedRings::front(int source, size_t& size)
+{
+	assert(isLocal(source));
+	Ring& r = *m_in[m_local[source]];
+	for (;;) {
+		uint64_t head = r.head;
+		if (head == r.tail)
+			return NULL;
+		__sync_synchronize();
+		size_t offset = head % RING_SIZE;
+		uint32_t n;
+		memcpy(&n, &r.data[offset], sizeof n);
+		if (n == WRAP) {
+			__sync_synchronize();
+			r.head = head + RING_SIZE - offset;
+			continue;
+		}
+		size = n;
+		return &r.data[offset + RECORD_HEADER];
+	}
+}
+
+/** Release the next packet from the specified process, so that its
+ * space may be reused by its sender. */
+void SharedRings::pop(int source)
+{
+	size_t size;
+	const char* p = front(source, size);
+	assert(p != NULL);
+	(void)p;
+	Ring& r = *m_in[m_local[source]];
+	uint64_t head = r.head + RECORD_HEADER + align8(size);
+	__sync_synchronize();
+	r.head = head;
+}
+
+/** Find a process of this node whose ring to this process is not
+ * empty, polling the rings in turn.
+ * @param[out] source the rank of the process
+ * @return false if every ring is empty
+ */
+bool SharedRings::poll(int& source)
+{
+	size_t size;
+	for (unsigned i = 0; i < m_ranks.size(); i++) {
+		int rank = m_ranks[m_next];
+		if (++m_next == m_ranks.size())
+			m_next = 0;
+		if (front(rank, size) != NULL) {
+			source = rank;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,81 @@
+#ifndef SHAREDRINGS_H
+#define SHAREDRINGS_H 1
+
+#include <mpi.h>
+#include <stdint.h>
+#include <vector>
+
+/** Rings of shared memory through which the processes of one node
+ * send packets to each other without MPI. There is one ring for each
+ * ordered pair of processes of the node, which is allocated by its
+ * receiver. A ring has a single sender and a single receiver, and so
+ * needs no lock. A packet is copied once into the ring by its sender,
+ * and is read in place by its receiver.
+ */
+class SharedRings
+{
+	public:
+		SharedRings();
+		~SharedRings();
+
+		/** Return whether the specified process is on this node. */
+		bool isLocal(int rank) const { return m_local[rank] >= 0; }
+
+		/** Return the number of processes of this node. */
+		unsigned size() const { return m_in.size(); }
+
+		bool push(int dest, const char* packet, size_t size);
+		const char* front(int source, size_t& size);
+		void pop(int source);
+		bool poll(int& source);
+
+		/** The size in bytes of each ring, which is larger than the
+		 * largest packet. */
+		static const size_t RING_SIZE = 128*1024;
+
+	private:
+		SharedRings(const SharedRings&);
+		SharedRings& operator=(const SharedRings&);
+
+		/** A ring of packets. Each packet is preceded by its size
+		 * and padded to a multiple of eight bytes. The positions
+		 * increase monotonically, and are written only by the
+		 * receiver and the sender respectively. */
+		struct Ring
+		{
+			/** The position of the next packet to receive. */
+			volatile uint64_t head;
+			char pad0[64 - sizeof (uint64_t)];
+			/** The position following the last packet sent. */
+			volatile uint64_t tail;
+			char pad1[64 - sizeof (uint64_t)];
+			char data[RING_SIZE];
+		};
+
+		/** The communicator of the processes of this node. */
+		MPI_Comm m_comm;
+
+		/** The window of shared memory holding the rings. */
+		MPI_Win m_win;
+
+		/** The rank on this node of each process, or -1 if the
+		 * process is on another node. */
+		std::vector<int> m_local;
+
+		/** The ring from each process of this node to this process,
+		 * indexed by the rank on this node. */
+		std::vector<Ring*> m_in;
+
+		/** The ring from this process to each process of this node.
+		 */
+		std::vector<Ring*> m_out;
+
+		/** The processes of this node, indexed by their rank on
+		 * this node. */
+		std::vector<int> m_ranks;
+
+		/** The next ring to poll. */
+		unsigned m_next;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * Measure the throughput of the messages sent between processes.
+ */
+
+#include "config.h"
+#include "MessageBuffer.h"
+#include "Assembly/Options.h"
+#include "Common/Options.h"
+#include "Kmer.h"
+#include "Sequence.h"
+#include "StringUtil.h"
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+#define PROGRAM "msgbench"
+
+static const char VERSION_MESSAGE[] =
+PROGRAM " (" PACKAGE_NAME ") " VERSION "\n"
+"\n"
+"Copyright 2014 Canada's Michael Smith Genome Sciences Centre\n";
+
+static const char USAGE_MESSAGE[] =
+"Usage: mpirun -np NP " PROGRAM " [OPTION]...\n"
+"Measure the number of messages per second sent by each process\n"
+"to the other processes, and the CPU time used to send them.\n"
+"\n"
+" Options:\n"
+"\n"
+"  -k, --kmer=N          length of a k-mer [31]\n"
+"  -n, --count=N         number of messages sent by each\n"
+"                        process [1000000]\n"
+"  -p, --packet-size=N   size of a packet in bytes, which may have\n"
+"                        a suffix k [0, adaptive]\n"
+"  -s, --shared-memory   send the messages to the processes of the\n"
+"                        same node through shared memory\n"
+"      --help            display this help and exit\n"
+"      --version         output version information and exit\n"
+"\n"
+"Report bugs to <" PACKAGE_BUGREPORT ">.\n";
+
+namespace opt {
+	static unsigned k = 31;
+	static unsigned count = 1000000;
+}
+
+static const char shortopts[] = "k:n:p:s";
+
+enum { OPT_HELP = 1, OPT_VERSION };
+
+static const struct option longopts[] = {
+	{ "kmer", required_argument, NULL, 'k' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "packet-size", required_argument, NULL, 'p' },
+	{ "shared-memory", no_argument, NULL, 's' },
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ "version", no_argument, NULL, OPT_VERSION },
+	{ NULL, 0, NULL, 0 }
+};
+
+/** Count the messages received. */
+struct MessageCounter
+{
+	size_t count;
+	MessageCounter() : count(0) { }
+
+	template <typename M>
+	void handle(int /*senderID*/, const M& /*message*/)
+	{
+		count++;
+	}
+};
+
+/** Return random k-mer. */
+static vector<Kmer> randomKmers(unsigned n)
+{
+	vector<Kmer> kmers;
+	kmers.reserve(n);
+	Sequence s(Kmer::length(), 'A');
+	for (unsigned i = 0; i < n; i++) {
+		for (Sequence::iterator it = s.begin(); it != s.end(); ++it)
+			*it = "ACGT"[rand() % 4];
+		kmers.push_back(Kmer(s));
+	}
+	return kmers;
+}
+
+/** Return the destination of the specified message. The messages
+ * are sent to the other processes in turn. */
+static int destination(unsigned i)
+{
+	if (opt::numProc == 1)
+		return 0;
+	return (opt::rank + 1 + i % (opt::numProc - 1)) % opt::numProc;
+}
+
+/** Receive and count the packets that have arrived. */
+static void pump(MessageBuffer& comm, MessageCounter& counter)
+{
+	int senderID;
+	while (comm.checkMessage(senderID) == APM_BUFFERED)
+		comm.receiveBufferedMessage(senderID, counter);
+}
+
+static void sendAdd(MessageBuffer& comm, int dest, const Kmer& kmer)
+{
+	comm.sendSeqAddMessage(dest, kmer);
+}
+
+static void sendSetBase(MessageBuffer& comm, int dest, const Kmer& kmer)
+{
+	comm.sendSetBaseExtension(dest, kmer, SENSE, 0);
+}
+
+/** Measure the throughput of one type of message. */
+static void bench(MessageBuffer& comm, const vector<Kmer>& kmers,
+		const char* op,
+		void (*send)(MessageBuffer&, int, const Kmer&))
+{
+	vector<long unsigned> sent(opt::numProc);
+	for (unsigned i = 0; i < opt::count; i++)
+		sent[destination(i)]++;
+	size_t expected = comm.reduce(sent)[opt::rank];
+
+	MessageCounter counter;
+	comm.barrier();
+	double start = MPI_Wtime();
+	clock_t cpuStart = clock();
+	for (unsigned i = 0; i < opt::count; i++) {
+		send(comm, destination(i), kmers[i % kmers.size()]);
+		if (i % 64 == 0)
+			pump(comm, counter);
+	}
+	while (!comm.flush() || counter.count < expected)
+		pump(comm, counter);
+	double result[2] = {
+		opt::count / (MPI_Wtime() - start),
+		(double)(clock() - cpuStart) / CLOCKS_PER_SEC
+	};
+	comm.barrier();
+
+	vector<double> results(2 * opt::numProc);
+	MPI_Gather(result, 2, MPI_DOUBLE,
+			&results[0], 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	if (opt::rank == 0)
+		for (int i = 0; i < opt::numProc; i++)
+			cout << i << '\t' << op << '\t'
+				<< (unsigned long)results[2 * i] << '\t'
+				<< results[2 * i + 1] << '\n';
+}
+
+int main(int argc, char** argv)
+{
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &opt::rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &opt::numProc);
+
+	bool die = false;
+	for (int c; (c = getopt_long(argc, argv,
+					shortopts, longopts, NULL)) != -1;) {
+		istringstream arg(optarg != NULL ? optarg : "");
+		switch (c) {
+		  case '?': die = true; break;
+		  case 'k': arg >> opt::k; break;
+		  case 'n': arg >> opt::count; break;
+		  case 'p': opt::packetSize = SIToBytes(arg); break;
+		  case 's': opt::sharedMemory = 1; break;
+		  case OPT_HELP:
+			if (opt::rank == 0)
+				cout << USAGE_MESSAGE;
+			MPI_Finalize();
+			exit(EXIT_SUCCESS);
+		  case OPT_VERSION:
+			if (opt::rank == 0)
+				cout << VERSION_MESSAGE;
+			MPI_Finalize();
+			exit(EXIT_SUCCESS);
+		}
+		if (optarg != NULL && !arg.eof()) {
+			cerr << PROGRAM ": invalid option: `-"
+				<< (char)c << optarg << "'\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (opt::k == 0 || opt::k > MAX_KMER) {
+		cerr << PROGRAM ": k must be between 1 and "
+			<< MAX_KMER << '\n';
+		die = true;
+	}
+
+	if (opt::count == 0 || optind < argc)
+		die = true;
+
+	if (die) {
+		cerr << "Try `" << PROGRAM
+			<< " --help' for more information.\n";
+		exit(EXIT_FAILURE);
+	}
+
+	Kmer::setLength(opt::k);
+	srand(opt::rank + 1);
+	vector<Kmer> kmers = randomKmers(1 << 16);
+	{
+		MessageBuffer comm;
+		if (opt::rank == 0)
+			cout << "rank\toperation\tmessages_per_second"
+				"\tcpu_seconds\n";
+		bench(comm, kmers, "add", sendAdd);
+		bench(comm, kmers, "setBase", sendSetBase);
+	}
+	MPI_Finalize();
+	return 0;
+}
@@ -16,6 +16,9 @@
 #include <sstream>
 #include <unistd.h> // for gethostname
 #include <vector>
+#if _OPENMP
+# include <omp.h>
+#endif
 
 using namespace std;
 
@@ -69,7 +72,9 @@ int main(int argc, char** argv)
 	// Set stdout to be line buffered.
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
-	MPI_Init(&argc,&argv);
+	// Only the master thread calls MPI.
+	int threadSupport;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSupport);
 	MPI_Comm_rank(MPI_COMM_WORLD, &opt::rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &opt::numProc);
 
@@ -78,8 +83,26 @@ int main(int argc, char** argv)
 	uncompress_init();
 
 	opt::parse(argc, argv);
-	if (opt::rank == 0)
-		cout << "Running on " << opt::numProc << " processors\n";
+	if (opt::threads == 0)
+		opt::threads = 1;
+	if (opt::threads > 1 && threadSupport < MPI_THREAD_FUNNELED) {
+		if (opt::rank == 0)
+			cerr << "warning: MPI does not support threads. "
+				"Using one thread per process.\n";
+		opt::threads = 1;
+	}
+#if _OPENMP
+	if (opt::threads > 0)
+		omp_set_num_threads(opt::threads);
+#else
+	opt::threads = 1;
+#endif
+	if (opt::rank == 0) {
+		cout << "Running on " << opt::numProc << " processors";
+		if (opt::threads > 1)
+			cout << " of " << opt::threads << " threads each";
+		cout << '\n';
+	}
 
 	MPI_Barrier(MPI_COMM_WORLD);
 	char hostname[HOST_NAME_MAX];
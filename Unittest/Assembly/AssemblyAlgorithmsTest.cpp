@@ -0,0 +1,48 @@
+#include "Assembly/AssemblyAlgorithms.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+/** Return a random sequence of the specified length. */
+static string randomSequence(unsigned n)
+{
+	string s(n, 'A');
+	for (unsigned i = 0; i < n; i++)
+		s[i] = "ACGT"[rand() % 4];
+	return s;
+}
+
+TEST(minimizerHash, reverseComplement)
+{
+	Kmer::setLength(31);
+	srand(1);
+	for (unsigned i = 0; i < 1000; i++) {
+		Kmer u(randomSequence(31));
+		Kmer v = u;
+		v.reverseComplement();
+		EXPECT_EQ(AssemblyAlgorithms::minimizerHash(u),
+				AssemblyAlgorithms::minimizerHash(v));
+	}
+}
+
+TEST(minimizerHash, adjacent)
+{
+	Kmer::setLength(31);
+	srand(2);
+	const unsigned n = 10000;
+	string s = randomSequence(n + 30);
+	unsigned same = 0;
+	uint64_t prev = AssemblyAlgorithms::minimizerHash(
+			Kmer(s.substr(0, 31)));
+	for (unsigned i = 1; i < n; i++) {
+		uint64_t h = AssemblyAlgorithms::minimizerHash(
+				Kmer(s.substr(i, 31)));
+		same += h == prev;
+		prev = h;
+	}
+	// With k=31 and m=15, a new minimizer is expected every
+	// (k - m + 2) / 2 = 9 k-mer.
+	EXPECT_GT(same, n * 3 / 4);
+}
@@ -0,0 +1,141 @@
+#include "Assembly/KmerTable.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** Return the k-mer of length k numbered n. */
+static Kmer kmer(unsigned k, unsigned n)
+{
+	string s(k, 'A');
+	for (unsigned i = 0; i < k && n > 0; i++, n /= 4)
+		s[i] = "ACGT"[n % 4];
+	return Kmer(s);
+}
+
+TEST(KmerTable, insert_find)
+{
+	Kmer::setLength(31);
+	KmerTable t;
+	EXPECT_TRUE(t.empty());
+	EXPECT_TRUE(t.find(kmer(31, 1)) == t.end());
+
+	const unsigned n = 10000;
+	for (unsigned i = 0; i < n; i++) {
+		pair<KmerTable::iterator, bool> inserted
+			= t.insert(make_pair(kmer(31, i), KmerData(SENSE, i % 7)));
+		EXPECT_TRUE(inserted.second);
+	}
+	EXPECT_EQ(n, t.size());
+	EXPECT_FALSE(t.insert(make_pair(kmer(31, 0), KmerData())).second);
+	EXPECT_LE(t.size(), 0.9 * t.bucket_count());
+
+	for (unsigned i = 0; i < n; i++) {
+		KmerTable::const_iterator it = t.find(kmer(31, i));
+		ASSERT_TRUE(it != t.end());
+		EXPECT_EQ(kmer(31, i), it->first);
+		EXPECT_EQ(i % 7, it->second.getMultiplicity(SENSE));
+	}
+	EXPECT_TRUE(t.find(kmer(31, n)) == t.end());
+
+	unsigned count = 0;
+	for (KmerTable::const_iterator it = t.begin(); it != t.end(); ++it)
+		count++;
+	EXPECT_EQ(n, count);
+}
+
+TEST(KmerTable, setData)
+{
+	Kmer::setLength(25);
+	KmerTable t;
+	Kmer u = kmer(25, 42);
+	t.insert(make_pair(u, KmerData(ANTISENSE, 3)));
+
+	KmerTable::iterator it = t.find(u);
+	KmerData data = it->second;
+	data.addMultiplicity(SENSE, 2);
+	data.setBaseExtension(SENSE, 1);
+	data.setBaseExtension(ANTISENSE, 3);
+	data.setFlag(SF_MARK_ANTISENSE);
+	t.setData(it, data);
+
+	KmerData x = t.find(u)->second;
+	EXPECT_EQ(2U, x.getMultiplicity(SENSE));
+	EXPECT_EQ(3U, x.getMultiplicity(ANTISENSE));
+	EXPECT_TRUE(x.getExtension(SENSE).checkBase(1));
+	EXPECT_FALSE(x.getExtension(SENSE).checkBase(3));
+	EXPECT_TRUE(x.getExtension(ANTISENSE).checkBase(3));
+	EXPECT_TRUE(x.marked(ANTISENSE));
+	EXPECT_FALSE(x.marked(SENSE));
+	EXPECT_FALSE(x.deleted());
+}
+
+TEST(KmerTable, erase_rehash)
+{
+	Kmer::setLength(64);
+	KmerTable t;
+	const unsigned n = 5000;
+	for (unsigned i = 0; i < n; i++)
+		t.insert(make_pair(kmer(64, i), KmerData()));
+
+	for (KmerTable::iterator it = t.begin(); it != t.end();) {
+		if (it->first < kmer(64, n / 2))
+			t.erase(it++);
+		else
+			++it;
+	}
+	size_t size = t.size();
+	EXPECT_LT(size, n);
+	for (unsigned i = 0; i < n; i++)
+		EXPECT_EQ(kmer(64, i) < kmer(64, n / 2),
+				t.find(kmer(64, i)) == t.end());
+
+	t.rehash(0);
+	EXPECT_EQ(size, t.size());
+	EXPECT_GE(t.size(), 0.8 * t.bucket_count());
+	for (unsigned i = 0; i < n; i++)
+		EXPECT_EQ(kmer(64, i) < kmer(64, n / 2),
+				t.find(kmer(64, i)) == t.end());
+}
+
+TEST(KmerTable, attach)
+{
+	Kmer::setLength(31);
+	KmerTable t;
+	const unsigned n = 1000;
+	for (unsigned i = 0; i < n; i++)
+		t.insert(make_pair(kmer(31, i), KmerData(SENSE, i % 5)));
+	t.rehash(0);
+	EXPECT_FALSE(t.attached());
+
+	vector<uint64_t> buf((t.memory() + 7) / 8);
+	memcpy(&buf[0], t.data(), t.memory());
+	KmerTable u;
+	u.attach(reinterpret_cast<char*>(&buf[0]),
+			t.bucket_count(), t.size());
+	EXPECT_TRUE(u.attached());
+	EXPECT_EQ(n, u.size());
+	for (unsigned i = 0; i < n; i++) {
+		KmerTable::const_iterator it = u.find(kmer(31, i));
+		ASSERT_TRUE(it != u.end());
+		EXPECT_EQ(i % 5, it->second.getMultiplicity(SENSE));
+	}
+
+	// A copy of an attached table uses the same memory.
+	KmerTable v(u);
+	EXPECT_TRUE(v.attached());
+	EXPECT_EQ(u.data(), v.data());
+
+	// The table is modified in place until it grows.
+	u.setData(u.find(kmer(31, 0)), KmerData(SENSE, 9));
+	EXPECT_EQ(9U, v.find(kmer(31, 0))->second.getMultiplicity());
+	for (unsigned i = n; i < 2 * n; i++)
+		u.insert(make_pair(kmer(31, i), KmerData()));
+	EXPECT_FALSE(u.attached());
+	EXPECT_EQ(2 * n, u.size());
+	EXPECT_EQ(9U, u.find(kmer(31, 0))->second.getMultiplicity());
+	EXPECT_EQ(n, v.size());
+}
@@ -0,0 +1,69 @@
+#include "Assembly/SequenceCollection.h"
+#include "Common/Options.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+/** Return the k-mer of length k numbered n. */
+static Kmer kmer(unsigned k, unsigned n)
+{
+	string s(k, 'A');
+	for (unsigned i = 0; i < k && n > 0; i++, n /= 4)
+		s[i] = "ACGT"[n % 4];
+	return Kmer(s);
+}
+
+/** Store a collection and load it into a collection of the
+ * specified number of shards. */
+static void storeLoad(unsigned shards)
+{
+	Kmer::setLength(27);
+	const unsigned n = 3000;
+	SequenceCollectionHash g(4);
+	for (unsigned i = 0; i < n; i++)
+		g.add(kmer(27, i), i % 3 + 1);
+	g.setBaseExtension(kmer(27, 1), SENSE, 2);
+	g.setFlag(kmer(27, 2), SF_MARK_SENSE);
+
+	char path[] = "SequenceCollectionTestXXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	g.store(path);
+	string kmerPath = string(path) + ".kmer";
+
+	SequenceCollectionHash h(shards);
+	h.load(kmerPath.c_str());
+	EXPECT_TRUE(h.isAdjacencyLoaded());
+	EXPECT_EQ(n, h.size());
+	for (unsigned i = 0; i < n; i++) {
+		ExtensionRecord ext;
+		int multiplicity;
+		ASSERT_TRUE(h.getSeqData(kmer(27, i), ext, multiplicity));
+		EXPECT_EQ((int)(i % 3 + 1), multiplicity);
+	}
+	EXPECT_TRUE(h[kmer(27, 1)].getExtension(SENSE).checkBase(2));
+	EXPECT_TRUE(h[kmer(27, 2)].marked(SENSE));
+
+	// The loaded collection may be modified.
+	h.add(kmer(27, n));
+	h.remove(kmer(27, 0));
+	h.cleanup();
+	EXPECT_EQ(n, h.size());
+
+	unlink(path);
+	unlink(kmerPath.c_str());
+}
+
+TEST(SequenceCollectionHash, store_load)
+{
+	storeLoad(4);
+}
+
+TEST(SequenceCollectionHash, store_load_reshard)
+{
+	storeLoad(1);
+}
@@ -30,3 +30,41 @@ TEST(Kmer, canonicalize)
 	EXPECT_EQ(oddLengthCanonical, kmer);
 }
 
+/** Return the reverse complement of the specified sequence. */
+static std::string rc(const std::string& s)
+{
+	std::string t(s.rbegin(), s.rend());
+	for (std::string::iterator it = t.begin(); it != t.end(); ++it)
+		*it = "TGCA"[baseToCode(*it)];
+	return t;
+}
+
+TEST(Kmer, shift_reverseComplement)
+{
+	// a k-mer is stored in as few bytes as possible
+	EXPECT_EQ(Kmer::NUM_BYTES, sizeof (Kmer));
+
+	std::string bases;
+	for (unsigned i = 0, x = 1; i < MAX_KMER; i++, x = 69069 * x + 1)
+		bases += "ACGT"[x >> 30];
+	for (unsigned k = 1; k <= MAX_KMER; k++) {
+		Kmer::setLength(k);
+		std::string s = bases.substr(0, k);
+		Kmer kmer(s);
+		EXPECT_EQ(s, kmer.str());
+
+		Kmer u = reverseComplement(kmer);
+		EXPECT_EQ(rc(s), u.str());
+		EXPECT_EQ(kmer, reverseComplement(u));
+		EXPECT_EQ(s <= rc(s), kmer.isCanonical());
+		EXPECT_EQ(rc(s) <= s, u.isCanonical());
+
+		u = kmer;
+		EXPECT_EQ(baseToCode(s[0]), u.shift(SENSE, baseToCode('G')));
+		EXPECT_EQ(Kmer(s.substr(1) + 'G'), u);
+		u = kmer;
+		EXPECT_EQ(baseToCode(s[k - 1]),
+				u.shift(ANTISENSE, baseToCode('T')));
+		EXPECT_EQ(Kmer('T' + s.substr(0, k - 1)), u);
+	}
+}
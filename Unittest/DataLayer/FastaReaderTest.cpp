@@ -0,0 +1,177 @@
+#include "config.h"
+#include "DataLayer/FastaReader.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if HAVE_ZLIB_H && HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+using namespace std;
+
+/** Return a FASTQ file of n reads. The quality of every third read
+ * starts with '@', like a FASTQ header.
+ */
+static string fastq(unsigned n)
+{
+	ostringstream s;
+	for (unsigned i = 0; i < n; i++) {
+		unsigned len = 1 + rand() % 50;
+		string seq(len, 'A'), qual(len, 'I');
+		for (unsigned j = 0; j < len; j++) {
+			seq[j] = "ACGT"[rand() % 4];
+			qual[j] = '!' + rand() % 40;
+		}
+		if (i % 3 == 0)
+			qual[0] = '@';
+		s << "@" << i << '\n' << seq << "\n+\n" << qual << '\n';
+	}
+	return s.str();
+}
+
+/** Return a FASTA file of n reads. */
+static string fasta(unsigned n)
+{
+	ostringstream s;
+	for (unsigned i = 0; i < n; i++)
+		s << ">" << i << '\n' << string(1 + rand() % 50, 'C') << '\n';
+	return s.str();
+}
+
+/** Write the data to a temporary file and return its path. */
+static string writeTemp(const string& data, const string& suffix = "")
+{
+	char path[] = "FastaReaderTestXXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	unlink(path);
+	string name = path + suffix;
+	ofstream out(name.c_str());
+	out << data;
+	assert(out.good());
+	return name;
+}
+
+/** Read each section of the file in turn and check that every record
+ * is read exactly once and in order.
+ */
+static void expectSplit(const string& path, unsigned n,
+		unsigned nsections)
+{
+	unsigned next = 0;
+	for (unsigned section = 1; section <= nsections; section++) {
+		FastaReader in(path.c_str(), FastaReader::NO_FOLD_CASE);
+		in.split(section, nsections);
+		for (FastqRecord rec; in >> rec;) {
+			ostringstream s;
+			s << next++;
+			ASSERT_EQ(s.str(), rec.id);
+		}
+	}
+	EXPECT_EQ(n, next);
+}
+
+TEST(FastaReader, splitFasta)
+{
+	srand(1);
+	const unsigned n = 1000;
+	string path = writeTemp(fasta(n));
+	for (unsigned nsections = 1; nsections <= 9; nsections++)
+		expectSplit(path, n, nsections);
+	unlink(path.c_str());
+}
+
+TEST(FastaReader, splitFastq)
+{
+	srand(1);
+	const unsigned n = 1000;
+	string path = writeTemp(fastq(n));
+	EXPECT_TRUE(FastaReader::isSplittable(path.c_str()));
+	for (unsigned nsections = 1; nsections <= 9; nsections++)
+		expectSplit(path, n, nsections);
+	expectSplit(path, n, 3 * n);
+	unlink(path.c_str());
+}
+
+TEST(FastaReader, isSplittable)
+{
+	string path = writeTemp("@HD\tVN:1.0\n");
+	EXPECT_FALSE(FastaReader::isSplittable(path.c_str()));
+	unlink(path.c_str());
+	EXPECT_FALSE(FastaReader::isSplittable("-"));
+}
+
+#if HAVE_ZLIB_H && HAVE_LIBZ
+/** Append a little-endian integer of the specified size. */
+static void putLE(string& s, unsigned long x, unsigned size)
+{
+	for (unsigned i = 0; i < size; i++, x >>= 8)
+		s += (char)(x & 0xff);
+}
+
+/** Return the data compressed using BGZF in blocks of the specified
+ * size, followed by an empty block.
+ */
+static string bgzf(const string& data, size_t blockSize)
+{
+	string out;
+	for (size_t i = 0; i <= data.size(); i += blockSize) {
+		string block = data.substr(i, blockSize);
+		vector<unsigned char> cdata(compressBound(block.size()) + 64);
+		z_stream z = z_stream();
+		int err = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				-MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+		assert(err == Z_OK);
+		z.next_in = (Bytef*)block.data();
+		z.avail_in = block.size();
+		z.next_out = &cdata[0];
+		z.avail_out = cdata.size();
+		err = deflate(&z, Z_FINISH);
+		assert(err == Z_STREAM_END);
+		(void)err;
+		size_t clen = z.total_out;
+		deflateEnd(&z);
+
+		out += string("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0",
+				16);
+		putLE(out, 12 + 6 + clen + 8 - 1, 2);
+		out.append((const char*)&cdata[0], clen);
+		putLE(out, crc32(0, (const Bytef*)block.data(), block.size()),
+				4);
+		putLE(out, block.size(), 4);
+		if (block.empty())
+			break;
+	}
+	return out;
+}
+
+TEST(FastaReader, splitBgzf)
+{
+	srand(1);
+	const unsigned n = 1000;
+	string path = writeTemp(bgzf(fastq(n), 1000), ".fq.gz");
+	EXPECT_TRUE(FastaReader::isSplittable(path.c_str()));
+	for (unsigned nsections = 1; nsections <= 9; nsections++)
+		expectSplit(path, n, nsections);
+	expectSplit(path, n, 100);
+	unlink(path.c_str());
+}
+
+/** Split a file of blocks of the size written by bgzip. */
+TEST(FastaReader, splitBgzfLargeBlocks)
+{
+	srand(1);
+	const unsigned n = 20000;
+	string path = writeTemp(bgzf(fastq(n), 0xff00), ".fq.gz");
+	for (unsigned nsections = 1; nsections <= 9; nsections++)
+		expectSplit(path, n, nsections);
+	expectSplit(path, n, 50);
+	unlink(path.c_str());
+}
+#endif
@@ -3,9 +3,13 @@
 #include "Bloom/CascadingBloomFilter.h"
 #include "Bloom/BloomFilterWindow.h"
 #include "Bloom/CascadingBloomFilterWindow.h"
+#include "Bloom/ConcurrentBloomFilter.h"
 
 #include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
 #include <string>
+#include <unistd.h>
 
 using namespace std;
 
@@ -183,6 +187,33 @@ TEST(CascadingBloomFilter, base)
 	EXPECT_FALSE(x[d]);
 }
 
+TEST(CascadingBloomFilter, multipleHashes)
+{
+	size_t bits = 1000;
+	CascadingBloomFilter x(bits, 4, Bloom::HASH_ROLLING);
+	CascadingBloomFilter y(bits, 4, Bloom::HASH_ROLLING);
+	ConcurrentBloomFilter<CascadingBloomFilter> cbf(y);
+
+	Kmer::setLength(16);
+	Kmer a("AGATGTGCTGCCGCCT");
+	Kmer b("TGGACAGCGTTACCTC");
+
+	// a k-mer seen once sets no bit of the second level
+	x.insert(a);
+	cbf.insert(a);
+	EXPECT_EQ(0U, x.popcount());
+	EXPECT_EQ(0U, y.popcount());
+	EXPECT_FALSE(x[a]);
+	x.insert(a);
+	cbf.insert(a);
+	EXPECT_TRUE(x[a]);
+	EXPECT_TRUE(y[a]);
+	EXPECT_EQ(x.popcount(), y.popcount());
+	EXPECT_LE(x.popcount(), 4U);
+	x.insert(b);
+	EXPECT_FALSE(x[b]);
+}
+
 TEST(BloomFilter, shrink)
 {
 	BloomFilter big(10);
@@ -321,3 +352,238 @@ TEST(CascadingBloomFilter, window)
 	EXPECT_TRUE(unionBloom[pos2]);
 	EXPECT_FALSE(unionBloom[pos3]);
 }
+
+TEST(RollingHash, roll)
+{
+	const unsigned k = 16;
+	Kmer::setLength(k);
+	string seq("AGATGTGCTGCCGCCTTGGACAGCGTTACCTC");
+
+	RollingHash rolled(seq, 0, k);
+	for (size_t i = 0; i + k <= seq.size(); i++) {
+		Kmer kmer(seq.substr(i, k));
+		RollingHash hash(kmer);
+		EXPECT_EQ(RollingHash(seq, i, k).hash(), hash.hash());
+		EXPECT_EQ(hash.hash(), rolled.hash());
+		EXPECT_EQ(hash.hash(),
+				RollingHash(reverseComplement(kmer)).hash());
+		if (i + k < seq.size()) {
+			RollingHash next(rolled);
+			next.rollRight(RollingHash::code(seq[i]),
+					RollingHash::code(seq[i + k]));
+			RollingHash prev(next);
+			prev.rollLeft(RollingHash::code(seq[i + k]),
+					RollingHash::code(seq[i]));
+			EXPECT_EQ(rolled.hash(), prev.hash());
+			rolled = next;
+		}
+	}
+}
+
+TEST(BloomFilter, multipleHashes)
+{
+	const unsigned k = 16;
+	Kmer::setLength(k);
+	string seq("AGATGTGCTGCCGCCTTGGACAGCGTTACCTC");
+
+	BloomFilter bloom(1000, 4, Bloom::HASH_ROLLING);
+	Bloom::loadSeq(bloom, k, seq);
+	EXPECT_LE(bloom.popcount(), 4 * (seq.size() - k + 1));
+	for (size_t i = 0; i + k <= seq.size(); i++) {
+		Kmer kmer(seq.substr(i, k));
+		EXPECT_TRUE(bloom[kmer]);
+		EXPECT_TRUE(bloom[reverseComplement(kmer)]);
+	}
+	EXPECT_FALSE(bloom[Kmer("GATCGTGGCGGGCGAT")]);
+
+	stringstream ss;
+	ss << bloom;
+	ASSERT_TRUE(ss.good());
+
+	BloomFilter copyBloom;
+	ss >> copyBloom;
+	ASSERT_TRUE(ss.good());
+	EXPECT_EQ(4U, copyBloom.getHashNum());
+	EXPECT_EQ(Bloom::HASH_ROLLING, copyBloom.getHashType());
+	EXPECT_EQ(bloom.popcount(), copyBloom.popcount());
+	for (size_t i = 0; i + k <= seq.size(); i++)
+		EXPECT_TRUE(copyBloom[Kmer(seq.substr(i, k))]);
+}
+
+TEST(BloomFilter, blocked)
+{
+	const unsigned k = 16;
+	Kmer::setLength(k);
+	string seq("AGATGTGCTGCCGCCTTGGACAGCGTTACCTC");
+
+	size_t bits = 8 * Bloom::BLOCK_BITS;
+	BloomFilter bloom(bits, 6, Bloom::HASH_ROLLING, true);
+	EXPECT_TRUE(bloom.isBlocked());
+	Bloom::loadSeq(bloom, k, seq);
+	for (size_t i = 0; i + k <= seq.size(); i++) {
+		Kmer kmer(seq.substr(i, k));
+		EXPECT_TRUE(bloom[kmer]);
+
+		// every bit of a k-mer is in the same block
+		size_t hashes[Bloom::MAX_HASHES];
+		Bloom::hashes(kmer, Bloom::HASH_ROLLING, 6, hashes);
+		size_t block = bloom.index(hashes, 0) / Bloom::BLOCK_BITS;
+		for (unsigned j = 1; j < 6; j++)
+			EXPECT_EQ(block, bloom.index(hashes, j) / Bloom::BLOCK_BITS);
+	}
+
+	BloomFilter other(bits, 6, Bloom::HASH_ROLLING, true);
+	Kmer d("GATCGTGGCGGGCGAT");
+	other.insert(d);
+
+	stringstream ss;
+	ss << bloom << other;
+	ASSERT_TRUE(ss.good());
+
+	BloomFilter unionBloom;
+	ss >> unionBloom;
+	ASSERT_TRUE(ss.good());
+	EXPECT_TRUE(unionBloom.isBlocked());
+	unionBloom.read(ss, Bloom::LOAD_UNION);
+	ASSERT_TRUE(ss.good());
+	EXPECT_LE(bloom.popcount(), unionBloom.popcount());
+	EXPECT_LE(unionBloom.popcount(), bloom.popcount() + other.popcount());
+	EXPECT_TRUE(unionBloom[d]);
+	for (size_t i = 0; i + k <= seq.size(); i++)
+		EXPECT_TRUE(unionBloom[Kmer(seq.substr(i, k))]);
+}
+
+TEST(ConcurrentBloomFilter, cascading)
+{
+	size_t bits = 1000;
+	CascadingBloomFilter serial(bits, 2, Bloom::HASH_ROLLING);
+	CascadingBloomFilter concurrent(bits, 2, Bloom::HASH_ROLLING);
+	ConcurrentBloomFilter<CascadingBloomFilter> cbf(concurrent);
+
+	for (size_t i = 0; i < 3 * bits; i++)
+		serial.insert(i * 7 % bits);
+#pragma omp parallel for
+	for (int i = 0; i < 3 * (int)bits; i++)
+		cbf.insert(i * 7 % bits);
+
+	// every bit was inserted at least twice
+	EXPECT_EQ(bits, concurrent.popcount());
+	for (unsigned level = 0; level < CascadingBloomFilter::MAX_COUNT;
+			level++)
+		EXPECT_EQ(serial.getBloomFilter(level).popcount(),
+				concurrent.getBloomFilter(level).popcount());
+
+	Kmer::setLength(16);
+	Kmer a("AGATGTGCTGCCGCCT");
+	cbf.insert(a);
+	EXPECT_TRUE(cbf[a]);
+}
+
+TEST(ConcurrentBloomFilter, cascadingMultipleHashes)
+{
+	const unsigned hashNum = 4;
+	const size_t n = 10000;
+	CascadingBloomFilter concurrent(1 << 24, hashNum);
+	ConcurrentBloomFilter<CascadingBloomFilter> cbf(concurrent);
+
+	// Adjacent threads insert the same element at the same time.
+#pragma omp parallel for schedule(static, 1)
+	for (int i = 0; i < 2 * (int)n; i++) {
+		size_t hashes[hashNum];
+		for (unsigned j = 0; j < hashNum; j++)
+			hashes[j] = (i / 2 + 1) * 0x9e3779b97f4a7c15ULL + j;
+		cbf.insert(hashes);
+	}
+
+	// every element inserted twice is in the second level
+	for (size_t i = 0; i < n; i++) {
+		size_t hashes[hashNum];
+		for (unsigned j = 0; j < hashNum; j++)
+			hashes[j] = (i + 1) * 0x9e3779b97f4a7c15ULL + j;
+		EXPECT_TRUE(cbf.contains(hashes));
+	}
+}
+
+TEST(BloomFilter, map)
+{
+	Kmer::setLength(16);
+	Kmer a("AGATGTGCTGCCGCCT");
+	Kmer b("TGGACAGCGTTACCTC");
+	Kmer c("GATCGTGGCGGGCGAT");
+
+	size_t bits = 4 * Bloom::BLOCK_BITS;
+	BloomFilter bloom(bits, 3, Bloom::HASH_ROLLING, true);
+	bloom.insert(a);
+	bloom.insert(b);
+
+	// the bit array starts at a multiple of the alignment
+	stringstream ss;
+	ss << bloom;
+	ASSERT_TRUE(ss.good());
+	EXPECT_EQ(Bloom::DATA_ALIGNMENT + bits / 8, ss.str().size());
+
+	char path[] = "BloomFilterTestXXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	ofstream out(path);
+	out << ss.str();
+	out.close();
+	ASSERT_TRUE(out.good());
+
+	BloomFilter mapped;
+	mapped.map(path);
+	EXPECT_EQ(bits, mapped.size());
+	EXPECT_EQ(3U, mapped.getHashNum());
+	EXPECT_EQ(Bloom::HASH_ROLLING, mapped.getHashType());
+	EXPECT_TRUE(mapped.isBlocked());
+	EXPECT_EQ(bloom.popcount(), mapped.popcount());
+	EXPECT_TRUE(mapped[a]);
+	EXPECT_TRUE(mapped[b]);
+	EXPECT_FALSE(mapped[c]);
+
+	// a copy of a mapped bloom filter may be modified
+	BloomFilter copy(mapped);
+	copy.insert(c);
+	EXPECT_TRUE(copy[c]);
+	EXPECT_FALSE(mapped[c]);
+
+	unlink(path);
+}
+
+TEST(BloomFilter, loadFiles)
+{
+	const unsigned k = 16;
+	Kmer::setLength(k);
+	string seq1("AGATGTGCTGCCGCCTTGGACAGCGTTACCTC");
+	string seq2("GATCGTGGCGGGCGATNTTAGCGGCCAACTGA");
+
+	vector<string> paths;
+	for (unsigned i = 0; i < 2; i++) {
+		char path[] = "BloomFilterTestXXXXXX";
+		int fd = mkstemp(path);
+		ASSERT_NE(-1, fd);
+		close(fd);
+		ofstream out(path);
+		for (unsigned j = 0; j < 3 * Bloom::LOAD_CHUNK_SIZE; j++)
+			out << ">" << j << '\n' << (i == 0 ? seq1 : seq2) << '\n';
+		out.close();
+		ASSERT_TRUE(out.good());
+		paths.push_back(path);
+	}
+
+	size_t bits = 1000;
+	BloomFilter serial(bits, 2, Bloom::HASH_ROLLING);
+	Bloom::loadSeq(serial, k, seq1);
+	Bloom::loadSeq(serial, k, seq2);
+
+	BloomFilter bloom(bits, 2, Bloom::HASH_ROLLING);
+	ConcurrentBloomFilter<BloomFilter> cbf(bloom);
+	Bloom::loadFiles(cbf, k, paths);
+	EXPECT_EQ(serial.popcount(), bloom.popcount());
+	for (size_t i = 0; i + k <= seq1.size(); i++)
+		EXPECT_TRUE(bloom[Kmer(seq1.substr(i, k))]);
+
+	for (unsigned i = 0; i < paths.size(); i++)
+		unlink(paths[i].c_str());
+}
@@ -61,3 +61,41 @@ TEST(DBGBloom, BloomFilterPolymorphism)
 	ei2++;
 	EXPECT_TRUE(ei2 == ei_end2);
 }
+
+TEST(DBGBloom, rollingHash)
+{
+	const unsigned k = 5;
+	Kmer::setLength(k);
+
+	Kmer kmer1("GACCT");
+	 Kmer kmer2("ACCTG");
+	  Kmer kmer3("CCTGA");
+
+	BloomFilter bloom(100000, 3, Bloom::HASH_ROLLING);
+	Bloom::loadSeq(bloom, k, "GACCTGA");
+
+	DBGBloom<BloomFilter> graph(bloom);
+
+	boost::graph_traits< DBGBloom<BloomFilter> >::out_edge_iterator ei, ei_end;
+	boost::tie(ei, ei_end) = out_edges(kmer1, graph);
+	ASSERT_TRUE(ei != ei_end);
+	EXPECT_TRUE(target(*ei, graph) == kmer2);
+	ei++;
+	EXPECT_TRUE(ei == ei_end);
+
+	boost::graph_traits< DBGBloom<BloomFilter> >::in_edge_iterator ii, ii_end;
+	boost::tie(ii, ii_end) = in_edges(kmer3, graph);
+	ASSERT_TRUE(ii != ii_end);
+	EXPECT_TRUE(source(*ii, graph) == kmer2);
+	ii++;
+	EXPECT_TRUE(ii == ii_end);
+
+	// the reverse complement strand is traversed the same way
+	boost::tie(ei, ei_end) = out_edges(reverseComplement(kmer3), graph);
+	ASSERT_TRUE(ei != ei_end);
+	EXPECT_TRUE(target(*ei, graph) == reverseComplement(kmer2));
+	ei++;
+	EXPECT_TRUE(ei == ei_end);
+
+	EXPECT_EQ(1U, out_degree(kmer2, graph));
+}
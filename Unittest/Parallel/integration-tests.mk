@@ -0,0 +1,96 @@
+#!/usr/bin/make -Rrf
+
+# Test ABYSS-P
+
+SHELL=/bin/bash -o pipefail
+
+#------------------------------------------------------------
+# testing params
+#------------------------------------------------------------
+
+# kmer size
+k?=31
+# number of synthetic read pairs
+N?=20000
+# error rate of synthetic reads
+e?=0.005
+# path to ABYSS binary
+abyss?=ABYSS
+# path to ABYSS-P binary
+abyss_p?=ABYSS-P
+# command to run ABYSS-P on n processes
+mpirun?=mpirun -np
+# temp dir for test outputs
+tmpdir=tmp
+# user options to ABYSS and ABYSS-P
+ABYSS_OPTS?=
+
+#------------------------------------------------------------
+# phony targets
+#------------------------------------------------------------
+
+tests=np_test \
+	serial_test
+
+.PHONY: all clean $(tests)
+.DELETE_ON_ERROR:
+.SECONDARY:
+
+#------------------------------------------------------------
+# top level rules
+#------------------------------------------------------------
+
+all: $(tests)
+
+clean:
+	rm -f $(tmpdir)/*
+	rmdir $(tmpdir) || true
+
+#------------------------------------------------------------
+# common rules
+#------------------------------------------------------------
+
+$(tmpdir):
+	mkdir -p $(tmpdir)
+
+$(tmpdir)/test_reference.fa: | $(tmpdir)
+	curl -L https://raw.githubusercontent.com/dzerbino/velvet/master/data/test_reference.fa >$@
+
+$(tmpdir)/e%_1.fq $(tmpdir)/e%_2.fq: $(tmpdir)/test_reference.fa
+	wgsim -S 0 -e $* -N $N -r 0 -R 0 $< $(tmpdir)/e$*_1.fq $(tmpdir)/e$*_2.fq
+
+# Assemble the reads using ABYSS-P on n processes.
+$(tmpdir)/e$e_np%.fa: $(tmpdir)/e$e_1.fq $(tmpdir)/e$e_2.fq
+	$(mpirun) $* $(abyss_p) -k$k $(ABYSS_OPTS) -o $@ $^
+
+# Assemble the reads using ABYSS.
+$(tmpdir)/e$e_serial.fa: $(tmpdir)/e$e_1.fq $(tmpdir)/e$e_2.fq
+	$(abyss) -k$k $(ABYSS_OPTS) -o $@ $^
+
+# Sort the sequences of the contigs, whose IDs depend on the
+# number of processes.
+%.sorted.txt: %.fa
+	paste - - <$< | cut -f2 | sort >$@
+
+#------------------------------------------------------------
+# np_test
+#------------------------------------------------------------
+
+np_test: $(tmpdir)/e$e_np2.sorted.txt \
+		$(tmpdir)/e$e_np3.sorted.txt \
+		$(tmpdir)/e$e_np4.sorted.txt
+	diff $(tmpdir)/e$e_np2.sorted.txt $(tmpdir)/e$e_np4.sorted.txt
+	diff $(tmpdir)/e$e_np2.sorted.txt $(tmpdir)/e$e_np3.sorted.txt
+	@echo '------------------'
+	@echo '$@: PASSED'
+	@echo '------------------'
+
+#------------------------------------------------------------
+# serial_test
+#------------------------------------------------------------
+
+serial_test: $(tmpdir)/e$e_serial.sorted.txt $(tmpdir)/e$e_np2.sorted.txt
+	diff $^
+	@echo '------------------'
+	@echo '$@: PASSED'
+	@echo '------------------'